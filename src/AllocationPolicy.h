@@ -0,0 +1,32 @@
+#ifndef ALLOCATION_POLICY_H
+#define ALLOCATION_POLICY_H
+
+#include <cstdint>
+
+namespace d64
+{
+
+// the tracks a file is placed on
+enum class Placement
+{
+    LINEAR, // from the first track on, the layout of earlier versions
+    DOS, // like the drive's DOS: starts on the free track nearest to the directory, then moves outward
+         // on that side of the directory, resp. continues nearest to the directory once the side is full
+    CLOSEST_TO_DIRECTORY // each track of a file is the free track nearest to the directory, on either side
+};
+
+// How the Writer picks the sectors of a file, see BasicSectorAllocator. The default gives the
+// layout of earlier versions.
+struct AllocationPolicy
+{
+    Placement placement = Placement::LINEAR;
+    // sectors from one block of a file to the next on a track, 0: the format's interleave.
+    // A fastloader needing n sectors of time per block is served best by an interleave of n + 1.
+    uint8_t interleave = 0;
+
+    bool isDefault() const { return (placement == Placement::LINEAR) && (interleave == 0); }
+};
+
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+
+#include "BatchBuilder.h"
+#include "ImageBuilder.h"
+#include "BoundedQueue.h"
+
+using namespace d64;
+using namespace std;
+
+BatchBuilder::BatchBuilder(unsigned numWorkers, ImageFormat format, BuildCache *pCache) :
+    numWorkers(numWorkers), format(format), pCache(pCache)
+{
+    if (this->numWorkers == 0)
+    {
+        this->numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+std::vector<BatchResult> BatchBuilder::build(std::vector<BatchJob> const &jobs) const
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return build(jobs, std::get<BasicWriterPool<D64ExtendedGeometry>>(writerPools));
+        case ImageFormat::D71: return build(jobs, std::get<BasicWriterPool<D71Geometry>>(writerPools));
+        case ImageFormat::D81: return build(jobs, std::get<BasicWriterPool<D81Geometry>>(writerPools));
+        default: return build(jobs, std::get<BasicWriterPool<D64Geometry>>(writerPools));
+    }
+}
+
+template <typename Geometry>
+std::vector<BatchResult> BatchBuilder::build(std::vector<BatchJob> const &jobs, BasicWriterPool<Geometry> &writerPool) const
+{
+    // an image which is laid out and waits for the output stage
+    struct Output
+    {
+        size_t jobIdx;
+        typename BasicWriterPool<Geometry>::Handle pWriter;
+        BuildCache::Key key;
+    };
+
+    std::vector<BatchResult> results(jobs.size(), BatchResult{false, ""});
+    std::atomic<size_t> nextJob(0);
+    size_t numThreads = std::min(static_cast<size_t>(numWorkers), jobs.size());
+    // one image per worker may wait, more would only hold Writers while the output lags behind
+    BoundedQueue<Output> outputs(std::max<size_t>(numThreads, 1));
+
+    // workers pull the next job until all are taken and lay out its image
+    auto worker = [this, &writerPool, &jobs, &results, &nextJob, &outputs]()
+    {
+        for (size_t jobIdx = nextJob++; jobIdx < jobs.size(); jobIdx = nextJob++)
+        {
+            std::ostringstream err;
+            BatchJob const &job = jobs[jobIdx];
+            BuildCache::Key key;
+
+            // a cache hit needs no Writer at all
+            if ((pCache != nullptr) && !hashFolder(job.srcPath, format, key, err))
+            {
+                results[jobIdx].error = err.str();
+                continue;
+            }
+            if ((pCache != nullptr) && pCache->fetch(key, job.imagePath))
+            {
+                results[jobIdx].success = true;
+                continue;
+            }
+
+            typename BasicWriterPool<Geometry>::Handle pWriter = writerPool.acquire(getDirName(job.srcPath));
+            bool success = addProgFiles(job.srcPath, *pWriter, err);
+            results[jobIdx].error = err.str();
+            if (success)
+            {
+                outputs.push(Output{jobIdx, std::move(pWriter), key});
+            }
+        }
+    };
+
+    // the output stage writes the images while the workers go on with the next folders,
+    // the result slot of a job is handed over with its image
+    auto output = [this, &jobs, &results, &outputs]()
+    {
+        Output item;
+        while (outputs.pop(item))
+        {
+            std::ostringstream err;
+            BatchResult &result = results[item.jobIdx];
+            result.success = saveImage(*item.pWriter, jobs[item.jobIdx].imagePath, err, format);
+            item.pWriter.reset(); // back to the pool
+
+            if (result.success && (pCache != nullptr))
+            {
+                pCache->store(item.key, jobs[item.jobIdx].imagePath);
+            }
+            result.error += err.str();
+        }
+    };
+
+    std::thread outputThread(output);
+    std::vector<std::thread> threads;
+    for (size_t threadIdx = 1; threadIdx < numThreads; threadIdx++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    // the calling thread is a worker too
+    worker();
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    outputs.close();
+    outputThread.join();
+
+    return results;
+}
+
+bool BatchBuilder::readManifest(std::istream &is, std::vector<BatchJob> &jobs, std::string &error)
+{
+    std::string line;
+    size_t lineNo = 0;
+
+    while (std::getline(is, line))
+    {
+        ++lineNo;
+
+        // strip trailing whitespace (and CR of DOS line endings)
+        size_t end = line.find_last_not_of(" \t\r");
+        line = (end == std::string::npos) ? "" : line.substr(0, end + 1);
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        size_t sep = line.find('\t');
+        if (sep == std::string::npos)
+        {
+            sep = line.find_last_of(' ');
+        }
+
+        BatchJob job;
+        if (sep != std::string::npos)
+        {
+            job.srcPath = line.substr(0, sep);
+            size_t imageStart = line.find_first_not_of(" \t", sep);
+            job.imagePath = (imageStart == std::string::npos) ? "" : line.substr(imageStart);
+            job.srcPath = job.srcPath.substr(0, job.srcPath.find_last_not_of(" \t") + 1);
+        }
+
+        if (job.srcPath.empty() || job.imagePath.empty())
+        {
+            std::ostringstream strm;
+            strm << "Manifest line " << lineNo << " does not contain a source path and an image path.";
+            error = strm.str();
+            return false;
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef BATCH_BUILDER_H
+#define BATCH_BUILDER_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <tuple>
+
+#include "WriterPool.h"
+#include "ImageBuilder.h"
+
+namespace d64
+{
+
+struct BatchJob
+{
+    std::string srcPath;
+    std::string imagePath;
+};
+
+struct BatchResult
+{
+    bool success;
+    std::string error; // what went wrong, if not successful
+};
+
+// Builds many images on a fixed number of worker threads. Each worker lays out one image
+// at a time with a Writer from the pool of the BatchBuilder and hands it to an output thread,
+// which writes the image file while the worker goes on with the next folder. At most one image
+// per worker waits for the output, so about 2 * numWorkers images are in memory at once and
+// the Writers are reused across images and calls of build().
+// With a BuildCache, images of folders which have been built before are taken from the cache.
+class BatchBuilder
+{
+public:
+    // numWorkers == 0 picks the number of hardware threads. The cache, if any, must outlive the builder.
+    explicit BatchBuilder(unsigned numWorkers = 0, ImageFormat format = ImageFormat::D64, BuildCache *pCache = nullptr);
+
+    unsigned getNumberOfWorkers() const { return numWorkers; }
+    ImageFormat getFormat() const { return format; }
+
+    // results are in the order of the jobs
+    std::vector<BatchResult> build(std::vector<BatchJob> const &jobs) const;
+
+    // one job per line, "<srcpath> <imagepath>", separated by a tab or else by the last blank.
+    // Empty lines and lines starting with '#' are ignored. Returns false on malformed lines.
+    static bool readManifest(std::istream &is, std::vector<BatchJob> &jobs, std::string &error);
+
+private:
+    template <typename Geometry>
+    std::vector<BatchResult> build(std::vector<BatchJob> const &jobs, BasicWriterPool<Geometry> &writerPool) const;
+
+    unsigned numWorkers;
+    ImageFormat format;
+    BuildCache *pCache;
+    // one pool per format, only the one of format is used
+    mutable std::tuple<BasicWriterPool<D64Geometry>, BasicWriterPool<D64ExtendedGeometry>,
+                       BasicWriterPool<D71Geometry>, BasicWriterPool<D81Geometry>> writerPools;
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "BinPacker.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+// Max tree over the free blocks of the disks, all disks not opened yet are empty. The leftmost
+// disk with room for a file is found in O(log n), which makes first fit O(n log n).
+class FreeBlocksTree
+{
+public:
+    FreeBlocksTree(size_t maxDisks, uint16_t blocksPerDisk) : numLeaves(1)
+    {
+        while (numLeaves < maxDisks)
+        {
+            numLeaves *= 2;
+        }
+        nodes.assign(2 * numLeaves, blocksPerDisk);
+    }
+
+    // leftmost disk with at least numBlocks free blocks
+    size_t findFirst(uint16_t numBlocks) const
+    {
+        size_t node = 1;
+        while (node < numLeaves)
+        {
+            node = (nodes[2 * node] >= numBlocks) ? 2 * node : 2 * node + 1;
+        }
+        return node - numLeaves;
+    }
+
+    uint16_t get(size_t disk) const { return nodes[numLeaves + disk]; }
+
+    void set(size_t disk, uint16_t freeBlocks)
+    {
+        size_t node = numLeaves + disk;
+        nodes[node] = freeBlocks;
+        for (node /= 2; node > 0; node /= 2)
+        {
+            nodes[node] = std::max(nodes[2 * node], nodes[2 * node + 1]);
+        }
+    }
+
+private:
+    size_t numLeaves;
+    std::vector<uint16_t> nodes; // 1 is the root, the leaves start at numLeaves
+};
+
+// file indices sorted by size, largest first, ties in the order of the files
+std::vector<size_t> sortBySize(std::vector<uint16_t> const &fileBlocks, std::vector<size_t> files)
+{
+    std::stable_sort(files.begin(), files.end(), [&fileBlocks](size_t lhs, size_t rhs) { return fileBlocks[lhs] > fileBlocks[rhs]; });
+    return files;
+}
+
+void packFirstFitDecreasing(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity, std::vector<size_t> const &nameIds,
+                            std::vector<std::vector<size_t>> &disks)
+{
+    std::vector<size_t> files(fileBlocks.size());
+    std::iota(files.begin(), files.end(), 0);
+
+    FreeBlocksTree tree(std::max<size_t>(files.size(), 1), capacity.blocks);
+    std::vector<uint16_t> freeEntries;
+    std::unordered_map<size_t, std::vector<size_t>> disksOfName;
+
+    for (size_t fileIdx : sortBySize(fileBlocks, files))
+    {
+        // the disks which hold a file of the same name are hidden from the search
+        std::vector<size_t> noDisks;
+        std::vector<size_t> &nameDisks = nameIds.empty() ? noDisks : disksOfName[nameIds[fileIdx]];
+        std::vector<uint16_t> hiddenBlocks;
+        for (size_t nameDisk : nameDisks)
+        {
+            hiddenBlocks.push_back(tree.get(nameDisk));
+            tree.set(nameDisk, 0);
+        }
+        size_t disk = tree.findFirst(fileBlocks[fileIdx]);
+        for (size_t hiddenIdx = 0; hiddenIdx < hiddenBlocks.size(); hiddenIdx++)
+        {
+            tree.set(nameDisks[hiddenIdx], hiddenBlocks[hiddenIdx]);
+        }
+
+        if (disk == disks.size())
+        {
+            disks.emplace_back();
+            freeEntries.push_back(capacity.entries);
+        }
+
+        disks[disk].push_back(fileIdx);
+        nameDisks.push_back(disk);
+        // a disk with a full directory does not take any more files
+        --freeEntries[disk];
+        tree.set(disk, (freeEntries[disk] > 0) ? static_cast<uint16_t>(tree.get(disk) - fileBlocks[fileIdx]) : 0);
+    }
+}
+
+// the subset of files which fills a disk best, by subset sum over the block counts. One bitset of
+// reachable sums per file, so the chosen files can be traced back.
+std::vector<size_t> fillDisk(std::vector<uint16_t> const &fileBlocks, std::vector<size_t> const &files, DiskCapacity capacity)
+{
+    size_t numWords = capacity.blocks / 64 + 1;
+    std::vector<uint64_t> reachable(files.size() * numWords, 0);
+
+    std::vector<uint64_t> sums(numWords, 0);
+    sums[0] = 1; // the empty subset
+    for (size_t pos = 0; pos < files.size(); pos++)
+    {
+        // sums |= sums << size, from the top so each file is used once
+        uint16_t size = fileBlocks[files[pos]];
+        size_t wordShift = size / 64;
+        unsigned bitShift = size % 64;
+        for (size_t wordIdx = numWords; wordIdx-- > wordShift; )
+        {
+            uint64_t shifted = sums[wordIdx - wordShift] << bitShift;
+            if ((bitShift > 0) && (wordIdx > wordShift))
+            {
+                shifted |= sums[wordIdx - wordShift - 1] >> (64 - bitShift);
+            }
+            sums[wordIdx] |= shifted;
+        }
+        std::copy(sums.begin(), sums.end(), &reachable[pos * numWords]);
+    }
+
+    auto isReachable = [&reachable, numWords](size_t pos, uint16_t sum)
+    {
+        return (reachable[pos * numWords + sum / 64] >> (sum % 64)) & 1;
+    };
+
+    uint16_t sum = capacity.blocks;
+    while ((sum > 0) && !isReachable(files.size() - 1, sum))
+    {
+        --sum;
+    }
+
+    std::vector<size_t> ret;
+    for (size_t pos = files.size(); (pos-- > 0) && (sum > 0); )
+    {
+        // the file is part of the subset if the sum is not reachable without it
+        if ((pos == 0) || !isReachable(pos - 1, sum))
+        {
+            ret.push_back(files[pos]);
+            sum = static_cast<uint16_t>(sum - fileBlocks[files[pos]]);
+        }
+    }
+    return ret;
+}
+
+void packBestFill(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity, std::vector<size_t> const &nameIds,
+                  std::vector<std::vector<size_t>> &disks)
+{
+    std::vector<size_t> remaining(fileBlocks.size());
+    std::iota(remaining.begin(), remaining.end(), 0);
+    remaining = sortBySize(fileBlocks, remaining);
+
+    while (!remaining.empty())
+    {
+        // the largest remaining file of each name is a candidate, the others wait for later disks
+        std::vector<size_t> candidates;
+        std::unordered_map<size_t, bool> isNameTaken;
+        for (size_t fileIdx : remaining)
+        {
+            if (nameIds.empty() || !isNameTaken[nameIds[fileIdx]])
+            {
+                candidates.push_back(fileIdx);
+                if (!nameIds.empty())
+                {
+                    isNameTaken[nameIds[fileIdx]] = true;
+                }
+            }
+        }
+
+        std::vector<size_t> disk = fillDisk(fileBlocks, candidates, capacity);
+        if (disk.size() > capacity.entries)
+        {
+            // too many small files for the directory, fill the disk largest first instead
+            disk.clear();
+            uint32_t usedBlocks = 0;
+            for (size_t fileIdx : candidates)
+            {
+                if ((disk.size() < capacity.entries) && (usedBlocks + fileBlocks[fileIdx] <= capacity.blocks))
+                {
+                    disk.push_back(fileIdx);
+                    usedBlocks += fileBlocks[fileIdx];
+                }
+            }
+        }
+
+        std::vector<bool> isOnDisk(fileBlocks.size(), false);
+        for (size_t fileIdx : disk)
+        {
+            isOnDisk[fileIdx] = true;
+        }
+        remaining.erase(std::remove_if(remaining.begin(), remaining.end(), [&isOnDisk](size_t fileIdx) { return isOnDisk[fileIdx]; }),
+                        remaining.end());
+        disks.push_back(disk);
+    }
+}
+
+}
+
+size_t d64::getMinimumNumberOfDisks(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity)
+{
+    uint64_t totalBlocks = std::accumulate(fileBlocks.begin(), fileBlocks.end(), uint64_t(0));
+    return static_cast<size_t>(std::max((totalBlocks + capacity.blocks - 1) / capacity.blocks,
+                                        (fileBlocks.size() + capacity.entries - 1) / static_cast<uint64_t>(capacity.entries)));
+}
+
+bool d64::packFiles(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity, PackingMode mode,
+                    std::vector<std::vector<size_t>> &disks, std::vector<size_t> const &nameIds)
+{
+    disks.clear();
+    if ((capacity.blocks == 0) || (capacity.entries == 0) || (!nameIds.empty() && (nameIds.size() != fileBlocks.size())) ||
+        std::any_of(fileBlocks.begin(), fileBlocks.end(), [capacity](uint16_t blocks) { return (blocks == 0) || (blocks > capacity.blocks); }))
+    {
+        return false;
+    }
+
+    packFirstFitDecreasing(fileBlocks, capacity, nameIds, disks);
+
+    // the slower fill only runs if first fit leaves room for improvement
+    if ((mode == PackingMode::BEST) && (disks.size() > getMinimumNumberOfDisks(fileBlocks, capacity)))
+    {
+        std::vector<std::vector<size_t>> filled;
+        packBestFill(fileBlocks, capacity, nameIds, filled);
+        if (filled.size() < disks.size())
+        {
+            disks.swap(filled);
+        }
+    }
+
+    for (auto &disk : disks)
+    {
+        std::sort(disk.begin(), disk.end());
+    }
+    return true;
+}
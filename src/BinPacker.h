@@ -0,0 +1,37 @@
+#ifndef BIN_PACKER_H
+#define BIN_PACKER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace d64
+{
+
+enum class PackingMode
+{
+    FAST, // first fit decreasing, O(n log n)
+    BEST // fills disk after disk with the subset of files which leaves the fewest blocks free, never worse than FAST
+};
+
+// what a blank disk holds
+struct DiskCapacity
+{
+    uint16_t blocks;
+    uint16_t entries; // of the directory
+};
+
+// Distributes files of the given sizes in blocks on as few disks as it finds. Each disk gets the
+// indices of its files in ascending order, so files keep their relative order across the disks.
+// Files with the same name id never share a disk, like files which have the same name on the
+// image; without name ids any files may share one.
+// False if a file is empty or larger than a disk, or if the name ids do not match the files.
+bool packFiles(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity, PackingMode mode,
+               std::vector<std::vector<size_t>> &disks, std::vector<size_t> const &nameIds = std::vector<size_t>());
+
+// no packing needs fewer disks than this
+size_t getMinimumNumberOfDisks(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity);
+
+}
+
+#endif
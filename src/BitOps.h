@@ -0,0 +1,41 @@
+#ifndef BIT_OPS_H
+#define BIT_OPS_H
+
+#include <cstdint>
+
+namespace d64
+{
+
+// index of the lowest set bit, bits must not be 0
+inline uint8_t lowestSetBit(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return static_cast<uint8_t>(__builtin_ctzll(bits));
+#else
+    uint8_t ret = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        ++ret;
+    }
+    return ret;
+#endif
+}
+
+inline uint8_t countSetBits(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return static_cast<uint8_t>(__builtin_popcountll(bits));
+#else
+    uint8_t ret = 0;
+    for (; bits; bits &= bits - 1)
+    {
+        ++ret;
+    }
+    return ret;
+#endif
+}
+
+}
+
+#endif
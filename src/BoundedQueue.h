@@ -0,0 +1,76 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <cstddef>
+
+namespace d64
+{
+
+// Thread-safe FIFO queue connecting the stages of a pipeline. push() blocks while the queue is
+// full, so a fast stage cannot run away from a slow one. After close() the queued items can still
+// be popped, but nothing can be pushed anymore.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    BoundedQueue(BoundedQueue const &) = delete;
+    BoundedQueue &operator = (BoundedQueue const &) = delete;
+
+    // false if the queue has been closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return closed || (items.size() < capacity); });
+        if (closed)
+        {
+            return false;
+        }
+
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // blocks until there is an item, false once the queue has been closed and is empty
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // wakes up all threads waiting to push or pop
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+}
+
+#endif
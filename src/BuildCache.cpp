@@ -0,0 +1,380 @@
+#include "BuildCache.h"
+
+#include <vector>
+#include <chrono>
+#include <cstring> // std::memcpy
+#include <cerrno>
+#include <memory>
+
+// POSIX API for the cache folder
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> // FICLONE
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+constexpr uint64_t PRIME_1 = 0x9e3779b185ebca87ull;
+constexpr uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+constexpr uint64_t PRIME_3 = 0x165667b19e3779f9ull;
+constexpr uint64_t PRIME_4 = 0x85ebca77c2b2ae63ull;
+
+constexpr char const *ENTRY_SUFFIX = ".img";
+constexpr size_t KEY_TEXT_LEN = 32;
+
+inline uint64_t rotateLeft(uint64_t value, unsigned bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t avalanche(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= PRIME_2;
+    value ^= value >> 29;
+    value *= PRIME_3;
+    value ^= value >> 32;
+    return value;
+}
+
+uint64_t getNanoseconds(struct timespec const &ts)
+{
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+uint64_t getNow()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+bool copyFile(std::string const &srcPath, std::string const &destPath)
+{
+    int srcFd = ::open(srcPath.c_str(), O_RDONLY);
+    if (srcFd < 0)
+    {
+        return false;
+    }
+
+    int destFd = ::open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool success = (destFd >= 0);
+    std::vector<uint8_t> buf;
+
+#ifdef FICLONE
+    // a copy-on-write clone where the file system supports it (btrfs, XFS), shares the blocks like a link
+    bool isCloned = success && (::ioctl(destFd, FICLONE, srcFd) == 0);
+#else
+    bool isCloned = false;
+#endif
+    if (success && !isCloned)
+    {
+        buf.resize(64 * 1024);
+    }
+
+    while (success && !isCloned)
+    {
+        ssize_t numRead = ::read(srcFd, buf.data(), buf.size());
+        if ((numRead < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (numRead <= 0)
+        {
+            success = (numRead == 0);
+            break;
+        }
+
+        for (ssize_t offset = 0; success && (offset < numRead); )
+        {
+            ssize_t written = ::write(destFd, &buf[offset], numRead - offset);
+            if (written < 0)
+            {
+                success = (errno == EINTR);
+                continue;
+            }
+            offset += written;
+        }
+    }
+
+    ::close(srcFd);
+    if ((destFd >= 0) && (::close(destFd) != 0))
+    {
+        success = false;
+    }
+    return success;
+}
+
+// a copy of srcPath resp. a hard link to it replaces destPath in one step, tempPath is taken on the way
+bool linkOrCopyFile(std::string const &srcPath, std::string const &destPath, std::string const &tempPath, bool isLinking)
+{
+    bool success = isLinking ?
+        ((::link(srcPath.c_str(), tempPath.c_str()) == 0) ||
+         (((errno == EXDEV) || (errno == EPERM) || (errno == EMLINK)) && copyFile(srcPath, tempPath))) :
+        copyFile(srcPath, tempPath);
+    if (success && (::rename(tempPath.c_str(), destPath.c_str()) == 0))
+    {
+        // rename() keeps the temporary link if destPath was a link to the same file already
+        ::unlink(tempPath.c_str());
+        return true;
+    }
+
+    ::unlink(tempPath.c_str());
+    return false;
+}
+
+}
+
+ContentHasher::ContentHasher() : laneA(PRIME_4), laneB(PRIME_1 ^ PRIME_3), pendingWord(0), numPendingBytes(0), totalLength(0)
+{
+}
+
+void ContentHasher::addWord(uint64_t word)
+{
+    // two different rounds, so a collision in one lane does not imply one in the other
+    laneA = rotateLeft(laneA + word * PRIME_2, 31) * PRIME_1;
+    laneB = rotateLeft(laneB ^ (word * PRIME_3), 27) * PRIME_4 + PRIME_2;
+}
+
+void ContentHasher::add(uint8_t const *pData, size_t length)
+{
+    totalLength += length;
+
+    // complete the pending word first
+    while ((numPendingBytes > 0) && (length > 0))
+    {
+        pendingWord |= static_cast<uint64_t>(*pData++) << (numPendingBytes * 8);
+        --length;
+        if (++numPendingBytes == 8)
+        {
+            addWord(pendingWord);
+            pendingWord = 0;
+            numPendingBytes = 0;
+        }
+    }
+
+    for (; length >= 8; pData += 8, length -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, pData, sizeof(word));
+        addWord(word);
+    }
+
+    for (; length > 0; --length)
+    {
+        pendingWord |= static_cast<uint64_t>(*pData++) << (numPendingBytes++ * 8);
+    }
+}
+
+void ContentHasher::add(std::string const &str)
+{
+    uint64_t length = str.length();
+    uint8_t lengthBytes[sizeof(length)];
+    std::memcpy(lengthBytes, &length, sizeof(length));
+    add(lengthBytes, sizeof(lengthBytes));
+    add(reinterpret_cast<uint8_t const *>(str.data()), str.length());
+}
+
+ContentHasher::Hash ContentHasher::finish() const
+{
+    uint64_t a = laneA;
+    uint64_t b = laneB;
+    if (numPendingBytes > 0)
+    {
+        a = rotateLeft(a + pendingWord * PRIME_2, 31) * PRIME_1;
+        b = rotateLeft(b ^ (pendingWord * PRIME_3), 27) * PRIME_4 + PRIME_2;
+    }
+
+    a ^= totalLength;
+    b += totalLength * PRIME_1;
+    // each half depends on both lanes
+    return Hash{avalanche(a + rotateLeft(b, 17)), avalanche(b ^ rotateLeft(a, 41))};
+}
+
+std::string ContentHasher::Hash::toString() const
+{
+    static char const digits[] = "0123456789abcdef";
+    std::string ret(KEY_TEXT_LEN, '0');
+    for (size_t digitIdx = 0; digitIdx < 16; digitIdx++)
+    {
+        ret[15 - digitIdx] = digits[(hi >> (digitIdx * 4)) & 0x0f];
+        ret[31 - digitIdx] = digits[(lo >> (digitIdx * 4)) & 0x0f];
+    }
+    return ret;
+}
+
+BuildCache::BuildCache(std::string const &cacheDir, uint64_t maxBytes, size_t maxEntries, bool isLinking) :
+    cacheDir(cacheDir), maxBytes(maxBytes), maxEntries(maxEntries), isLinking(isLinking), valid(false), totalBytes(0), tempCounter(0),
+    numLookups(0), numHits(0), numStores(0), numEvictions(0)
+{
+    if ((::mkdir(cacheDir.c_str(), 0755) != 0) && (errno != EEXIST))
+    {
+        return;
+    }
+
+    unique_ptr<DIR, int (*)(DIR *)> pDIR(opendir(cacheDir.c_str()), closedir);
+    if (pDIR == nullptr)
+    {
+        return;
+    }
+
+    // entries are named <key text>.img, anything else in the folder is left alone
+    struct dirent *dp = nullptr;
+    while ((dp = readdir(pDIR.get())) != nullptr)
+    {
+        std::string fileName = dp->d_name;
+        struct stat st;
+        if ((fileName.length() == KEY_TEXT_LEN + std::strlen(ENTRY_SUFFIX)) &&
+            (fileName.compare(KEY_TEXT_LEN, std::string::npos, ENTRY_SUFFIX) == 0) &&
+            (::stat((cacheDir + "/" + fileName).c_str(), &st) == 0) && S_ISREG(st.st_mode))
+        {
+            entries[fileName.substr(0, KEY_TEXT_LEN)] = Entry{static_cast<uint64_t>(st.st_size), getNanoseconds(st.st_mtim)};
+            totalBytes += static_cast<uint64_t>(st.st_size);
+        }
+    }
+
+    valid = true;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    evict();
+}
+
+std::string BuildCache::getEntryPath(std::string const &keyText) const
+{
+    return cacheDir + "/" + keyText + ENTRY_SUFFIX;
+}
+
+std::string BuildCache::makeTempPath(std::string const &path)
+{
+    // unique among the threads of this process and the processes sharing the cache
+    uint64_t counter = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counter = tempCounter++;
+    }
+    return path + ".tmp" + std::to_string(::getpid()) + "_" + std::to_string(counter);
+}
+
+bool BuildCache::fetch(Key const &key, std::string const &imagePath)
+{
+    ++numLookups;
+    std::string keyText = key.toString();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!valid || (entries.find(keyText) == entries.end()))
+        {
+            return false;
+        }
+    }
+
+    std::string entryPath = getEntryPath(keyText);
+    if (!linkOrCopyFile(entryPath, imagePath, makeTempPath(imagePath), isLinking))
+    {
+        // evicted by another process sharing the folder
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(keyText);
+        if ((it != entries.end()) && (::access(entryPath.c_str(), F_OK) != 0))
+        {
+            totalBytes -= it->second.size;
+            entries.erase(it);
+        }
+        return false;
+    }
+
+    // the modification time keeps the order of use for the next run
+    ::utimensat(AT_FDCWD, entryPath.c_str(), nullptr, 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(keyText);
+        if (it != entries.end())
+        {
+            it->second.lastUse = getNow();
+        }
+    }
+
+    ++numHits;
+    return true;
+}
+
+bool BuildCache::store(Key const &key, std::string const &imagePath)
+{
+    struct stat st;
+    if (!valid || (::stat(imagePath.c_str(), &st) != 0))
+    {
+        return false;
+    }
+
+    std::string keyText = key.toString();
+    std::string entryPath = getEntryPath(keyText);
+    if (!linkOrCopyFile(imagePath, entryPath, makeTempPath(entryPath), isLinking))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(keyText);
+    if (it != entries.end())
+    {
+        totalBytes -= it->second.size;
+    }
+    entries[keyText] = Entry{static_cast<uint64_t>(st.st_size), getNow()};
+    totalBytes += static_cast<uint64_t>(st.st_size);
+    ++numStores;
+
+    evict();
+    return true;
+}
+
+void BuildCache::evict()
+{
+    // a linear search for the oldest entry, evictions are rare compared to lookups
+    while (!entries.empty() && ((totalBytes > maxBytes) || (entries.size() > maxEntries)))
+    {
+        auto oldest = entries.begin();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+            if (it->second.lastUse < oldest->second.lastUse)
+            {
+                oldest = it;
+            }
+        }
+
+        ::unlink(getEntryPath(oldest->first).c_str());
+        totalBytes -= oldest->second.size;
+        entries.erase(oldest);
+        ++numEvictions;
+    }
+}
+
+BuildCache::Stats BuildCache::getStats() const
+{
+    return Stats{numLookups.load(), numHits.load(), numStores.load(), numEvictions.load()};
+}
+
+size_t BuildCache::getNumberOfEntries() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+uint64_t BuildCache::getSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalBytes;
+}
+
+bool d64::breakHardLink(std::string const &path)
+{
+    struct stat st;
+    if ((::lstat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode) || (st.st_nlink < 2))
+    {
+        return true;
+    }
+    return ::unlink(path.c_str()) == 0;
+}
@@ -0,0 +1,128 @@
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace d64
+{
+
+// 128 bit hash over a stream of bytes, fed in pieces of any size. Two lanes of 64 bit
+// multiply-rotate rounds over 8 byte words, which is fast enough to hash the programs
+// of a folder in a fraction of the time building their image takes. Not cryptographic.
+class ContentHasher
+{
+public:
+    struct Hash
+    {
+        uint64_t lo;
+        uint64_t hi;
+
+        bool operator == (Hash const &rhs) const { return (lo == rhs.lo) && (hi == rhs.hi); }
+        bool operator != (Hash const &rhs) const { return !(*this == rhs); }
+        // 32 hex digits
+        std::string toString() const;
+    };
+
+    ContentHasher();
+
+    void add(uint8_t const *pData, size_t length);
+    // the length first, so the boundaries between the strings are part of the hash
+    void add(std::string const &str);
+    Hash finish() const;
+
+private:
+    void addWord(uint64_t word);
+
+    uint64_t laneA;
+    uint64_t laneB;
+    uint64_t pendingWord; // bytes which do not fill a word yet
+    uint8_t numPendingBytes;
+    uint64_t totalLength;
+};
+
+// On-disk cache of images, keyed by the hash of everything an image is built from, see
+// hashFolder(). A hit copies the cached image to the requested path, so no Writer is needed; the
+// copy is a copy-on-write clone where the file system supports it. Hard links instead of copies
+// are faster and take no space, but a program writing a linked image in place changes the cached
+// one as well, so they are opt-in. The least recently used entries are evicted to stay within the
+// limits. Thread-safe; several processes may share the folder, entries appear atomically. Local
+// file systems only.
+class BuildCache
+{
+public:
+    using Key = ContentHasher::Hash;
+
+    struct Stats
+    {
+        size_t lookups;
+        size_t hits;
+        size_t stores;
+        size_t evictions;
+
+        double getHitRate() const { return (lookups > 0) ? static_cast<double>(hits) / lookups : 0.0; }
+    };
+
+    static constexpr uint64_t DEFAULT_MAX_BYTES = 256ull << 20;
+    static constexpr size_t DEFAULT_MAX_ENTRIES = 4096;
+
+    // creates the folder if required, entries found in it count as used in the order of their modification times.
+    // isLinking hard-links the images to resp. from the cache (copied across file systems).
+    explicit BuildCache(std::string const &cacheDir, uint64_t maxBytes = DEFAULT_MAX_BYTES, size_t maxEntries = DEFAULT_MAX_ENTRIES,
+                        bool isLinking = false);
+
+    BuildCache(BuildCache const &) = delete;
+    BuildCache &operator = (BuildCache const &) = delete;
+
+    // false if the folder could not be created or read
+    bool isValid() const { return valid; }
+
+    // makes the image of the key available at imagePath, false on a miss
+    bool fetch(Key const &key, std::string const &imagePath);
+    // takes the image at imagePath into the cache, false if it could not be stored
+    bool store(Key const &key, std::string const &imagePath);
+
+    Stats getStats() const;
+    size_t getNumberOfEntries() const;
+    uint64_t getSize() const;
+
+private:
+    struct Entry
+    {
+        uint64_t size;
+        uint64_t lastUse; // ns since the epoch
+    };
+
+    std::string getEntryPath(std::string const &keyText) const;
+    std::string makeTempPath(std::string const &path);
+    // evicts least recently used entries until both limits hold, called with the mutex locked
+    void evict();
+
+    std::string cacheDir;
+    uint64_t maxBytes;
+    size_t maxEntries;
+    bool isLinking;
+    bool valid;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries; // by key text
+    uint64_t totalBytes;
+    uint64_t tempCounter;
+
+    std::atomic<size_t> numLookups;
+    std::atomic<size_t> numHits;
+    std::atomic<size_t> numStores;
+    std::atomic<size_t> numEvictions;
+};
+
+// removes path if it is one of several hard links of its file, so writing the path does not
+// change the other links, e.g. a BuildCache entry. True if path is not linked (anymore).
+bool breakHardLink(std::string const &path);
+
+}
+
+#endif
@@ -0,0 +1,682 @@
+#include "BuildServer.h"
+#include "BoundedQueue.h"
+#include "ProgFile.h"
+#include "G64.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+constexpr size_t MAX_LINE_LENGTH = 4096;
+// inline file contents of one request, more than fits onto the largest disk
+constexpr size_t MAX_INLINE_BYTES = 4u << 20;
+
+// the n-th percentile of sorted samples, nearest rank
+uint64_t getPercentile(std::vector<uint64_t> const &sorted, unsigned percent)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+}
+
+void LatencyRecorder::record(uint64_t micros, bool success)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.size() < window)
+    {
+        samples.push_back(micros);
+    }
+    else
+    {
+        samples[numRequests % window] = micros;
+    }
+    ++numRequests;
+    numFailed += success ? 0 : 1;
+}
+
+LatencyRecorder::Summary LatencyRecorder::getSummary() const
+{
+    std::vector<uint64_t> sorted;
+    Summary ret{};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sorted = samples;
+        ret.numRequests = numRequests;
+        ret.numFailed = numFailed;
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    ret.p50Micros = getPercentile(sorted, 50);
+    ret.p90Micros = getPercentile(sorted, 90);
+    ret.p99Micros = getPercentile(sorted, 99);
+    ret.maxMicros = sorted.empty() ? 0 : sorted.back();
+    return ret;
+}
+
+// buffered reading of lines and payloads from a socket and sending the answers
+class BuildServer::Connection
+{
+public:
+    explicit Connection(int fd) : fd(fd), pos(0), isBroken(false) {}
+
+    // the next line without the line feed, false at the end of the connection or for a line which is too long
+    bool readLine(std::string &line)
+    {
+        for (;;)
+        {
+            size_t end = buf.find('\n', pos);
+            if (end != std::string::npos)
+            {
+                line.assign(buf, pos, end - pos);
+                pos = end + 1;
+                return true;
+            }
+            if ((buf.size() - pos > MAX_LINE_LENGTH) || !fill())
+            {
+                return false;
+            }
+        }
+    }
+
+    bool readBytes(size_t length, std::vector<uint8_t> &bytes)
+    {
+        while (buf.size() - pos < length)
+        {
+            if (!fill())
+            {
+                return false;
+            }
+        }
+        bytes.assign(buf.begin() + pos, buf.begin() + pos + length);
+        pos += length;
+        return true;
+    }
+
+    bool send(void const *pData, size_t length)
+    {
+        uint8_t const *pBytes = static_cast<uint8_t const *>(pData);
+        while (!isBroken && (length > 0))
+        {
+            // the client may be gone, that must not raise SIGPIPE
+            ssize_t sent = ::send(fd, pBytes, length, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                isBroken = (errno != EINTR);
+                continue;
+            }
+            pBytes += sent;
+            length -= static_cast<size_t>(sent);
+        }
+        return !isBroken;
+    }
+
+    bool send(std::string const &text) { return send(text.data(), text.size()); }
+
+    bool isOk() const { return !isBroken; }
+    // a request follows without waiting for the socket
+    bool hasBufferedInput() const { return pos < buf.size(); }
+    int getFd() const { return fd; }
+
+private:
+    bool fill()
+    {
+        // drop what has been consumed before reading more
+        buf.erase(0, pos);
+        pos = 0;
+
+        char chunk[65536];
+        for (;;)
+        {
+            ssize_t numRead = ::read(fd, chunk, sizeof(chunk));
+            if (numRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (numRead <= 0)
+            {
+                return false;
+            }
+            buf.append(chunk, static_cast<size_t>(numRead));
+            return true;
+        }
+    }
+
+    int fd;
+    std::string buf;
+    size_t pos;
+    bool isBroken;
+};
+
+struct BuildServer::Request
+{
+    struct File
+    {
+        std::string name;
+        std::string path; // empty for inline content
+        std::vector<uint8_t> data;
+    };
+
+    ImageFormat format = ImageFormat::D64;
+    std::string diskName = "Demo";
+    std::string diskId = "42";
+    std::vector<File> files;
+    std::string outputPath;
+};
+
+BuildServer::BuildServer(unsigned numWorkers, unsigned timeoutMillis) :
+    numWorkers(numWorkers), timeoutMillis(timeoutMillis), listenFd(-1), wakeFds{-1, -1}, stopped(false)
+{
+    if (this->numWorkers == 0)
+    {
+        this->numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // a full pipe wakes run() up all the same, so the writers never block
+    if (::pipe2(wakeFds, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        wakeFds[0] = wakeFds[1] = -1;
+    }
+}
+
+BuildServer::~BuildServer()
+{
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        ::unlink(socketPath.c_str());
+    }
+    for (int fd : wakeFds)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+}
+
+bool BuildServer::listen(std::string const &socketPath, std::ostream &err)
+{
+    sockaddr_un addr{};
+    if (socketPath.empty() || (socketPath.size() >= sizeof(addr.sun_path)))
+    {
+        err << "Invalid socket path " << socketPath << "." << std::endl;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // a socket left behind by a previous server, but nothing else
+    struct stat st;
+    if ((::stat(socketPath.c_str(), &st) == 0) && S_ISSOCK(st.st_mode))
+    {
+        ::unlink(socketPath.c_str());
+    }
+
+    // non-blocking, a client which is gone before accept() must not stall run()
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    // FILE and OUTPUT act with the rights of the server, so only its user may connect. Connecting
+    // fails until listen(), the socket is never open to others.
+    if ((wakeFds[0] < 0) || (fd < 0) || (::bind(fd, reinterpret_cast<sockaddr const *>(&addr), sizeof(addr)) != 0) ||
+        (::chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0) || (::listen(fd, SOMAXCONN) != 0))
+    {
+        err << "Could not listen on " << socketPath << ": " << std::strerror(errno) << "." << std::endl;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    listenFd = fd;
+    this->socketPath = socketPath;
+    return true;
+}
+
+void BuildServer::run()
+{
+    // every connection is queued at most once, so push() never blocks
+    BoundedQueue<Connection *> requests(MAX_CONNECTIONS);
+    auto worker = [this, &requests]()
+    {
+        Connection *pConnection = nullptr;
+        while (requests.pop(pConnection))
+        {
+            {
+                std::lock_guard<std::mutex> lock(activeMutex);
+                activeFds.insert(pConnection->getFd());
+            }
+            bool canGoOn = !stopped && serveNext(*pConnection);
+            {
+                std::lock_guard<std::mutex> lock(activeMutex);
+                activeFds.erase(pConnection->getFd());
+                servedConnections.emplace_back(pConnection, canGoOn);
+            }
+            wake();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned workerIdx = 0; workerIdx < numWorkers; workerIdx++)
+    {
+        workers.emplace_back(worker);
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::map<int, std::unique_ptr<Connection>> connections; // all open ones
+    std::vector<std::pair<Connection *, Clock::time_point>> idle; // waiting for a request, since when
+    std::vector<pollfd> pollFds;
+    auto closeConnection = [&connections](Connection *pConnection)
+    {
+        int fd = pConnection->getFd();
+        connections.erase(fd);
+        ::close(fd);
+    };
+
+    while (!stopped && (listenFd >= 0))
+    {
+        // the connections the workers are done with wait for the next request, unless it is there already
+        std::vector<std::pair<Connection *, bool>> served;
+        {
+            std::lock_guard<std::mutex> lock(activeMutex);
+            served.swap(servedConnections);
+        }
+        for (auto const &connection : served)
+        {
+            if (!connection.second || !connection.first->isOk())
+            {
+                closeConnection(connection.first);
+            }
+            else if (connection.first->hasBufferedInput())
+            {
+                requests.push(connection.first);
+            }
+            else
+            {
+                idle.emplace_back(connection.first, Clock::now());
+            }
+        }
+
+        // idle clients are dropped after the timeout
+        Clock::time_point now = Clock::now();
+        Clock::duration timeout = std::chrono::milliseconds(timeoutMillis);
+        int waitMillis = -1;
+        for (size_t idleIdx = 0; idleIdx < idle.size();)
+        {
+            Clock::duration idleFor = now - idle[idleIdx].second;
+            if (idleFor >= timeout)
+            {
+                closeConnection(idle[idleIdx].first);
+                idle[idleIdx] = idle.back();
+                idle.pop_back();
+                continue;
+            }
+            int leftMillis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout - idleFor).count()) + 1;
+            waitMillis = (waitMillis < 0) ? leftMillis : std::min(waitMillis, leftMillis);
+            idleIdx++;
+        }
+
+        pollFds.clear();
+        pollFds.push_back(pollfd{wakeFds[0], POLLIN, 0});
+        pollFds.push_back(pollfd{listenFd, static_cast<short>((connections.size() < MAX_CONNECTIONS) ? POLLIN : 0), 0});
+        for (auto const &connection : idle)
+        {
+            pollFds.push_back(pollfd{connection.first->getFd(), POLLIN, 0});
+        }
+        if (::poll(pollFds.data(), pollFds.size(), waitMillis) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (pollFds[0].revents != 0)
+        {
+            char drained[64];
+            while (::read(wakeFds[0], drained, sizeof(drained)) > 0)
+            {
+            }
+        }
+
+        // a request has arrived resp. the client has closed the connection, the workers take it from here
+        for (size_t idleIdx = idle.size(); idleIdx-- > 0;)
+        {
+            if (pollFds[idleIdx + 2].revents != 0)
+            {
+                requests.push(idle[idleIdx].first);
+                idle[idleIdx] = idle.back();
+                idle.pop_back();
+            }
+        }
+
+        if (pollFds[1].revents != 0)
+        {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                // a client stalling within a request resp. not reading the answer fails it
+                timeval ioTimeout{static_cast<time_t>(timeoutMillis / 1000), static_cast<suseconds_t>((timeoutMillis % 1000) * 1000)};
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &ioTimeout, sizeof(ioTimeout));
+                ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &ioTimeout, sizeof(ioTimeout));
+                std::unique_ptr<Connection> pConnection(new Connection(fd));
+                idle.emplace_back(pConnection.get(), Clock::now());
+                connections[fd] = std::move(pConnection);
+            }
+            else if ((errno != EINTR) && (errno != ECONNABORTED) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                break;
+            }
+        }
+    }
+
+    // idle clients must not keep the workers waiting
+    stopped = true;
+    {
+        std::lock_guard<std::mutex> lock(activeMutex);
+        for (int fd : activeFds)
+        {
+            ::shutdown(fd, SHUT_RD);
+        }
+    }
+    requests.close();
+    for (auto &thread : workers)
+    {
+        thread.join();
+    }
+    servedConnections.clear();
+    for (auto const &connection : connections)
+    {
+        ::close(connection.first);
+    }
+}
+
+void BuildServer::stop()
+{
+    // async-signal-safe
+    stopped = true;
+    wake();
+}
+
+void BuildServer::wake()
+{
+    if (wakeFds[1] >= 0)
+    {
+        char byte = 0;
+        ssize_t numWritten = ::write(wakeFds[1], &byte, 1);
+        static_cast<void>(numWritten);
+    }
+}
+
+void BuildServer::serveConnection(int fd)
+{
+    Connection connection(fd);
+    while (serveNext(connection))
+    {
+    }
+}
+
+bool BuildServer::serveNext(Connection &connection)
+{
+    std::string line;
+    if (!connection.readLine(line))
+    {
+        return false;
+    }
+
+    if (line.empty())
+    {
+        return true;
+    }
+
+    if (line == "STATS")
+    {
+        LatencyRecorder::Summary summary = getLatency();
+        std::ostringstream json;
+        json << "{\"requests\": " << summary.numRequests << ", \"failed\": " << summary.numFailed
+             << ", \"p50Micros\": " << summary.p50Micros << ", \"p90Micros\": " << summary.p90Micros
+             << ", \"p99Micros\": " << summary.p99Micros << ", \"maxMicros\": " << summary.maxMicros << "}\n";
+        connection.send("OK " + std::to_string(json.str().size()) + "\n" + json.str());
+        return connection.isOk();
+    }
+    return serveRequest(connection, line);
+}
+
+bool BuildServer::serveRequest(Connection &connection, std::string const &firstLine)
+{
+    // from the first line on, requests which are rejected resp. cut off count as failed
+    auto start = std::chrono::steady_clock::now();
+    auto recordLatency = [this, &start](bool success)
+    {
+        latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(), success);
+    };
+
+    Request request;
+    std::string error;
+
+    if ((firstLine != "BUILD") && ((firstLine.compare(0, 6, "BUILD ") != 0) || !parseImageFormat(firstLine.substr(6), request.format)))
+    {
+        error = "Unknown request " + firstLine.substr(0, 40) + ".";
+    }
+
+    // the lines up to END, the connection cannot go on after a malformed one
+    std::string line;
+    size_t numInlineBytes = 0;
+    while (error.empty())
+    {
+        if (!connection.readLine(line))
+        {
+            recordLatency(false);
+            return false;
+        }
+
+        if (line.empty())
+        {
+            continue;
+        }
+
+        size_t sep = line.find(' ');
+        std::string keyword = line.substr(0, sep);
+        std::string arg = (sep == std::string::npos) ? "" : line.substr(sep + 1);
+
+        if (keyword == "END")
+        {
+            break;
+        }
+        else if ((keyword == "NAME") && !arg.empty())
+        {
+            request.diskName = arg;
+        }
+        else if ((keyword == "ID") && !arg.empty())
+        {
+            request.diskId = arg;
+        }
+        else if ((keyword == "OUTPUT") && !arg.empty())
+        {
+            request.outputPath = arg;
+        }
+        else if ((keyword == "FILE") && !arg.empty())
+        {
+            size_t tab = arg.find('\t');
+            std::string path = (tab == std::string::npos) ? arg : arg.substr(tab + 1);
+            std::string name = (tab == std::string::npos) ? path.substr(path.find_last_of('/') + 1) : arg.substr(0, tab);
+            request.files.push_back(Request::File{name, path, {}});
+        }
+        else if (keyword == "DATA")
+        {
+            size_t nameSep = arg.find(' ');
+            char *pEnd = nullptr;
+            unsigned long long length = std::strtoull(arg.c_str(), &pEnd, 10);
+            if ((nameSep == std::string::npos) || (pEnd != arg.c_str() + nameSep) || (nameSep == 0) ||
+                (length > MAX_INLINE_BYTES - numInlineBytes))
+            {
+                error = "Malformed or too large DATA line.";
+                break;
+            }
+            numInlineBytes += length;
+            request.files.push_back(Request::File{arg.substr(nameSep + 1), "", {}});
+            if (!connection.readBytes(length, request.files.back().data))
+            {
+                recordLatency(false);
+                return false;
+            }
+        }
+        else
+        {
+            error = "Unknown line " + line.substr(0, 40) + ".";
+        }
+    }
+
+    if (!error.empty())
+    {
+        connection.send("ERROR " + error + "\n");
+        recordLatency(false);
+        return false;
+    }
+
+    bool success = build(request, connection, error);
+    if (!success)
+    {
+        connection.send("ERROR " + error + "\n");
+    }
+    recordLatency(success);
+    return connection.isOk();
+}
+
+bool BuildServer::build(Request const &request, Connection &connection, std::string &error)
+{
+    switch (request.format)
+    {
+        case ImageFormat::D64_40_TRACKS: return buildAs(request, std::get<BasicWriterPool<D64ExtendedGeometry>>(writerPools), connection, error);
+        case ImageFormat::D71: return buildAs(request, std::get<BasicWriterPool<D71Geometry>>(writerPools), connection, error);
+        case ImageFormat::D81: return buildAs(request, std::get<BasicWriterPool<D81Geometry>>(writerPools), connection, error);
+        default: return buildAs(request, std::get<BasicWriterPool<D64Geometry>>(writerPools), connection, error);
+    }
+}
+
+template <typename Geometry>
+bool BuildServer::buildAs(Request const &request, BasicWriterPool<Geometry> &writerPool, Connection &connection, std::string &error)
+{
+    typename BasicWriterPool<Geometry>::Handle pWriter = writerPool.acquire(request.diskName, request.diskId);
+
+    for (auto const &file : request.files)
+    {
+        bool success = false;
+        if (file.path.empty())
+        {
+            success = !file.data.empty() && pWriter->writeFile(file.name, file.data.data(), file.data.size());
+        }
+        else
+        {
+            // checked like the files of a folder
+            ProgFile progFile(file.path);
+            if (progFile.getStatus() != ProgFile::Status::OK)
+            {
+                error = "File " + file.path + " " + ProgFile::getStatusText(progFile.getStatus()) + ".";
+                return false;
+            }
+            success = pWriter->writeFile(file.name, progFile.getData(), progFile.getLength());
+        }
+
+        if (!success)
+        {
+            error = "Could not write file " + file.name + " to image.";
+            return false;
+        }
+    }
+
+    if (!request.outputPath.empty())
+    {
+        std::ostringstream err;
+        if (!saveImage(*pWriter, request.outputPath, err, request.format))
+        {
+            error = "Could not write image " + request.outputPath + ".";
+            return false;
+        }
+        connection.send("OK 0\n");
+        return true;
+    }
+
+    // the dense Writers of the pools hold the image in one piece
+    std::vector<uint8_t> g64;
+    uint8_t const *pImage = pWriter->getImageData();
+    size_t length = pWriter->getImageSize();
+    if constexpr (isG64Geometry<Geometry>())
+    {
+        if (request.format == ImageFormat::G64)
+        {
+            encodeG64<Geometry>([&pWriter](uint16_t idx) { return pWriter->getSectorData(idx); }, g64);
+            pImage = g64.data();
+            length = g64.size();
+        }
+    }
+
+    connection.send("OK " + std::to_string(length) + "\n");
+    connection.send(pImage, length);
+    D64_STATS_ADD(BYTES_WRITTEN, length);
+    D64_STATS_ADD(IMAGES_WRITTEN, 1);
+    return true;
+}
+
+namespace
+{
+
+std::atomic<BuildServer *> pSignalledServer(nullptr);
+
+void stopServer(int)
+{
+    BuildServer *pServer = pSignalledServer.load();
+    if (pServer != nullptr)
+    {
+        pServer->stop();
+    }
+}
+
+}
+
+bool d64::serveBuilds(std::string const &socketPath, unsigned numWorkers, std::ostream &err)
+{
+    BuildServer server(numWorkers);
+    if (!server.listen(socketPath, err))
+    {
+        return false;
+    }
+
+    // SIGINT and SIGTERM let the requests in progress finish and remove the socket
+    pSignalledServer = &server;
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    server.run();
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    pSignalledServer = nullptr;
+    return true;
+}
@@ -0,0 +1,142 @@
+#ifndef BUILD_SERVER_H
+#define BUILD_SERVER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <tuple>
+#include <set>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "WriterPool.h"
+#include "ImageBuilder.h"
+
+namespace d64
+{
+
+// Request latencies of a BuildServer. Keeps the most recent ones for the percentiles.
+class LatencyRecorder
+{
+public:
+    static constexpr size_t DEFAULT_WINDOW = 4096;
+
+    struct Summary
+    {
+        uint64_t numRequests; // all so far
+        uint64_t numFailed; // including the malformed ones and the ones cut off by the client
+        // over the window of the most recent requests
+        uint64_t p50Micros;
+        uint64_t p90Micros;
+        uint64_t p99Micros;
+        uint64_t maxMicros;
+    };
+
+    explicit LatencyRecorder(size_t window = DEFAULT_WINDOW) : window(window), numRequests(0), numFailed(0) {}
+
+    void record(uint64_t micros, bool success);
+    Summary getSummary() const;
+
+private:
+    size_t window;
+    mutable std::mutex mutex;
+    std::vector<uint64_t> samples; // ring buffer once the window is full
+    uint64_t numRequests;
+    uint64_t numFailed;
+};
+
+// Builds images for clients on a Unix domain socket, so a service does not have to launch the
+// command line tool per image. The requests are served on a fixed number of worker threads, one
+// request at a time: run() polls the open connections and hands a connection to a worker once a
+// request arrives on it, so idle clients do not hold a worker. A client which sends nothing for
+// the timeout, between requests or within one, is dropped. The Writers come from pools and are
+// reused from request to request.
+//
+// A connection carries any number of requests, one after the other. A request consists of lines:
+//
+//   BUILD [<format>]                 d64 (default), d64-40, d71, d81 or g64
+//   NAME <disk name>                 optional, "Demo" by default
+//   ID <disk id>                     optional, "42" by default
+//   FILE <path>                      a '.prg' file, written under its file name
+//   FILE <name>\t<path>              the same under another name
+//   DATA <length> <name>             followed by <length> bytes of file content, taken as they are
+//   OUTPUT <path>                    optional, writes the image there instead of sending it
+//   END
+//
+// Empty lines are skipped. The files are written in the order of the request. The answer is "OK <length>\n" followed by the
+// bytes of the image (length 0 with OUTPUT), resp. "ERROR <message>\n". "STATS" answers "OK <length>\n"
+// with a JSON object of the number of requests and the latency percentiles. A malformed request
+// closes the connection after the error.
+//
+// FILE reads and OUTPUT writes any path the user of the server may, so the clients are trusted
+// like that user: the socket is created with the permissions 0600.
+class BuildServer
+{
+public:
+    static constexpr unsigned DEFAULT_TIMEOUT_MILLIS = 30000;
+    // connections beyond are closed right after they are accepted
+    static constexpr size_t MAX_CONNECTIONS = 1024;
+
+    // numWorkers == 0 picks the number of hardware threads
+    explicit BuildServer(unsigned numWorkers = 0, unsigned timeoutMillis = DEFAULT_TIMEOUT_MILLIS);
+    ~BuildServer();
+
+    BuildServer(BuildServer const &) = delete;
+    BuildServer &operator = (BuildServer const &) = delete;
+
+    unsigned getNumberOfWorkers() const { return numWorkers; }
+
+    // binds the socket for the user of the process only, replacing a stale socket file at the path.
+    // Problems are reported on err.
+    bool listen(std::string const &socketPath, std::ostream &err);
+    // accepts connections and serves them until stop() is called
+    void run();
+    // may be called from any thread and from signal handlers. run() closes the connections being
+    // served, lets the requests in progress finish and returns.
+    void stop();
+
+    // serves the requests arriving on the connected socket fd until the client closes it,
+    // the caller keeps the ownership of fd. Thread-safe.
+    void serveConnection(int fd);
+
+    LatencyRecorder::Summary getLatency() const { return latency.getSummary(); }
+
+private:
+    struct Request;
+    class Connection;
+
+    // the next request or STATS line resp. an empty line, false if the connection cannot go on
+    bool serveNext(Connection &connection);
+    // one request, false if the connection cannot go on
+    bool serveRequest(Connection &connection, std::string const &firstLine);
+    // builds the image and sends it resp. writes it to the output path, false with the error if it fails
+    bool build(Request const &request, Connection &connection, std::string &error);
+    template <typename Geometry>
+    bool buildAs(Request const &request, BasicWriterPool<Geometry> &writerPool, Connection &connection, std::string &error);
+    // wakes up run() from the workers and from stop()
+    void wake();
+
+    unsigned numWorkers;
+    unsigned timeoutMillis;
+    int listenFd;
+    int wakeFds[2]; // a pipe, read by run()
+    std::string socketPath;
+    std::atomic<bool> stopped;
+    std::mutex activeMutex;
+    std::set<int> activeFds; // the connections being served by the workers
+    // the connections the workers are done with, false if the connection cannot go on
+    std::vector<std::pair<Connection *, bool>> servedConnections;
+    LatencyRecorder latency;
+    // one pool per geometry, G64 images are built with the D64 ones
+    std::tuple<BasicWriterPool<D64Geometry>, BasicWriterPool<D64ExtendedGeometry>,
+               BasicWriterPool<D71Geometry>, BasicWriterPool<D81Geometry>> writerPools;
+};
+
+// serves on socketPath until SIGINT or SIGTERM, returns false if it cannot listen
+bool serveBuilds(std::string const &socketPath, unsigned numWorkers, std::ostream &err);
+
+}
+
+#endif
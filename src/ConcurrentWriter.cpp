@@ -0,0 +1,96 @@
+#include "ConcurrentWriter.h"
+#include "Stats.h"
+
+#include <vector>
+
+using namespace d64;
+using namespace std;
+
+template <typename Geometry>
+BasicConcurrentWriter<Geometry>::BasicConcurrentWriter(Writer &writer) :
+    writer(writer), allocator(writer.allocator), isDense(writer.storage.getMode() == StorageMode::DENSE)
+{
+}
+
+template <typename Geometry>
+bool BasicConcurrentWriter<Geometry>::writeFile(std::string const &name, uint8_t const *pData, size_t length)
+{
+    if ((length == 0) || (length > static_cast<size_t>(Writer::NUM_SECTORS) * Writer::DATA_BYTES_PER_SECTOR))
+    {
+        return false;
+    }
+
+    DirectoryIndex::Name d64Name = makeD64FileName(name);
+    uint16_t numberOfBlocks = static_cast<uint16_t>((length + (Writer::DATA_BYTES_PER_SECTOR - 1)) / Writer::DATA_BYTES_PER_SECTOR);
+    uint16_t slot = DirectoryIndex::INVALID;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        D64_STATS_TIMER(DIRECTORY);
+        D64_STATS_ADD(DIRECTORY_SEARCHES, 1);
+        slot = writer.directory.getFirstFreeSlot();
+        if ((slot == DirectoryIndex::INVALID) || (writer.directory.find(d64Name) != DirectoryIndex::INVALID))
+        {
+            return false;
+        }
+        // the slot and the name stay reserved while the data is written, like for a FileSink
+        writer.directory.add(slot, d64Name);
+    }
+
+    if (!allocator.reserve(numberOfBlocks))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writer.directory.remove(slot);
+        return false;
+    }
+
+    // sparse storage materializes sectors from the pool and counts them
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    if (!isDense)
+    {
+        lock.lock();
+    }
+
+    std::vector<uint16_t> sectors;
+    sectors.reserve(numberOfBlocks);
+    uint32_t numProbes = 0;
+    TrackSector firstSector = allocator.takeFirst(numProbes);
+    TrackSector ts = firstSector;
+    uint16_t prevSectorIdx = Writer::INVALID;
+    while (length > 0)
+    {
+        if (prevSectorIdx != Writer::INVALID)
+        {
+            ts = allocator.takeNext(ts, numProbes);
+        }
+
+        uint16_t sectorIdx = Geometry::getSectorIdx(ts);
+        uint8_t writtenData = writer.writeDataToSector(sectorIdx, pData, length, prevSectorIdx);
+        pData = &pData[writtenData];
+        length -= writtenData;
+        sectors.push_back(sectorIdx);
+        prevSectorIdx = sectorIdx;
+    }
+
+    if (!lock.owns_lock())
+    {
+        lock.lock();
+    }
+    for (uint16_t sectorIdx : sectors)
+    {
+        writer.setSectorOccupied(sectorIdx);
+    }
+    D64_STATS_ADD(SECTORS_ALLOCATED, sectors.size());
+    D64_STATS_ADD(ALLOCATION_PROBES, numProbes);
+    writer.writeDirEntry(slot, d64Name, firstSector, numberOfBlocks);
+    return true;
+}
+
+namespace d64
+{
+
+template class BasicConcurrentWriter<D64Geometry>;
+template class BasicConcurrentWriter<D64ExtendedGeometry>;
+template class BasicConcurrentWriter<D71Geometry>;
+template class BasicConcurrentWriter<D81Geometry>;
+
+}
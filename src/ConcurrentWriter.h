@@ -0,0 +1,54 @@
+#ifndef CONCURRENT_WRITER_H
+#define CONCURRENT_WRITER_H
+
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "Writer.h"
+#include "SectorAllocator.h"
+
+namespace d64
+{
+
+// Lets several threads write files into one Writer at the same time. The sectors of a file are
+// taken from an atomic copy of the allocator without any lock, then the data is copied and the
+// sectors are linked in parallel. Only claiming the directory slot and marking the sectors in the
+// BAM, which share a few sectors between all files, go through a mutex.
+//
+// Files take the free sectors in the order of the default allocation policy, but which file gets
+// which sectors and directory slot depends on the timing of the threads. The image is valid in
+// any case: no sector belongs to two files and the BAM matches the chains.
+//
+// The Writer must not be used otherwise while the ConcurrentWriter exists. Dense storage copies
+// the data of the files in parallel, sparse storage hands out its sectors under the mutex.
+template <typename Geometry>
+class BasicConcurrentWriter
+{
+public:
+    using Writer = BasicWriter<Geometry>;
+
+    explicit BasicConcurrentWriter(Writer &writer);
+
+    BasicConcurrentWriter(BasicConcurrentWriter const &) = delete;
+    BasicConcurrentWriter &operator = (BasicConcurrentWriter const &) = delete;
+
+    // thread-safe, false if the name is taken or the file does not fit like Writer::writeFile()
+    bool writeFile(std::string const &name, uint8_t const *pData, size_t length);
+
+    // blocks free for files which are not being written
+    uint16_t getNumberOfFreeSectors() const { return allocator.getNumberOfUnreservedSectors(); }
+
+private:
+    Writer &writer;
+    BasicAtomicSectorAllocator<Geometry> allocator;
+    bool isDense;
+    std::mutex mutex; // the directory and the BAM of the Writer
+};
+
+using ConcurrentWriter = BasicConcurrentWriter<D64Geometry>;
+
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "D64Api.h"
+#include "Image.h"
+
+#include <new>
+#include <cstring>
+
+using namespace d64;
+using namespace std;
+
+struct d64_image
+{
+    Image image;
+};
+
+static_assert((static_cast<int>(ImageFormat::D64) == D64_FORMAT_D64) && (static_cast<int>(ImageFormat::D64_40_TRACKS) == D64_FORMAT_D64_40_TRACKS) &&
+              (static_cast<int>(ImageFormat::D71) == D64_FORMAT_D71) && (static_cast<int>(ImageFormat::D81) == D64_FORMAT_D81) &&
+              (static_cast<int>(ImageFormat::G64) == D64_FORMAT_G64), "the C formats do not match ImageFormat");
+static_assert(static_cast<int>(Image::Status::WRITE_FAILED) == D64_WRITE_FAILED, "the C status codes do not match Image::Status");
+
+namespace
+{
+
+d64_status toStatus(Image::Status status)
+{
+    switch (status)
+    {
+        case Image::Status::OK: return D64_OK;
+        case Image::Status::INVALID_ARGUMENT: return D64_INVALID_ARGUMENT;
+        case Image::Status::NAME_EXISTS: return D64_NAME_EXISTS;
+        case Image::Status::DIRECTORY_FULL: return D64_DIRECTORY_FULL;
+        case Image::Status::DISK_FULL: return D64_DISK_FULL;
+        case Image::Status::READ_FAILED: return D64_READ_FAILED;
+        default: return D64_WRITE_FAILED;
+    }
+}
+
+// no exception may leave the C interface, the library only throws std::bad_alloc
+template <typename Function>
+d64_status guard(Function function)
+{
+    try
+    {
+        return function();
+    }
+    catch (std::bad_alloc const &)
+    {
+        return D64_OUT_OF_MEMORY;
+    }
+}
+
+}
+
+const char *d64_status_text(d64_status status)
+{
+    switch (status)
+    {
+        case D64_BUFFER_TOO_SMALL: return "buffer too small";
+        case D64_OUT_OF_MEMORY: return "out of memory";
+        default: return ((status >= D64_OK) && (status <= D64_WRITE_FAILED)) ? Image::getStatusText(static_cast<Image::Status>(status)) : "unknown status";
+    }
+}
+
+d64_status d64_image_create(d64_format format, const char *disk_name, const char *disk_id, d64_image **image)
+{
+    if ((image == nullptr) || (static_cast<int>(format) < D64_FORMAT_D64) || (static_cast<int>(format) > D64_FORMAT_G64))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+
+    *image = nullptr;
+    return guard([=]()
+    {
+        *image = new d64_image{Image(static_cast<ImageFormat>(format), (disk_name != nullptr) ? disk_name : "Demo",
+                                     (disk_id != nullptr) ? disk_id : "42")};
+        return D64_OK;
+    });
+}
+
+void d64_image_destroy(d64_image *image)
+{
+    delete image;
+}
+
+d64_status d64_image_add_file(d64_image *image, const char *name, const uint8_t *data, size_t length)
+{
+    if ((image == nullptr) || (name == nullptr))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+    return guard([=]() { return toStatus(image->image.addFile(name, data, length)); });
+}
+
+d64_status d64_image_add_file_fd(d64_image *image, const char *name, int fd)
+{
+    if ((image == nullptr) || (name == nullptr))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+    return guard([=]() { return toStatus(image->image.addFile(name, fd)); });
+}
+
+d64_status d64_image_get_number_of_files(const d64_image *image, uint16_t *number_of_files)
+{
+    if ((image == nullptr) || (number_of_files == nullptr))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+    *number_of_files = image->image.getNumberOfFiles();
+    return D64_OK;
+}
+
+d64_status d64_image_get_bytes(const d64_image *image, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    if ((image == nullptr) || (length == nullptr) || ((buffer == nullptr) && (capacity > 0)))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+    return guard([=]()
+    {
+        // the size is known without building the image, e.g. without encoding a G64
+        *length = image->image.getSize();
+        if (*length > capacity)
+        {
+            return D64_BUFFER_TOO_SMALL;
+        }
+
+        std::vector<uint8_t> bytes;
+        d64_status status = toStatus(image->image.getBytes(bytes));
+        if (status == D64_OK)
+        {
+            std::memcpy(buffer, bytes.data(), bytes.size());
+        }
+        return status;
+    });
+}
+
+d64_status d64_image_save(const d64_image *image, const char *path)
+{
+    if ((image == nullptr) || (path == nullptr))
+    {
+        return D64_INVALID_ARGUMENT;
+    }
+    return guard([=]() { return toStatus(image->image.saveImage(path)); });
+}
@@ -0,0 +1,66 @@
+#ifndef D64_API_H
+#define D64_API_H
+
+/*
+ * C interface of the d64 library, see Image.h for the C++ one. All functions return a d64_status
+ * and never throw, the images are opaque handles owned by the caller.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "D64Export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum d64_status
+{
+    D64_OK = 0,
+    D64_INVALID_ARGUMENT = 1, /* null pointer, empty file name or file, unknown format */
+    D64_NAME_EXISTS = 2,
+    D64_DIRECTORY_FULL = 3,
+    D64_DISK_FULL = 4,
+    D64_READ_FAILED = 5, /* of the file descriptor */
+    D64_WRITE_FAILED = 6, /* of the image file */
+    D64_BUFFER_TOO_SMALL = 7,
+    D64_OUT_OF_MEMORY = 8
+} d64_status;
+
+typedef enum d64_format
+{
+    D64_FORMAT_D64 = 0, /* 35 tracks */
+    D64_FORMAT_D64_40_TRACKS = 1,
+    D64_FORMAT_D71 = 2,
+    D64_FORMAT_D81 = 3,
+    D64_FORMAT_G64 = 4
+} d64_format;
+
+typedef struct d64_image d64_image;
+
+/* e.g. "disk full", never NULL */
+D64_EXPORT const char *d64_status_text(d64_status status);
+
+/* a blank image, disk_name and disk_id may be NULL for "Demo" and "42" */
+D64_EXPORT d64_status d64_image_create(d64_format format, const char *disk_name, const char *disk_id, d64_image **image);
+D64_EXPORT void d64_image_destroy(d64_image *image);
+
+/* the image is left as it was if a file cannot be added */
+D64_EXPORT d64_status d64_image_add_file(d64_image *image, const char *name, const uint8_t *data, size_t length);
+/* reads from the current position of fd to its end, fd is left open */
+D64_EXPORT d64_status d64_image_add_file_fd(d64_image *image, const char *name, int fd);
+
+D64_EXPORT d64_status d64_image_get_number_of_files(const d64_image *image, uint16_t *number_of_files);
+
+/* copies the image file into buffer. *length receives the size of the image, D64_BUFFER_TOO_SMALL if
+   it exceeds capacity. buffer may be NULL with capacity 0 to ask for the size, which does not build the
+   image. */
+D64_EXPORT d64_status d64_image_get_bytes(const d64_image *image, uint8_t *buffer, size_t capacity, size_t *length);
+D64_EXPORT d64_status d64_image_save(const d64_image *image, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
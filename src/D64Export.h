@@ -0,0 +1,14 @@
+#ifndef D64_EXPORT_H
+#define D64_EXPORT_H
+
+/*
+ * Marks the API of Image.h and D64Api.h. The library is compiled with hidden visibility, so a shared
+ * library exports these symbols only. Included from C as well.
+ */
+#if defined(__GNUC__)
+#define D64_EXPORT __attribute__((visibility("default")))
+#else
+#define D64_EXPORT
+#endif
+
+#endif
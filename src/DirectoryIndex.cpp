@@ -0,0 +1,162 @@
+#include "DirectoryIndex.h"
+#include "BitOps.h"
+
+#include <algorithm>
+
+using namespace d64;
+
+DirectoryName d64::makeD64FileName(std::string const &origFileName)
+{
+    DirectoryName ret;
+    ret.fill(0xa0);
+
+    for (size_t idx = 0; idx < std::min(origFileName.length(), static_cast<size_t>(ret.size())); idx++)
+    {
+        uint8_t ch = origFileName[idx];
+        if ((ch >= '0' && ch <= '9') || (ch >= 'A'  && ch <= 'Z') || (ch == '_') || (ch == '.'))
+        {
+            ret[idx] = ch;
+        }
+        else if (ch >= 'a'  && ch <= 'z')
+        {
+            // toUpper
+            ret[idx] = static_cast<uint8_t>((ch - 'a') + 'A');
+        }
+        else
+        {
+            ret[idx] = '_';
+        }
+    }
+
+    return ret;
+}
+
+template <uint16_t MaxEntries>
+void BasicDirectoryIndex<MaxEntries>::clear()
+{
+    numUsedSlots = 0;
+    numRemovedBuckets = 0;
+    buckets.fill(EMPTY);
+
+    for (uint16_t wordIdx = 0; wordIdx < NUM_SLOT_WORDS; wordIdx++)
+    {
+        uint16_t slotsInWord = (wordIdx + 1 < NUM_SLOT_WORDS) ? 64 : MAX_ENTRIES - wordIdx * 64;
+        freeSlots[wordIdx] = (slotsInWord == 64) ? ~0ull : ((1ull << slotsInWord) - 1);
+    }
+}
+
+template <uint16_t MaxEntries>
+uint16_t BasicDirectoryIndex<MaxEntries>::getFirstFreeSlot() const
+{
+    for (uint16_t wordIdx = 0; wordIdx < NUM_SLOT_WORDS; wordIdx++)
+    {
+        if (freeSlots[wordIdx])
+        {
+            return wordIdx * 64 + lowestSetBit(freeSlots[wordIdx]);
+        }
+    }
+
+    return INVALID;
+}
+
+template <uint16_t MaxEntries>
+uint16_t BasicDirectoryIndex<MaxEntries>::hash(Name const &name)
+{
+    // FNV-1a
+    uint32_t ret = 2166136261u;
+    for (uint8_t ch : name)
+    {
+        ret = (ret ^ ch) * 16777619u;
+    }
+
+    return static_cast<uint16_t>((ret ^ (ret >> 16)) & (HASH_TABLE_SIZE - 1));
+}
+
+template <uint16_t MaxEntries>
+uint16_t BasicDirectoryIndex<MaxEntries>::find(Name const &name) const
+{
+    // linear probing, the table is never more than 75% full with used and removed buckets
+    for (uint16_t bucketIdx = hash(name); buckets[bucketIdx] != EMPTY; bucketIdx = (bucketIdx + 1) & (HASH_TABLE_SIZE - 1))
+    {
+        if (buckets[bucketIdx] != REMOVED)
+        {
+            uint16_t slot = buckets[bucketIdx] - 1;
+            if (names[slot] == name)
+            {
+                return slot;
+            }
+        }
+    }
+
+    return INVALID;
+}
+
+template <uint16_t MaxEntries>
+void BasicDirectoryIndex<MaxEntries>::add(uint16_t slot, Name const &name)
+{
+    // only an add can fill an EMPTY bucket, so the 75% are checked here; removes leave the count as it is
+    if (numUsedSlots + numRemovedBuckets + 1 > (HASH_TABLE_SIZE * 3) / 4)
+    {
+        rehash();
+    }
+
+    uint16_t bucketIdx = hash(name);
+    while ((buckets[bucketIdx] != EMPTY) && (buckets[bucketIdx] != REMOVED))
+    {
+        bucketIdx = (bucketIdx + 1) & (HASH_TABLE_SIZE - 1);
+    }
+
+    if (buckets[bucketIdx] == REMOVED)
+    {
+        --numRemovedBuckets;
+    }
+
+    buckets[bucketIdx] = static_cast<Bucket>(slot + 1);
+    names[slot] = name;
+    freeSlots[slot / 64] &= ~(1ull << (slot % 64));
+    ++numUsedSlots;
+}
+
+template <uint16_t MaxEntries>
+void BasicDirectoryIndex<MaxEntries>::remove(uint16_t slot)
+{
+    for (uint16_t bucketIdx = hash(names[slot]); buckets[bucketIdx] != EMPTY; bucketIdx = (bucketIdx + 1) & (HASH_TABLE_SIZE - 1))
+    {
+        if (buckets[bucketIdx] == slot + 1)
+        {
+            buckets[bucketIdx] = REMOVED;
+            freeSlots[slot / 64] |= (1ull << (slot % 64));
+            --numUsedSlots;
+            ++numRemovedBuckets;
+            break;
+        }
+    }
+}
+
+template <uint16_t MaxEntries>
+void BasicDirectoryIndex<MaxEntries>::rehash()
+{
+    buckets.fill(EMPTY);
+    numRemovedBuckets = 0;
+
+    for (uint16_t slot = 0; slot < MAX_ENTRIES; slot++)
+    {
+        if ((freeSlots[slot / 64] & (1ull << (slot % 64))) == 0)
+        {
+            uint16_t bucketIdx = hash(names[slot]);
+            while (buckets[bucketIdx] != EMPTY)
+            {
+                bucketIdx = (bucketIdx + 1) & (HASH_TABLE_SIZE - 1);
+            }
+            buckets[bucketIdx] = static_cast<Bucket>(slot + 1);
+        }
+    }
+}
+
+namespace d64
+{
+
+template class BasicDirectoryIndex<144>;
+template class BasicDirectoryIndex<296>;
+
+}
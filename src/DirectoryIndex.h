@@ -0,0 +1,72 @@
+#ifndef DIRECTORY_INDEX_H
+#define DIRECTORY_INDEX_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace d64
+{
+
+// file or disk name as in a directory entry resp. the header, padded with 0xa0
+using DirectoryName = std::array<uint8_t, 16>;
+
+// name of a host file in the directory: the first 16 characters in upper case,
+// characters other than 0-9, A-Z, '_' and '.' are replaced with '_'
+DirectoryName makeD64FileName(std::string const &origFileName);
+
+// In-memory index over the directory entries of an image. Keeps which slots are taken
+// and a hash table over the padded 16 byte file names, so finding a free slot or a
+// file by name does not scan the directory sectors.
+template <uint16_t MaxEntries>
+class BasicDirectoryIndex
+{
+public:
+    static constexpr uint16_t MAX_ENTRIES = MaxEntries;
+    static constexpr uint16_t NAME_LEN = 16;
+    static constexpr uint16_t INVALID = 65535;
+
+    using Name = DirectoryName;
+
+    BasicDirectoryIndex() { clear(); }
+
+    void clear();
+
+    // lowest free slot, INVALID if the directory is full
+    uint16_t getFirstFreeSlot() const;
+    uint16_t getNumberOfUsedSlots() const { return numUsedSlots; }
+
+    // slot of the entry with the given name, INVALID if there is none
+    uint16_t find(Name const &name) const;
+    // claims a slot for a name which is not in the index yet
+    void add(uint16_t slot, Name const &name);
+    // frees the slot of an entry
+    void remove(uint16_t slot);
+
+private:
+    // power of two, with room for a third more than MAX_ENTRIES
+    static constexpr uint16_t HASH_TABLE_SIZE = (MAX_ENTRIES < 192) ? 256 : 512;
+    static constexpr uint16_t NUM_SLOT_WORDS = (MAX_ENTRIES + 63) / 64;
+
+    // a bucket holds slot + 1, one byte is enough for the directory of a D64
+    using Bucket = std::conditional_t<(MAX_ENTRIES < 255), uint8_t, uint16_t>;
+    static constexpr Bucket EMPTY = 0;
+    static constexpr Bucket REMOVED = static_cast<Bucket>(~Bucket(0)); // keeps probe sequences through removed entries intact
+
+    static uint16_t hash(Name const &name);
+    void rehash();
+
+    std::array<Name, MAX_ENTRIES> names;
+    std::array<uint64_t, NUM_SLOT_WORDS> freeSlots; // bit set == slot free
+    std::array<Bucket, HASH_TABLE_SIZE> buckets; // slot + 1, EMPTY or REMOVED
+    uint16_t numUsedSlots;
+    uint16_t numRemovedBuckets;
+};
+
+// 18 sectors on the directory track of a D64, 8 entries each
+using DirectoryIndex = BasicDirectoryIndex<144>;
+
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef DISK_GEOMETRY_H
+#define DISK_GEOMETRY_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "TrackSector.h"
+
+namespace d64
+{
+
+// the layout of sectors and directory entries, the same in all formats
+struct SectorLayout
+{
+    static constexpr uint16_t BYTES_PER_SECTOR = 256;
+    static constexpr uint16_t DATA_BYTES_PER_SECTOR = 254; // the first two bytes link to the next sector
+    static constexpr uint8_t DIR_ENTRIES_PER_SECTOR = 8;
+    static constexpr uint16_t BYTES_PER_DIR_ENTRY = 32;
+};
+
+// byte within a sector
+struct SectorField
+{
+    TrackSector ts;
+    uint8_t offset;
+};
+
+// where the BAM keeps the free sector count and the free sector bitmap of a track
+struct BamLocation
+{
+    SectorField count;
+    SectorField bits; // bit n == sector n, '1' == free, LSB of the first byte is sector 0
+};
+
+// The formats describe a disk with zero-based tracks: the sectors and the interleave per track,
+// where the BAM keeps which sectors are free, the header fields and the directory sectors.
+// format() fills in the constant bytes of the system sectors of a blank disk, the BAM track
+// entries, disk name and ID are done by the Writer.
+
+// 1541, 35 tracks
+struct D64Format
+{
+    static constexpr uint8_t NUM_TRACKS = 35;
+    static constexpr uint16_t NUM_SECTORS = 683;
+    static constexpr uint8_t MAX_SECTORS_ON_TRACK = 21;
+
+    static constexpr uint8_t getSectorsInZone(uint8_t track) { return detail::D64Zones::getSectorsInZone(track); }
+    static constexpr uint8_t getInterleaveInZone(uint8_t track) { return detail::D64Zones::getInterleaveInZone(track); }
+
+    static constexpr uint8_t DIRECTORY_TRACK = 17;
+    // tracks which are not handed out for files and not counted as free
+    static constexpr bool isReservedTrack(uint8_t track) { return track == DIRECTORY_TRACK; }
+    // position of the head for a track
+    static constexpr uint8_t getCylinder(uint8_t track) { return track; }
+
+    static constexpr TrackSector HEADER_SECTOR = {DIRECTORY_TRACK, 0};
+    static constexpr TrackSector BAM_SECTOR = {DIRECTORY_TRACK, 0};
+    static constexpr uint8_t DISK_NAME_OFFSET = 0x90; // in the header sector
+    static constexpr std::array<SectorField, 1> DISK_ID_FIELDS = {{ {HEADER_SECTOR, 0xa2} }};
+    static constexpr std::array<TrackSector, 1> SYSTEM_SECTORS = {{ BAM_SECTOR }};
+    static constexpr bool isAllocatedOnFormat(TrackSector ts) { return ts == BAM_SECTOR; }
+
+    static constexpr uint8_t BAM_BITMAP_BYTES = 3;
+    static constexpr BamLocation getBamLocation(uint8_t track)
+    {
+        return BamLocation{ {BAM_SECTOR, static_cast<uint8_t>(4 + track * 4)}, {BAM_SECTOR, static_cast<uint8_t>(5 + track * 4)} };
+    }
+
+    // sectors 1..18 of the directory track. Like 1541 DOS, the chain uses an interleave of 3:
+    // 1, 4, 7, .., 16, 2, 5, .., 17, 3, 6, .., 18
+    static constexpr uint8_t NUM_DIR_SECTORS = 18;
+    static constexpr uint8_t getDirSectorOnTrack(uint8_t n) { return 1 + ((n * 3) % NUM_DIR_SECTORS) + ((n * 3) / NUM_DIR_SECTORS); }
+
+    template <typename GetSector>
+    static void format(GetSector getSector)
+    {
+        uint8_t *pBAM = getSector(BAM_SECTOR);
+        pBAM[0] = DIRECTORY_TRACK + 1;
+        pBAM[1] = 0x01; // is ignored, next sector is sector #3
+        pBAM[2] = 0x41; // DOS version type
+        pBAM[3] = 0x00; // unused
+
+        for (uint8_t offset = 0x90; offset < 0xab; offset++)
+        {
+            pBAM[offset] = 0xa0; // Disk Name, Disk ID, DOS Type and their padding
+        }
+        pBAM[0xa5] = 0x32; // DOS Type "2A"
+        pBAM[0xa6] = 0x41;
+    }
+};
+
+// 1541 with 40 tracks, the BAM of tracks 36..40 as written by SpeedDOS
+struct D64ExtendedFormat : D64Format
+{
+    static constexpr uint8_t NUM_TRACKS = 40;
+    static constexpr uint16_t NUM_SECTORS = 768;
+
+    static constexpr BamLocation getBamLocation(uint8_t track)
+    {
+        return (track < 35) ? D64Format::getBamLocation(track) :
+            BamLocation{ {BAM_SECTOR, static_cast<uint8_t>(0xc0 + (track - 35) * 4)}, {BAM_SECTOR, static_cast<uint8_t>(0xc1 + (track - 35) * 4)} };
+    }
+};
+
+// 1571, double sided: the second side repeats the zones of the first one on tracks 36..70.
+// The BAM of the second side is split: free counts at the end of the BAM sector, the bitmaps on
+// sector 0 of track 53. Track 53 is not used for files.
+struct D71Format : D64Format
+{
+    static constexpr uint8_t NUM_TRACKS = 70;
+    static constexpr uint16_t NUM_SECTORS = 1366;
+    static constexpr uint8_t SIDE_2_BAM_TRACK = 52;
+
+    static constexpr uint8_t getSectorsInZone(uint8_t track) { return D64Format::getSectorsInZone(track % 35); }
+    static constexpr uint8_t getInterleaveInZone(uint8_t track) { return D64Format::getInterleaveInZone(track % 35); }
+
+    static constexpr bool isReservedTrack(uint8_t track) { return (track == DIRECTORY_TRACK) || (track == SIDE_2_BAM_TRACK); }
+    // the second head reads the tracks of the second side
+    static constexpr uint8_t getCylinder(uint8_t track) { return track % 35; }
+
+    static constexpr TrackSector SIDE_2_BAM_SECTOR = {SIDE_2_BAM_TRACK, 0};
+    static constexpr std::array<TrackSector, 2> SYSTEM_SECTORS = {{ BAM_SECTOR, SIDE_2_BAM_SECTOR }};
+    static constexpr bool isAllocatedOnFormat(TrackSector ts) { return (ts == BAM_SECTOR) || (ts.track == SIDE_2_BAM_TRACK); }
+
+    static constexpr BamLocation getBamLocation(uint8_t track)
+    {
+        return (track < 35) ? D64Format::getBamLocation(track) :
+            BamLocation{ {BAM_SECTOR, static_cast<uint8_t>(0xdd + (track - 35))}, {SIDE_2_BAM_SECTOR, static_cast<uint8_t>((track - 35) * 3)} };
+    }
+
+    template <typename GetSector>
+    static void format(GetSector getSector)
+    {
+        D64Format::format(getSector);
+        getSector(BAM_SECTOR)[3] = 0x80; // double sided
+    }
+};
+
+// 1581, 80 tracks of 40 sectors. Track 40 holds the header, two BAM sectors for tracks 1..40
+// and 41..80, and the directory from sector 3 on.
+struct D81Format
+{
+    static constexpr uint8_t NUM_TRACKS = 80;
+    static constexpr uint16_t NUM_SECTORS = 3200;
+    static constexpr uint8_t MAX_SECTORS_ON_TRACK = 40;
+
+    static constexpr uint8_t getSectorsInZone(uint8_t) { return 40; }
+    static constexpr uint8_t getInterleaveInZone(uint8_t) { return 1; }
+
+    static constexpr uint8_t DIRECTORY_TRACK = 39;
+    static constexpr bool isReservedTrack(uint8_t track) { return track == DIRECTORY_TRACK; }
+    // a track covers both sides of a cylinder
+    static constexpr uint8_t getCylinder(uint8_t track) { return track; }
+
+    static constexpr TrackSector HEADER_SECTOR = {DIRECTORY_TRACK, 0};
+    static constexpr TrackSector BAM_SECTOR = {DIRECTORY_TRACK, 1};
+    static constexpr TrackSector BAM_SECTOR_2 = {DIRECTORY_TRACK, 2};
+    static constexpr uint8_t DISK_NAME_OFFSET = 0x04;
+    static constexpr std::array<SectorField, 3> DISK_ID_FIELDS = {{ {HEADER_SECTOR, 0x16}, {BAM_SECTOR, 0x04}, {BAM_SECTOR_2, 0x04} }};
+    static constexpr std::array<TrackSector, 3> SYSTEM_SECTORS = {{ HEADER_SECTOR, BAM_SECTOR, BAM_SECTOR_2 }};
+    static constexpr bool isAllocatedOnFormat(TrackSector ts) { return (ts.track == DIRECTORY_TRACK) && (ts.sector < 3); }
+
+    static constexpr uint8_t BAM_BITMAP_BYTES = 5;
+    static constexpr BamLocation getBamLocation(uint8_t track)
+    {
+        TrackSector bamSector = (track < 40) ? BAM_SECTOR : BAM_SECTOR_2;
+        uint8_t offset = static_cast<uint8_t>(0x10 + (track % 40) * 6);
+        return BamLocation{ {bamSector, offset}, {bamSector, static_cast<uint8_t>(offset + 1)} };
+    }
+
+    // sectors 3..39, one after the other
+    static constexpr uint8_t NUM_DIR_SECTORS = 37;
+    static constexpr uint8_t getDirSectorOnTrack(uint8_t n) { return 3 + n; }
+
+    template <typename GetSector>
+    static void format(GetSector getSector)
+    {
+        uint8_t *pHeader = getSector(HEADER_SECTOR);
+        pHeader[0] = DIRECTORY_TRACK + 1; // first directory sector
+        pHeader[1] = getDirSectorOnTrack(0);
+        pHeader[2] = 0x44; // DOS version 'D'
+        for (uint8_t offset = 0x04; offset < 0x1d; offset++)
+        {
+            pHeader[offset] = 0xa0; // Disk Name, Disk ID, DOS Type and their padding
+        }
+        pHeader[0x19] = 0x33; // DOS Type "3D"
+        pHeader[0x1a] = 0x44;
+
+        for (TrackSector bamSector : {BAM_SECTOR, BAM_SECTOR_2})
+        {
+            uint8_t *pBAM = getSector(bamSector);
+            bool isFirst = (bamSector == BAM_SECTOR);
+            pBAM[0] = isFirst ? DIRECTORY_TRACK + 1 : 0x00; // the second BAM sector ends the chain
+            pBAM[1] = isFirst ? BAM_SECTOR_2.sector : 0xff;
+            pBAM[2] = 0x44; // DOS version 'D' and its complement
+            pBAM[3] = 0xbb;
+            pBAM[6] = 0xc0; // I/O byte: verify on, check header CRC
+        }
+    }
+};
+
+// Compile-time geometry of a format: sector index conversions through lookup tables, and the
+// BAM locations and system sectors as sector indices.
+template <typename Format>
+struct DiskGeometry : Format
+{
+    using Format::NUM_TRACKS;
+    using Format::NUM_SECTORS;
+    using Format::DIRECTORY_TRACK;
+
+    static constexpr detail::GeometryTables<NUM_SECTORS> TABLES = detail::makeGeometryTables<Format>();
+
+    // return TrackSector::INVALID resp. {255, 255} for positions outside the image
+    static constexpr uint16_t getSectorIdx(TrackSector ts)
+    {
+        return (ts.sector < TABLES.sectorsOnTrack[ts.track]) ? TABLES.firstSectorIdx[ts.track] + ts.sector : TrackSector::INVALID;
+    }
+
+    static constexpr TrackSector getTrackAndSector(uint16_t sectorIdx)
+    {
+        return (sectorIdx < NUM_SECTORS) ? TABLES.trackAndSector[sectorIdx] : TrackSector{255, 255};
+    }
+
+    // return 0 for tracks outside the image
+    static constexpr uint8_t getSectorsOnTrack(uint8_t track) { return TABLES.sectorsOnTrack[track]; }
+    static constexpr uint8_t getInterleaveOnTrack(uint8_t track) { return TABLES.interleaveOnTrack[track]; }
+
+    static constexpr uint16_t HEADER_SECTOR_IDX = getSectorIdx(Format::HEADER_SECTOR);
+    static constexpr uint16_t BAM_SECTOR_IDX = getSectorIdx(Format::BAM_SECTOR);
+    static constexpr uint16_t FIRST_DIR_SECTOR_IDX = getSectorIdx(TrackSector{DIRECTORY_TRACK, Format::getDirSectorOnTrack(0)});
+    static constexpr uint16_t MAX_DIR_ENTRIES = Format::NUM_DIR_SECTORS * 8;
+
+    // BAM track entry as sector indices
+    struct BamEntry
+    {
+        uint16_t countSectorIdx;
+        uint8_t countOffset;
+        uint16_t bitsSectorIdx;
+        uint8_t bitsOffset;
+    };
+
+    static constexpr std::array<BamEntry, NUM_TRACKS> makeBamEntries()
+    {
+        std::array<BamEntry, NUM_TRACKS> ret{};
+        for (uint8_t track = 0; track < NUM_TRACKS; track++)
+        {
+            BamLocation location = Format::getBamLocation(track);
+            ret[track] = BamEntry{getSectorIdx(location.count.ts), location.count.offset, getSectorIdx(location.bits.ts), location.bits.offset};
+        }
+        return ret;
+    }
+
+    static constexpr std::array<BamEntry, NUM_TRACKS> BAM_ENTRIES = makeBamEntries();
+    static constexpr BamEntry const &getBamEntry(uint8_t track) { return BAM_ENTRIES[track]; }
+
+    // true if the free count and the bitmap of some track are in different sectors
+    static constexpr bool hasSplitBamEntries()
+    {
+        for (BamEntry const &entry : BAM_ENTRIES)
+        {
+            if (entry.countSectorIdx != entry.bitsSectorIdx)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static constexpr std::array<uint16_t, Format::SYSTEM_SECTORS.size()> makeSystemSectorIndices()
+    {
+        std::array<uint16_t, Format::SYSTEM_SECTORS.size()> ret{};
+        for (size_t idx = 0; idx < ret.size(); idx++)
+        {
+            ret[idx] = getSectorIdx(Format::SYSTEM_SECTORS[idx]);
+        }
+        return ret;
+    }
+
+    static constexpr std::array<uint16_t, Format::SYSTEM_SECTORS.size()> SYSTEM_SECTOR_INDICES = makeSystemSectorIndices();
+
+    static_assert(TABLES.firstSectorIdx[NUM_TRACKS] == NUM_SECTORS, "zone table does not cover the image");
+    static_assert(Format::BAM_BITMAP_BYTES * 8 >= Format::MAX_SECTORS_ON_TRACK, "BAM bitmap does not cover the track");
+    static_assert(MAX_DIR_ENTRIES <= 296, "directory is larger than any supported format");
+};
+
+using D64Geometry = DiskGeometry<D64Format>;
+using D64ExtendedGeometry = DiskGeometry<D64ExtendedFormat>;
+using D71Geometry = DiskGeometry<D71Format>;
+using D81Geometry = DiskGeometry<D81Format>;
+
+static_assert(D64Geometry::BAM_SECTOR_IDX == 357, "BAM sector has moved");
+static_assert(D64Geometry::getTrackAndSector(682) == TrackSector{34, 16}, "last sector has moved");
+static_assert(D64ExtendedGeometry::getTrackAndSector(767) == TrackSector{39, 16}, "last sector of the 40 track image has moved");
+static_assert(D71Geometry::getSectorIdx(TrackSector{35, 0}) == 683, "second side does not follow the first one");
+static_assert(D71Geometry::getSectorIdx(D71Format::SIDE_2_BAM_SECTOR) == 1040, "BAM of the second side has moved");
+static_assert(D81Geometry::HEADER_SECTOR_IDX == 1560, "header of the 1581 has moved");
+static_assert(D81Geometry::FIRST_DIR_SECTOR_IDX == 1563, "directory of the 1581 has moved");
+
+}
+
+#endif
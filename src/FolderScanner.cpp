@@ -0,0 +1,103 @@
+#include "FolderScanner.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Stats.h"
+
+using namespace d64;
+using namespace std;
+
+FolderScanner::FolderScanner(std::string const &srcPath, unsigned numReaders, size_t depth) :
+    srcPath(srcPath), pDIR(opendir(srcPath.c_str()), closedir), pending(depth), requests(depth), stopped(false)
+{
+    if (pDIR == nullptr)
+    {
+        pending.close();
+        return;
+    }
+
+    scanner = std::thread(&FolderScanner::scan, this);
+    for (unsigned readerIdx = 0; readerIdx < std::max(1u, numReaders); readerIdx++)
+    {
+        readers.emplace_back(&FolderScanner::read, this);
+    }
+}
+
+FolderScanner::~FolderScanner()
+{
+    stopped = true;
+    pending.close();
+    requests.close();
+
+    if (scanner.joinable())
+    {
+        scanner.join();
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+}
+
+void FolderScanner::scan()
+{
+    for (;;)
+    {
+        struct dirent *dp = nullptr;
+        {
+            D64_STATS_TIMER(SCAN);
+            dp = readdir(pDIR.get());
+        }
+        if (dp == nullptr)
+        {
+            break;
+        }
+        if (!ProgFile::hasProgSuffix(dp->d_name))
+        {
+            if ((strcmp(dp->d_name, ".") != 0) && (strcmp(dp->d_name, "..") != 0))
+            {
+                D64_STATS_ADD(SKIPPED_NOT_PRG, 1);
+            }
+            continue;
+        }
+
+        // the place in the order first, then the work for the readers
+        std::promise<ProgFile> content;
+        if (!pending.push(Pending(dp->d_name, content.get_future())) ||
+            !requests.push(Request(srcPath + "/" + dp->d_name, std::move(content))))
+        {
+            break;
+        }
+    }
+
+    pending.close();
+    requests.close();
+}
+
+void FolderScanner::read()
+{
+    Request request;
+    while (requests.pop(request))
+    {
+        // nobody waits for the files anymore once the scanner is stopped
+        if (!stopped)
+        {
+            D64_STATS_TIMER(READ);
+            request.second.set_value(ProgFile(request.first, true));
+        }
+    }
+}
+
+bool FolderScanner::next(std::string &fileName, ProgFile &progFile)
+{
+    Pending file;
+    if (!pending.pop(file))
+    {
+        return false;
+    }
+
+    fileName = file.first;
+    progFile = file.second.get();
+    return true;
+}
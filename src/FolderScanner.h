@@ -0,0 +1,62 @@
+#ifndef FOLDER_SCANNER_H
+#define FOLDER_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <utility>
+
+#include <dirent.h>
+
+#include "ProgFile.h"
+#include "BoundedQueue.h"
+
+namespace d64
+{
+
+// Reads the '.prg' files of a folder ahead of the stage which uses them, so the latency of slow
+// or cold file systems overlaps with the work on the files. A pipeline of three stages connected
+// by bounded queues: a thread enumerates the directory, a small pool of reader threads maps the
+// files and reads them in, and next() hands them out in directory order, the same order as
+// readdir() gives. At most depth files are on their way at a time.
+class FolderScanner
+{
+public:
+    static constexpr unsigned DEFAULT_NUM_READERS = 2;
+    static constexpr size_t DEFAULT_DEPTH = 16;
+
+    explicit FolderScanner(std::string const &srcPath, unsigned numReaders = DEFAULT_NUM_READERS, size_t depth = DEFAULT_DEPTH);
+    // stops the stages, the files which have not been taken are dropped
+    ~FolderScanner();
+
+    FolderScanner(FolderScanner const &) = delete;
+    FolderScanner &operator = (FolderScanner const &) = delete;
+
+    // false if the folder cannot be read, next() returns nothing then
+    bool isOpen() const { return pDIR != nullptr; }
+
+    // the next '.prg' file, false after the last one. The status of the file tells whether it could be read.
+    bool next(std::string &fileName, ProgFile &progFile);
+
+private:
+    using Pending = std::pair<std::string, std::future<ProgFile>>; // name and content in directory order
+    using Request = std::pair<std::string, std::promise<ProgFile>>; // path to read
+
+    void scan();
+    void read();
+
+    std::string srcPath;
+    std::unique_ptr<DIR, int (*)(DIR *)> pDIR;
+    BoundedQueue<Pending> pending;
+    BoundedQueue<Request> requests;
+    std::atomic<bool> stopped;
+    std::thread scanner;
+    std::vector<std::thread> readers;
+};
+
+}
+
+#endif
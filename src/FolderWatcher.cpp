@@ -0,0 +1,274 @@
+#include "FolderWatcher.h"
+#include "ProgFile.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring> // strerror
+
+// Linux API to watch the folder
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstdio> // std::rename
+#include <cstdlib> // mkstemp
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+constexpr uint32_t WATCHED_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// true if the descriptor becomes readable within timeoutMs
+bool waitForEvents(int fd, int timeoutMs)
+{
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ret = 0;
+    while (((ret = ::poll(&pfd, 1, timeoutMs)) < 0) && (errno == EINTR))
+    {
+    }
+    return ret > 0;
+}
+
+uint32_t getMicrosSince(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+}
+
+template <typename Geometry>
+BasicFolderWatcher<Geometry>::BasicFolderWatcher(std::string const &srcPath, std::string const &imagePath, std::ostream &err, int debounceMs) :
+    srcPath(srcPath), imagePath(imagePath), err(err), debounceMs(debounceMs), inotifyFd(-1), isRebuildPending(false),
+    numChangedFiles(0), updateMicros(0)
+{
+}
+
+template <typename Geometry>
+BasicFolderWatcher<Geometry>::~BasicFolderWatcher()
+{
+    if (inotifyFd >= 0)
+    {
+        ::close(inotifyFd);
+    }
+}
+
+template <typename Geometry>
+bool BasicFolderWatcher<Geometry>::start()
+{
+    // watch before building, so no change gets lost in between
+    inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((inotifyFd < 0) || (::inotify_add_watch(inotifyFd, srcPath.c_str(), WATCHED_EVENTS) < 0))
+    {
+        err << "Could not watch folder " << srcPath << ": " << std::strerror(errno) << "." << std::endl;
+        return false;
+    }
+
+    // the writer takes up ~175KB for a D64 and more for the larger formats, keep it off the stack
+    pWriter.reset(new Writer(getDirName(srcPath)));
+    return replaceImage(true);
+}
+
+template <typename Geometry>
+bool BasicFolderWatcher<Geometry>::readEvents(std::set<std::string> &changedFiles)
+{
+    alignas(inotify_event) char buf[16 * 1024];
+
+    while (true)
+    {
+        ssize_t length = ::read(inotifyFd, buf, sizeof(buf));
+        if (length <= 0)
+        {
+            // EAGAIN: all events are read
+            return (length < 0) && ((errno == EAGAIN) || (errno == EINTR));
+        }
+
+        for (char const *pBuf = buf; pBuf < buf + length; )
+        {
+            inotify_event const *pEvent = reinterpret_cast<inotify_event const *>(pBuf);
+            pBuf += sizeof(inotify_event) + pEvent->len;
+
+            if (pEvent->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                return false;
+            }
+            if (pEvent->mask & IN_Q_OVERFLOW)
+            {
+                // events got lost, an empty name stands for all files
+                changedFiles.insert("");
+            }
+            else if ((pEvent->len > 0) && ProgFile::hasProgSuffix(pEvent->name))
+            {
+                changedFiles.insert(pEvent->name);
+            }
+        }
+    }
+}
+
+template <typename Geometry>
+bool BasicFolderWatcher<Geometry>::applyChange(std::string const &fileName)
+{
+    std::string filePath = srcPath + "/" + fileName;
+    if (::access(filePath.c_str(), F_OK) != 0)
+    {
+        // deleted or moved away, it may not have been on the image if it could not be written
+        pWriter->deleteFile(fileName);
+        return true;
+    }
+
+    ProgFile progFile(filePath);
+    if (progFile.getStatus() == ProgFile::Status::NOT_A_REGULAR_FILE)
+    {
+        // skipped like by a build, e.g. a folder named like a '.prg' file
+        pWriter->deleteFile(fileName);
+        return true;
+    }
+    if (progFile.getStatus() != ProgFile::Status::OK)
+    {
+        err << "File " << filePath << " " << ProgFile::getStatusText(progFile.getStatus()) << "." << std::endl;
+        return false;
+    }
+    if (!pWriter->replaceFile(fileName, progFile.getData(), progFile.getLength()))
+    {
+        err << "Could not write file " << fileName << " to image." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Geometry>
+bool BasicFolderWatcher<Geometry>::replaceImage(bool rebuild)
+{
+    // readers of the image see either the old or the new one, never a partly written file. The
+    // name is unique, so watchers of the same image do not write into each other's file.
+    std::string tempPath = imagePath + ".XXXXXX";
+    int fd = ::mkstemp(&tempPath[0]);
+    if (fd < 0)
+    {
+        err << "Could not create a file next to image " << imagePath << ": " << std::strerror(errno) << "." << std::endl;
+        return false;
+    }
+    // the image keeps its permissions, mkstemp() grants the owner only
+    struct stat st;
+    ::fchmod(fd, (::stat(imagePath.c_str(), &st) == 0) ? (st.st_mode & 07777) : 0644);
+    ::close(fd);
+
+    if (rebuild ? !buildImage(srcPath, tempPath, *pWriter, err) : !saveImage(*pWriter, tempPath, err, ImageFormat::D64))
+    {
+        ::unlink(tempPath.c_str());
+        return false;
+    }
+    if (std::rename(tempPath.c_str(), imagePath.c_str()) != 0)
+    {
+        err << "Could not replace image " << imagePath << ": " << std::strerror(errno) << "." << std::endl;
+        ::unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+template <typename Geometry>
+typename BasicFolderWatcher<Geometry>::Result BasicFolderWatcher<Geometry>::update(int timeoutMs)
+{
+    if (!waitForEvents(inotifyFd, timeoutMs))
+    {
+        return Result::IDLE;
+    }
+
+    // collect events until the folder has been quiet for the debounce time
+    std::set<std::string> changedFiles;
+    do
+    {
+        if (!readEvents(changedFiles))
+        {
+            err << "Folder " << srcPath << " has gone away." << std::endl;
+            return Result::FAILED;
+        }
+    } while (waitForEvents(inotifyFd, debounceMs));
+
+    if (changedFiles.empty())
+    {
+        return Result::IDLE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (isRebuildPending || (changedFiles.count("") > 0))
+    {
+        // lost events, start over from the folder. Until that succeeds, every change rebuilds.
+        pWriter->reset(getDirName(srcPath));
+        isRebuildPending = !replaceImage(true);
+        numChangedFiles = pWriter->getNumberOfFiles();
+        updateMicros = getMicrosSince(start);
+        return isRebuildPending ? Result::NOT_UPDATED : Result::UPDATED;
+    }
+
+    // deleted files first, the others may take their sectors
+    for (auto const &fileName : changedFiles)
+    {
+        if (::access((srcPath + "/" + fileName).c_str(), F_OK) != 0)
+        {
+            applyChange(fileName);
+        }
+    }
+    for (auto const &fileName : changedFiles)
+    {
+        if (::access((srcPath + "/" + fileName).c_str(), F_OK) == 0)
+        {
+            applyChange(fileName);
+        }
+    }
+
+    bool success = replaceImage(false);
+    numChangedFiles = static_cast<uint32_t>(changedFiles.size());
+    updateMicros = getMicrosSince(start);
+    return success ? Result::UPDATED : Result::NOT_UPDATED;
+}
+
+template <typename Geometry>
+static bool watchFolderAs(std::string const &srcPath, std::string const &imagePath, std::ostream &out, std::ostream &err)
+{
+    BasicFolderWatcher<Geometry> watcher(srcPath, imagePath, err);
+    if (!watcher.start())
+    {
+        return false;
+    }
+
+    out << "Watching " << srcPath << ", image " << imagePath << " is up to date." << std::endl;
+    typename BasicFolderWatcher<Geometry>::Result result;
+    // failed updates are reported on err and leave the image as it was, only a folder which is gone ends the watch
+    while ((result = watcher.update()) != BasicFolderWatcher<Geometry>::Result::FAILED)
+    {
+        if (result == BasicFolderWatcher<Geometry>::Result::UPDATED)
+        {
+            out << "Updated " << imagePath << ": " << watcher.getNumberOfChangedFiles() << " file(s) in "
+                << watcher.getUpdateMicros() << " us." << std::endl;
+        }
+    }
+    return false;
+}
+
+bool d64::watchFolder(std::string const &srcPath, std::string const &imagePath, std::ostream &out, std::ostream &err, ImageFormat format)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return watchFolderAs<D64ExtendedGeometry>(srcPath, imagePath, out, err);
+        case ImageFormat::D71: return watchFolderAs<D71Geometry>(srcPath, imagePath, out, err);
+        case ImageFormat::D81: return watchFolderAs<D81Geometry>(srcPath, imagePath, out, err);
+        case ImageFormat::G64:
+            err << "G64 images cannot be updated." << std::endl;
+            return false;
+        default: return watchFolderAs<D64Geometry>(srcPath, imagePath, out, err);
+    }
+}
+
+namespace d64
+{
+
+template class BasicFolderWatcher<D64Geometry>;
+template class BasicFolderWatcher<D64ExtendedGeometry>;
+template class BasicFolderWatcher<D71Geometry>;
+template class BasicFolderWatcher<D81Geometry>;
+
+}
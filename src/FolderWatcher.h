@@ -0,0 +1,82 @@
+#ifndef FOLDER_WATCHER_H
+#define FOLDER_WATCHER_H
+
+#include <string>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <cstdint>
+
+#include "Writer.h"
+#include "ImageBuilder.h"
+
+namespace d64
+{
+
+// Keeps the image of a folder up to date while its '.prg' files change. The image is built once,
+// then the Writer stays in memory and inotify reports which files have been written, moved or
+// deleted. Changes arriving in quick succession are collected until the folder has been quiet for
+// the debounce time, then only the affected files are replaced resp. deleted in the Writer and the
+// image file is replaced in one step by renaming a new file over it. An update which fails is
+// reported and leaves the image file as it was, the watcher goes on. Linux only.
+template <typename Geometry>
+class BasicFolderWatcher
+{
+public:
+    using Writer = BasicWriter<Geometry>;
+
+    enum class Result
+    {
+        IDLE, // nothing changed within the timeout
+        UPDATED,
+        NOT_UPDATED, // the image could not be rebuilt resp. written, the previous one stays
+        FAILED // the folder cannot be watched anymore
+    };
+
+    static constexpr int DEFAULT_DEBOUNCE_MS = 10;
+
+    BasicFolderWatcher(std::string const &srcPath, std::string const &imagePath, std::ostream &err,
+                       int debounceMs = DEFAULT_DEBOUNCE_MS);
+    ~BasicFolderWatcher();
+
+    BasicFolderWatcher(BasicFolderWatcher const &) = delete;
+    BasicFolderWatcher &operator = (BasicFolderWatcher const &) = delete;
+
+    // starts watching and writes the initial image, false if either fails
+    bool start();
+    // waits up to timeoutMs (-1: without limit) for changes and applies them. Files which cannot
+    // be read or do not fit are reported and keep their previous content in the image.
+    Result update(int timeoutMs = -1);
+
+    uint32_t getNumberOfChangedFiles() const { return numChangedFiles; } // by the last update
+    uint32_t getUpdateMicros() const { return updateMicros; } // time of the last update without the debounce
+
+private:
+    // collects the names of the '.prg' files of the events in the buffer, false if the folder is gone
+    bool readEvents(std::set<std::string> &changedFiles);
+    bool applyChange(std::string const &fileName);
+    // writes the Writer resp. rebuilds it from the folder into a new file next to the image and
+    // renames it over the image, false with the problem reported on err
+    bool replaceImage(bool rebuild);
+
+    std::string srcPath;
+    std::string imagePath;
+    std::ostream &err;
+    int debounceMs;
+
+    std::unique_ptr<Writer> pWriter;
+    int inotifyFd;
+    bool isRebuildPending; // the Writer is incomplete after a failed rebuild
+    uint32_t numChangedFiles;
+    uint32_t updateMicros;
+};
+
+using FolderWatcher = BasicFolderWatcher<D64Geometry>;
+
+// builds the image and keeps it up to date until the folder goes away, reports each update on out
+bool watchFolder(std::string const &srcPath, std::string const &imagePath, std::ostream &out, std::ostream &err,
+                 ImageFormat format = ImageFormat::D64);
+
+}
+
+#endif
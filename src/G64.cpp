@@ -0,0 +1,195 @@
+#include "G64.h"
+
+#include <array>
+#include <cstring> // std::memcpy, std::memset
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+constexpr uint8_t GCR_CODES[16] =
+{
+    0x0a, 0x0b, 0x12, 0x13, 0x0e, 0x0f, 0x16, 0x17,
+    0x09, 0x19, 0x1a, 0x1b, 0x0d, 0x1d, 0x1e, 0x15
+};
+
+// the 10 bit code of each byte, so a group of 4 bytes takes 4 lookups
+constexpr std::array<uint16_t, 256> makeByteCodes()
+{
+    std::array<uint16_t, 256> ret{};
+    for (unsigned byte = 0; byte < 256; byte++)
+    {
+        ret[byte] = static_cast<uint16_t>((GCR_CODES[byte >> 4] << 5) | GCR_CODES[byte & 0x0f]);
+    }
+    return ret;
+}
+
+// nibble of each 5 bit code, 0xff for the codes which are not used
+constexpr std::array<uint8_t, 32> makeNibbles()
+{
+    std::array<uint8_t, 32> ret{};
+    for (uint8_t code = 0; code < 32; code++)
+    {
+        ret[code] = 0xff;
+    }
+    for (uint8_t nibble = 0; nibble < 16; nibble++)
+    {
+        ret[GCR_CODES[nibble]] = nibble;
+    }
+    return ret;
+}
+
+constexpr std::array<uint16_t, 256> BYTE_CODES = makeByteCodes();
+constexpr std::array<uint8_t, 32> NIBBLES = makeNibbles();
+
+inline uint64_t toBigEndian(uint64_t value)
+{
+#if defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    return __builtin_bswap64(value);
+#else
+    uint64_t ret = 0;
+    uint8_t *pRet = reinterpret_cast<uint8_t *>(&ret);
+    for (int byteIdx = 0; byteIdx < 8; byteIdx++)
+    {
+        pRet[byteIdx] = static_cast<uint8_t>(value >> (56 - byteIdx * 8));
+    }
+    return ret;
+#endif
+}
+
+inline void putUint16(uint8_t *pDest, uint16_t value)
+{
+    pDest[0] = static_cast<uint8_t>(value & 0xff);
+    pDest[1] = static_cast<uint8_t>(value >> 8);
+}
+
+inline void putUint32(uint8_t *pDest, uint32_t value)
+{
+    for (int byteIdx = 0; byteIdx < 4; byteIdx++)
+    {
+        pDest[byteIdx] = static_cast<uint8_t>(value >> (byteIdx * 8));
+    }
+}
+
+// sync mark and GCR bytes of a block, returns the position behind it
+uint8_t *putBlock(uint8_t *pDest, uint8_t const *pRaw, size_t rawLength)
+{
+    std::memset(pDest, 0xff, G64Layout::SYNC_BYTES);
+    encodeGcr(pRaw, rawLength, &pDest[G64Layout::SYNC_BYTES]);
+    return &pDest[G64Layout::SYNC_BYTES + rawLength / 4 * 5];
+}
+
+}
+
+void d64::encodeGcr(uint8_t const *pSrc, size_t length, uint8_t *pDest)
+{
+    for (size_t offset = 0; offset < length; offset += 4, pSrc += 4, pDest += 5)
+    {
+        // one load, so the stores below cannot force the source bytes to be read again
+        uint8_t group[4];
+        std::memcpy(group, pSrc, sizeof(group));
+        uint64_t bits = (static_cast<uint64_t>(BYTE_CODES[group[0]]) << 30) | (static_cast<uint64_t>(BYTE_CODES[group[1]]) << 20) |
+                        (static_cast<uint64_t>(BYTE_CODES[group[2]]) << 10) | BYTE_CODES[group[3]];
+        if (offset + 4 < length)
+        {
+            // one store of 8 bytes, the 3 bytes too many are overwritten by the next group
+            uint64_t bigEndian = toBigEndian(bits << 24);
+            std::memcpy(pDest, &bigEndian, sizeof(bigEndian));
+        }
+        else
+        {
+            for (int byteIdx = 0; byteIdx < 5; byteIdx++)
+            {
+                pDest[byteIdx] = static_cast<uint8_t>(bits >> (32 - byteIdx * 8));
+            }
+        }
+    }
+}
+
+bool d64::decodeGcr(uint8_t const *pSrc, size_t length, uint8_t *pDest)
+{
+    uint8_t invalid = 0;
+    for (size_t offset = 0; offset < length; offset += 4, pSrc += 5, pDest += 4)
+    {
+        uint64_t bits = (static_cast<uint64_t>(pSrc[0]) << 32) | (static_cast<uint64_t>(pSrc[1]) << 24) |
+                        (static_cast<uint64_t>(pSrc[2]) << 16) | (static_cast<uint64_t>(pSrc[3]) << 8) | pSrc[4];
+        for (int byteIdx = 0; byteIdx < 4; byteIdx++)
+        {
+            uint8_t high = NIBBLES[(bits >> (35 - byteIdx * 10)) & 0x1f];
+            uint8_t low = NIBBLES[(bits >> (30 - byteIdx * 10)) & 0x1f];
+            invalid |= (high | low) & 0xf0;
+            pDest[byteIdx] = static_cast<uint8_t>((high << 4) | (low & 0x0f));
+        }
+    }
+    return invalid == 0;
+}
+
+template <typename Geometry>
+void d64::encodeG64(std::function<uint8_t const *(uint16_t sectorIdx)> const &getSector, std::vector<uint8_t> &image)
+{
+    static_assert(isG64Geometry<Geometry>(), "G64 images hold 1541 disks only");
+    using L = G64Layout;
+
+    image.assign(getG64Size<Geometry>(), 0x00);
+    std::memcpy(&image[0], L::SIGNATURE, L::SIGNATURE_LENGTH);
+    image[8] = 0x00; // version
+    image[9] = L::NUM_HALF_TRACKS;
+    putUint16(&image[10], L::MAX_TRACK_BYTES);
+
+    SectorField const &idField = Geometry::DISK_ID_FIELDS[0];
+    uint8_t const *pIdSector = getSector(Geometry::getSectorIdx(idField.ts));
+    uint8_t id1 = pIdSector[idField.offset];
+    uint8_t id2 = pIdSector[idField.offset + 1];
+
+    for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+    {
+        uint8_t numSectors = Geometry::getSectorsOnTrack(trackIdx);
+        uint8_t speedZone = L::getSpeedZone(numSectors);
+        uint16_t trackBytes = L::getTrackBytes(speedZone);
+        size_t trackOffset = L::FIRST_TRACK_OFFSET + trackIdx * L::BYTES_PER_TRACK_ENTRY;
+
+        // full tracks only, the half tracks in between stay empty
+        putUint32(&image[L::TRACK_OFFSETS_OFFSET + trackIdx * 2 * 4], static_cast<uint32_t>(trackOffset));
+        putUint32(&image[L::SPEED_ZONES_OFFSET + trackIdx * 2 * 4], speedZone);
+        putUint16(&image[trackOffset], trackBytes);
+
+        // the gaps between the sectors take what the blocks leave of the track, the rest goes to the end
+        uint16_t sectorBytes = 2 * L::SYNC_BYTES + L::HEADER_GCR_BYTES + L::HEADER_GAP_BYTES + L::DATA_GCR_BYTES;
+        uint16_t gapBytes = static_cast<uint16_t>((trackBytes - numSectors * sectorBytes) / numSectors);
+        uint8_t *pTrack = &image[trackOffset + 2];
+        std::memset(pTrack, L::GAP_BYTE, trackBytes);
+
+        uint8_t *pDest = pTrack;
+        uint8_t track = static_cast<uint8_t>(trackIdx + 1); // on the disk, tracks start with "1"
+        for (uint8_t sector = 0; sector < numSectors; sector++)
+        {
+            uint8_t header[8] = { L::HEADER_BLOCK_ID, static_cast<uint8_t>(sector ^ track ^ id2 ^ id1), sector, track, id2, id1, 0x0f, 0x0f };
+            pDest = putBlock(pDest, header, sizeof(header));
+            pDest += L::HEADER_GAP_BYTES;
+
+            uint8_t data[260];
+            data[0] = L::DATA_BLOCK_ID;
+            std::memcpy(&data[1], getSector(Geometry::getSectorIdx(TrackSector{trackIdx, sector})), 256);
+            uint8_t checksum = 0;
+            for (int byteIdx = 1; byteIdx <= 256; byteIdx++)
+            {
+                checksum ^= data[byteIdx];
+            }
+            data[257] = checksum;
+            data[258] = 0x00;
+            data[259] = 0x00;
+            pDest = putBlock(pDest, data, sizeof(data));
+            pDest += gapBytes;
+        }
+    }
+}
+
+namespace d64
+{
+
+template void encodeG64<D64Geometry>(std::function<uint8_t const *(uint16_t)> const &, std::vector<uint8_t> &);
+template void encodeG64<D64ExtendedGeometry>(std::function<uint8_t const *(uint16_t)> const &, std::vector<uint8_t> &);
+
+}
@@ -0,0 +1,71 @@
+#ifndef G64_H
+#define G64_H
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "DiskGeometry.h"
+
+namespace d64
+{
+
+// GCR, as the 1541 writes bytes onto the disk: each nibble becomes a 5 bit code, so 4 bytes
+// become 5. length must be a multiple of 4.
+void encodeGcr(uint8_t const *pSrc, size_t length, uint8_t *pDest);
+// the other way round, length is the one of the decoded bytes. False on a code which is not GCR.
+bool decodeGcr(uint8_t const *pSrc, size_t length, uint8_t *pDest);
+
+// G64 images hold the GCR bitstream of each track of a 1541 disk, see encodeG64()
+struct G64Layout
+{
+    static constexpr char SIGNATURE[] = "GCR-1541";
+    static constexpr size_t SIGNATURE_LENGTH = 8;
+    static constexpr uint8_t NUM_HALF_TRACKS = 84;
+    static constexpr uint16_t MAX_TRACK_BYTES = 7928;
+    static constexpr size_t HEADER_BYTES = 12;
+    // half track table of uint32 offsets, then the one of uint32 speed zones, then the tracks
+    static constexpr size_t TRACK_OFFSETS_OFFSET = HEADER_BYTES;
+    static constexpr size_t SPEED_ZONES_OFFSET = TRACK_OFFSETS_OFFSET + 4 * NUM_HALF_TRACKS;
+    static constexpr size_t FIRST_TRACK_OFFSET = SPEED_ZONES_OFFSET + 4 * NUM_HALF_TRACKS;
+    // each track is a uint16 length followed by MAX_TRACK_BYTES, its unused part is 0x00
+    static constexpr size_t BYTES_PER_TRACK_ENTRY = 2 + MAX_TRACK_BYTES;
+
+    // a block starts with 40 '1' bits, then its GCR encoded bytes
+    static constexpr uint8_t SYNC_BYTES = 5;
+    static constexpr uint8_t HEADER_BLOCK_ID = 0x08;
+    static constexpr uint8_t DATA_BLOCK_ID = 0x07;
+    static constexpr uint8_t HEADER_GCR_BYTES = 10; // id, checksum, sector, track, 2 ID bytes, 2 bytes 0x0f
+    static constexpr uint8_t HEADER_GAP_BYTES = 9;
+    static constexpr uint16_t DATA_GCR_BYTES = 325; // id, 256 bytes, checksum, 2 bytes 0x00
+    static constexpr uint8_t GAP_BYTE = 0x55;
+
+    // speed zone 3 for the 21 sectors of tracks 1..17 down to zone 0 for the 17 sectors from track 31 on
+    static constexpr uint8_t getSpeedZone(uint8_t sectorsOnTrack) { return (sectorsOnTrack == 21) ? 3 : (sectorsOnTrack == 19) ? 2 : (sectorsOnTrack == 18) ? 1 : 0; }
+    static constexpr uint16_t getTrackBytes(uint8_t speedZone) { return (speedZone == 3) ? 7692 : (speedZone == 2) ? 7142 : (speedZone == 1) ? 6666 : 6250; }
+};
+
+// true for the formats of the 1541, which G64 images can hold
+template <typename Geometry>
+constexpr bool isG64Geometry()
+{
+    return (Geometry::MAX_SECTORS_ON_TRACK == 21) && (Geometry::NUM_TRACKS * 2 <= G64Layout::NUM_HALF_TRACKS);
+}
+
+// the size of the G64 image of a disk of the geometry
+template <typename Geometry>
+constexpr size_t getG64Size()
+{
+    return G64Layout::FIRST_TRACK_OFFSET + Geometry::NUM_TRACKS * G64Layout::BYTES_PER_TRACK_ENTRY;
+}
+
+// The G64 image of a 1541 disk with the sectors getSector(sectorIdx) returns: per track the
+// header and the data block of each sector in the speed zone of the track, with the disk ID of
+// the header sector. The half tracks in between are left empty.
+template <typename Geometry>
+void encodeG64(std::function<uint8_t const *(uint16_t sectorIdx)> const &getSector, std::vector<uint8_t> &image);
+
+}
+
+#endif
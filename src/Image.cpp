@@ -0,0 +1,219 @@
+#include "Image.h"
+#include "ImageBuilder.h"
+#include "G64.h"
+
+#include <sstream>
+#include <cerrno>
+#include <algorithm>
+
+#include <unistd.h>
+
+using namespace d64;
+using namespace std;
+
+// the Writer of the format of the image
+class Image::Impl
+{
+public:
+    virtual ~Impl() = default;
+
+    virtual Status addFile(std::string const &name, uint8_t const *pData, size_t length) = 0;
+    virtual Status addFile(std::string const &name, int fd) = 0;
+    virtual uint16_t getNumberOfFiles() const = 0;
+    virtual uint16_t getNumberOfFreeSectors() const = 0;
+    virtual size_t getSize(ImageFormat format) const = 0;
+    virtual void getBytes(std::vector<uint8_t> &bytes, ImageFormat format) const = 0;
+    virtual bool saveImage(std::string const &path, ImageFormat format) const = 0;
+};
+
+namespace
+{
+
+template <typename Geometry>
+class ImageImplAs : public Image::Impl
+{
+public:
+    using Writer = BasicWriter<Geometry>;
+
+    ImageImplAs(std::string const &diskName, std::string const &diskId) : writer(diskName, StorageMode::DENSE, diskId) {}
+
+    Image::Status addFile(std::string const &name, uint8_t const *pData, size_t length) override
+    {
+        Image::Status status = checkFile(name, length);
+        if (status != Image::Status::OK)
+        {
+            return status;
+        }
+        return writer.writeFile(name, pData, length) ? Image::Status::OK : Image::Status::DISK_FULL;
+    }
+
+    Image::Status addFile(std::string const &name, int fd) override
+    {
+        Image::Status status = checkFile(name, 1);
+        if (status != Image::Status::OK)
+        {
+            return status;
+        }
+
+        // reads no more than one byte beyond what fits onto the disk
+        size_t maxLength = writer.getNumberOfAvailableBytes() + 1;
+        std::vector<uint8_t> data;
+        uint8_t buf[4096];
+        while (data.size() < maxLength)
+        {
+            ssize_t numRead = ::read(fd, buf, std::min(sizeof(buf), maxLength - data.size()));
+            if (numRead < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return Image::Status::READ_FAILED;
+            }
+            if (numRead == 0)
+            {
+                break;
+            }
+            data.insert(data.end(), buf, buf + numRead);
+        }
+
+        return addFile(name, data.data(), data.size());
+    }
+
+    uint16_t getNumberOfFiles() const override { return writer.getNumberOfFiles(); }
+    uint16_t getNumberOfFreeSectors() const override { return writer.getNumberOfFreeSectors(); }
+
+    size_t getSize(ImageFormat format) const override
+    {
+        if constexpr (isG64Geometry<Geometry>())
+        {
+            if (format == ImageFormat::G64)
+            {
+                return getG64Size<Geometry>();
+            }
+        }
+        return writer.getImageSize();
+    }
+
+    void getBytes(std::vector<uint8_t> &bytes, ImageFormat format) const override
+    {
+        if constexpr (isG64Geometry<Geometry>())
+        {
+            if (format == ImageFormat::G64)
+            {
+                bytes.clear();
+                encodeG64<Geometry>([this](uint16_t idx) { return writer.getSectorData(idx); }, bytes);
+                return;
+            }
+        }
+        bytes.assign(writer.getImageData(), writer.getImageData() + writer.getImageSize());
+    }
+
+    bool saveImage(std::string const &path, ImageFormat format) const override
+    {
+        std::ostringstream err;
+        return d64::saveImage(writer, path, err, format);
+    }
+
+private:
+    Image::Status checkFile(std::string const &name, size_t length) const
+    {
+        if (name.empty() || (length == 0))
+        {
+            return Image::Status::INVALID_ARGUMENT;
+        }
+        if (writer.hasFile(name))
+        {
+            return Image::Status::NAME_EXISTS;
+        }
+        if (writer.isDirectoryFull())
+        {
+            return Image::Status::DIRECTORY_FULL;
+        }
+        return (length <= writer.getNumberOfAvailableBytes()) ? Image::Status::OK : Image::Status::DISK_FULL;
+    }
+
+    Writer writer;
+};
+
+std::unique_ptr<Image::Impl> makeImpl(ImageFormat format, std::string const &diskName, std::string const &diskId)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return std::unique_ptr<Image::Impl>(new ImageImplAs<D64ExtendedGeometry>(diskName, diskId));
+        case ImageFormat::D71: return std::unique_ptr<Image::Impl>(new ImageImplAs<D71Geometry>(diskName, diskId));
+        case ImageFormat::D81: return std::unique_ptr<Image::Impl>(new ImageImplAs<D81Geometry>(diskName, diskId));
+        default: return std::unique_ptr<Image::Impl>(new ImageImplAs<D64Geometry>(diskName, diskId));
+    }
+}
+
+}
+
+char const *Image::getStatusText(Status status)
+{
+    switch (status)
+    {
+        case Status::OK: return "OK";
+        case Status::INVALID_ARGUMENT: return "invalid argument";
+        case Status::NAME_EXISTS: return "file name exists";
+        case Status::DIRECTORY_FULL: return "directory full";
+        case Status::DISK_FULL: return "disk full";
+        case Status::READ_FAILED: return "could not be read";
+        case Status::WRITE_FAILED: return "could not be written";
+        default: return "unknown status";
+    }
+}
+
+Image::Image(ImageFormat format, std::string const &diskName, std::string const &diskId) :
+    format(format), pImpl(makeImpl(format, diskName, diskId))
+{
+}
+
+Image::~Image() = default;
+Image::Image(Image &&other) = default;
+Image &Image::operator = (Image &&other) = default;
+
+// a moved-from Image has no Impl anymore
+Image::Status Image::addFile(std::string const &name, uint8_t const *pData, size_t length)
+{
+    return (!pImpl || (pData == nullptr)) ? Status::INVALID_ARGUMENT : pImpl->addFile(name, pData, length);
+}
+
+Image::Status Image::addFile(std::string const &name, int fd)
+{
+    return (!pImpl || (fd < 0)) ? Status::INVALID_ARGUMENT : pImpl->addFile(name, fd);
+}
+
+uint16_t Image::getNumberOfFiles() const
+{
+    return pImpl ? pImpl->getNumberOfFiles() : 0;
+}
+
+uint16_t Image::getNumberOfFreeSectors() const
+{
+    return pImpl ? pImpl->getNumberOfFreeSectors() : 0;
+}
+
+size_t Image::getSize() const
+{
+    return pImpl ? pImpl->getSize(format) : 0;
+}
+
+Image::Status Image::getBytes(std::vector<uint8_t> &bytes) const
+{
+    if (!pImpl)
+    {
+        return Status::INVALID_ARGUMENT;
+    }
+    pImpl->getBytes(bytes, format);
+    return Status::OK;
+}
+
+Image::Status Image::saveImage(std::string const &path) const
+{
+    if (!pImpl)
+    {
+        return Status::INVALID_ARGUMENT;
+    }
+    return pImpl->saveImage(path, format) ? Status::OK : Status::WRITE_FAILED;
+}
@@ -0,0 +1,72 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ImageFormat.h"
+#include "D64Export.h"
+
+namespace d64
+{
+
+// Entry point of the d64 library for programs which build images in memory rather than from
+// folders: create an image, add files from memory or file descriptors, take the bytes of the
+// image or save it. The Writer behind it is hidden, so the class keeps its layout as the
+// library changes. See D64Api.h for the same as a C API. A moved-from Image holds no image anymore,
+// its members fail with INVALID_ARGUMENT resp. return 0 until another Image is assigned to it.
+class D64_EXPORT Image
+{
+public:
+    enum class Status
+    {
+        OK,
+        INVALID_ARGUMENT, // empty file name or file, unknown format
+        NAME_EXISTS,
+        DIRECTORY_FULL,
+        DISK_FULL,
+        READ_FAILED, // of the file descriptor
+        WRITE_FAILED // of the image file
+    };
+
+    // e.g. "disk full"
+    static char const *getStatusText(Status status);
+
+    // like all members may throw std::bad_alloc
+    explicit Image(ImageFormat format = ImageFormat::D64, std::string const &diskName = "Demo", std::string const &diskId = "42");
+    ~Image();
+
+    Image(Image &&other);
+    Image &operator = (Image &&other);
+    Image(Image const &) = delete;
+    Image &operator = (Image const &) = delete;
+
+    ImageFormat getFormat() const { return format; }
+
+    // the image is left as it was if a file cannot be added
+    Status addFile(std::string const &name, uint8_t const *pData, size_t length);
+    // reads from the current position of fd to its end, fd is left open
+    Status addFile(std::string const &name, int fd);
+
+    uint16_t getNumberOfFiles() const;
+    uint16_t getNumberOfFreeSectors() const;
+
+    // the size of the image file, without building it
+    size_t getSize() const;
+    // the image file as saveImage() writes it, the GCR bitstream for G64
+    Status getBytes(std::vector<uint8_t> &bytes) const;
+    Status saveImage(std::string const &path) const;
+
+    class Impl;
+
+private:
+    ImageFormat format;
+    std::unique_ptr<Impl> pImpl;
+};
+
+}
+
+#endif
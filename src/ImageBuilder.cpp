@@ -0,0 +1,617 @@
+#include <memory>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <map>
+
+// POSIX API to read files
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ImageBuilder.h"
+#include "ProgFile.h"
+#include "FolderScanner.h"
+#include "Stats.h"
+#include "Reader.h"
+#include "WriterPool.h"
+
+using namespace std;
+
+namespace d64
+{
+
+std::string getDirName(std::string path)
+{
+    // if present, remove trailing '/'
+    if (path.length() > 1 && path.at(path.length() - 1) == '/')
+    {
+        path = path.substr(0, path.length() -1);
+    }
+
+    auto pos = path.find_last_of('/');
+    return (pos != std::string::npos) ? path.substr(pos + 1) : path;
+}
+
+bool parseImageFormat(std::string const &name, ImageFormat &format)
+{
+    static std::pair<char const *, ImageFormat> const formats[] =
+    {
+        {"d64", ImageFormat::D64},
+        {"d64-40", ImageFormat::D64_40_TRACKS},
+        {"d71", ImageFormat::D71},
+        {"d81", ImageFormat::D81},
+        {"g64", ImageFormat::G64}
+    };
+
+    for (auto const &entry : formats)
+    {
+        if (name == entry.first)
+        {
+            format = entry.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+char const *getImageSuffix(ImageFormat format)
+{
+    switch (format)
+    {
+        case ImageFormat::D71: return ".d71";
+        case ImageFormat::D81: return ".d81";
+        case ImageFormat::G64: return ".g64";
+        default: return ".d64";
+    }
+}
+
+static std::pair<char const *, Placement> const placements[] =
+{
+    {"linear", Placement::LINEAR},
+    {"dos", Placement::DOS},
+    {"closest", Placement::CLOSEST_TO_DIRECTORY}
+};
+
+bool parsePlacement(std::string const &name, Placement &placement)
+{
+    for (auto const &entry : placements)
+    {
+        if (name == entry.first)
+        {
+            placement = entry.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+char const *getPlacementName(Placement placement)
+{
+    for (auto const &entry : placements)
+    {
+        if (placement == entry.second)
+        {
+            return entry.first;
+        }
+    }
+
+    return "";
+}
+
+// writes the image in the file format of format. It must not go into a cached image linked to the path.
+template <typename Geometry>
+static bool writeImageFile(BasicWriter<Geometry> const &writer, std::string const &imagePath, ImageFormat format)
+{
+    return breakHardLink(imagePath) && ((format == ImageFormat::G64) ? writer.writeG64File(imagePath) : writer.writeImageFile(imagePath));
+}
+
+template <typename Geometry>
+static bool buildNewImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                          AllocationPolicy const &policy)
+{
+    // the writer takes up ~175KB for a D64 and more for the larger formats, keep it off the stack of worker threads
+    unique_ptr<BasicWriter<Geometry>> pWriter(new BasicWriter<Geometry>(getDirName(srcPath)));
+    pWriter->setAllocationPolicy(policy);
+    return buildImage(srcPath, imagePath, *pWriter, err, format);
+}
+
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format)
+{
+    return buildImage(srcPath, imagePath, err, format, AllocationPolicy());
+}
+
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                AllocationPolicy const &policy)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return buildNewImage<D64ExtendedGeometry>(srcPath, imagePath, err, format, policy);
+        case ImageFormat::D71: return buildNewImage<D71Geometry>(srcPath, imagePath, err, format, policy);
+        case ImageFormat::D81: return buildNewImage<D81Geometry>(srcPath, imagePath, err, format, policy);
+        default: return buildNewImage<D64Geometry>(srcPath, imagePath, err, format, policy);
+    }
+}
+
+static void countRejected(ProgFile::Status status)
+{
+    switch (status)
+    {
+        case ProgFile::Status::TOO_SHORT: D64_STATS_ADD(REJECTED_TOO_SHORT, 1); break;
+        case ProgFile::Status::TOO_LARGE: D64_STATS_ADD(REJECTED_TOO_LARGE, 1); break;
+        case ProgFile::Status::EXCEEDS_ADDRESS_SPACE: D64_STATS_ADD(REJECTED_EXCEEDS_ADDRESS_SPACE, 1); break;
+        default: D64_STATS_ADD(REJECTED_UNREADABLE, 1); break;
+    }
+}
+
+// calls consumer(fileName, progFile) for each valid '.prg' file in the folder, stops at the first
+// file which is not valid or which the consumer does not take. Entries with a '.prg' name which
+// are not regular files, e.g. folders, are skipped like files of other names. The files are read ahead by a
+// FolderScanner while the consumer works on the previous ones.
+template <typename Consumer>
+static bool forEachProgFile(std::string const &srcPath, std::ostream &err, Consumer consumer)
+{
+    FolderScanner scanner(srcPath);
+    if (!scanner.isOpen())
+    {
+        // error handling: did not find folder
+        err << "Could not find folder " << srcPath << "." << std::endl;
+        return false;
+    }
+
+    std::string fileName;
+    ProgFile progFile;
+    while (scanner.next(fileName, progFile))
+    {
+        if (progFile.getStatus() == ProgFile::Status::NOT_A_REGULAR_FILE)
+        {
+            D64_STATS_ADD(SKIPPED_NOT_PRG, 1);
+            continue;
+        }
+        if (progFile.getStatus() != ProgFile::Status::OK)
+        {
+            countRejected(progFile.getStatus());
+            err << "File " << srcPath << "/" << fileName << " " << ProgFile::getStatusText(progFile.getStatus()) << "." << std::endl;
+            return false;
+        }
+        D64_STATS_ADD(FILES_READ, 1);
+        D64_STATS_ADD(BYTES_READ, progFile.getLength());
+
+        if (!consumer(fileName, progFile))
+        {
+            D64_STATS_ADD(REJECTED_NO_ROOM, 1);
+            err << "Could not write file " << fileName << " to image." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool hashFolder(std::string const &srcPath, ImageFormat format, BuildCache::Key &key, std::ostream &err)
+{
+    ContentHasher hasher;
+    hasher.add(getImageSuffix(format));
+    hasher.add(std::to_string(static_cast<int>(format)));
+    hasher.add(getDirName(srcPath));
+
+    bool success = forEachProgFile(srcPath, err, [&hasher](std::string const &fileName, ProgFile &progFile)
+    {
+        hasher.add(fileName);
+        hasher.add(std::to_string(progFile.getLength()));
+        hasher.add(progFile.getData(), progFile.getLength());
+        return true;
+    });
+
+    key = hasher.finish();
+    return success;
+}
+
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format, BuildCache &cache)
+{
+    BuildCache::Key key;
+    if (!hashFolder(srcPath, format, key, err))
+    {
+        return false;
+    }
+    if (cache.fetch(key, imagePath))
+    {
+        return true;
+    }
+
+    // an image which cannot be cached is still built
+    bool success = buildImage(srcPath, imagePath, err, format);
+    if (success)
+    {
+        cache.store(key, imagePath);
+    }
+    return success;
+}
+
+template <typename Geometry>
+bool addProgFiles(std::string const &srcPath, BasicWriter<Geometry> &writer, std::ostream &err)
+{
+    // the mapped files are copied straight into the sectors of the image
+    return forEachProgFile(srcPath, err, [&writer](std::string const &fileName, ProgFile &progFile)
+    {
+        return writer.writeFile(fileName, progFile.getData(), progFile.getLength());
+    });
+}
+
+template <typename Geometry>
+bool saveImage(BasicWriter<Geometry> const &writer, std::string const &imagePath, std::ostream &err, ImageFormat format)
+{
+    if (!writeImageFile(writer, imagePath, format))
+    {
+        err << "Could not write image " << imagePath << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Geometry>
+bool buildImage(std::string const &srcPath, std::string const &imagePath, BasicWriter<Geometry> &writer, std::ostream &err,
+                ImageFormat format)
+{
+    // all files have been added, now generate the image
+    return addProgFiles(srcPath, writer, err) && saveImage(writer, imagePath, err, format);
+}
+
+template <typename Geometry>
+static bool buildFastestImageAs(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                                uint8_t interleave, LoadCostModel const &model, AllocationPolicy &chosenPolicy, LoadCost &cost)
+{
+    using Writer = BasicWriter<Geometry>;
+
+    std::vector<std::pair<std::string, ProgFile>> progFiles;
+    bool success = forEachProgFile(srcPath, err, [&progFiles](std::string const &fileName, ProgFile &progFile)
+    {
+        progFiles.emplace_back(fileName, std::move(progFile));
+        return true;
+    });
+    if (!success)
+    {
+        return false;
+    }
+
+    // the fastest image so far is kept, the other Writer takes the next placement
+    unique_ptr<Writer> pBest;
+    unique_ptr<Writer> pWriter(new Writer());
+    for (auto const &entry : placements)
+    {
+        pWriter->reset(getDirName(srcPath));
+        AllocationPolicy policy = { entry.second, interleave };
+        pWriter->setAllocationPolicy(policy);
+        for (auto const &progFile : progFiles)
+        {
+            if (!pWriter->writeFile(progFile.first, progFile.second.getData(), progFile.second.getLength()))
+            {
+                err << "Could not write file " << progFile.first << " to image." << std::endl;
+                return false;
+            }
+        }
+
+        BasicReader<Geometry> reader(pWriter->getImageData(), pWriter->getImageSize());
+        LoadCost placementCost = estimateLoadCost(reader, model);
+        if (!pBest || (placementCost.micros < cost.micros))
+        {
+            cost = placementCost;
+            chosenPolicy = policy;
+            pBest.swap(pWriter);
+            if (!pWriter)
+            {
+                pWriter.reset(new Writer());
+            }
+        }
+    }
+
+    if (!writeImageFile(*pBest, imagePath, format))
+    {
+        err << "Could not write image " << imagePath << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool buildFastestImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                       uint8_t interleave, LoadCostModel const &model, AllocationPolicy &chosenPolicy, LoadCost &cost)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return buildFastestImageAs<D64ExtendedGeometry>(srcPath, imagePath, err, format, interleave, model, chosenPolicy, cost);
+        case ImageFormat::D71: return buildFastestImageAs<D71Geometry>(srcPath, imagePath, err, format, interleave, model, chosenPolicy, cost);
+        case ImageFormat::D81: return buildFastestImageAs<D81Geometry>(srcPath, imagePath, err, format, interleave, model, chosenPolicy, cost);
+        default: return buildFastestImageAs<D64Geometry>(srcPath, imagePath, err, format, interleave, model, chosenPolicy, cost);
+    }
+}
+
+std::string getSpannedImagePath(std::string const &imagePath, size_t diskNo)
+{
+    // the suffix is the part after the last '.' of the file name, if any
+    size_t nameStart = imagePath.find_last_of('/');
+    size_t dot = imagePath.find_last_of('.');
+    if ((dot == std::string::npos) || ((nameStart != std::string::npos) && (dot < nameStart)))
+    {
+        dot = imagePath.length();
+    }
+    return imagePath.substr(0, dot) + "_" + std::to_string(diskNo) + imagePath.substr(dot);
+}
+
+template <typename Geometry>
+static bool buildSpannedImagesAs(std::string const &srcPath, std::string const &imagePath, std::ostream &err,
+                                 std::vector<std::string> &imagePaths, ImageFormat format, PackingMode mode, unsigned numWorkers)
+{
+    using Writer = BasicWriter<Geometry>;
+
+    std::vector<std::pair<std::string, ProgFile>> progFiles;
+    bool success = forEachProgFile(srcPath, err, [&progFiles](std::string const &fileName, ProgFile &progFile)
+    {
+        progFiles.emplace_back(fileName, std::move(progFile));
+        return true;
+    });
+    if (!success)
+    {
+        return false;
+    }
+    if (progFiles.empty())
+    {
+        err << "Folder " << srcPath << " holds no '.prg' files." << std::endl;
+        return false;
+    }
+
+    // the block counts are all the packing needs, and the names, as files of the same name go
+    // onto different disks
+    std::vector<uint16_t> fileBlocks;
+    std::vector<size_t> nameIds;
+    std::map<DirectoryName, size_t> nameIdOfName;
+    for (auto const &progFile : progFiles)
+    {
+        fileBlocks.push_back(static_cast<uint16_t>(std::min<size_t>((progFile.second.getLength() + Writer::DATA_BYTES_PER_SECTOR - 1) /
+                                                                    Writer::DATA_BYTES_PER_SECTOR, 65535)));
+        nameIds.push_back(nameIdOfName.emplace(makeD64FileName(progFile.first), nameIdOfName.size()).first->second);
+    }
+
+    DiskCapacity capacity = { Writer::getNumberOfFreeSectorsOnBlankImage(), Writer::MAX_DIR_ENTRIES };
+    std::vector<std::vector<size_t>> disks;
+    if (!packFiles(fileBlocks, capacity, mode, disks, nameIds))
+    {
+        for (size_t fileIdx = 0; fileIdx < fileBlocks.size(); fileIdx++)
+        {
+            if (fileBlocks[fileIdx] > capacity.blocks)
+            {
+                err << "File " << progFiles[fileIdx].first << " does not fit onto a disk." << std::endl;
+            }
+        }
+        return false;
+    }
+
+    imagePaths.clear();
+    for (size_t diskIdx = 0; diskIdx < disks.size(); diskIdx++)
+    {
+        imagePaths.push_back(getSpannedImagePath(imagePath, diskIdx + 1));
+    }
+
+    // one image per worker at a time, as in the BatchBuilder
+    BasicWriterPool<Geometry> writerPool;
+    std::vector<std::string> errors(disks.size());
+    std::atomic<size_t> nextDisk(0);
+    std::string dirName = getDirName(srcPath);
+
+    auto worker = [&]()
+    {
+        for (size_t diskIdx = nextDisk++; diskIdx < disks.size(); diskIdx = nextDisk++)
+        {
+            // "_<n>" stays visible in the 16 characters of the disk name
+            std::string suffix = "_" + std::to_string(diskIdx + 1);
+            auto pWriter = writerPool.acquire(dirName.substr(0, DirectoryName().size() - suffix.length()) + suffix);
+            std::ostringstream diskErr;
+
+            for (size_t fileIdx : disks[diskIdx])
+            {
+                ProgFile const &progFile = progFiles[fileIdx].second;
+                if (!pWriter->writeFile(progFiles[fileIdx].first, progFile.getData(), progFile.getLength()))
+                {
+                    diskErr << "Could not write file " << progFiles[fileIdx].first << " to image." << std::endl;
+                }
+            }
+
+            if (diskErr.str().empty() && !writeImageFile(*pWriter, imagePaths[diskIdx], format))
+            {
+                diskErr << "Could not write image " << imagePaths[diskIdx] << "." << std::endl;
+            }
+            errors[diskIdx] = diskErr.str();
+        }
+    };
+
+    unsigned numThreads = static_cast<unsigned>(std::min<size_t>((numWorkers > 0) ? numWorkers : std::max(1u, std::thread::hardware_concurrency()),
+                                                                 disks.size()));
+    std::vector<std::thread> threads;
+    for (unsigned threadIdx = 1; threadIdx < numThreads; threadIdx++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    for (auto const &diskErr : errors)
+    {
+        err << diskErr;
+        success = success && diskErr.empty();
+    }
+    return success;
+}
+
+bool buildSpannedImages(std::string const &srcPath, std::string const &imagePath, std::ostream &err,
+                        std::vector<std::string> &imagePaths, ImageFormat format, PackingMode mode, unsigned numWorkers)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return buildSpannedImagesAs<D64ExtendedGeometry>(srcPath, imagePath, err, imagePaths, format, mode, numWorkers);
+        case ImageFormat::D71: return buildSpannedImagesAs<D71Geometry>(srcPath, imagePath, err, imagePaths, format, mode, numWorkers);
+        case ImageFormat::D81: return buildSpannedImagesAs<D81Geometry>(srcPath, imagePath, err, imagePaths, format, mode, numWorkers);
+        default: return buildSpannedImagesAs<D64Geometry>(srcPath, imagePath, err, imagePaths, format, mode, numWorkers);
+    }
+}
+
+template <typename Geometry>
+static bool hasContent(BasicFileView<Geometry> const &view, uint8_t const *pData, size_t length)
+{
+    size_t offset = 0;
+    for (auto chunk : view)
+    {
+        if ((offset + chunk.length > length) || !std::equal(chunk.pData, chunk.pData + chunk.length, &pData[offset]))
+        {
+            return false;
+        }
+        offset += chunk.length;
+    }
+
+    return (offset == length) && view.isComplete();
+}
+
+template <typename Geometry>
+static bool updateExistingImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err)
+{
+    using Reader = BasicReader<Geometry>;
+
+    std::vector<std::pair<std::string, ProgFile>> progFiles;
+    bool success = forEachProgFile(srcPath, err, [&progFiles](std::string const &fileName, ProgFile &progFile)
+    {
+        progFiles.emplace_back(fileName, std::move(progFile));
+        return true;
+    });
+    if (!success)
+    {
+        return false;
+    }
+
+    // buildImage() fails on the second file of the same name, so does the update
+    std::vector<DirectoryName> names;
+    for (auto const &progFile : progFiles)
+    {
+        names.push_back(makeD64FileName(progFile.first));
+    }
+    std::sort(names.begin(), names.end());
+    if (std::adjacent_find(names.begin(), names.end()) != names.end())
+    {
+        err << "Folder " << srcPath << " holds files which have the same name on the image." << std::endl;
+        return false;
+    }
+
+    Reader reader(imagePath);
+    if (reader.getStatus() != Reader::Status::OK)
+    {
+        err << "Image " << imagePath << " " << Reader::getStatusText(reader.getStatus()) << "." << std::endl;
+        return false;
+    }
+
+    unique_ptr<BasicWriter<Geometry>> pWriter(new BasicWriter<Geometry>(getDirName(srcPath)));
+    if (!pWriter->loadImage(reader.getImageData(), Reader::IMAGE_SIZE))
+    {
+        err << "Image " << imagePath << " has a directory which cannot be updated." << std::endl;
+        return false;
+    }
+
+    // which files of the image are still in the folder
+    auto const &files = reader.getFiles();
+    std::vector<bool> isInFolder(files.size(), false);
+    for (auto const &progFile : progFiles)
+    {
+        auto pEntry = reader.findFile(progFile.first);
+        if (pEntry != nullptr)
+        {
+            isInFolder[pEntry - &files[0]] = true;
+        }
+    }
+
+    // deleted files go first, the changed and new ones may take their sectors
+    for (size_t fileIdx = 0; fileIdx < files.size(); fileIdx++)
+    {
+        if (!isInFolder[fileIdx])
+        {
+            pWriter->deleteFile(files[fileIdx].name);
+        }
+    }
+
+    for (auto const &progFile : progFiles)
+    {
+        uint8_t const *pData = progFile.second.getData();
+        size_t length = progFile.second.getLength();
+        auto pEntry = reader.findFile(progFile.first);
+
+        if ((pEntry != nullptr) && hasContent(reader.getFile(*pEntry), pData, length))
+        {
+            continue;
+        }
+        if (!pWriter->replaceFile(progFile.first, pData, length))
+        {
+            err << "Could not write file " << progFile.first << " to image." << std::endl;
+            return false;
+        }
+    }
+
+    // an image linked to a cached one is written as a whole into a file of its own
+    struct stat st;
+    bool isLinked = (::stat(imagePath.c_str(), &st) == 0) && (st.st_nlink > 1);
+    if (isLinked)
+    {
+        success = breakHardLink(imagePath) && pWriter->writeImageFile(imagePath);
+    }
+    else
+    {
+        int fd = ::open(imagePath.c_str(), O_WRONLY);
+        success = (fd >= 0) && pWriter->writeChangedSectors(fd);
+        if ((fd >= 0) && (::close(fd) != 0))
+        {
+            success = false;
+        }
+    }
+    if (!success)
+    {
+        err << "Could not update image " << imagePath << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool updateImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return updateExistingImage<D64ExtendedGeometry>(srcPath, imagePath, err);
+        case ImageFormat::D71: return updateExistingImage<D71Geometry>(srcPath, imagePath, err);
+        case ImageFormat::D81: return updateExistingImage<D81Geometry>(srcPath, imagePath, err);
+        case ImageFormat::G64:
+            err << "G64 images cannot be updated." << std::endl;
+            return false;
+        default: return updateExistingImage<D64Geometry>(srcPath, imagePath, err);
+    }
+}
+
+template bool buildImage(std::string const &, std::string const &, BasicWriter<D64Geometry> &, std::ostream &, ImageFormat);
+template bool buildImage(std::string const &, std::string const &, BasicWriter<D64ExtendedGeometry> &, std::ostream &, ImageFormat);
+template bool buildImage(std::string const &, std::string const &, BasicWriter<D71Geometry> &, std::ostream &, ImageFormat);
+template bool buildImage(std::string const &, std::string const &, BasicWriter<D81Geometry> &, std::ostream &, ImageFormat);
+
+template bool addProgFiles(std::string const &, BasicWriter<D64Geometry> &, std::ostream &);
+template bool addProgFiles(std::string const &, BasicWriter<D64ExtendedGeometry> &, std::ostream &);
+template bool addProgFiles(std::string const &, BasicWriter<D71Geometry> &, std::ostream &);
+template bool addProgFiles(std::string const &, BasicWriter<D81Geometry> &, std::ostream &);
+
+template bool saveImage(BasicWriter<D64Geometry> const &, std::string const &, std::ostream &, ImageFormat);
+template bool saveImage(BasicWriter<D64ExtendedGeometry> const &, std::string const &, std::ostream &, ImageFormat);
+template bool saveImage(BasicWriter<D71Geometry> const &, std::string const &, std::ostream &, ImageFormat);
+template bool saveImage(BasicWriter<D81Geometry> const &, std::string const &, std::ostream &, ImageFormat);
+
+}
@@ -0,0 +1,85 @@
+#ifndef IMAGE_BUILDER_H
+#define IMAGE_BUILDER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "ImageFormat.h"
+#include "Writer.h"
+#include "BuildCache.h"
+#include "BinPacker.h"
+#include "AllocationPolicy.h"
+#include "LoadCost.h"
+
+namespace d64
+{
+
+// "d64", "d64-40", "d71", "d81" or "g64", false for other names
+bool parseImageFormat(std::string const &name, ImageFormat &format);
+// file name suffix of the images of a format, e.g. ".d71"
+char const *getImageSuffix(ImageFormat format);
+
+// "linear", "dos" or "closest", false for other names
+bool parsePlacement(std::string const &name, Placement &placement);
+char const *getPlacementName(Placement placement);
+
+// returns the name of the bottommost directory of the path
+// getDirName("./foo/bar/baz") returns "baz"
+std::string getDirName(std::string path);
+
+// writes all '.prg' files found in srcPath into a new image named after the folder and stores
+// it in imagePath. Problems are reported on err, returns true if the image was written.
+// A '.prg' file which cannot be read or is not a valid program fails the image.
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format = ImageFormat::D64);
+
+// same, with the files placed according to the policy
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                AllocationPolicy const &policy);
+
+// builds the image once per placement with the given interleave and writes the one which loads fastest
+// according to the model, chosenPolicy and cost receive its policy and its estimated load cost
+bool buildFastestImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format,
+                       uint8_t interleave, LoadCostModel const &model, AllocationPolicy &chosenPolicy, LoadCost &cost);
+
+// same, but takes the image from the cache if the folder has been built before and puts new images into it
+bool buildImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format, BuildCache &cache);
+
+// hash over everything the image of srcPath is built from: the format, the folder name and the names
+// and contents of the '.prg' files in the order they are written. Fails like buildImage() on bad files.
+bool hashFolder(std::string const &srcPath, ImageFormat format, BuildCache::Key &key, std::ostream &err);
+
+// writes the '.prg' files of srcPath onto as few images as needed when they do not fit onto one:
+// imagePath "games.d64" becomes "games_1.d64", "games_2.d64" and so on, see getSpannedImagePath().
+// The images are built in parallel on numWorkers threads (0: one per hardware thread), imagePaths
+// receives their paths. Files which have the same name on the image go onto different disks.
+// Fails if the folder holds no '.prg' files or a file does not fit onto an empty disk.
+bool buildSpannedImages(std::string const &srcPath, std::string const &imagePath, std::ostream &err,
+                        std::vector<std::string> &imagePaths, ImageFormat format = ImageFormat::D64,
+                        PackingMode mode = PackingMode::FAST, unsigned numWorkers = 0);
+// imagePath with "_<diskNo>" inserted before the suffix
+std::string getSpannedImagePath(std::string const &imagePath, size_t diskNo);
+
+// same as buildImage(), but adds the files to the given blank Writer, e.g. one from a WriterPool.
+// format only tells the file format of the image, the Writer must be of its geometry.
+template <typename Geometry>
+bool buildImage(std::string const &srcPath, std::string const &imagePath, BasicWriter<Geometry> &writer, std::ostream &err,
+                ImageFormat format = ImageFormat::D64);
+
+// the two halves of the above, for a pipeline which writes the image of one folder while the next one
+// is laid out: adds the '.prg' files of srcPath to the Writer, resp. writes its image in the file format
+// of format. Both report problems on err.
+template <typename Geometry>
+bool addProgFiles(std::string const &srcPath, BasicWriter<Geometry> &writer, std::ostream &err);
+template <typename Geometry>
+bool saveImage(BasicWriter<Geometry> const &writer, std::string const &imagePath, std::ostream &err, ImageFormat format);
+
+// brings the existing image in imagePath in line with the '.prg' files in srcPath: new files are
+// added, changed ones replaced and files which are not in the folder anymore deleted. Only the
+// modified sectors are written back, the image is left untouched if anything fails before.
+// G64 images cannot be updated.
+bool updateImage(std::string const &srcPath, std::string const &imagePath, std::ostream &err, ImageFormat format = ImageFormat::D64);
+
+}
+
+#endif
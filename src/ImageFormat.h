@@ -0,0 +1,19 @@
+#ifndef IMAGE_FORMAT_H
+#define IMAGE_FORMAT_H
+
+namespace d64
+{
+
+// the file formats of the images, installed with Image.h, so it must not depend on the other headers
+enum class ImageFormat
+{
+    D64, // 35 tracks
+    D64_40_TRACKS,
+    D71,
+    D81,
+    G64 // the 35 tracks of a D64 as the GCR bitstream of the disk, see G64.h
+};
+
+}
+
+#endif
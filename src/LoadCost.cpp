@@ -0,0 +1,71 @@
+#include "LoadCost.h"
+
+using namespace d64;
+using namespace std;
+
+template <typename Geometry>
+LoadCost d64::estimateLoadCost(BasicFileView<Geometry> const &file, LoadCostModel const &model)
+{
+    LoadCost ret;
+    TrackSector head = {Geometry::DIRECTORY_TRACK, 0};
+    bool isOnTrack = false; // false: the position on the track is unknown after a step
+
+    for (auto it = file.begin(); it != file.end(); ++it)
+    {
+        TrackSector ts = Geometry::getTrackAndSector(it.getSectorIdx());
+        uint8_t numSectors = Geometry::getSectorsOnTrack(ts.track);
+        uint32_t numSectorTimes = 0;
+
+        if (!isOnTrack || (ts.track != head.track))
+        {
+            uint8_t fromCylinder = Geometry::getCylinder(head.track);
+            uint8_t toCylinder = Geometry::getCylinder(ts.track);
+            uint32_t numSteps = (fromCylinder < toCylinder) ? toCylinder - fromCylinder : fromCylinder - toCylinder;
+            ret.numSteps += numSteps;
+            ret.micros += numSteps * static_cast<uint64_t>(model.stepMicros);
+            numSectorTimes = numSectors / 2;
+        }
+        else
+        {
+            // the sectors between the last one read and this one pass the head, at least as many as the loader is busy
+            numSectorTimes = (ts.sector + numSectors - head.sector - 1) % numSectors;
+            while (numSectorTimes < model.busySectors)
+            {
+                numSectorTimes += numSectors;
+            }
+        }
+
+        ++numSectorTimes; // reading the block
+        ret.numSectorTimes += numSectorTimes;
+        ret.micros += numSectorTimes * static_cast<uint64_t>(model.revolutionMicros) / numSectors;
+        head = ts;
+        isOnTrack = true;
+    }
+
+    return ret;
+}
+
+template <typename Geometry>
+LoadCost d64::estimateLoadCost(BasicReader<Geometry> const &reader, LoadCostModel const &model)
+{
+    LoadCost ret;
+    for (auto const &entry : reader.getFiles())
+    {
+        ret += estimateLoadCost(reader.getFile(entry), model);
+    }
+    return ret;
+}
+
+namespace d64
+{
+
+template LoadCost estimateLoadCost(BasicFileView<D64Geometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicFileView<D64ExtendedGeometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicFileView<D71Geometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicFileView<D81Geometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicReader<D64Geometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicReader<D64ExtendedGeometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicReader<D71Geometry> const &, LoadCostModel const &);
+template LoadCost estimateLoadCost(BasicReader<D81Geometry> const &, LoadCostModel const &);
+
+}
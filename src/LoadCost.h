@@ -0,0 +1,45 @@
+#ifndef LOAD_COST_H
+#define LOAD_COST_H
+
+#include <cstdint>
+
+#include "Reader.h"
+
+namespace d64
+{
+
+// Rough timing of a drive loading a file: the head steps from the directory track to the file,
+// then the blocks are read one after the other. After reading a block the loader is busy for a
+// while, a block passing the head in that time has to wait for the next revolution. After a step
+// the head finds the track at a random position, which costs half a revolution on average.
+struct LoadCostModel
+{
+    uint32_t stepMicros = 3000; // one cylinder
+    uint32_t revolutionMicros = 200000; // 300 rpm
+    uint8_t busySectors = 9; // sectors passing the head while a block is handled, ~9 for the DOS, 2..5 for fastloaders
+};
+
+struct LoadCost
+{
+    uint32_t numSteps = 0; // cylinders the head moves
+    uint32_t numSectorTimes = 0; // sectors passing the head while waiting and reading
+    uint64_t micros = 0;
+
+    LoadCost &operator += (LoadCost const &rhs)
+    {
+        numSteps += rhs.numSteps;
+        numSectorTimes += rhs.numSectorTimes;
+        micros += rhs.micros;
+        return *this;
+    }
+};
+
+template <typename Geometry>
+LoadCost estimateLoadCost(BasicFileView<Geometry> const &file, LoadCostModel const &model = LoadCostModel());
+// of loading each file of the image on its own, starting from the directory track
+template <typename Geometry>
+LoadCost estimateLoadCost(BasicReader<Geometry> const &reader, LoadCostModel const &model = LoadCostModel());
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "Planner.h"
+
+#include <algorithm>
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+// BAM free counts of a blank image, see makeBlankImage() of the Writer
+template <typename Geometry>
+std::array<uint8_t, Geometry::NUM_TRACKS> makeBlankFreeCounts()
+{
+    std::array<uint8_t, Geometry::NUM_TRACKS> ret{};
+    TrackSector firstDirSector = Geometry::getTrackAndSector(Geometry::FIRST_DIR_SECTOR_IDX);
+    for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+    {
+        for (uint8_t sector = 0; sector < Geometry::getSectorsOnTrack(trackIdx); sector++)
+        {
+            TrackSector ts = {trackIdx, sector};
+            if (!Geometry::isAllocatedOnFormat(ts) && (ts != firstDirSector))
+            {
+                ++ret[trackIdx];
+            }
+        }
+    }
+    return ret;
+}
+
+template <typename Geometry>
+std::array<uint8_t, Geometry::NUM_TRACKS> const &getBlankFreeCounts()
+{
+    static std::array<uint8_t, Geometry::NUM_TRACKS> const counts = makeBlankFreeCounts<Geometry>();
+    return counts;
+}
+
+template <typename Geometry>
+uint16_t getBlankFreeSectors()
+{
+    static uint16_t const numFree = [] ()
+    {
+        auto const &counts = getBlankFreeCounts<Geometry>();
+        uint16_t ret = 0;
+        for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+        {
+            ret += Geometry::isReservedTrack(trackIdx) ? 0 : counts[trackIdx];
+        }
+        return ret;
+    }();
+    return numFree;
+}
+
+}
+
+template <typename Geometry>
+void BasicPlanner<Geometry>::reset()
+{
+    numUsedBlocks = 0;
+    numFiles = 0;
+    numRejectedFiles = 0;
+}
+
+template <typename Geometry>
+bool BasicPlanner<Geometry>::addFile(size_t length)
+{
+    // same checks as writeFile() and writeData()
+    if ((numFiles == MAX_DIR_ENTRIES) || (length == 0) ||
+        (length > getNumberOfFreeSectors() * static_cast<size_t>(DATA_BYTES_PER_SECTOR)))
+    {
+        ++numRejectedFiles;
+        return false;
+    }
+
+    numUsedBlocks += getNumberOfBlocks(length);
+    ++numFiles;
+    return true;
+}
+
+template <typename Geometry>
+bool BasicPlanner<Geometry>::addFiles(std::vector<size_t> const &lengths)
+{
+    for (size_t length : lengths)
+    {
+        addFile(length);
+    }
+    return isEverythingFitting();
+}
+
+template <typename Geometry>
+uint16_t BasicPlanner<Geometry>::getNumberOfFreeSectors() const
+{
+    return getBlankFreeSectors<Geometry>() - numUsedBlocks;
+}
+
+template <typename Geometry>
+uint8_t BasicPlanner<Geometry>::getNumberOfDirSectors() const
+{
+    // a blank directory has one sector, then one per 8 entries
+    return static_cast<uint8_t>(std::max(1, (numFiles + DIR_ENTRIES_PER_SECTOR - 1) / DIR_ENTRIES_PER_SECTOR));
+}
+
+template <typename Geometry>
+typename BasicPlanner<Geometry>::FreeCounts BasicPlanner<Geometry>::getFreeCountsOfBam() const
+{
+    FreeCounts ret = getBlankFreeCounts<Geometry>();
+
+    // the files fill the tracks from the first one on, skipping the reserved tracks
+    uint16_t numBlocks = numUsedBlocks;
+    for (uint8_t trackIdx = 0; (trackIdx < NUM_TRACKS) && (numBlocks > 0); trackIdx++)
+    {
+        if (!Geometry::isReservedTrack(trackIdx))
+        {
+            uint8_t numOnTrack = static_cast<uint8_t>(std::min<uint16_t>(numBlocks, ret[trackIdx]));
+            ret[trackIdx] -= numOnTrack;
+            numBlocks -= numOnTrack;
+        }
+    }
+
+    // the first directory sector is allocated on format
+    ret[Geometry::DIRECTORY_TRACK] -= getNumberOfDirSectors() - 1;
+    return ret;
+}
+
+namespace d64
+{
+
+template class BasicPlanner<D64Geometry>;
+template class BasicPlanner<D64ExtendedGeometry>;
+template class BasicPlanner<D71Geometry>;
+template class BasicPlanner<D81Geometry>;
+
+}
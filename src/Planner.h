@@ -0,0 +1,66 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "DiskGeometry.h"
+
+namespace d64
+{
+
+// Dry run of BasicWriter::writeFile() on a blank image: tells which files of the given lengths fit,
+// how many blocks they take and what the BAM and the directory look like afterwards, without
+// touching a sector. On a blank image the Writer hands out the free sectors track by track in
+// interleave order, so the files always take the first sectors of that order and counting them
+// is enough. Adding a file is O(1), the BAM free counts take O(tracks). The free counts per track
+// are the ones of the default allocation policy, everything else holds for any policy.
+template <typename Geometry>
+class BasicPlanner
+{
+public:
+    static constexpr uint8_t NUM_TRACKS = Geometry::NUM_TRACKS;
+    static constexpr uint16_t DATA_BYTES_PER_SECTOR = SectorLayout::DATA_BYTES_PER_SECTOR;
+    static constexpr uint8_t DIR_ENTRIES_PER_SECTOR = SectorLayout::DIR_ENTRIES_PER_SECTOR;
+    static constexpr uint16_t MAX_DIR_ENTRIES = Geometry::MAX_DIR_ENTRIES;
+
+    using FreeCounts = std::array<uint8_t, NUM_TRACKS>;
+
+    BasicPlanner() { reset(); }
+
+    // back to a blank image
+    void reset();
+    // false if writeFile() would fail on the length, i.e. if the file is empty, there are not
+    // enough free blocks or the directory is full. The file is left out then, like the Writer does.
+    bool addFile(size_t length);
+    // adds the files in order, true if all of them fit
+    bool addFiles(std::vector<size_t> const &lengths);
+
+    bool isEverythingFitting() const { return numRejectedFiles == 0; }
+    uint16_t getNumberOfRejectedFiles() const { return numRejectedFiles; }
+
+    // blocks taken by files, the directory track does not count
+    uint16_t getNumberOfUsedBlocks() const { return numUsedBlocks; }
+    uint16_t getNumberOfFreeSectors() const;
+    // directory slots, one per file
+    uint16_t getNumberOfFiles() const { return numFiles; }
+    // length of the directory sector chain
+    uint8_t getNumberOfDirSectors() const;
+    // free sector count of each track as the BAM will hold it
+    FreeCounts getFreeCountsOfBam() const;
+
+    static uint16_t getNumberOfBlocks(size_t length) { return static_cast<uint16_t>((length + (DATA_BYTES_PER_SECTOR - 1)) / DATA_BYTES_PER_SECTOR); }
+
+private:
+    uint16_t numUsedBlocks;
+    uint16_t numFiles;
+    uint16_t numRejectedFiles;
+};
+
+using Planner = BasicPlanner<D64Geometry>;
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "ProgFile.h"
+
+// POSIX API to map files
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace d64;
+
+ProgFile::ProgFile(std::string const &filePath, bool prefetch) : status(Status::OPEN_FAILED), pData(nullptr), length(0)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+    {
+        status = Status::NOT_A_REGULAR_FILE;
+    }
+    else if (st.st_size < 2)
+    {
+        status = Status::TOO_SHORT;
+    }
+    else if (static_cast<size_t>(st.st_size) > MAX_PROG_FILE_LEN)
+    {
+        status = Status::TOO_LARGE;
+    }
+    else
+    {
+        length = static_cast<size_t>(st.st_size);
+        void *pMapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE | (prefetch ? MAP_POPULATE : 0), fd, 0);
+
+        if (pMapping == MAP_FAILED)
+        {
+            status = Status::MAPPING_FAILED;
+            length = 0;
+        }
+        else
+        {
+            ::madvise(pMapping, length, MADV_SEQUENTIAL);
+            pData = static_cast<uint8_t const *>(pMapping);
+
+            // the program bytes behind the load address occupy [offset, offset + length - 3]
+            uint32_t offset = pData[0] + (pData[1] << 8);
+            status = (offset + (length - 2) <= MAX_PROG_FILE_LEN + 1) ? Status::OK : Status::EXCEEDS_ADDRESS_SPACE;
+        }
+    }
+
+    ::close(fd);
+}
+
+ProgFile::~ProgFile()
+{
+    unmap();
+}
+
+ProgFile::ProgFile(ProgFile &&other) : status(other.status), pData(other.pData), length(other.length)
+{
+    other.pData = nullptr;
+    other.length = 0;
+    other.status = Status::OPEN_FAILED;
+}
+
+ProgFile &ProgFile::operator = (ProgFile &&other)
+{
+    if (this != &other)
+    {
+        unmap();
+        status = other.status;
+        pData = other.pData;
+        length = other.length;
+        other.pData = nullptr;
+        other.length = 0;
+        other.status = Status::OPEN_FAILED;
+    }
+
+    return *this;
+}
+
+void ProgFile::unmap()
+{
+    if (pData != nullptr)
+    {
+        ::munmap(const_cast<uint8_t *>(pData), length);
+        pData = nullptr;
+    }
+}
+
+bool ProgFile::hasProgSuffix(std::string const &filePath)
+{
+    std::string fileSuffix = filePath.length() > 4 ? filePath.substr(filePath.length() - 4, 4) : "";
+    return (fileSuffix == ".PRG" || fileSuffix == ".prg");
+}
+
+char const *ProgFile::getStatusText(Status status)
+{
+    switch (status)
+    {
+        case Status::OK: return "ok";
+        case Status::OPEN_FAILED: return "could not be opened";
+        case Status::NOT_A_REGULAR_FILE: return "is not a regular file";
+        case Status::TOO_SHORT: return "is too short to hold a load address";
+        case Status::TOO_LARGE: return "is larger than 64K";
+        case Status::EXCEEDS_ADDRESS_SPACE: return "does not fit into memory at its load address";
+        case Status::MAPPING_FAILED: return "could not be mapped into memory";
+    }
+
+    return "unknown error";
+}
@@ -0,0 +1,58 @@
+#ifndef PROG_FILE_H
+#define PROG_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace d64
+{
+
+// A '.prg' file mapped read-only into memory. The first two bytes hold the load address,
+// the program must fit into the 64K address space of the C64.
+class ProgFile
+{
+public:
+    static constexpr size_t MAX_PROG_FILE_LEN = 65535;
+
+    enum class Status
+    {
+        OK,
+        OPEN_FAILED,
+        NOT_A_REGULAR_FILE,
+        TOO_SHORT, // no load address
+        TOO_LARGE,
+        EXCEEDS_ADDRESS_SPACE, // load address + program length beyond $FFFF
+        MAPPING_FAILED
+    };
+
+    // no file, like a moved-from one: OPEN_FAILED
+    ProgFile() : status(Status::OPEN_FAILED), pData(nullptr), length(0) {}
+    // prefetch reads the whole file while mapping it, otherwise its pages are read on first access
+    explicit ProgFile(std::string const &filePath, bool prefetch = false);
+    ~ProgFile();
+
+    ProgFile(ProgFile const &) = delete;
+    ProgFile &operator = (ProgFile const &) = delete;
+    ProgFile(ProgFile &&other);
+    ProgFile &operator = (ProgFile &&other);
+
+    Status getStatus() const { return status; }
+    // the mapped file content including the load address, only valid if getStatus() returns OK
+    uint8_t const *getData() const { return pData; }
+    size_t getLength() const { return length; }
+
+    static bool hasProgSuffix(std::string const &filePath);
+    static char const *getStatusText(Status status);
+
+private:
+    void unmap();
+
+    Status status;
+    uint8_t const *pData;
+    size_t length;
+};
+
+}
+
+#endif
@@ -0,0 +1,291 @@
+#include "Reader.h"
+
+#include <algorithm>
+
+// POSIX API to map the image
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+// the sector following sector in its chain, TrackSector::INVALID for the last sector or a link outside the image
+template <typename Geometry>
+uint16_t getNextSectorIdx(uint8_t const *pSector)
+{
+    // tracks start with 1 on the disk, a link to track 0 marks the last sector
+    return (pSector[0] == 0) ? TrackSector::INVALID :
+        Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(pSector[0] - 1), pSector[1]});
+}
+
+// the data bytes of a last sector, 0 if its byte 1 is not valid. 255 can only come from the DOS,
+// so it is a full sector in either format.
+size_t getLastSectorLength(uint8_t const *pSector, LastSectorFormat format)
+{
+    if (pSector[1] == 0xff)
+    {
+        return SectorLayout::DATA_BYTES_PER_SECTOR;
+    }
+    return (format == LastSectorFormat::LAST_BYTE_OFFSET) ? static_cast<size_t>(std::max(pSector[1], uint8_t(1)) - 1) : pSector[1];
+}
+
+}
+
+template <typename Geometry>
+typename BasicFileView<Geometry>::Chunk BasicFileView<Geometry>::Iterator::operator * () const
+{
+    uint8_t const *pSector = &pImage[sectorIdx * BasicReader<Geometry>::BYTES_PER_SECTOR];
+    // the last sector tells its used bytes in place of the sector link
+    size_t length = (pSector[0] == 0) ? getLastSectorLength(pSector, lastSectorFormat) : SectorLayout::DATA_BYTES_PER_SECTOR;
+    return Chunk{&pSector[2], length};
+}
+
+template <typename Geometry>
+typename BasicFileView<Geometry>::Iterator &BasicFileView<Geometry>::Iterator::operator ++ ()
+{
+    uint8_t const *pSector = &pImage[sectorIdx * BasicReader<Geometry>::BYTES_PER_SECTOR];
+    sectorIdx = (++numSectors < Geometry::NUM_SECTORS) ? getNextSectorIdx<Geometry>(pSector) : TrackSector::INVALID;
+    return *this;
+}
+
+template <typename Geometry>
+size_t BasicFileView<Geometry>::getLength() const
+{
+    size_t ret = 0;
+    for (Chunk chunk : *this)
+    {
+        ret += chunk.length;
+    }
+    return ret;
+}
+
+template <typename Geometry>
+uint16_t BasicFileView<Geometry>::getNumberOfSectors() const
+{
+    uint16_t ret = 0;
+    for (auto it = begin(); it != end(); ++it)
+    {
+        ++ret;
+    }
+    return ret;
+}
+
+template <typename Geometry>
+bool BasicFileView<Geometry>::isComplete() const
+{
+    uint16_t lastSectorIdx = TrackSector::INVALID;
+    uint16_t numSectors = 0;
+    for (auto it = begin(); it != end(); ++it)
+    {
+        lastSectorIdx = it.getSectorIdx();
+        ++numSectors;
+    }
+
+    if ((lastSectorIdx == TrackSector::INVALID) || (numSectors == Geometry::NUM_SECTORS))
+    {
+        return false;
+    }
+
+    uint8_t const *pLastSector = &pImage[lastSectorIdx * BasicReader<Geometry>::BYTES_PER_SECTOR];
+    return (pLastSector[0] == 0) && (getLastSectorLength(pLastSector, lastSectorFormat) > 0);
+}
+
+template <typename Geometry>
+void BasicFileView<Geometry>::copyTo(std::vector<uint8_t> &out) const
+{
+    for (Chunk chunk : *this)
+    {
+        out.insert(out.end(), chunk.pData, chunk.pData + chunk.length);
+    }
+}
+
+template <typename Geometry>
+BasicReader<Geometry>::BasicReader(std::string const &imagePath) :
+    status(Status::OPEN_FAILED), pImage(nullptr), mappedLength(0), lastSectorFormat(LastSectorFormat::BYTE_COUNT)
+{
+    int fd = ::open(imagePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+    {
+        status = Status::NOT_A_REGULAR_FILE;
+    }
+    else if ((static_cast<size_t>(st.st_size) != IMAGE_SIZE) && (static_cast<size_t>(st.st_size) != IMAGE_SIZE + NUM_SECTORS))
+    {
+        status = Status::WRONG_SIZE;
+    }
+    else
+    {
+        void *pMapping = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (pMapping == MAP_FAILED)
+        {
+            status = Status::MAPPING_FAILED;
+        }
+        else
+        {
+            // directory and file chains are read in an order which does not follow the file offsets
+            ::madvise(pMapping, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+            pImage = static_cast<uint8_t const *>(pMapping);
+            mappedLength = static_cast<size_t>(st.st_size);
+            status = Status::OK;
+        }
+    }
+
+    ::close(fd);
+}
+
+template <typename Geometry>
+BasicReader<Geometry>::BasicReader(uint8_t const *pImage, size_t length) :
+    status(((length == IMAGE_SIZE) || (length == IMAGE_SIZE + NUM_SECTORS)) ? Status::OK : Status::WRONG_SIZE),
+    pImage((status == Status::OK) ? pImage : nullptr), mappedLength(0), lastSectorFormat(LastSectorFormat::BYTE_COUNT)
+{
+}
+
+template <typename Geometry>
+BasicReader<Geometry>::~BasicReader()
+{
+    if (mappedLength > 0)
+    {
+        ::munmap(const_cast<uint8_t *>(pImage), mappedLength);
+    }
+}
+
+template <typename Geometry>
+char const *BasicReader<Geometry>::getStatusText(Status status)
+{
+    switch (status)
+    {
+        case Status::OK: return "is a valid image";
+        case Status::OPEN_FAILED: return "could not be opened";
+        case Status::NOT_A_REGULAR_FILE: return "is not a regular file";
+        case Status::WRONG_SIZE: return "does not have the size of an image";
+        case Status::MAPPING_FAILED: return "could not be mapped into memory";
+    }
+    return "";
+}
+
+template <typename Geometry>
+std::vector<typename BasicReader<Geometry>::FileEntry> const &BasicReader<Geometry>::getFiles() const
+{
+    std::call_once(indexed, [this]() { indexDirectory(); });
+    return files;
+}
+
+template <typename Geometry>
+typename BasicReader<Geometry>::FileEntry const *BasicReader<Geometry>::findFile(std::string const &name) const
+{
+    return findFile(makeD64FileName(name));
+}
+
+template <typename Geometry>
+typename BasicReader<Geometry>::FileEntry const *BasicReader<Geometry>::findFile(DirectoryName const &name) const
+{
+    std::call_once(indexed, [this]() { indexDirectory(); });
+    uint16_t idx = directory.find(name);
+    return (idx != Directory::INVALID) ? &files[idx] : nullptr;
+}
+
+template <typename Geometry>
+LastSectorFormat BasicReader<Geometry>::getLastSectorFormat() const
+{
+    std::call_once(indexed, [this]() { indexDirectory(); });
+    return lastSectorFormat;
+}
+
+template <typename Geometry>
+void BasicReader<Geometry>::indexDirectory() const
+{
+    if (status != Status::OK)
+    {
+        return;
+    }
+
+    files.reserve(Geometry::MAX_DIR_ENTRIES);
+
+    // follow the chain of directory sectors, it never leaves the directory track
+    uint16_t sectorIdx = Geometry::FIRST_DIR_SECTOR_IDX;
+    for (uint8_t dirSectorIdx = 0; (dirSectorIdx < Geometry::NUM_DIR_SECTORS) && (sectorIdx != TrackSector::INVALID); dirSectorIdx++)
+    {
+        uint8_t const *pSector = getSectorData(sectorIdx);
+
+        for (uint8_t entryIdx = 0; entryIdx < SectorLayout::DIR_ENTRIES_PER_SECTOR; entryIdx++)
+        {
+            uint8_t const *pEntry = &pSector[entryIdx * SectorLayout::BYTES_PER_DIR_ENTRY];
+            if (pEntry[2] == 0x00)
+            {
+                continue; // unused or deleted
+            }
+
+            FileEntry entry;
+            entry.slot = dirSectorIdx * SectorLayout::DIR_ENTRIES_PER_SECTOR + entryIdx;
+            std::copy(&pEntry[5], &pEntry[5 + entry.name.size()], entry.name.begin());
+            entry.type = pEntry[2];
+            entry.firstSector = TrackSector{static_cast<uint8_t>(pEntry[3] - 1), pEntry[4]};
+            entry.numberOfBlocks = static_cast<uint16_t>(pEntry[30] + (pEntry[31] << 8));
+
+            // of several entries with the same name, the first one is found by name
+            if (directory.find(entry.name) == Directory::INVALID)
+            {
+                directory.add(static_cast<uint16_t>(files.size()), entry.name);
+            }
+            files.push_back(entry);
+        }
+
+        uint16_t nextSectorIdx = getNextSectorIdx<Geometry>(pSector);
+        bool onDirectoryTrack = (pSector[0] == Geometry::DIRECTORY_TRACK + 1);
+        sectorIdx = onDirectoryTrack ? nextSectorIdx : TrackSector::INVALID;
+    }
+
+    detectLastSectorFormat();
+}
+
+template <typename Geometry>
+void BasicReader<Geometry>::detectLastSectorFormat() const
+{
+    // 1 is valid for the Writer only, 255 for the DOS only, the values in between for both
+    bool hasWriterValue = false;
+    bool hasDosValue = false;
+    for (auto const &entry : files)
+    {
+        FileView view(pImage, Geometry::getSectorIdx(entry.firstSector), LastSectorFormat::BYTE_COUNT);
+        uint16_t lastSectorIdx = TrackSector::INVALID;
+        for (auto it = view.begin(); it != view.end(); ++it)
+        {
+            lastSectorIdx = it.getSectorIdx();
+        }
+
+        uint8_t const *pLastSector = (lastSectorIdx != TrackSector::INVALID) ? getSectorData(lastSectorIdx) : nullptr;
+        if ((pLastSector != nullptr) && (pLastSector[0] == 0))
+        {
+            hasWriterValue = hasWriterValue || (pLastSector[1] == 1);
+            hasDosValue = hasDosValue || (pLastSector[1] == 0xff);
+        }
+    }
+
+    lastSectorFormat = (hasDosValue && !hasWriterValue) ? LastSectorFormat::LAST_BYTE_OFFSET : LastSectorFormat::BYTE_COUNT;
+}
+
+namespace d64
+{
+
+template class BasicFileView<D64Geometry>;
+template class BasicFileView<D64ExtendedGeometry>;
+template class BasicFileView<D71Geometry>;
+template class BasicFileView<D81Geometry>;
+
+template class BasicReader<D64Geometry>;
+template class BasicReader<D64ExtendedGeometry>;
+template class BasicReader<D71Geometry>;
+template class BasicReader<D81Geometry>;
+
+}
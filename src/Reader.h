@@ -0,0 +1,162 @@
+#ifndef READER_H
+#define READER_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "DiskGeometry.h"
+#include "DirectoryIndex.h"
+
+namespace d64
+{
+
+template <typename Geometry>
+class BasicReader;
+
+// What byte 1 of the last sector of a file holds. The Writer stores the number of data bytes,
+// 1 to 254, the 1541 DOS the offset of the last data byte, 2 to 255, which is one more.
+enum class LastSectorFormat
+{
+    BYTE_COUNT, // as the Writer writes it
+    LAST_BYTE_OFFSET // as the DOS writes it
+};
+
+// The content of a file as a view over its sector chain, nothing is copied. Iterating yields
+// the data bytes of one sector after the other. The chain ends at its last sector, at a link
+// outside the image, or after as many sectors as the image has, so broken chains and cycles
+// cannot run away. The view is valid as long as its Reader.
+template <typename Geometry>
+class BasicFileView
+{
+public:
+    struct Chunk
+    {
+        uint8_t const *pData;
+        size_t length;
+    };
+
+    class Iterator
+    {
+    public:
+        Chunk operator * () const;
+        Iterator &operator ++ ();
+        bool operator == (Iterator const &rhs) const { return sectorIdx == rhs.sectorIdx; }
+        bool operator != (Iterator const &rhs) const { return sectorIdx != rhs.sectorIdx; }
+
+        uint16_t getSectorIdx() const { return sectorIdx; }
+
+    private:
+        friend BasicFileView;
+        Iterator(uint8_t const *pImage, uint16_t sectorIdx, LastSectorFormat lastSectorFormat) :
+            pImage(pImage), sectorIdx(sectorIdx), numSectors(0), lastSectorFormat(lastSectorFormat) {}
+
+        uint8_t const *pImage;
+        uint16_t sectorIdx; // TrackSector::INVALID at the end
+        uint16_t numSectors; // visited so far
+        LastSectorFormat lastSectorFormat;
+    };
+
+    Iterator begin() const { return Iterator(pImage, firstSectorIdx, lastSectorFormat); }
+    Iterator end() const { return Iterator(pImage, TrackSector::INVALID, lastSectorFormat); }
+
+    // walks the chain
+    size_t getLength() const;
+    uint16_t getNumberOfSectors() const;
+    // true if the chain ends with a proper last sector
+    bool isComplete() const;
+    // appends the content
+    void copyTo(std::vector<uint8_t> &out) const;
+
+private:
+    friend class BasicReader<Geometry>;
+    BasicFileView(uint8_t const *pImage, uint16_t firstSectorIdx, LastSectorFormat lastSectorFormat) :
+        pImage(pImage), firstSectorIdx(firstSectorIdx), lastSectorFormat(lastSectorFormat) {}
+
+    uint8_t const *pImage;
+    uint16_t firstSectorIdx;
+    LastSectorFormat lastSectorFormat;
+};
+
+// Reads an existing image, either mapped read-only from a file or from memory. The directory
+// is read on the first lookup and indexed by name, so finding a file costs the same on a full
+// directory as on an empty one. File contents are handed out as views into the image.
+// The last sectors of the files tell how they were written: the image is read like the DOS
+// writes it if a file ends with a full last sector marked 255 and none with one marked 1, and
+// like the Writer writes it otherwise. An image written by the DOS without a full last sector
+// is read like one of the Writer, one byte too many per file; 255 is read as 254 bytes anyway.
+template <typename Geometry>
+class BasicReader
+{
+public:
+    using FileView = BasicFileView<Geometry>;
+    using Directory = BasicDirectoryIndex<Geometry::MAX_DIR_ENTRIES>;
+
+    static constexpr uint16_t NUM_SECTORS = Geometry::NUM_SECTORS;
+    static constexpr uint16_t BYTES_PER_SECTOR = SectorLayout::BYTES_PER_SECTOR;
+    static constexpr size_t IMAGE_SIZE = static_cast<size_t>(NUM_SECTORS) * BYTES_PER_SECTOR;
+
+    enum class Status
+    {
+        OK,
+        OPEN_FAILED,
+        NOT_A_REGULAR_FILE,
+        WRONG_SIZE, // neither the plain image nor the image followed by one error byte per sector
+        MAPPING_FAILED
+    };
+
+    struct FileEntry
+    {
+        uint16_t slot; // position in the directory
+        DirectoryName name;
+        uint8_t type; // 0x82 == .PRG
+        TrackSector firstSector;
+        uint16_t numberOfBlocks;
+    };
+
+    explicit BasicReader(std::string const &imagePath);
+    // the image bytes must outlive the reader
+    BasicReader(uint8_t const *pImage, size_t length);
+    ~BasicReader();
+
+    BasicReader(BasicReader const &) = delete;
+    BasicReader &operator = (BasicReader const &) = delete;
+
+    Status getStatus() const { return status; }
+    static char const *getStatusText(Status status);
+
+    uint8_t const *getImageData() const { return pImage; }
+    uint8_t const *getSectorData(uint16_t idx) const { return &pImage[idx * BYTES_PER_SECTOR]; }
+
+    // the files of the directory in directory order, deleted entries are left out
+    std::vector<FileEntry> const &getFiles() const;
+    // nullptr if there is no file with that name, the name is converted like the Writer does
+    FileEntry const *findFile(std::string const &name) const;
+    FileEntry const *findFile(DirectoryName const &name) const;
+
+    FileView getFile(FileEntry const &entry) const { return FileView(pImage, Geometry::getSectorIdx(entry.firstSector), getLastSectorFormat()); }
+    LastSectorFormat getLastSectorFormat() const;
+
+private:
+    void indexDirectory() const;
+    void detectLastSectorFormat() const;
+
+    Status status;
+    uint8_t const *pImage;
+    size_t mappedLength; // 0 if the image is not mapped by the reader
+
+    mutable std::once_flag indexed;
+    mutable std::vector<FileEntry> files;
+    mutable Directory directory; // slots of the index are positions in files
+    mutable LastSectorFormat lastSectorFormat;
+};
+
+using Reader = BasicReader<D64Geometry>;
+using FileView = BasicFileView<D64Geometry>;
+
+}
+
+#endif
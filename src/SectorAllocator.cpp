@@ -0,0 +1,420 @@
+#include "SectorAllocator.h"
+#include "BitOps.h"
+#include "Stats.h"
+
+#include <algorithm>
+
+using namespace d64;
+
+namespace
+{
+
+// interleave chain of a track, starting at sector 0: sector -> position and position -> sector
+template <typename Geometry>
+struct InterleaveChain
+{
+    uint8_t position[Geometry::MAX_SECTORS_ON_TRACK];
+    uint8_t sector[Geometry::MAX_SECTORS_ON_TRACK];
+};
+
+template <typename Geometry>
+struct InterleaveChains
+{
+    InterleaveChain<Geometry> track[Geometry::NUM_TRACKS];
+};
+
+template <typename Geometry>
+constexpr InterleaveChains<Geometry> makeInterleaveChains()
+{
+    InterleaveChains<Geometry> ret{};
+
+    for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+    {
+        uint8_t interleave = Geometry::getInterleaveOnTrack(trackIdx);
+        uint8_t numSectors = Geometry::getSectorsOnTrack(trackIdx);
+
+        // interleave and sectors per track are coprime for all zones, so the chain visits every sector
+        for (uint8_t pos = 0; pos < numSectors; pos++)
+        {
+            uint8_t sectorOnTrack = static_cast<uint8_t>((pos * interleave) % numSectors);
+            ret.track[trackIdx].sector[pos] = sectorOnTrack;
+            ret.track[trackIdx].position[sectorOnTrack] = pos;
+        }
+    }
+
+    return ret;
+}
+
+template <typename Geometry>
+constexpr InterleaveChains<Geometry> chains = makeInterleaveChains<Geometry>();
+
+// the file tracks ordered by the distance of their cylinder to the one of the directory, the
+// tracks below the directory first, resp. the first side
+template <typename Geometry>
+struct DistanceOrder
+{
+    uint8_t track[Geometry::NUM_TRACKS];
+    uint8_t position[Geometry::NUM_TRACKS];
+    uint8_t numTracks;
+};
+
+template <typename Geometry>
+constexpr uint16_t getDistanceKey(uint8_t track)
+{
+    uint8_t dirCylinder = Geometry::getCylinder(Geometry::DIRECTORY_TRACK);
+    uint8_t cylinder = Geometry::getCylinder(track);
+    uint8_t distance = (cylinder < dirCylinder) ? dirCylinder - cylinder : cylinder - dirCylinder;
+    return static_cast<uint16_t>((distance << 9) | ((cylinder > dirCylinder) << 8) | track);
+}
+
+template <typename Geometry>
+constexpr DistanceOrder<Geometry> makeDistanceOrder()
+{
+    DistanceOrder<Geometry> ret{};
+
+    // insertion sort, there are no more than 80 tracks
+    for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+    {
+        if (Geometry::isReservedTrack(trackIdx))
+        {
+            continue;
+        }
+
+        uint8_t pos = ret.numTracks++;
+        while ((pos > 0) && (getDistanceKey<Geometry>(ret.track[pos - 1]) > getDistanceKey<Geometry>(trackIdx)))
+        {
+            ret.track[pos] = ret.track[pos - 1];
+            --pos;
+        }
+        ret.track[pos] = trackIdx;
+    }
+
+    for (uint8_t pos = 0; pos < ret.numTracks; pos++)
+    {
+        ret.position[ret.track[pos]] = pos;
+    }
+    return ret;
+}
+
+template <typename Geometry>
+constexpr DistanceOrder<Geometry> distanceOrder = makeDistanceOrder<Geometry>();
+
+template <typename Geometry>
+constexpr bool isBelowDirectory(uint8_t track)
+{
+    return Geometry::getCylinder(track) < Geometry::getCylinder(Geometry::DIRECTORY_TRACK);
+}
+
+}
+
+template <typename Geometry>
+void BasicSectorAllocator<Geometry>::clear()
+{
+    numFreeSectors = 0;
+
+    for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+    {
+        Bits allFree = (Bits(1) << Geometry::getSectorsOnTrack(trackIdx)) - 1;
+        freeBits[trackIdx] = allFree;
+        freeChainBits[trackIdx] = allFree;
+
+        if (!Geometry::isReservedTrack(trackIdx))
+        {
+            numFreeSectors += Geometry::getSectorsOnTrack(trackIdx);
+        }
+    }
+}
+
+template <typename Geometry>
+void BasicSectorAllocator<Geometry>::loadTrack(uint8_t track, Bits freeSectorBits)
+{
+    uint8_t numSectors = Geometry::getSectorsOnTrack(track);
+    Bits bits = freeSectorBits & ((Bits(1) << numSectors) - 1);
+
+    if (!Geometry::isReservedTrack(track))
+    {
+        numFreeSectors = numFreeSectors - countSetBits(freeBits[track]) + countSetBits(bits);
+    }
+
+    freeBits[track] = bits;
+    freeChainBits[track] = 0;
+    for (uint8_t sectorOnTrack = 0; sectorOnTrack < numSectors; sectorOnTrack++)
+    {
+        if (bits & (Bits(1) << sectorOnTrack))
+        {
+            freeChainBits[track] |= (Bits(1) << chains<Geometry>.track[track].position[sectorOnTrack]);
+        }
+    }
+}
+
+template <typename Geometry>
+void BasicSectorAllocator<Geometry>::setOccupied(TrackSector ts)
+{
+    if (isAvailable(ts))
+    {
+        freeBits[ts.track] &= ~(Bits(1) << ts.sector);
+        freeChainBits[ts.track] &= ~(Bits(1) << chains<Geometry>.track[ts.track].position[ts.sector]);
+
+        if (!Geometry::isReservedTrack(ts.track))
+        {
+            --numFreeSectors;
+        }
+    }
+}
+
+template <typename Geometry>
+void BasicSectorAllocator<Geometry>::setFree(TrackSector ts)
+{
+    if (!isAvailable(ts))
+    {
+        freeBits[ts.track] |= (Bits(1) << ts.sector);
+        freeChainBits[ts.track] |= (Bits(1) << chains<Geometry>.track[ts.track].position[ts.sector]);
+
+        if (!Geometry::isReservedTrack(ts.track))
+        {
+            ++numFreeSectors;
+        }
+    }
+}
+
+template <typename Geometry>
+uint8_t BasicSectorAllocator<Geometry>::getNumberOfFreeSectorsOnTrack(uint8_t track) const
+{
+    return countSetBits(freeBits[track]);
+}
+
+template <typename Geometry>
+TrackSector BasicSectorAllocator<Geometry>::getFirstFree() const
+{
+    return getNextFree(TrackSector{0, 0});
+}
+
+template <typename Geometry>
+TrackSector BasicSectorAllocator<Geometry>::getNextFree(TrackSector previous) const
+{
+    auto const &chain = chains<Geometry>;
+    uint8_t trackIdx = previous.track;
+
+    if (!Geometry::isReservedTrack(trackIdx))
+    {
+        // chain positions from the previous sector onwards first, then wrap around on the same track
+        Bits chainBits = freeChainBits[trackIdx];
+        Bits ahead = chainBits & (~Bits(0) << chain.track[trackIdx].position[previous.sector]);
+        Bits candidates = ahead ? ahead : chainBits;
+
+        if (candidates)
+        {
+            D64_STATS_COUNT(numProbes, 1);
+            return TrackSector{trackIdx, chain.track[trackIdx].sector[lowestSetBit(candidates)]};
+        }
+    }
+
+    // track is full, continue with the chain start (sector 0) of the following tracks
+    for (uint8_t i = 1; i < NUM_TRACKS; i++)
+    {
+        trackIdx = (trackIdx + 1 < NUM_TRACKS) ? trackIdx + 1 : 0;
+        Bits chainBits = freeChainBits[trackIdx];
+
+        if (!Geometry::isReservedTrack(trackIdx) && chainBits)
+        {
+            D64_STATS_COUNT(numProbes, i + 1);
+            return TrackSector{trackIdx, chain.track[trackIdx].sector[lowestSetBit(chainBits)]};
+        }
+    }
+
+    D64_STATS_COUNT(numProbes, NUM_TRACKS);
+    return TRACK_SECTOR_INVALID;
+}
+
+template <typename Geometry>
+TrackSector BasicSectorAllocator<Geometry>::getFirstFreeOnTrack(uint8_t track, uint8_t interleave) const
+{
+    Bits bits = (interleave == 0) ? freeChainBits[track] : freeBits[track];
+    if (bits == 0)
+    {
+        return TRACK_SECTOR_INVALID;
+    }
+
+    uint8_t bit = lowestSetBit(bits);
+    return TrackSector{track, (interleave == 0) ? chains<Geometry>.track[track].sector[bit] : bit};
+}
+
+template <typename Geometry>
+uint8_t BasicSectorAllocator<Geometry>::findNearestFreeTrack(uint8_t firstPos, bool isSameSideOnly, bool isBelow) const
+{
+    auto const &order = distanceOrder<Geometry>;
+    for (uint8_t pos = firstPos; pos < order.numTracks; pos++)
+    {
+        uint8_t trackIdx = order.track[pos];
+        if ((freeBits[trackIdx] != 0) && (!isSameSideOnly || (isBelowDirectory<Geometry>(trackIdx) == isBelow)))
+        {
+            D64_STATS_COUNT(numProbes, pos - firstPos + 1);
+            return trackIdx;
+        }
+    }
+    D64_STATS_COUNT(numProbes, order.numTracks - std::min(firstPos, order.numTracks));
+    return NUM_TRACKS;
+}
+
+template <typename Geometry>
+TrackSector BasicSectorAllocator<Geometry>::getFirstFree(AllocationPolicy const &policy) const
+{
+    if (policy.isDefault())
+    {
+        return getFirstFree();
+    }
+
+    if (policy.placement == Placement::LINEAR)
+    {
+        for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+        {
+            if (!Geometry::isReservedTrack(trackIdx) && (freeBits[trackIdx] != 0))
+            {
+                return getFirstFreeOnTrack(trackIdx, policy.interleave);
+            }
+        }
+        return TRACK_SECTOR_INVALID;
+    }
+
+    uint8_t trackIdx = findNearestFreeTrack(0, false, false);
+    return (trackIdx < NUM_TRACKS) ? getFirstFreeOnTrack(trackIdx, policy.interleave) : TRACK_SECTOR_INVALID;
+}
+
+template <typename Geometry>
+TrackSector BasicSectorAllocator<Geometry>::getNextFree(TrackSector previous, AllocationPolicy const &policy) const
+{
+    if (policy.isDefault())
+    {
+        return getNextFree(previous);
+    }
+
+    uint8_t trackIdx = previous.track;
+    if (!Geometry::isReservedTrack(trackIdx) && (freeBits[trackIdx] != 0))
+    {
+        D64_STATS_COUNT(numProbes, 1);
+        if (policy.interleave == 0)
+        {
+            // the interleave chain of the track, as getNextFree() does
+            Bits chainBits = freeChainBits[trackIdx];
+            Bits ahead = chainBits & (~Bits(0) << chains<Geometry>.track[trackIdx].position[previous.sector]);
+            return TrackSector{trackIdx, chains<Geometry>.track[trackIdx].sector[lowestSetBit(ahead ? ahead : chainBits)]};
+        }
+
+        // the first free sector from previous + interleave on, wrapping around the track
+        uint8_t target = static_cast<uint8_t>((previous.sector + policy.interleave) % Geometry::getSectorsOnTrack(trackIdx));
+        Bits ahead = freeBits[trackIdx] & (~Bits(0) << target);
+        return TrackSector{trackIdx, lowestSetBit(ahead ? ahead : freeBits[trackIdx])};
+    }
+
+    // the track is full
+    switch (policy.placement)
+    {
+        case Placement::LINEAR:
+            for (uint8_t i = 1; i < NUM_TRACKS; i++)
+            {
+                trackIdx = (trackIdx + 1 < NUM_TRACKS) ? trackIdx + 1 : 0;
+                if (!Geometry::isReservedTrack(trackIdx) && (freeBits[trackIdx] != 0))
+                {
+                    D64_STATS_COUNT(numProbes, i + 1);
+                    return getFirstFreeOnTrack(trackIdx, policy.interleave);
+                }
+            }
+            D64_STATS_COUNT(numProbes, NUM_TRACKS);
+            return TRACK_SECTOR_INVALID;
+
+        case Placement::DOS:
+            // further outward on the same side first
+            if (!Geometry::isReservedTrack(trackIdx))
+            {
+                uint8_t nextTrackIdx = findNearestFreeTrack(distanceOrder<Geometry>.position[trackIdx] + 1, true,
+                                                            isBelowDirectory<Geometry>(trackIdx));
+                if (nextTrackIdx < NUM_TRACKS)
+                {
+                    return getFirstFreeOnTrack(nextTrackIdx, policy.interleave);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    trackIdx = findNearestFreeTrack(0, false, false);
+    return (trackIdx < NUM_TRACKS) ? getFirstFreeOnTrack(trackIdx, policy.interleave) : TRACK_SECTOR_INVALID;
+}
+
+template <typename Geometry>
+BasicAtomicSectorAllocator<Geometry>::BasicAtomicSectorAllocator(Allocator const &allocator) :
+    numUnreserved(allocator.getNumberOfFreeSectors())
+{
+    for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+    {
+        // the reserved tracks are never handed out
+        freeChainBits[trackIdx].store(Geometry::isReservedTrack(trackIdx) ? 0 : allocator.freeChainBits[trackIdx]);
+    }
+}
+
+template <typename Geometry>
+bool BasicAtomicSectorAllocator<Geometry>::reserve(uint16_t numSectors)
+{
+    uint16_t available = numUnreserved.load();
+    do
+    {
+        if (available < numSectors)
+        {
+            return false;
+        }
+    } while (!numUnreserved.compare_exchange_weak(available, static_cast<uint16_t>(available - numSectors)));
+    return true;
+}
+
+template <typename Geometry>
+TrackSector BasicAtomicSectorAllocator<Geometry>::takeOnTrack(uint8_t track, uint8_t firstPos)
+{
+    // the sector contents are published by the Writer's lock resp. by joining the threads,
+    // the bitmaps only have to hand out each sector once
+    Bits bits = freeChainBits[track].load(std::memory_order_relaxed);
+    while (bits != 0)
+    {
+        Bits ahead = bits & (~Bits(0) << firstPos);
+        uint8_t pos = lowestSetBit(ahead ? ahead : bits);
+        if (freeChainBits[track].compare_exchange_weak(bits, bits & ~(Bits(1) << pos), std::memory_order_relaxed))
+        {
+            return TrackSector{track, chains<Geometry>.track[track].sector[pos]};
+        }
+    }
+    return TRACK_SECTOR_INVALID;
+}
+
+template <typename Geometry>
+TrackSector BasicAtomicSectorAllocator<Geometry>::takeNext(TrackSector previous, uint32_t &numProbes)
+{
+    uint8_t trackIdx = previous.track;
+    TrackSector ret = takeOnTrack(trackIdx, chains<Geometry>.track[trackIdx].position[previous.sector]);
+    uint16_t probes = 1;
+
+    // a reservation guarantees a free sector, sectors are only ever taken
+    while (ret == TRACK_SECTOR_INVALID)
+    {
+        trackIdx = (trackIdx + 1 < NUM_TRACKS) ? trackIdx + 1 : 0;
+        ret = takeOnTrack(trackIdx, 0);
+        ++probes;
+    }
+    numProbes += probes;
+    return ret;
+}
+
+namespace d64
+{
+
+template class BasicSectorAllocator<D64Geometry>;
+template class BasicSectorAllocator<D64ExtendedGeometry>;
+template class BasicSectorAllocator<D71Geometry>;
+template class BasicSectorAllocator<D81Geometry>;
+
+template class BasicAtomicSectorAllocator<D64Geometry>;
+template class BasicAtomicSectorAllocator<D64ExtendedGeometry>;
+template class BasicAtomicSectorAllocator<D71Geometry>;
+template class BasicAtomicSectorAllocator<D81Geometry>;
+
+}
@@ -0,0 +1,119 @@
+#ifndef SECTOR_ALLOCATOR_H
+#define SECTOR_ALLOCATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#include "DiskGeometry.h"
+#include "AllocationPolicy.h"
+
+namespace d64
+{
+
+// In-memory index over the BAM which hands out free sectors in interleave order.
+// Per track it keeps the free sectors twice: once in natural order (bit n == sector n,
+// same as the BAM) and once in the order of the interleave chain starting at sector 0
+// (bit p == p-th sector of the chain), so the next free sector is a single bit scan.
+template <typename Geometry>
+class BasicAtomicSectorAllocator;
+
+template <typename Geometry>
+class BasicSectorAllocator
+{
+public:
+    static constexpr uint8_t NUM_TRACKS = Geometry::NUM_TRACKS;
+    static constexpr uint8_t DIRECTORY_TRACK = Geometry::DIRECTORY_TRACK;
+    static constexpr uint8_t MAX_SECTORS_ON_TRACK = Geometry::MAX_SECTORS_ON_TRACK;
+    static constexpr TrackSector TRACK_SECTOR_INVALID = {255, 255};
+
+    // one bit per sector of a track
+    using Bits = std::conditional_t<(MAX_SECTORS_ON_TRACK > 32), uint64_t, uint32_t>;
+
+    BasicSectorAllocator() : numProbes(0) { clear(); }
+
+    // marks all sectors as free
+    void clear();
+    // sets the free sectors of a track from its BAM bitmap
+    void loadTrack(uint8_t track, Bits freeSectorBits);
+
+    bool isAvailable(TrackSector ts) const { return (freeBits[ts.track] & (Bits(1) << ts.sector)) != 0; }
+    void setOccupied(TrackSector ts);
+    void setFree(TrackSector ts);
+
+    // number of free sectors, the reserved tracks (e.g. the directory track) are not counted
+    uint16_t getNumberOfFreeSectors() const { return numFreeSectors; }
+    uint8_t getNumberOfFreeSectorsOnTrack(uint8_t track) const;
+
+    TrackSector getFirstFree() const;
+    // first free sector following previous in interleave order, continues on the next tracks
+    TrackSector getNextFree(TrackSector previous) const;
+
+    // the same with the tracks and the interleave of a policy, the default policy gives the
+    // sectors of the functions above. A custom interleave takes the first free sector from
+    // previous + interleave on, like the DOS does.
+    TrackSector getFirstFree(AllocationPolicy const &policy) const;
+    TrackSector getNextFree(TrackSector previous, AllocationPolicy const &policy) const;
+
+    // the tracks looked at by the functions above since the last call, for the stats. Counted
+    // only with D64_ENABLE_STATS.
+    uint32_t takeNumberOfProbes() const
+    {
+        uint32_t ret = numProbes;
+        numProbes = 0;
+        return ret;
+    }
+
+private:
+    friend BasicAtomicSectorAllocator<Geometry>;
+
+    TrackSector getFirstFreeOnTrack(uint8_t track, uint8_t interleave) const;
+    // free track nearest to the directory, from the position in the distance order on and on
+    // the given side of the directory only if requested. NUM_TRACKS if there is none.
+    uint8_t findNearestFreeTrack(uint8_t firstPos, bool isSameSideOnly, bool isBelow) const;
+
+    Bits freeBits[NUM_TRACKS];
+    Bits freeChainBits[NUM_TRACKS];
+    uint16_t numFreeSectors;
+    mutable uint32_t numProbes;
+};
+
+// Lock-free variant for several threads taking sectors at the same time, see ConcurrentWriter.
+// It starts with the free sectors of an allocator and only takes sectors away. A thread first
+// reserves the number of sectors of its file, then takes them one by one: each sector is claimed
+// by a compare-and-swap on the bitmap of its track, so no sector goes to two threads.
+template <typename Geometry>
+class BasicAtomicSectorAllocator
+{
+public:
+    using Allocator = BasicSectorAllocator<Geometry>;
+    using Bits = typename Allocator::Bits;
+
+    static constexpr uint8_t NUM_TRACKS = Geometry::NUM_TRACKS;
+    static constexpr TrackSector TRACK_SECTOR_INVALID = {255, 255};
+
+    explicit BasicAtomicSectorAllocator(Allocator const &allocator);
+
+    // false if fewer sectors are free and not reserved
+    bool reserve(uint16_t numSectors);
+
+    // a reserved sector, in the order of BasicSectorAllocator::getFirstFree() resp. getNextFree().
+    // numProbes is increased by the number of tracks looked at.
+    TrackSector takeFirst(uint32_t &numProbes) { return takeNext(TrackSector{0, 0}, numProbes); }
+    TrackSector takeNext(TrackSector previous, uint32_t &numProbes);
+
+    uint16_t getNumberOfUnreservedSectors() const { return numUnreserved.load(); }
+
+private:
+    // the first free sector from the chain position on, wrapping around the track, INVALID if it is full
+    TrackSector takeOnTrack(uint8_t track, uint8_t firstPos);
+
+    std::atomic<Bits> freeChainBits[NUM_TRACKS];
+    std::atomic<uint16_t> numUnreserved;
+};
+
+using SectorAllocator = BasicSectorAllocator<D64Geometry>;
+
+}
+
+#endif
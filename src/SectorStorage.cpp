@@ -0,0 +1,230 @@
+#include <cstring> // std::memset, std::memcpy
+
+#include "SectorStorage.h"
+#include "DiskGeometry.h"
+
+using namespace d64;
+
+namespace
+{
+
+// lives in .bss, the pages are backed by the shared zero page of the OS as they are only read.
+// Large enough for the largest format, all sizes of storages share it.
+uint8_t const zeroImage[SectorStorage::MAX_NUM_SECTORS * SectorStorage::BYTES_PER_SECTOR] = {};
+
+}
+
+SectorPool &SectorPool::getDefault()
+{
+    static SectorPool pool;
+    return pool;
+}
+
+uint8_t *SectorPool::acquire()
+{
+    uint8_t *pSlot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (freeSlots.empty())
+        {
+            chunks.emplace_back(new uint8_t[SLOTS_PER_CHUNK * SectorStorage::BYTES_PER_SECTOR]);
+            // room for all slots, so release() never allocates
+            freeSlots.reserve(chunks.size() * SLOTS_PER_CHUNK);
+            for (size_t slotIdx = SLOTS_PER_CHUNK; slotIdx > 0; slotIdx--)
+            {
+                freeSlots.push_back(&chunks.back()[(slotIdx - 1) * SectorStorage::BYTES_PER_SECTOR]);
+            }
+        }
+
+        pSlot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    std::memset(pSlot, 0x00, SectorStorage::BYTES_PER_SECTOR);
+    return pSlot;
+}
+
+void SectorPool::release(uint8_t *pSlot)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    freeSlots.push_back(pSlot);
+}
+
+size_t SectorPool::getNumberOfSlotsInUse() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return chunks.size() * SLOTS_PER_CHUNK - freeSlots.size();
+}
+
+template <uint16_t NumSectors>
+BasicSectorStorage<NumSectors>::BasicSectorStorage(Mode mode, SectorPool &pool) : mode(mode), pPool(&pool), numMaterialized(0)
+{
+    pages.fill(nullptr);
+    flags.fill(0);
+
+    if (mode == Mode::DENSE)
+    {
+        // value-initialized, i.e. zeroed
+        denseBytes.reset(new uint8_t[getSize()]());
+        for (uint16_t idx = 0; idx < NUM_SECTORS; idx++)
+        {
+            pages[idx] = &denseBytes[idx * BYTES_PER_SECTOR];
+        }
+        numMaterialized = NUM_SECTORS;
+    }
+}
+
+template <uint16_t NumSectors>
+BasicSectorStorage<NumSectors>::BasicSectorStorage(BasicSectorStorage const &other) : BasicSectorStorage(other.mode, *other.pPool)
+{
+    copyFrom(other);
+}
+
+template <uint16_t NumSectors>
+BasicSectorStorage<NumSectors> &BasicSectorStorage<NumSectors>::operator = (BasicSectorStorage const &other)
+{
+    if ((this != &other) && (mode == other.mode))
+    {
+        clear();
+        copyFrom(other);
+    }
+    else if (this != &other)
+    {
+        BasicSectorStorage copy(other);
+        releaseAll();
+        mode = copy.mode;
+        pPool = copy.pPool;
+        denseBytes = std::move(copy.denseBytes);
+        pages = copy.pages;
+        flags = copy.flags;
+        numMaterialized = copy.numMaterialized;
+        copy.pages.fill(nullptr);
+        copy.numMaterialized = 0;
+    }
+
+    return *this;
+}
+
+template <uint16_t NumSectors>
+BasicSectorStorage<NumSectors>::~BasicSectorStorage()
+{
+    releaseAll();
+}
+
+template <uint16_t NumSectors>
+void BasicSectorStorage<NumSectors>::clearSector(uint16_t idx)
+{
+    if (mode == Mode::DENSE)
+    {
+        std::memset(pages[idx], 0x00, BYTES_PER_SECTOR);
+    }
+    else if (pages[idx] != nullptr)
+    {
+        pPool->release(pages[idx]);
+        pages[idx] = nullptr;
+        --numMaterialized;
+    }
+    flags[idx] = DIRTY;
+}
+
+template <uint16_t NumSectors>
+void BasicSectorStorage<NumSectors>::clear()
+{
+    if (mode == Mode::DENSE)
+    {
+        for (uint16_t idx = 0; idx < NUM_SECTORS; idx++)
+        {
+            if (flags[idx] & TOUCHED)
+            {
+                std::memset(pages[idx], 0x00, BYTES_PER_SECTOR);
+            }
+        }
+    }
+    else
+    {
+        releaseAll();
+    }
+    flags.fill(0);
+}
+
+template <uint16_t NumSectors>
+uint16_t BasicSectorStorage<NumSectors>::getNumberOfDirtySectors() const
+{
+    uint16_t ret = 0;
+    for (uint8_t sectorFlags : flags)
+    {
+        ret += ((sectorFlags & DIRTY) != 0);
+    }
+    return ret;
+}
+
+template <uint16_t NumSectors>
+void BasicSectorStorage<NumSectors>::markClean()
+{
+    for (uint8_t &sectorFlags : flags)
+    {
+        sectorFlags &= static_cast<uint8_t>(~DIRTY);
+    }
+}
+
+template <uint16_t NumSectors>
+uint8_t const *BasicSectorStorage<NumSectors>::getZeroSector(uint16_t idx)
+{
+    return &zeroImage[idx * BYTES_PER_SECTOR];
+}
+
+template <uint16_t NumSectors>
+uint8_t *BasicSectorStorage<NumSectors>::materialize(uint16_t idx)
+{
+    pages[idx] = pPool->acquire();
+    ++numMaterialized;
+    return pages[idx];
+}
+
+template <uint16_t NumSectors>
+void BasicSectorStorage<NumSectors>::releaseAll()
+{
+    if (mode == Mode::SPARSE)
+    {
+        for (auto &pSector : pages)
+        {
+            if (pSector != nullptr)
+            {
+                pPool->release(pSector);
+                pSector = nullptr;
+            }
+        }
+        numMaterialized = 0;
+    }
+}
+
+template <uint16_t NumSectors>
+void BasicSectorStorage<NumSectors>::copyFrom(BasicSectorStorage const &other)
+{
+    if (mode == Mode::DENSE)
+    {
+        std::memcpy(denseBytes.get(), other.denseBytes.get(), getSize());
+        flags = other.flags;
+    }
+    else
+    {
+        for (uint16_t idx = 0; idx < NUM_SECTORS; idx++)
+        {
+            if (other.pages[idx] != nullptr)
+            {
+                std::memcpy(getSector(idx), other.pages[idx], BYTES_PER_SECTOR);
+            }
+        }
+    }
+}
+
+namespace d64
+{
+
+template class BasicSectorStorage<D64Geometry::NUM_SECTORS>;
+template class BasicSectorStorage<D64ExtendedGeometry::NUM_SECTORS>;
+template class BasicSectorStorage<D71Geometry::NUM_SECTORS>;
+template class BasicSectorStorage<D81Geometry::NUM_SECTORS>;
+
+}
@@ -0,0 +1,145 @@
+#ifndef SECTOR_STORAGE_H
+#define SECTOR_STORAGE_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "TrackSector.h"
+
+namespace d64
+{
+
+// Thread-safe pool of 256 byte sector slots, shared by the sparse SectorStorages.
+// Slots are carved out of larger chunks and recycled, chunks are never returned.
+class SectorPool
+{
+public:
+    static constexpr size_t SLOTS_PER_CHUNK = 64;
+
+    static SectorPool &getDefault();
+
+    // a zeroed slot
+    uint8_t *acquire();
+    void release(uint8_t *pSlot);
+
+    size_t getNumberOfSlotsInUse() const;
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<uint8_t[]>> chunks;
+    std::vector<uint8_t *> freeSlots;
+};
+
+enum class StorageMode
+{
+    DENSE,
+    SPARSE
+};
+
+// The sectors of an image. DENSE keeps all sectors in one contiguous block. SPARSE keeps a page
+// table over the sectors: untouched sectors read as shared read-only zeros and get a slot from
+// the pool when they are written first. Both modes read back the same bytes.
+template <uint16_t NumSectors>
+class BasicSectorStorage
+{
+public:
+    static constexpr uint16_t NUM_SECTORS = NumSectors;
+    static constexpr uint16_t BYTES_PER_SECTOR = 256;
+    static constexpr uint16_t MAX_NUM_SECTORS = 3200; // of all formats, the zero sectors cover this many
+
+    static_assert(NUM_SECTORS <= MAX_NUM_SECTORS, "image is larger than the zero sectors");
+
+    using Mode = StorageMode;
+
+    explicit BasicSectorStorage(Mode mode = Mode::DENSE, SectorPool &pool = SectorPool::getDefault());
+    BasicSectorStorage(BasicSectorStorage const &other);
+    BasicSectorStorage &operator = (BasicSectorStorage const &other);
+    ~BasicSectorStorage();
+
+    Mode getMode() const { return mode; }
+
+    // writable sector, materializes it in sparse mode
+    uint8_t *getSector(uint16_t idx)
+    {
+        uint8_t *pSector = pages[idx];
+        flags[idx] = TOUCHED | DIRTY;
+        return (pSector != nullptr) ? pSector : materialize(idx);
+    }
+
+    uint8_t const *getSector(uint16_t idx) const
+    {
+        uint8_t const *pSector = pages[idx];
+        return (pSector != nullptr) ? pSector : getZeroSector(idx);
+    }
+
+    // zeroes a sector, in sparse mode it goes back to the pool
+    void clearSector(uint16_t idx);
+    // zeroes all sectors. Only the sectors handed out writable since the last clear() are
+    // touched, so clearing an image with a few small files is cheap in dense mode too.
+    void clear();
+
+    // all bytes in one block in dense mode, nullptr in sparse mode
+    uint8_t const *getData() const { return denseBytes.get(); }
+    size_t getSize() const { return static_cast<size_t>(NUM_SECTORS) * BYTES_PER_SECTOR; }
+    uint16_t getNumberOfMaterializedSectors() const { return numMaterialized; }
+
+    // A sector is dirty once it has been handed out writable or cleared since the last markClean(),
+    // so an image loaded from a file and modified can be written back sector by sector
+    bool isDirty(uint16_t idx) const { return (flags[idx] & DIRTY) != 0; }
+    uint16_t getNumberOfDirtySectors() const;
+    void markClean();
+
+    // calls consumer(pBytes, length) for runs of adjacent sectors which are contiguous in memory,
+    // in the order of the image. Stops and returns false as soon as the consumer returns false.
+    template <typename Consumer>
+    bool forEachRun(Consumer consumer) const
+    {
+        uint16_t idx = 0;
+        while (idx < NUM_SECTORS)
+        {
+            uint8_t const *pRun = getSector(idx);
+            size_t length = BYTES_PER_SECTOR;
+
+            for (++idx; (idx < NUM_SECTORS) && (getSector(idx) == pRun + length); ++idx)
+            {
+                length += BYTES_PER_SECTOR;
+            }
+
+            if (!consumer(pRun, length))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // read-only zeros standing in for an untouched sector. The zero sectors of adjacent indices
+    // are adjacent in memory, so runs of untouched sectors are serialized in one go.
+    static uint8_t const *getZeroSector(uint16_t idx);
+
+private:
+    static constexpr uint8_t TOUCHED = 0x01; // the sector may hold non-zero bytes
+    static constexpr uint8_t DIRTY = 0x02;
+
+    uint8_t *materialize(uint16_t idx);
+    void releaseAll();
+    void copyFrom(BasicSectorStorage const &other);
+
+    Mode mode;
+    SectorPool *pPool;
+    std::unique_ptr<uint8_t[]> denseBytes;
+    std::array<uint8_t *, NUM_SECTORS> pages;
+    std::array<uint8_t, NUM_SECTORS> flags; // TOUCHED, DIRTY
+    uint16_t numMaterialized;
+};
+
+using SectorStorage = BasicSectorStorage<TrackSector::NUM_SECTORS>;
+
+}
+
+#endif
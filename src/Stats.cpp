@@ -0,0 +1,109 @@
+#include "Stats.h"
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+constexpr int NUM_COUNTERS = static_cast<int>(stats::Counter::NUM_COUNTERS);
+constexpr int NUM_PHASES = static_cast<int>(stats::Phase::NUM_PHASES);
+
+char const *const counterNames[NUM_COUNTERS] =
+{
+    "filesRead",
+    "bytesRead",
+    "bytesWritten",
+    "imagesWritten",
+    "sectorsAllocated",
+    "allocationProbes",
+    "directorySearches",
+    "skippedNotPrg",
+    "rejectedUnreadable",
+    "rejectedTooShort",
+    "rejectedTooLarge",
+    "rejectedExceedsAddressSpace",
+    "rejectedNoRoom"
+};
+
+char const *const phaseNames[NUM_PHASES] =
+{
+    "scan",
+    "read",
+    "layout",
+    "directory",
+    "serialize"
+};
+
+}
+
+namespace d64
+{
+namespace stats
+{
+
+#ifdef D64_ENABLE_STATS
+std::atomic<uint64_t> counters[NUM_COUNTERS];
+std::atomic<uint64_t> phaseCalls[NUM_PHASES];
+std::atomic<uint64_t> phaseNanos[NUM_PHASES];
+#endif
+
+char const *getName(Counter counter)
+{
+    return counterNames[static_cast<int>(counter)];
+}
+
+char const *getName(Phase phase)
+{
+    return phaseNames[static_cast<int>(phase)];
+}
+
+Snapshot getSnapshot()
+{
+    Snapshot ret{};
+#ifdef D64_ENABLE_STATS
+    for (int idx = 0; idx < NUM_COUNTERS; idx++)
+    {
+        ret.counters[idx] = counters[idx].load(std::memory_order_relaxed);
+    }
+    for (int idx = 0; idx < NUM_PHASES; idx++)
+    {
+        ret.phases[idx] = PhaseTotal{phaseCalls[idx].load(std::memory_order_relaxed), phaseNanos[idx].load(std::memory_order_relaxed)};
+    }
+#endif
+    return ret;
+}
+
+void reset()
+{
+#ifdef D64_ENABLE_STATS
+    for (auto &counter : counters)
+    {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (int idx = 0; idx < NUM_PHASES; idx++)
+    {
+        phaseCalls[idx].store(0, std::memory_order_relaxed);
+        phaseNanos[idx].store(0, std::memory_order_relaxed);
+    }
+#endif
+}
+
+void writeJsonMembers(std::ostream &os, Snapshot const &snapshot)
+{
+    os << "\"phases\": {";
+    for (int idx = 0; idx < NUM_PHASES; idx++)
+    {
+        os << ((idx > 0) ? ", " : "") << "\"" << phaseNames[idx] << "\": {\"calls\": " << snapshot.phases[idx].calls
+           << ", \"micros\": " << (snapshot.phases[idx].nanos / 1000) << "}";
+    }
+    os << "}, \"counters\": {";
+    for (int idx = 0; idx < NUM_COUNTERS; idx++)
+    {
+        os << ((idx > 0) ? ", " : "") << "\"" << counterNames[idx] << "\": " << snapshot.counters[idx];
+    }
+    os << "}";
+}
+
+}
+}
@@ -0,0 +1,138 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <ostream>
+#include <cstdint>
+
+#ifdef D64_ENABLE_STATS
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace d64
+{
+
+// Process-wide instrumentation: counters and the time spent in the phases of building images,
+// summed over all threads. The D64_STATS_* macros compile to nothing unless D64_ENABLE_STATS is
+// defined, which the build does for Debug and with -DD64_ENABLE_STATS=ON. Counting is one relaxed
+// atomic add, timing a phase takes two reads of the steady clock. Hot loops count into a local
+// with D64_STATS_COUNT and add it once, so they do not hit the shared counters per sector.
+namespace stats
+{
+
+enum class Counter
+{
+    FILES_READ,
+    BYTES_READ, // of the '.prg' files
+    BYTES_WRITTEN, // of the images, resp. of their changed sectors
+    IMAGES_WRITTEN,
+    SECTORS_ALLOCATED, // for files and the directory
+    ALLOCATION_PROBES, // tracks looked at to find the next free sector
+    DIRECTORY_SEARCHES, // for a free slot and the name
+    // entries of the folder which were not written, and why
+    SKIPPED_NOT_PRG,
+    REJECTED_UNREADABLE,
+    REJECTED_TOO_SHORT,
+    REJECTED_TOO_LARGE,
+    REJECTED_EXCEEDS_ADDRESS_SPACE,
+    REJECTED_NO_ROOM, // the image is full, or the name is taken
+    NUM_COUNTERS
+};
+
+enum class Phase
+{
+    SCAN, // directory enumeration
+    READ, // opening and reading the '.prg' files
+    LAYOUT, // allocating sectors and copying the file data
+    DIRECTORY, // searching a free directory slot
+    SERIALIZE, // writing the image files
+    NUM_PHASES
+};
+
+constexpr bool isEnabled()
+{
+#ifdef D64_ENABLE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+struct PhaseTotal
+{
+    uint64_t calls;
+    uint64_t nanos;
+};
+
+struct Snapshot
+{
+    uint64_t counters[static_cast<int>(Counter::NUM_COUNTERS)];
+    PhaseTotal phases[static_cast<int>(Phase::NUM_PHASES)];
+
+    uint64_t get(Counter counter) const { return counters[static_cast<int>(counter)]; }
+    PhaseTotal const &get(Phase phase) const { return phases[static_cast<int>(phase)]; }
+};
+
+// names as in the JSON, e.g. "bytesRead"
+char const *getName(Counter counter);
+char const *getName(Phase phase);
+
+// all zeros if the instrumentation is compiled out
+Snapshot getSnapshot();
+void reset();
+
+// "phases" and "counters" as members of a JSON object, without the enclosing braces
+void writeJsonMembers(std::ostream &os, Snapshot const &snapshot);
+
+#ifdef D64_ENABLE_STATS
+
+extern std::atomic<uint64_t> counters[static_cast<int>(Counter::NUM_COUNTERS)];
+extern std::atomic<uint64_t> phaseCalls[static_cast<int>(Phase::NUM_PHASES)];
+extern std::atomic<uint64_t> phaseNanos[static_cast<int>(Phase::NUM_PHASES)];
+
+inline void add(Counter counter, uint64_t value)
+{
+    counters[static_cast<int>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+// adds the time from construction to destruction to a phase
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(Phase phase) : phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer()
+    {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        phaseCalls[static_cast<int>(phase)].fetch_add(1, std::memory_order_relaxed);
+        phaseNanos[static_cast<int>(phase)].fetch_add(static_cast<uint64_t>(nanos), std::memory_order_relaxed);
+    }
+
+    PhaseTimer(PhaseTimer const &) = delete;
+    PhaseTimer &operator = (PhaseTimer const &) = delete;
+
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
+
+}
+
+}
+
+#ifdef D64_ENABLE_STATS
+#define D64_STATS_CONCAT_(a, b) a##b
+#define D64_STATS_CONCAT(a, b) D64_STATS_CONCAT_(a, b)
+#define D64_STATS_ADD(counter, value) ::d64::stats::add(::d64::stats::Counter::counter, (value))
+#define D64_STATS_COUNT(local, value) ((local) += (value))
+// times the rest of the enclosing scope
+#define D64_STATS_TIMER(phase) ::d64::stats::PhaseTimer D64_STATS_CONCAT(statsTimer_, __LINE__)(::d64::stats::Phase::phase)
+#else
+// the value is not evaluated
+#define D64_STATS_ADD(counter, value) ((void)sizeof(value))
+#define D64_STATS_COUNT(local, value) ((void)0)
+#define D64_STATS_TIMER(phase) ((void)0)
+#endif
+
+#endif
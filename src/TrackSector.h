@@ -5,30 +5,121 @@
 
 namespace d64
 {
+// position of a sector on a disk. The static conversions describe the 35 track D64 image,
+// see DiskGeometry.h for the other formats.
 class TrackSector
 {
 public:
     static constexpr uint16_t INVALID = 65535;
+    static constexpr uint8_t NUM_TRACKS = 35;
+    static constexpr uint16_t NUM_SECTORS = 683;
 
     uint8_t track; // zero-based track index
     uint8_t sector; // zero-based sector index within track
 
-    bool operator == (TrackSector const &rhs) const
+    constexpr bool operator == (TrackSector const &rhs) const
     {
         return ((track == rhs.track) && (sector == rhs.sector));
     }
 
-    bool operator != (TrackSector const &rhs) const
+    constexpr bool operator != (TrackSector const &rhs) const
     {
-        return !(*this == rhs); 
+        return !(*this == rhs);
     }
 
-    static uint16_t getSectorIdx(TrackSector ts);
-    static TrackSector getTrackAndSector(uint16_t sectorIdx);
-    static uint8_t getSectorsOnTrack(uint8_t track);
-    static uint8_t getInterleaveOnTrack(uint8_t track);    
+    // return INVALID resp. {255, 255} for positions outside the image
+    static constexpr uint16_t getSectorIdx(TrackSector ts);
+    static constexpr TrackSector getTrackAndSector(uint16_t sectorIdx);
+    // return 0 for tracks outside the image
+    static constexpr uint8_t getSectorsOnTrack(uint8_t track);
+    static constexpr uint8_t getInterleaveOnTrack(uint8_t track);
 };
 
+namespace detail
+{
+
+// lookup tables of an image, generated at compile time from the sectors and interleave per track
+// of a format. The per-track tables cover every uint8_t track, tracks outside the image have 0 sectors.
+template <uint16_t NumSectors>
+struct GeometryTables
+{
+    uint8_t sectorsOnTrack[256];
+    uint8_t interleaveOnTrack[256];
+    uint16_t firstSectorIdx[256];
+    TrackSector trackAndSector[NumSectors];
+};
+
+template <typename Zones>
+constexpr GeometryTables<Zones::NUM_SECTORS> makeGeometryTables()
+{
+    GeometryTables<Zones::NUM_SECTORS> ret{};
+    uint16_t sectorIdx = 0;
+
+    for (uint8_t track = 0; track < Zones::NUM_TRACKS; track++)
+    {
+        uint8_t sectors = Zones::getSectorsInZone(track);
+        ret.sectorsOnTrack[track] = sectors;
+        ret.interleaveOnTrack[track] = Zones::getInterleaveInZone(track);
+        ret.firstSectorIdx[track] = sectorIdx;
+
+        for (uint8_t sector = 0; sector < sectors; sector++)
+        {
+            ret.trackAndSector[sectorIdx++] = TrackSector{track, sector};
+        }
+    }
+
+    ret.firstSectorIdx[Zones::NUM_TRACKS] = sectorIdx;
+    return ret;
+}
+
+// the speed zones of the 1541
+struct D64Zones
+{
+    static constexpr uint8_t NUM_TRACKS = TrackSector::NUM_TRACKS;
+    static constexpr uint16_t NUM_SECTORS = TrackSector::NUM_SECTORS;
+
+    // tracks 0..16: 21 sectors, 17..23: 19 sectors, 24..29: 18 sectors, 30..34 (and beyond): 17 sectors
+    static constexpr uint8_t getSectorsInZone(uint8_t track)
+    {
+        return (track < 17) ? 21 : (track < 24) ? 19 : (track < 30) ? 18 : 17;
+    }
+
+    static constexpr uint8_t getInterleaveInZone(uint8_t track)
+    {
+        uint8_t sectors = getSectorsInZone(track);
+        return (sectors == 18) ? 7 : (sectors == 17) ? 9 : 10;
+    }
+};
+
+inline constexpr GeometryTables<TrackSector::NUM_SECTORS> GEOMETRY = makeGeometryTables<D64Zones>();
+
+}
+
+constexpr uint16_t TrackSector::getSectorIdx(TrackSector ts)
+{
+    return (ts.sector < detail::GEOMETRY.sectorsOnTrack[ts.track]) ?
+        detail::GEOMETRY.firstSectorIdx[ts.track] + ts.sector : INVALID;
+}
+
+constexpr TrackSector TrackSector::getTrackAndSector(uint16_t sectorIdx)
+{
+    return (sectorIdx < NUM_SECTORS) ? detail::GEOMETRY.trackAndSector[sectorIdx] : TrackSector{255, 255};
+}
+
+constexpr uint8_t TrackSector::getSectorsOnTrack(uint8_t track)
+{
+    return detail::GEOMETRY.sectorsOnTrack[track];
+}
+
+constexpr uint8_t TrackSector::getInterleaveOnTrack(uint8_t track)
+{
+    return detail::GEOMETRY.interleaveOnTrack[track];
+}
+
+static_assert(detail::GEOMETRY.firstSectorIdx[TrackSector::NUM_TRACKS] == TrackSector::NUM_SECTORS, "zone table does not cover the image");
+static_assert(TrackSector::getSectorIdx(TrackSector{17, 0}) == 357, "BAM sector has moved");
+static_assert(TrackSector::getTrackAndSector(682) == TrackSector{34, 16}, "last sector has moved");
+
 }
 
 #endif
@@ -0,0 +1,443 @@
+#include "Verifier.h"
+#include "Reader.h"
+#include "BitOps.h"
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+using namespace d64;
+using namespace std;
+
+namespace
+{
+
+// owners of sectors besides the files, which are owned by their directory slot
+constexpr uint16_t NO_OWNER = 0xffff;
+constexpr uint16_t SYSTEM_OWNER = 0xfffe;
+constexpr uint16_t DIRECTORY_OWNER = 0xfffd;
+
+// file types in the low bits of the type byte of a directory entry
+constexpr uint8_t TYPE_DEL = 0;
+constexpr uint8_t TYPE_REL = 4;
+constexpr uint8_t TYPE_CBM = 5; // a partition of the 1581
+constexpr uint8_t TYPE_CLOSED = 0x80;
+
+// one verification of an image, all sectors are looked at once at most
+template <typename Geometry>
+class Verification
+{
+public:
+    Verification(uint8_t const *pImage, VerifyResult &result) : pImage(pImage), result(result)
+    {
+        owners.fill(NO_OWNER);
+        used.fill(0);
+    }
+
+    void run()
+    {
+        for (uint16_t sectorIdx : Geometry::SYSTEM_SECTOR_INDICES)
+        {
+            claim(sectorIdx, SYSTEM_OWNER);
+        }
+
+        walkDirectory();
+        checkBam();
+
+        result.numUsedSectors = 0;
+        for (uint64_t word : used)
+        {
+            result.numUsedSectors = static_cast<uint16_t>(result.numUsedSectors + countSetBits(word));
+        }
+    }
+
+private:
+    static constexpr uint16_t NUM_WORDS = (Geometry::NUM_SECTORS + 63) / 64;
+
+    uint8_t const *getSector(uint16_t sectorIdx) const { return &pImage[sectorIdx * SectorLayout::BYTES_PER_SECTOR]; }
+
+    void addProblem(std::string const &problem) { result.problems.push_back(problem); }
+
+    // tracks are counted from 1 like on the disk
+    static std::string describe(uint8_t track, uint8_t sector)
+    {
+        return "track " + std::to_string(track) + " sector " + std::to_string(sector);
+    }
+
+    static std::string describe(uint16_t sectorIdx)
+    {
+        TrackSector ts = Geometry::getTrackAndSector(sectorIdx);
+        return describe(static_cast<uint8_t>(ts.track + 1), ts.sector);
+    }
+
+    static std::string describeLink(uint16_t fromIdx)
+    {
+        return (fromIdx == TrackSector::INVALID) ? "starts at " : "links from " + describe(fromIdx) + " to ";
+    }
+
+    std::string describeOwner(uint16_t owner) const
+    {
+        switch (owner)
+        {
+            case SYSTEM_OWNER: return "the BAM";
+            case DIRECTORY_OWNER: return "the directory";
+            default: return "file \"" + fileNames[owner] + "\"";
+        }
+    }
+
+    // names end up on terminals, so PETSCII control codes and graphics are shown as \xNN
+    static std::string escapeName(uint8_t const *pBegin, uint8_t const *pEnd)
+    {
+        static char const HEX_DIGITS[] = "0123456789abcdef";
+        std::string ret;
+        for (uint8_t const *pChar = pBegin; pChar != pEnd; pChar++)
+        {
+            if ((*pChar >= 0x20) && (*pChar < 0x7f) && (*pChar != '"') && (*pChar != '\\'))
+            {
+                ret += static_cast<char>(*pChar);
+            }
+            else
+            {
+                ret += std::string("\\x") + HEX_DIGITS[*pChar >> 4] + HEX_DIGITS[*pChar & 0x0f];
+            }
+        }
+        return ret;
+    }
+
+    // false if the sector is used already
+    bool claim(uint16_t sectorIdx, uint16_t owner)
+    {
+        if (owners[sectorIdx] != NO_OWNER)
+        {
+            return false;
+        }
+        owners[sectorIdx] = owner;
+        used[sectorIdx / 64] |= uint64_t(1) << (sectorIdx % 64);
+        return true;
+    }
+
+    // claims the sectors of the chain starting at the link for owner and appends them to chain.
+    // Stops at the last sector, at a link outside the image and at a sector in use already.
+    void walkChain(uint8_t linkTrack, uint8_t linkSector, uint16_t owner, std::vector<uint16_t> &chain)
+    {
+        uint16_t fromIdx = TrackSector::INVALID;
+
+        while (true)
+        {
+            // a link to track 0 marks the last sector, the first link of a chain must not be one
+            uint16_t sectorIdx = (linkTrack == 0) ? TrackSector::INVALID :
+                Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(linkTrack - 1), linkSector});
+            if (sectorIdx == TrackSector::INVALID)
+            {
+                addProblem(describeOwner(owner) + ": " + describeLink(fromIdx) + describe(linkTrack, linkSector) + ", which is outside the image");
+                return;
+            }
+            if (owners[sectorIdx] == owner)
+            {
+                addProblem(describeOwner(owner) + ": " + describeLink(fromIdx) + describe(sectorIdx) + ", which it uses already");
+                return;
+            }
+            if (!claim(sectorIdx, owner))
+            {
+                addProblem(describeOwner(owner) + ": " + describe(sectorIdx) + " is used by " + describeOwner(owners[sectorIdx]) + " as well");
+                return;
+            }
+
+            chain.push_back(sectorIdx);
+            uint8_t const *pSector = getSector(sectorIdx);
+            if (pSector[0] == 0)
+            {
+                return;
+            }
+            linkTrack = pSector[0];
+            linkSector = pSector[1];
+            fromIdx = sectorIdx;
+        }
+    }
+
+    void walkDirectory()
+    {
+        // the header links to the first directory sector
+        uint8_t const *pHeader = getSector(Geometry::HEADER_SECTOR_IDX);
+        std::vector<uint16_t> dirSectors;
+        walkChain(pHeader[0], pHeader[1], DIRECTORY_OWNER, dirSectors);
+
+        // the DOS looks for the directory on its track only
+        auto offTrack = std::find_if(dirSectors.begin(), dirSectors.end(),
+                                     [](uint16_t sectorIdx) { return Geometry::getTrackAndSector(sectorIdx).track != Geometry::DIRECTORY_TRACK; });
+        if (offTrack != dirSectors.end())
+        {
+            addProblem("the directory: " + describe(*offTrack) + " is not on the directory track");
+            dirSectors.erase(offTrack, dirSectors.end());
+        }
+        if (dirSectors.size() > Geometry::NUM_DIR_SECTORS)
+        {
+            addProblem("the directory has " + std::to_string(dirSectors.size()) + " sectors, at most " +
+                       std::to_string(Geometry::NUM_DIR_SECTORS) + " are possible");
+            dirSectors.resize(Geometry::NUM_DIR_SECTORS);
+        }
+
+        // the names first, a file may be cross-linked with one further down the directory
+        fileNames.assign(dirSectors.size() * SectorLayout::DIR_ENTRIES_PER_SECTOR, std::string());
+        for (uint16_t slot = 0; slot < fileNames.size(); slot++)
+        {
+            uint8_t const *pEntry = getEntry(dirSectors, slot);
+            uint8_t const *pName = &pEntry[5];
+            fileNames[slot] = escapeName(pName, std::find(pName, pName + 16, 0xa0));
+        }
+
+        result.numFiles = 0;
+        std::vector<uint16_t> chain;
+        for (uint16_t slot = 0; slot < fileNames.size(); slot++)
+        {
+            uint8_t const *pEntry = getEntry(dirSectors, slot);
+            if (pEntry[2] != 0x00)
+            {
+                ++result.numFiles;
+                chain.clear();
+                checkFile(pEntry, slot, chain);
+            }
+        }
+    }
+
+    uint8_t const *getEntry(std::vector<uint16_t> const &dirSectors, uint16_t slot) const
+    {
+        return &getSector(dirSectors[slot / SectorLayout::DIR_ENTRIES_PER_SECTOR])[(slot % SectorLayout::DIR_ENTRIES_PER_SECTOR) * SectorLayout::BYTES_PER_DIR_ENTRY];
+    }
+
+    void checkFile(uint8_t const *pEntry, uint16_t slot, std::vector<uint16_t> &chain)
+    {
+        uint8_t type = pEntry[2] & 0x07;
+        uint16_t numberOfBlocks = static_cast<uint16_t>(pEntry[30] + (pEntry[31] << 8));
+
+        if ((pEntry[2] & TYPE_CLOSED) == 0)
+        {
+            addProblem(describeOwner(slot) + ": the file has not been closed");
+        }
+
+        if (type == TYPE_DEL)
+        {
+            return; // no content of its own, DEL entries often serve as separators
+        }
+        if (type == TYPE_CBM)
+        {
+            checkPartition(pEntry, slot, numberOfBlocks);
+            return;
+        }
+        if (type > TYPE_CBM)
+        {
+            addProblem(describeOwner(slot) + ": unknown file type " + std::to_string(pEntry[2]));
+            return;
+        }
+
+        walkChain(pEntry[3], pEntry[4], slot, chain);
+        if (type == TYPE_REL)
+        {
+            // the side sectors count for the blocks of the file as well
+            walkChain(pEntry[21], pEntry[22], slot, chain);
+        }
+
+        if (chain.size() != numberOfBlocks)
+        {
+            addProblem(describeOwner(slot) + ": the directory gives " + std::to_string(numberOfBlocks) + " blocks, the file has " +
+                       std::to_string(chain.size()));
+        }
+    }
+
+    // a partition is a range of consecutive sectors
+    void checkPartition(uint8_t const *pEntry, uint16_t slot, uint16_t numberOfBlocks)
+    {
+        uint16_t firstIdx = (pEntry[3] == 0) ? TrackSector::INVALID :
+            Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(pEntry[3] - 1), pEntry[4]});
+        if ((firstIdx == TrackSector::INVALID) || (firstIdx + numberOfBlocks > Geometry::NUM_SECTORS))
+        {
+            addProblem(describeOwner(slot) + ": the partition does not fit onto the image");
+            return;
+        }
+
+        for (uint16_t sectorIdx = firstIdx; sectorIdx < firstIdx + numberOfBlocks; sectorIdx++)
+        {
+            if (!claim(sectorIdx, slot))
+            {
+                addProblem(describeOwner(slot) + ": " + describe(sectorIdx) + " is used by " + describeOwner(owners[sectorIdx]) + " as well");
+                return;
+            }
+        }
+    }
+
+    // the used sectors of the track as bits, sector 0 in bit 0
+    uint64_t getUsedOnTrack(uint8_t track) const
+    {
+        uint16_t firstIdx = Geometry::getSectorIdx(TrackSector{track, 0});
+        uint8_t shift = firstIdx % 64;
+        uint16_t wordIdx = firstIdx / 64;
+        uint64_t bits = used[wordIdx] >> shift;
+        if ((shift > 0) && (wordIdx + 1 < NUM_WORDS))
+        {
+            bits |= used[wordIdx + 1] << (64 - shift);
+        }
+        return bits;
+    }
+
+    static std::string listSectors(uint64_t bits)
+    {
+        std::string ret;
+        for (; bits != 0; bits &= bits - 1)
+        {
+            ret += (ret.empty() ? "" : ", ") + std::to_string(lowestSetBit(bits));
+        }
+        return ret;
+    }
+
+    // compares the BAM with the sectors in use, a whole track at a time
+    void checkBam()
+    {
+        for (uint8_t track = 0; track < Geometry::NUM_TRACKS; track++)
+        {
+            typename Geometry::BamEntry const &entry = Geometry::getBamEntry(track);
+            uint8_t const *pBits = &getSector(entry.bitsSectorIdx)[entry.bitsOffset];
+            uint8_t numSectors = Geometry::getSectorsOnTrack(track);
+            uint64_t trackMask = (uint64_t(1) << numSectors) - 1;
+            std::string trackName = "BAM of track " + std::to_string(track + 1);
+
+            // a set bit marks a free sector
+            uint64_t freeBits = 0;
+            for (uint8_t byteIdx = 0; byteIdx < Geometry::BAM_BITMAP_BYTES; byteIdx++)
+            {
+                freeBits |= uint64_t(pBits[byteIdx]) << (byteIdx * 8);
+            }
+            if ((freeBits & ~trackMask) != 0)
+            {
+                addProblem(trackName + ": sectors beyond the end of the track are free");
+                freeBits &= trackMask;
+            }
+
+            uint8_t numFree = getSector(entry.countSectorIdx)[entry.countOffset];
+            if (numFree != countSetBits(freeBits))
+            {
+                addProblem(trackName + ": " + std::to_string(numFree) + " free sectors are counted, " +
+                           std::to_string(countSetBits(freeBits)) + " are marked free");
+            }
+
+            uint64_t usedBits = getUsedOnTrack(track) & trackMask;
+            uint64_t reservedBits = 0;
+            for (uint8_t sector = 0; sector < numSectors; sector++)
+            {
+                reservedBits |= Geometry::isAllocatedOnFormat(TrackSector{track, sector}) ? (uint64_t(1) << sector) : 0;
+            }
+
+            if ((usedBits & freeBits) != 0)
+            {
+                addProblem(trackName + ": sectors " + listSectors(usedBits & freeBits) + " are in use but free");
+            }
+            uint64_t unusedBits = trackMask & ~freeBits & ~usedBits & ~reservedBits;
+            if (unusedBits != 0)
+            {
+                addProblem(trackName + ": sectors " + listSectors(unusedBits) + " are allocated but not in use");
+            }
+        }
+    }
+
+    uint8_t const *pImage;
+    VerifyResult &result;
+    std::array<uint16_t, Geometry::NUM_SECTORS> owners;
+    std::array<uint64_t, NUM_WORDS> used; // the sectors with an owner
+    std::vector<std::string> fileNames; // by directory slot
+};
+
+template <typename Geometry>
+VerifyResult verifyFileAs(std::string const &imagePath)
+{
+    BasicReader<Geometry> reader(imagePath);
+    if (reader.getStatus() != BasicReader<Geometry>::Status::OK)
+    {
+        return VerifyResult{{std::string("the image ") + BasicReader<Geometry>::getStatusText(reader.getStatus())}, 0, 0};
+    }
+    return d64::verify<Geometry>(reader.getImageData(), BasicReader<Geometry>::IMAGE_SIZE);
+}
+
+}
+
+namespace d64
+{
+
+template <typename Geometry>
+VerifyResult verify(uint8_t const *pImage, size_t length)
+{
+    VerifyResult result{{}, 0, 0};
+    if ((length != BasicReader<Geometry>::IMAGE_SIZE) && (length != BasicReader<Geometry>::IMAGE_SIZE + Geometry::NUM_SECTORS))
+    {
+        result.problems.push_back("the image does not have the size of an image");
+        return result;
+    }
+
+    Verification<Geometry>(pImage, result).run();
+    return result;
+}
+
+template VerifyResult verify<D64Geometry>(uint8_t const *pImage, size_t length);
+template VerifyResult verify<D64ExtendedGeometry>(uint8_t const *pImage, size_t length);
+template VerifyResult verify<D71Geometry>(uint8_t const *pImage, size_t length);
+template VerifyResult verify<D81Geometry>(uint8_t const *pImage, size_t length);
+
+}
+
+VerifyResult d64::verify(uint8_t const *pImage, size_t length, ImageFormat format)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return verify<D64ExtendedGeometry>(pImage, length);
+        case ImageFormat::D71: return verify<D71Geometry>(pImage, length);
+        case ImageFormat::D81: return verify<D81Geometry>(pImage, length);
+        case ImageFormat::G64: return VerifyResult{{"G64 images cannot be verified"}, 0, 0};
+        default: return verify<D64Geometry>(pImage, length);
+    }
+}
+
+VerifyResult d64::verifyFile(std::string const &imagePath, ImageFormat format)
+{
+    switch (format)
+    {
+        case ImageFormat::D64_40_TRACKS: return verifyFileAs<D64ExtendedGeometry>(imagePath);
+        case ImageFormat::D71: return verifyFileAs<D71Geometry>(imagePath);
+        case ImageFormat::D81: return verifyFileAs<D81Geometry>(imagePath);
+        case ImageFormat::G64: return VerifyResult{{"G64 images cannot be verified"}, 0, 0};
+        default: return verifyFileAs<D64Geometry>(imagePath);
+    }
+}
+
+std::vector<VerifyResult> d64::verifyFiles(std::vector<std::string> const &imagePaths, ImageFormat format, unsigned numWorkers)
+{
+    std::vector<VerifyResult> results(imagePaths.size());
+    std::atomic<size_t> nextPath(0);
+    if (numWorkers == 0)
+    {
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // workers pull the next image until all are taken
+    auto worker = [&imagePaths, format, &results, &nextPath]()
+    {
+        for (size_t pathIdx = nextPath++; pathIdx < imagePaths.size(); pathIdx = nextPath++)
+        {
+            results[pathIdx] = verifyFile(imagePaths[pathIdx], format);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t threadIdx = 1; threadIdx < std::min(static_cast<size_t>(numWorkers), imagePaths.size()); threadIdx++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    // the calling thread is a worker too
+    worker();
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    return results;
+}
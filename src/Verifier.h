@@ -0,0 +1,43 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "ImageBuilder.h"
+
+namespace d64
+{
+
+struct VerifyResult
+{
+    std::vector<std::string> problems; // empty if the image is consistent
+    uint16_t numFiles;
+    uint16_t numUsedSectors; // by the files, the directory and the system sectors
+
+    bool isOk() const { return problems.empty(); }
+};
+
+// Checks the structure of an image like a file system check: the chain of directory sectors,
+// the sector chain of every file for links outside the image and cycles, sectors used by more
+// than one file or by a file and the directory, the number of blocks in the directory entries,
+// and the BAM against the sectors actually in use. The chains are walked once, each sector goes
+// into a bitmap of used sectors, which is then compared with the BAM a track at a time.
+// The image bytes may be followed by one error byte per sector. G64 images are not supported.
+template <typename Geometry>
+VerifyResult verify(uint8_t const *pImage, size_t length);
+VerifyResult verify(uint8_t const *pImage, size_t length, ImageFormat format);
+
+// maps the image file, files which cannot be read count as a problem
+VerifyResult verifyFile(std::string const &imagePath, ImageFormat format = ImageFormat::D64);
+
+// verifies the images on numWorkers threads (0 picks the number of hardware threads), the
+// results are in the order of the paths
+std::vector<VerifyResult> verifyFiles(std::vector<std::string> const &imagePaths, ImageFormat format = ImageFormat::D64,
+                                      unsigned numWorkers = 0);
+
+}
+
+#endif
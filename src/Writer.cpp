@@ -1,272 +1,798 @@
 
 #include "Writer.h"
-#include <sstream>
-#include <cstring> // std::memset
+#include "BitOps.h"
+#include "G64.h"
+#include "Stats.h"
+#include <cstring> // std::memset, std::memcpy
+#include <cerrno>
 #include <algorithm>
 #include <assert.h>
 
+// POSIX API for writing the image
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <climits> // IOV_MAX
+
 using namespace d64;
 using namespace std;
 
-void Writer::initImage(std::string const &folderName)
+namespace
 {
-    uint8_t *pBAM = getSector(BAM_SECTOR_IDX);
-    pBAM[0] = TrackSector::getTrackAndSector(BAM_SECTOR_IDX).track + 1;
-    pBAM[1] = 0x01; // is ignored, next sector is sector #3
-    pBAM[2] = 0x41; // DOS version type
-    pBAM[3] = 0x00; // unused
 
-    // 0x04..0x8F BAM track entries cover which sector on which track is free/occupied
-    for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+// system sectors (header and BAM) and allocator state of a formatted image without files.
+// The disk name and ID fields are left blank, reset() fills them in.
+template <typename Geometry>
+struct BlankImage
+{
+    using Writer = BasicWriter<Geometry>;
+
+    std::array<std::array<uint8_t, Writer::BYTES_PER_SECTOR>, Geometry::SYSTEM_SECTORS.size()> systemSectors;
+    typename Writer::Allocator allocator;
+};
+
+template <typename Geometry>
+BlankImage<Geometry> makeBlankImage()
+{
+    using Writer = BasicWriter<Geometry>;
+    BlankImage<Geometry> blank;
+
+    // built once in a scratch image, only the system sectors are kept
+    std::vector<uint8_t> image(Writer::NUM_SECTORS * Writer::BYTES_PER_SECTOR, 0x00);
+    auto getSector = [&image](TrackSector ts) { return &image[Geometry::getSectorIdx(ts) * Writer::BYTES_PER_SECTOR]; };
+    Geometry::format(getSector);
+
+    // the BAM track entries cover which sector on which track is free/occupied:
+    // a free count and a bitmap with a '1' flag for each available sector, bit n == sector n
+    TrackSector firstDirSector = Geometry::getTrackAndSector(Writer::FIRST_DIR_SECTOR_IDX);
+    for (uint8_t trackIdx = 0; trackIdx < Writer::NUM_TRACKS; trackIdx++)
+    {
+        uint64_t freeBits = 0;
+        for (uint8_t sector = 0; sector < Geometry::getSectorsOnTrack(trackIdx); sector++)
+        {
+            TrackSector ts = {trackIdx, sector};
+            if (!Geometry::isAllocatedOnFormat(ts) && (ts != firstDirSector))
+            {
+                freeBits |= (1ull << sector);
+            }
+        }
+
+        BamLocation location = Geometry::getBamLocation(trackIdx);
+        getSector(location.count.ts)[location.count.offset] = countSetBits(freeBits);
+        for (uint8_t byteIdx = 0; byteIdx < Geometry::BAM_BITMAP_BYTES; byteIdx++)
+        {
+            getSector(location.bits.ts)[location.bits.offset + byteIdx] = static_cast<uint8_t>(freeBits >> (byteIdx * 8));
+        }
+        blank.allocator.loadTrack(trackIdx, static_cast<typename Writer::Allocator::Bits>(freeBits));
+    }
+
+    for (size_t idx = 0; idx < Geometry::SYSTEM_SECTORS.size(); idx++)
+    {
+        std::memcpy(blank.systemSectors[idx].data(), getSector(Geometry::SYSTEM_SECTORS[idx]), Writer::BYTES_PER_SECTOR);
+    }
+
+    return blank;
+}
+
+template <typename Geometry>
+BlankImage<Geometry> const &getBlankImage()
+{
+    static BlankImage<Geometry> const blank = makeBlankImage<Geometry>();
+    return blank;
+}
+
+}
+
+template <typename Geometry>
+void BasicWriter<Geometry>::reset(std::string const &diskName, std::string const &diskId)
+{
+    // only the sectors written since the last reset are zeroed
+    storage.clear();
+
+    BlankImage<Geometry> const &blank = getBlankImage<Geometry>();
+    for (size_t idx = 0; idx < Geometry::SYSTEM_SECTOR_INDICES.size(); idx++)
+    {
+        std::memcpy(getSector(Geometry::SYSTEM_SECTOR_INDICES[idx]), blank.systemSectors[idx].data(), BYTES_PER_SECTOR);
+    }
+    allocator = blank.allocator;
+
+    DirectoryIndex::Name d64DiskName = makeD64FileName(diskName);
+    std::copy(d64DiskName.begin(), d64DiskName.end(), &getSector(HEADER_SECTOR_IDX)[Geometry::DISK_NAME_OFFSET]);
+    // Disk ID, two characters, the same ones as allowed in names
+    DirectoryIndex::Name d64DiskId = makeD64FileName(diskId);
+    for (SectorField const &field : Geometry::DISK_ID_FIELDS)
     {
-        uint8_t *pTrackEntry = &pBAM[4 + trackIdx* 4];
-        // 4 bytes per track, first byte indicates the free sectors per track
-        uint8_t sectorsOnTrack = TrackSector::getSectorsOnTrack(trackIdx);
-        pTrackEntry[0] = sectorsOnTrack;
-        // Bytes 1..3 provide '1' flag for available, '0' for occupied sector
-        // indexing starts with first byte MSB first, i.e. MSB of first byte
-        // contains status of sector 0
-        uint32_t occupiedBits = (1 << sectorsOnTrack) - 1;
-        pTrackEntry[1] = static_cast<uint8_t>(occupiedBits & 0xff);
-        pTrackEntry[2] = static_cast<uint8_t>((occupiedBits >> 8) & 0xff);
-        pTrackEntry[3] = static_cast<uint8_t>((occupiedBits >> 16) & 0xff);
-    }
-    setSectorOccupied(BAM_SECTOR_IDX); // the sector in which we are just writing
-
-    writeStringWithPadding(&pBAM[0x90], makeD64FileName(folderName), 16, 0xa0); // Disk Name
-    pBAM[0xa0] = 0xa0;
-    pBAM[0xa1] = 0xa0;
-    pBAM[0xa2] = 0x34; // Disk ID "42"
-    pBAM[0xa3] = 0x32; // Disk ID
-    pBAM[0xa4] = 0xa0;  
-    pBAM[0xa5] = 0x32; // DOS Type "2A"
-    pBAM[0xa6] = 0x41; 
-    pBAM[0xa7] = 0xa0;
-    pBAM[0xa8] = 0xa0;
-    pBAM[0xa9] = 0xa0;
-    pBAM[0xaa] = 0xa0;
-
-    std::memset(&pBAM[0xab], 0x00, 0xff-0xab); // rest of BAM is unused
-}
-
-void Writer::setSectorOccupied(uint16_t sectorIdx)
-{
-    uint8_t *pBAM = getSector(BAM_SECTOR_IDX);
-    TrackSector ts = TrackSector::getTrackAndSector(sectorIdx);
-    uint8_t *pBAMEntryTrack = &pBAM[0x04 + (ts.track * 4)];
-    --pBAMEntryTrack[0]; // number of free sectors resuced by one (ours)
-    uint8_t *pBAMEntrySector = &pBAMEntryTrack[1 + ts.sector / 8];
+        uint8_t *pSector = getSector(Geometry::getSectorIdx(field.ts));
+        pSector[field.offset] = d64DiskId[0];
+        pSector[field.offset + 1] = d64DiskId[1];
+    }
+
+    // the directory starts with one empty sector
+    uint8_t *pFirstDirSector = getSector(FIRST_DIR_SECTOR_IDX);
+    pFirstDirSector[0] = 0x00; // there is no next directory sector
+    pFirstDirSector[1] = 0xff;
+    numDirSectors = 1;
+    directory.clear();
+    policy = AllocationPolicy();
+}
+
+template <typename Geometry>
+uint16_t BasicWriter<Geometry>::getNumberOfFreeSectorsOnBlankImage()
+{
+    return getBlankImage<Geometry>().allocator.getNumberOfFreeSectors();
+}
+
+template <typename Geometry>
+void BasicWriter<Geometry>::setSectorOccupied(uint16_t sectorIdx)
+{
+    TrackSector ts = Geometry::getTrackAndSector(sectorIdx);
+    auto const &bamEntry = Geometry::getBamEntry(ts.track);
+    uint8_t *pCountSector = getSector(bamEntry.countSectorIdx);
+    uint8_t *pBitsSector = Geometry::hasSplitBamEntries() ? getSector(bamEntry.bitsSectorIdx) : pCountSector;
+    --pCountSector[bamEntry.countOffset]; // number of free sectors resuced by one (ours)
+    uint8_t *pBAMEntrySector = &pBitsSector[bamEntry.bitsOffset + ts.sector / 8];
     uint8_t mask = (1 << (ts.sector % 8)) ^ 0xff;
     *pBAMEntrySector &= mask;
+    allocator.setOccupied(ts);
 }
 
-
-uint32_t Writer::getSectorBitsOfTrack(uint8_t trackIdx) const
+template <typename Geometry>
+void BasicWriter<Geometry>::setSectorFree(uint16_t sectorIdx)
 {
-    uint8_t const *pBAM = getSector(BAM_SECTOR_IDX);
-    uint8_t const *pTrackEntry = &pBAM[4 + trackIdx * 4];
-    return pTrackEntry[1] + (pTrackEntry[2] << 8) + (pTrackEntry[3] << 16);
+    TrackSector ts = Geometry::getTrackAndSector(sectorIdx);
+    if (!allocator.isAvailable(ts))
+    {
+        auto const &bamEntry = Geometry::getBamEntry(ts.track);
+        ++getSector(bamEntry.countSectorIdx)[bamEntry.countOffset];
+        getSector(bamEntry.bitsSectorIdx)[bamEntry.bitsOffset + ts.sector / 8] |= (1 << (ts.sector % 8));
+        allocator.setFree(ts);
+    }
 }
 
-uint16_t Writer::getNumberOfFreeSectors() const
+template <typename Geometry>
+template <typename FreeSector>
+uint16_t BasicWriter<Geometry>::walkFileChain(TrackSector firstSector, FreeSector freeSector) const
 {
+    // stops at the end of the chain, at sectors which are free already or outside the file area,
+    // so broken chains and chains with cycles cannot free anything twice
     uint16_t ret = 0;
-    uint8_t const *pBAM = getSector(BAM_SECTOR_IDX);
-
-    for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+    uint16_t sectorIdx = Geometry::getSectorIdx(firstSector);
+    while ((sectorIdx != TrackSector::INVALID) && (ret < NUM_SECTORS))
     {
-        // directory track cannot be used for data
-        if (trackIdx != DIRECTORY_TRACK)
+        TrackSector ts = Geometry::getTrackAndSector(sectorIdx);
+        if (Geometry::isReservedTrack(ts.track) || allocator.isAvailable(ts))
         {
-            // first byte of a track entry holds the free sectors
-            ret = ret + pBAM[(trackIdx + 1) * 4];
+            break;
         }
+
+        uint8_t const *pSector = getSector(sectorIdx);
+        uint16_t nextIdx = (pSector[0] == 0) ? TrackSector::INVALID :
+            Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(pSector[0] - 1), pSector[1]});
+        freeSector(sectorIdx);
+        ++ret;
+        sectorIdx = nextIdx;
     }
 
     return ret;
 }
 
-std::string Writer::makeD64FileName(std::string const &origFileName)
+template <typename Geometry>
+bool BasicWriter<Geometry>::loadImage(uint8_t const *pImage, size_t length)
 {
-    std::stringstream strm;
+    if (length < getImageSize())
+    {
+        return false;
+    }
 
-    for (size_t idx = 0; idx < std::min(origFileName.length(), static_cast<size_t>(16)); idx++)
+    storage.clear();
+    for (uint16_t idx = 0; idx < NUM_SECTORS; idx++)
     {
-        uint8_t ch = origFileName[idx];
-        if ((ch >= '0' && ch <= '9') || (ch >= 'A'  && ch <= 'Z') || (ch == '_') || (ch == '.'))
+        uint8_t const *pSrc = &pImage[idx * BYTES_PER_SECTOR];
+        // empty sectors stay unmaterialized in sparse mode
+        bool isEmpty = std::all_of(pSrc, pSrc + BYTES_PER_SECTOR, [](uint8_t byte) { return byte == 0x00; });
+        if (!isEmpty || (storage.getMode() == StorageMode::DENSE))
         {
-            strm << ch;
+            std::memcpy(getSector(idx), pSrc, BYTES_PER_SECTOR);
         }
-        else if (ch >= 'a'  && ch <= 'z')
+    }
+
+    // the allocator takes the free sectors from the bitmaps of the BAM
+    for (uint8_t trackIdx = 0; trackIdx < NUM_TRACKS; trackIdx++)
+    {
+        auto const &bamEntry = Geometry::getBamEntry(trackIdx);
+        uint8_t const *pBits = &getSectorData(bamEntry.bitsSectorIdx)[bamEntry.bitsOffset];
+        uint64_t freeBits = 0;
+        for (uint8_t byteIdx = 0; byteIdx < Geometry::BAM_BITMAP_BYTES; byteIdx++)
         {
-            // toUpper
-            strm << static_cast<uint8_t>((ch - 'a') + 'A');
+            freeBits |= static_cast<uint64_t>(pBits[byteIdx]) << (byteIdx * 8);
         }
-        else
+        allocator.loadTrack(trackIdx, static_cast<typename Allocator::Bits>(freeBits));
+    }
+
+    // the directory chain must take the sectors claimDirEntry() would give it
+    directory.clear();
+    numDirSectors = 0;
+    uint16_t sectorIdx = FIRST_DIR_SECTOR_IDX;
+    while (true)
+    {
+        uint8_t const *pSector = getSectorData(sectorIdx);
+        for (uint8_t entryIdx = 0; entryIdx < DIR_ENTRIES_PER_SECTOR; entryIdx++)
         {
-            strm << '_';
+            uint8_t const *pDirEntry = &pSector[entryIdx * BYTES_PER_DIR_ENTRY];
+            if (pDirEntry[2] == 0x00)
+            {
+                continue; // unused or deleted
+            }
+
+            DirectoryName name;
+            std::copy(&pDirEntry[5], &pDirEntry[5 + name.size()], name.begin());
+            if (directory.find(name) != Directory::INVALID)
+            {
+                return false;
+            }
+            directory.add(numDirSectors * DIR_ENTRIES_PER_SECTOR + entryIdx, name);
+        }
+        ++numDirSectors;
+
+        if (pSector[0] == 0x00)
+        {
+            break;
+        }
+        if ((numDirSectors == NUM_DIR_SECTORS) || (pSector[0] != DIRECTORY_TRACK + 1) || (pSector[1] != getDirSectorOnTrack(numDirSectors)))
+        {
+            return false;
         }
+        sectorIdx = Geometry::getSectorIdx(TrackSector{DIRECTORY_TRACK, pSector[1]});
     }
 
-    return strm.str();
+    // the image as loaded is what the file holds
+    storage.markClean();
+    return true;
 }
 
-void Writer::writeString(uint8_t *pDest, std::string const &in)
+template <typename Geometry>
+bool BasicWriter<Geometry>::deleteFile(std::string const &name)
 {
-    size_t idx = 0;
-    for (auto ch : in)
+    return deleteFile(makeD64FileName(name));
+}
+
+template <typename Geometry>
+bool BasicWriter<Geometry>::deleteFile(DirectoryName const &name)
+{
+    uint16_t slot = directory.find(name);
+    if (slot == Directory::INVALID)
     {
-        pDest[idx++] = ch;
+        return false;
     }
+
+    // like the DOS scratches a file: the sectors keep their content, only the BAM and the entry change
+    uint8_t *pDirEntry = claimDirEntry(slot);
+    walkFileChain(TrackSector{static_cast<uint8_t>(pDirEntry[3] - 1), pDirEntry[4]}, [this](uint16_t sectorIdx)
+    {
+        setSectorFree(sectorIdx);
+    });
+    pDirEntry[2] = 0x00;
+    directory.remove(slot);
+    return true;
 }
 
-void Writer::writeStringWithPadding(uint8_t *pDest, std::string const &in, size_t len, uint8_t padding)
+template <typename Geometry>
+bool BasicWriter<Geometry>::replaceFile(std::string const &name, uint8_t const *pData, size_t length)
 {
-    writeString(pDest, in);
-    for (size_t idx = in.length(); idx < len; idx++)
+    DirectoryName d64Name = makeD64FileName(name);
+    uint16_t slot = directory.find(d64Name);
+    if (slot == Directory::INVALID)
+    {
+        return writeFile(name, pData, length);
+    }
+
+    // the new content may take the sectors of the old one, the chain is walked once
+    uint8_t *pDirEntry = claimDirEntry(slot);
+    std::vector<uint16_t> oldSectors;
+    walkFileChain(TrackSector{static_cast<uint8_t>(pDirEntry[3] - 1), pDirEntry[4]}, [&oldSectors](uint16_t sectorIdx)
     {
-        pDest[idx] = padding;
+        oldSectors.push_back(sectorIdx);
+    });
+    if ((length == 0) || (length > (getNumberOfFreeSectors() + oldSectors.size()) * static_cast<size_t>(DATA_BYTES_PER_SECTOR)))
+    {
+        return false;
+    }
+
+    // scratched like deleteFile() does
+    uint8_t fileType = pDirEntry[2];
+    for (uint16_t sectorIdx : oldSectors)
+    {
+        setSectorFree(sectorIdx);
+    }
+    pDirEntry[2] = 0x00;
+    directory.remove(slot);
+
+    TrackSector ts = writeData(pData, length);
+    directory.add(slot, d64Name);
+    if (ts == TRACK_SECTOR_INVALID)
+    {
+        // e.g. sectors of the chain which were free in the BAM already. writeData() has not
+        // written anything, so the old file is still there.
+        for (uint16_t sectorIdx : oldSectors)
+        {
+            setSectorOccupied(sectorIdx);
+        }
+        claimDirEntry(slot)[2] = fileType;
+        return false;
     }
+    uint16_t numberOfBlocks = (length + (DATA_BYTES_PER_SECTOR - 1)) / DATA_BYTES_PER_SECTOR;
+    writeDirEntry(slot, d64Name, ts, numberOfBlocks);
+    return true;
 }
 
-TrackSector Writer::getFirstFreeTrackSector() const
+template <typename Geometry>
+uint8_t *BasicWriter<Geometry>::claimDirEntry(uint16_t slot)
 {
-    TrackSector ret = {0,0};
-    return isTrackSectorAvailable(ret) ? ret : getNextFreeTrackSector(ret);
+    uint8_t dirSectorIdx = static_cast<uint8_t>(slot / DIR_ENTRIES_PER_SECTOR);
+    uint16_t sectorIdx = Geometry::getSectorIdx(TrackSector{DIRECTORY_TRACK, getDirSectorOnTrack(dirSectorIdx)});
+
+    // slots are handed out lowest first, but open FileSinks may complete in any order,
+    // so the chain may have to grow by more than one sector
+    while (dirSectorIdx >= numDirSectors)
+    {
+        uint8_t *pPrevSector = getSector(Geometry::getSectorIdx(TrackSector{DIRECTORY_TRACK, getDirSectorOnTrack(numDirSectors - 1)}));
+        pPrevSector[0] = DIRECTORY_TRACK + 1;
+        pPrevSector[1] = getDirSectorOnTrack(numDirSectors);
+
+        uint16_t newSectorIdx = Geometry::getSectorIdx(TrackSector{DIRECTORY_TRACK, getDirSectorOnTrack(numDirSectors)});
+        uint8_t *pSector = getSector(newSectorIdx);
+        pSector[0] = 0x00; // there is no next directory sector
+        pSector[1] = 0xff;
+        setSectorOccupied(newSectorIdx);
+        D64_STATS_ADD(SECTORS_ALLOCATED, 1);
+        ++numDirSectors;
+    }
+
+    return &getSector(sectorIdx)[BYTES_PER_DIR_ENTRY * (slot % DIR_ENTRIES_PER_SECTOR)];
+}
+
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeFile(string const &name, uint8_t const *pData, size_t length)
+{
+    DirectoryIndex::Name d64Name = makeD64FileName(name);
+    uint16_t slot = DirectoryIndex::INVALID;
+    {
+        D64_STATS_TIMER(DIRECTORY);
+        D64_STATS_ADD(DIRECTORY_SEARCHES, 1);
+        slot = directory.getFirstFreeSlot();
+
+        // the name must be unique and the directory must have room for another entry
+        if ((slot == DirectoryIndex::INVALID) || (directory.find(d64Name) != DirectoryIndex::INVALID))
+        {
+            return false;
+        }
+    }
+
+    TrackSector ts = writeData(pData, length);
+    if (ts == TRACK_SECTOR_INVALID)
+    {
+        return false;
+    }
+
+    directory.add(slot, d64Name);
+    uint16_t numberOfBlocks = (length + (DATA_BYTES_PER_SECTOR - 1)) / DATA_BYTES_PER_SECTOR;
+    writeDirEntry(slot, d64Name, ts, numberOfBlocks);
+    return true;
 }
 
-TrackSector Writer::getNextFreeTrackSector(TrackSector previous) const
+template <typename Geometry>
+void BasicWriter<Geometry>::writeDirEntry(uint16_t slot, DirectoryIndex::Name const &name, TrackSector firstSector, uint16_t numberOfBlocks)
 {
-    uint8_t sectorStartIDx = previous.sector;
+    // bytes 0, 1 link the directory sectors in the first entry of a sector, and are 0x00 otherwise
+    uint8_t *pDirEntry = claimDirEntry(slot);
+    pDirEntry[2] = 0x82; // .PRG
+    pDirEntry[3] = firstSector.track + 1;
+    pDirEntry[4] = firstSector.sector;
+    std::copy(name.begin(), name.end(), &pDirEntry[5]);
+    // 9 bytes unused for .PRG, the slot may have held another type of file before
+    std::fill(&pDirEntry[21], &pDirEntry[30], 0x00);
+    // file length in sectors, aka "blocks", little endian
+    pDirEntry[30] = static_cast<uint8_t>(numberOfBlocks & 0xff);
+    pDirEntry[31] = static_cast<uint8_t>((numberOfBlocks >> 8) & 0xff);
 
-    for (uint8_t trackIdx = previous.track; trackIdx < NUM_TRACKS; trackIdx++)
+}
+
+template <typename Geometry>
+typename BasicWriter<Geometry>::FileSink BasicWriter<Geometry>::openFile(std::string const &name)
+{
+    DirectoryIndex::Name d64Name = makeD64FileName(name);
+    uint16_t slot = DirectoryIndex::INVALID;
     {
-        if (trackIdx != DIRECTORY_TRACK)
+        D64_STATS_TIMER(DIRECTORY);
+        D64_STATS_ADD(DIRECTORY_SEARCHES, 1);
+        slot = directory.getFirstFreeSlot();
+
+        // the name must be unique and the directory must have room for another entry
+        if ((slot == DirectoryIndex::INVALID) || (directory.find(d64Name) != DirectoryIndex::INVALID))
         {
-            uint8_t interleave = TrackSector::getInterleaveOnTrack(trackIdx);
-            uint8_t numSectors = TrackSector::getSectorsOnTrack(trackIdx);
-            uint32_t sectorBits = getSectorBitsOfTrack(trackIdx);
+            return FileSink(nullptr, d64Name, DirectoryIndex::INVALID);
+        }
+    }
+
+    // the slot stays reserved for the sink until it is closed or released
+    directory.add(slot, d64Name);
+    return FileSink(this, d64Name, slot);
+}
+
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeFile(std::string const &name, std::function<size_t(uint8_t *pBuf, size_t maxLength)> const &reader)
+{
+    FileSink sink = openFile(name);
+    std::array<uint8_t, DATA_BYTES_PER_SECTOR> buf;
+    size_t length = 0;
 
-            for (uint8_t i = 0; i < numSectors; i++)
+    while (sink.isOpen() && ((length = reader(buf.data(), buf.size())) > 0))
+    {
+        sink.write(buf.data(), length);
+    }
+
+    return sink.close();
+}
+
+template <typename Geometry>
+BasicFileSink<Geometry>::BasicFileSink(Writer *pWriter, DirectoryIndex::Name const &name, uint16_t slot) :
+    pWriter(pWriter), name(name), slot(slot), firstSector(Writer::TRACK_SECTOR_INVALID),
+    sectorIdx(Writer::INVALID), usedBytesInSector(0), numberOfBlocks(0)
+{
+}
+
+template <typename Geometry>
+BasicFileSink<Geometry>::BasicFileSink(BasicFileSink &&other) :
+    pWriter(other.pWriter), name(other.name), slot(other.slot), firstSector(other.firstSector),
+    sectorIdx(other.sectorIdx), usedBytesInSector(other.usedBytesInSector), numberOfBlocks(other.numberOfBlocks)
+{
+    other.pWriter = nullptr;
+}
+
+template <typename Geometry>
+BasicFileSink<Geometry>::~BasicFileSink()
+{
+    release();
+}
+
+template <typename Geometry>
+bool BasicFileSink<Geometry>::write(uint8_t const *pData, size_t length)
+{
+    if (pWriter == nullptr)
+    {
+        return false;
+    }
+
+    while (length > 0)
+    {
+        if ((sectorIdx == Writer::INVALID) || (usedBytesInSector == Writer::DATA_BYTES_PER_SECTOR))
+        {
+            // current sector is full, continue the chain on the next free sector
+            TrackSector next = (sectorIdx == Writer::INVALID) ?
+                pWriter->allocator.getFirstFree(pWriter->policy) :
+                pWriter->allocator.getNextFree(Geometry::getTrackAndSector(sectorIdx), pWriter->policy);
+            uint16_t nextSectorIdx = Geometry::getSectorIdx(next);
+
+            if ((pWriter->getNumberOfFreeSectors() == 0) || (nextSectorIdx == TrackSector::INVALID))
             {
-                uint8_t sectorOnTrack = static_cast<uint8_t>((sectorStartIDx + (i * interleave)) % numSectors);
-                TrackSector nextTS = {trackIdx, sectorOnTrack};
-                if (isTrackSectorAvailable(nextTS))
-                {
-                    return nextTS;
-                }
+                release();
+                return false;
+            }
+
+            if (sectorIdx == Writer::INVALID)
+            {
+                firstSector = next;
             }
+            else
+            {
+                uint8_t *pPrevSector = pWriter->getSector(sectorIdx);
+                pPrevSector[0] = next.track + 1; // on the disk system, tracks start with "1"
+                pPrevSector[1] = next.sector; // but sectors are still zero-based
+            }
+
+            pWriter->setSectorOccupied(nextSectorIdx);
+            sectorIdx = nextSectorIdx;
+            usedBytesInSector = 0;
+            ++numberOfBlocks;
         }
 
-        // complete track is full, we continue on sector 0 of next track
-        sectorStartIDx = 0;
+        uint8_t *pSector = pWriter->getSector(sectorIdx);
+        size_t chunk = std::min(length, static_cast<size_t>(Writer::DATA_BYTES_PER_SECTOR - usedBytesInSector));
+        std::copy(&pData[0], &pData[chunk], &pSector[2 + usedBytesInSector]);
+        usedBytesInSector += static_cast<uint8_t>(chunk);
+        pData = &pData[chunk];
+        length -= chunk;
     }
 
-    return TRACK_SECTOR_INVALID;
+    return true;
 }
 
-bool Writer::isTrackSectorAvailable(TrackSector ts) const
+template <typename Geometry>
+bool BasicFileSink<Geometry>::close()
 {
-    uint32_t sectorBits = getSectorBitsOfTrack(ts.track);
-    return (sectorBits & (1 << ts.sector));
-}
+    if ((pWriter == nullptr) || (numberOfBlocks == 0))
+    {
+        release();
+        return false;
+    }
 
+    // this is the last sector of our file. conclude with track := 0, sector := <used bytes>
+    uint8_t *pSector = pWriter->getSector(sectorIdx);
+    pSector[0] = 0x00;
+    pSector[1] = usedBytesInSector;
+    // a sector of a deleted file still holds its old content
+    std::fill(&pSector[2 + usedBytesInSector], &pSector[Writer::BYTES_PER_SECTOR], 0x00);
+
+    pWriter->writeDirEntry(slot, name, firstSector, numberOfBlocks);
+    D64_STATS_ADD(SECTORS_ALLOCATED, numberOfBlocks);
+    D64_STATS_ADD(ALLOCATION_PROBES, pWriter->allocator.takeNumberOfProbes());
+    pWriter = nullptr;
+    return true;
+}
 
-bool Writer::writeFile(string const &name, uint8_t *pData, size_t length)
+template <typename Geometry>
+void BasicFileSink<Geometry>::release()
 {
-    bool success = false;
-    uint8_t *pFirstDirSector = getSector(FIRST_DIR_SECTOR_IDX); // sector 1 on DIRECTORY_TRACK
+    if (pWriter == nullptr)
+    {
+        return;
+    }
 
-    // FIXME: Put that into a separate functions
-    uint8_t dirIdx = 0;
-    uint8_t *pDirEntry = &pFirstDirSector[BYTES_PER_DIR_ENTRY * dirIdx];
-    while ((dirIdx < DIR_ENTRIES_PER_SECTOR) && (pDirEntry[2] != 0))
+    // give back the sectors of the chain written so far, and the reserved directory slot
+    uint16_t idx = Geometry::getSectorIdx(firstSector);
+    for (uint16_t block = 0; block < numberOfBlocks; block++)
     {
-        ++dirIdx;
-        pDirEntry = &pFirstDirSector[BYTES_PER_DIR_ENTRY * dirIdx];
+        uint8_t *pSector = pWriter->getSector(idx);
+        uint16_t nextIdx = Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(pSector[0] - 1), pSector[1]});
+        pWriter->storage.clearSector(idx);
+        pWriter->setSectorFree(idx);
+        idx = nextIdx;
     }
 
-    // For now, we do not use the other directory sectors
-    if (dirIdx < DIR_ENTRIES_PER_SECTOR)
+    pWriter->directory.remove(slot);
+    D64_STATS_ADD(SECTORS_ALLOCATED, numberOfBlocks);
+    D64_STATS_ADD(ALLOCATION_PROBES, pWriter->allocator.takeNumberOfProbes());
+    pWriter = nullptr;
+}
+
+
+template <typename Geometry>
+void BasicWriter<Geometry>::streamImage(std::ostream &os) const
+{
+    static_assert(sizeof(char) == sizeof(uint8_t), "the types char and uint8_t do not have the same size");
+    storage.forEachRun([&os](uint8_t const *pRun, size_t length)
+    {
+        return static_cast<bool>(os.write(reinterpret_cast<char const *>(pRun), length));
+    });
+}
+
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeImage(int fd) const
+{
+    D64_STATS_TIMER(SERIALIZE);
+    // one vector per run of sectors contiguous in memory: one in total for dense storage
+    std::array<iovec, NUM_SECTORS> iov;
+    int iovCnt = 0;
+    storage.forEachRun([&iov, &iovCnt](uint8_t const *pRun, size_t length)
+    {
+        iov[iovCnt++] = iovec{ const_cast<uint8_t *>(pRun), length };
+        return true;
+    });
+
+    iovec *pIov = &iov[0];
+
+    while (iovCnt > 0)
     {
-        if (dirIdx == 0)
+        ssize_t written = ::writev(fd, pIov, std::min(iovCnt, IOV_MAX));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        // partial write: skip the completely written vectors, advance into the next one
+        size_t remaining = static_cast<size_t>(written);
+        while ((iovCnt > 0) && (remaining >= pIov->iov_len))
+        {
+            remaining -= pIov->iov_len;
+            ++pIov;
+            --iovCnt;
+        }
+        if (iovCnt > 0)
         {
-            pDirEntry[0] = 0x00; // invalid, there is no next entry
-            pDirEntry[1] = 0xff; // invalid, there is no next entry
+            pIov->iov_base = static_cast<uint8_t *>(pIov->iov_base) + remaining;
+            pIov->iov_len -= remaining;
         }
-        else
+    }
+
+    D64_STATS_ADD(BYTES_WRITTEN, getImageSize());
+    D64_STATS_ADD(IMAGES_WRITTEN, 1);
+    return true;
+}
+
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeChangedSectors(int fd)
+{
+    D64_STATS_TIMER(SERIALIZE);
+    // one pwrite per run of adjacent changed sectors which are contiguous in memory
+    uint16_t idx = 0;
+    while (idx < NUM_SECTORS)
+    {
+        if (!storage.isDirty(idx))
         {
-            pDirEntry[0] = 0x00;
-            pDirEntry[1] = 0x00;
+            ++idx;
+            continue;
         }
 
-        pDirEntry[2] = 0x82; // .PRG
-        TrackSector ts = writeData(pData, length);
+        uint16_t firstIdx = idx;
+        uint8_t const *pRun = getSectorData(idx);
+        size_t length = BYTES_PER_SECTOR;
+        for (++idx; (idx < NUM_SECTORS) && storage.isDirty(idx) && (getSectorData(idx) == pRun + length); ++idx)
+        {
+            length += BYTES_PER_SECTOR;
+        }
 
-        if (ts != TRACK_SECTOR_INVALID)
+        off_t offset = static_cast<off_t>(firstIdx) * BYTES_PER_SECTOR;
+        while (length > 0)
         {
-            pDirEntry[3] = ts.track + 1;
-            pDirEntry[4] = ts.sector;
+            ssize_t written = ::pwrite(fd, pRun, length, offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            pRun += written;
+            length -= static_cast<size_t>(written);
+            offset += written;
+            D64_STATS_ADD(BYTES_WRITTEN, written);
+        }
+    }
 
-            string d64Name = makeD64FileName(name);
-            writeStringWithPadding(&pDirEntry[5], d64Name, 16, 0xa0);
-            // 9 bytes unused for .PRG leave at 0x00 as is
-            // file length in sectors, aka "blocks", little endian
-            uint16_t numberOfBlocks = (length + (DATA_BYTES_PER_SECTOR - 1)) / DATA_BYTES_PER_SECTOR;
+    storage.markClean();
+    D64_STATS_ADD(IMAGES_WRITTEN, 1);
+    return true;
+}
 
-            pDirEntry[30] = static_cast<uint8_t>(numberOfBlocks & 0xff);
-            pDirEntry[31] = static_cast<uint8_t>((numberOfBlocks >> 8) & 0xff);
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeImageFile(std::string const &path, bool useMmap) const
+{
+    int fd = ::open(path.c_str(), (useMmap ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool success = false;
 
-            success = true;
+    if (useMmap)
+    {
+        D64_STATS_TIMER(SERIALIZE);
+        if (::ftruncate(fd, getImageSize()) == 0)
+        {
+            void *pMapping = ::mmap(nullptr, getImageSize(), PROT_WRITE, MAP_SHARED, fd, 0);
+            if (pMapping != MAP_FAILED)
+            {
+                uint8_t *pDest = static_cast<uint8_t *>(pMapping);
+                storage.forEachRun([&pDest](uint8_t const *pRun, size_t length)
+                {
+                    std::memcpy(pDest, pRun, length);
+                    pDest += length;
+                    return true;
+                });
+                success = (::munmap(pMapping, getImageSize()) == 0);
+                D64_STATS_ADD(BYTES_WRITTEN, success ? getImageSize() : 0);
+                D64_STATS_ADD(IMAGES_WRITTEN, success ? 1 : 0);
+            }
         }
     }
+    else
+    {
+        success = writeImage(fd);
+    }
 
-
-    return success;
+    return (::close(fd) == 0) && success;
 }
 
-
-std::ostream & d64::operator << (std::ostream &os, d64::Writer const &writer)
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeG64(int fd) const
 {
-    for (auto ch : writer.diskBytes)
+    if constexpr (!isG64Geometry<Geometry>())
     {
-        os << ch;
+        return false;
     }
+    else
+    {
+        D64_STATS_TIMER(SERIALIZE);
+        std::vector<uint8_t> image;
+        encodeG64<Geometry>([this](uint16_t idx) { return getSectorData(idx); }, image);
 
-    return os;
+        uint8_t const *pData = image.data();
+        size_t length = image.size();
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, pData, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            pData += written;
+            length -= static_cast<size_t>(written);
+        }
+        D64_STATS_ADD(BYTES_WRITTEN, image.size());
+        D64_STATS_ADD(IMAGES_WRITTEN, 1);
+        return true;
+    }
 }
 
+template <typename Geometry>
+bool BasicWriter<Geometry>::writeG64File(std::string const &path) const
+{
+    if (!isG64Geometry<Geometry>())
+    {
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
 
-TrackSector Writer::writeData(uint8_t *pData, size_t length)
+    bool success = writeG64(fd);
+    return (::close(fd) == 0) && success;
+}
+
+template <typename Geometry>
+TrackSector BasicWriter<Geometry>::writeData(uint8_t const *pData, size_t length)
 {
+    D64_STATS_TIMER(LAYOUT);
     TrackSector ret = TRACK_SECTOR_INVALID;
 
     size_t availableBytes = getNumberOfAvailableBytes();
 
     if (length <= availableBytes && length > 0)
     {
-        ret = getFirstFreeTrackSector();
+        ret = allocator.getFirstFree(policy);
 
-        uint16_t sectorIdx = TrackSector::getSectorIdx(ret);
+        uint16_t sectorIdx = Geometry::getSectorIdx(ret);
         uint16_t previousSectorIdx = INVALID;
+        uint32_t numSectors = 0;
 
         while (length && (sectorIdx != INVALID))
         {
             uint8_t writtenData = writeDataToSector(sectorIdx, pData, length, previousSectorIdx);
+            // mark as occupied, prevents overwriting
+            setSectorOccupied(sectorIdx);
+            D64_STATS_COUNT(numSectors, 1);
             length -= writtenData;
             pData=&pData[writtenData];
 
             previousSectorIdx = sectorIdx;
-            // Check is there a way to get this faster?
-            sectorIdx = TrackSector::getSectorIdx(getNextFreeTrackSector(TrackSector::getTrackAndSector(sectorIdx)));
+            sectorIdx = length ? Geometry::getSectorIdx(allocator.getNextFree(Geometry::getTrackAndSector(sectorIdx), policy)) : INVALID;
         }
+
+        // once per file rather than per sector
+        D64_STATS_ADD(SECTORS_ALLOCATED, numSectors);
+        D64_STATS_ADD(ALLOCATION_PROBES, allocator.takeNumberOfProbes());
     }
 
     return ret;
 }
 
 // returns the number of written bytes
-uint8_t Writer::writeDataToSector(uint16_t sectorIdx, uint8_t *pData, size_t length, uint16_t prevSectorIdx)
+template <typename Geometry>
+uint8_t BasicWriter<Geometry>::writeDataToSector(uint16_t sectorIdx, uint8_t const *pData, size_t length, uint16_t prevSectorIdx)
 {
     uint8_t *pSector = getSector(sectorIdx);
     uint8_t ret = std::min(length, static_cast<size_t>(DATA_BYTES_PER_SECTOR));
@@ -275,21 +801,21 @@ uint8_t Writer::writeDataToSector(uint16_t sectorIdx, uint8_t *pData, size_t len
     if (prevSectorIdx != INVALID)
     {
         uint8_t *pPrevSector = getSector(prevSectorIdx);
-        TrackSector tsCurrent = TrackSector::getTrackAndSector(sectorIdx);
+        TrackSector tsCurrent = Geometry::getTrackAndSector(sectorIdx);
         pPrevSector[0] = tsCurrent.track + 1; // on the disk system, tracks start with "1"
         pPrevSector[1] = tsCurrent.sector; // but sectors are still zero-based
     }
 
     // copy data
     std::copy(&pData[0], &pData[ret], &pSector[2]);
-    // mark as occupied, prevents overwriting
-    setSectorOccupied(sectorIdx);
 
     if (ret <= DATA_BYTES_PER_SECTOR)
     {
         // this is the last sector of our file. conclude with track := 0, sector := <used bytes>
         pSector[0] = 0x00;
         pSector[1] = ret;
+        // a sector of a deleted file still holds its old content
+        std::fill(&pSector[2 + ret], &pSector[BYTES_PER_SECTOR], 0x00);
     }
 
     return ret;
@@ -297,3 +823,18 @@ uint8_t Writer::writeDataToSector(uint16_t sectorIdx, uint8_t *pData, size_t len
 
 
 
+
+namespace d64
+{
+
+template class BasicWriter<D64Geometry>;
+template class BasicWriter<D64ExtendedGeometry>;
+template class BasicWriter<D71Geometry>;
+template class BasicWriter<D81Geometry>;
+
+template class BasicFileSink<D64Geometry>;
+template class BasicFileSink<D64ExtendedGeometry>;
+template class BasicFileSink<D71Geometry>;
+template class BasicFileSink<D81Geometry>;
+
+}
@@ -5,66 +5,208 @@
 #include <vector>
 #include <string>
 #include <ostream>
+#include <functional>
 
 #include "TrackSector.h"
+#include "DiskGeometry.h"
+#include "SectorAllocator.h"
+#include "AllocationPolicy.h"
+#include "DirectoryIndex.h"
+#include "SectorStorage.h"
 
 namespace d64
 {
 
-class Writer
+template <typename Geometry>
+class BasicFileSink;
+
+template <typename Geometry>
+class BasicConcurrentWriter;
+
+// Builds an image of the format described by Geometry, see DiskGeometry.h. All sector index
+// math is resolved at compile time per format, the D64 Writer is BasicWriter<D64Geometry>.
+template <typename Geometry>
+class BasicWriter
 {
 public:
-    static constexpr uint16_t NUM_SECTORS = 683;
-    static constexpr uint16_t NUM_TRACKS = 35;
-    static constexpr uint16_t DIRECTORY_TRACK = 17;
+    using Allocator = BasicSectorAllocator<Geometry>;
+    using Directory = BasicDirectoryIndex<Geometry::MAX_DIR_ENTRIES>;
+    using Storage = BasicSectorStorage<Geometry::NUM_SECTORS>;
+    using FileSink = BasicFileSink<Geometry>;
+
+    static constexpr uint16_t NUM_SECTORS = Geometry::NUM_SECTORS;
+    static constexpr uint16_t NUM_TRACKS = Geometry::NUM_TRACKS;
+    static constexpr uint16_t DIRECTORY_TRACK = Geometry::DIRECTORY_TRACK;
     static constexpr uint16_t INVALID = 65535;
 
-    static constexpr uint16_t BYTES_PER_SECTOR = 256;
-    static constexpr uint16_t DATA_BYTES_PER_SECTOR = 254;
-    static constexpr uint16_t BAM_SECTOR_IDX = 357;
-    static constexpr uint16_t FIRST_DIR_SECTOR_IDX = 358;
+    static constexpr uint16_t BYTES_PER_SECTOR = SectorLayout::BYTES_PER_SECTOR;
+    static constexpr uint16_t DATA_BYTES_PER_SECTOR = SectorLayout::DATA_BYTES_PER_SECTOR;
+    static constexpr uint16_t HEADER_SECTOR_IDX = Geometry::HEADER_SECTOR_IDX;
+    static constexpr uint16_t BAM_SECTOR_IDX = Geometry::BAM_SECTOR_IDX;
+    static constexpr uint16_t FIRST_DIR_SECTOR_IDX = Geometry::FIRST_DIR_SECTOR_IDX;
 
-    static constexpr uint8_t DIR_ENTRIES_PER_SECTOR = 8;
-    static constexpr uint16_t BYTES_PER_DIR_ENTRY = 32;
+    static constexpr uint8_t DIR_ENTRIES_PER_SECTOR = SectorLayout::DIR_ENTRIES_PER_SECTOR;
+    static constexpr uint16_t BYTES_PER_DIR_ENTRY = SectorLayout::BYTES_PER_DIR_ENTRY;
+    static constexpr uint8_t NUM_DIR_SECTORS = Geometry::NUM_DIR_SECTORS;
+    static constexpr uint16_t MAX_DIR_ENTRIES = NUM_DIR_SECTORS * DIR_ENTRIES_PER_SECTOR;
 
 
     static constexpr TrackSector TRACK_SECTOR_INVALID = {255, 255};
 
-    Writer(std::string const folderName = "Demo")
+    static_assert(NUM_TRACKS == Allocator::NUM_TRACKS, "allocator and writer disagree on the number of tracks");
+    static_assert(MAX_DIR_ENTRIES == Geometry::MAX_DIR_ENTRIES, "directory index does not cover the directory track");
+    static_assert(BYTES_PER_SECTOR == Storage::BYTES_PER_SECTOR, "sector size does not match the storage");
+
+    // sector on the directory track holding the n-th directory sector of the chain
+    static constexpr uint8_t getDirSectorOnTrack(uint8_t n) { return Geometry::getDirSectorOnTrack(n); }
+
+    // SPARSE storage only keeps the sectors in memory which have been written, see SectorStorage
+    BasicWriter(std::string const folderName = "Demo", StorageMode storageMode = StorageMode::DENSE,
+                std::string const &diskId = "42") :
+        storage(storageMode)
     {
-        diskBytes.fill(0x00);
-        initImage(folderName);
+        reset(folderName, diskId);
     }
 
-    bool writeFile(std::string const &name, uint8_t *pData, size_t length);
-    friend std::ostream & operator << (std::ostream &os, d64::Writer const &writer);
+    // turns the Writer back into a blank image with the given name and ID, without any allocation.
+    // Copies prebuilt system sectors and only zeroes the sectors which have been written, so reusing
+    // a Writer is much cheaper than building a new one. Open FileSinks must be closed before.
+    void reset(std::string const &diskName, std::string const &diskId = "42");
+
+    // where the files written from now on go, reset() restores the default policy. Can be changed
+    // from file to file, but not while a FileSink is open.
+    void setAllocationPolicy(AllocationPolicy const &allocationPolicy) { policy = allocationPolicy; }
+    AllocationPolicy const &getAllocationPolicy() const { return policy; }
+
+    bool writeFile(std::string const &name, uint8_t const *pData, size_t length);
+
+    // Incremental update of an existing image: loadImage() takes over its sectors, BAM and directory,
+    // then files can be written, replaced and deleted, and writeChangedSectors() writes back only the
+    // sectors modified since. Fails if the directory chain does not follow the layout of this Writer
+    // or holds a name twice, the Writer must be reset() then before it is used again.
+    bool loadImage(uint8_t const *pImage, size_t length);
+    // frees the sectors of the file and its directory entry, false if there is no such file.
+    // Not for the files of open FileSinks.
+    bool deleteFile(std::string const &name);
+    bool deleteFile(DirectoryName const &name);
+    // writes the file in the directory slot of the existing file of that name, resp. like writeFile()
+    // if there is none. The old file is kept if the new one does not fit.
+    bool replaceFile(std::string const &name, uint8_t const *pData, size_t length);
+
+    uint16_t getNumberOfFiles() const { return directory.getNumberOfUsedSlots(); }
+    // why writeFile() would fail: the name is taken, resp. the directory has no room for another entry
+    bool hasFile(std::string const &name) const { return directory.find(makeD64FileName(name)) != DirectoryIndex::INVALID; }
+    bool isDirectoryFull() const { return directory.getFirstFreeSlot() == DirectoryIndex::INVALID; }
+    // blocks free for files, the directory track does not count
+    uint16_t getNumberOfFreeSectors() const { return allocator.getNumberOfFreeSectors(); }
+    size_t getNumberOfAvailableBytes() const { return getNumberOfFreeSectors() * DATA_BYTES_PER_SECTOR; }
+    // the same of a blank image, e.g. 664 blocks for a 35 track D64
+    static uint16_t getNumberOfFreeSectorsOnBlankImage();
+
+    // sectors modified since loadImage() resp. the last writeChangedSectors()
+    uint16_t getNumberOfChangedSectors() const { return storage.getNumberOfDirtySectors(); }
+    // writes the modified sectors at their offsets into the image file
+    bool writeChangedSectors(int fd);
+
+    // Streaming variants: the file content arrives in chunks and is written into sectors as it comes.
+    // openFile() reserves a directory slot, see FileSink. The reader of the second variant fills
+    // the given buffer and returns the number of bytes it provided, 0 at the end of the file.
+    FileSink openFile(std::string const &name);
+    bool writeFile(std::string const &name, std::function<size_t(uint8_t *pBuf, size_t maxLength)> const &reader);
+
+    // the bytes of the image, valid until the Writer is modified or destroyed.
+    // With sparse storage the image is not contiguous, getImageData() returns nullptr then.
+    uint8_t const *getImageData() const { return storage.getData(); }
+    size_t getImageSize() const { return storage.getSize(); }
+    uint8_t const *getSectorData(uint16_t idx) const { return storage.getSector(idx); }
+    uint16_t getNumberOfMaterializedSectors() const { return storage.getNumberOfMaterializedSectors(); }
+
+    // write the whole image in one go to a file descriptor, resp. a file which gets created or truncated
+    bool writeImage(int fd) const;
+    bool writeImageFile(std::string const &path, bool useMmap = false) const;
+    // the same as a G64 image, the GCR bitstream of the tracks as the drive reads them.
+    // False for the formats of other drives than the 1541, see G64.h.
+    bool writeG64(int fd) const;
+    bool writeG64File(std::string const &path) const;
+
+    friend std::ostream & operator << (std::ostream &os, BasicWriter const &writer)
+    {
+        writer.streamImage(os);
+        return os;
+    }
 
 private:
-    void initImage(std::string const &folderName);
-
-    uint8_t *getSector(uint16_t idx) {  return &diskBytes[idx * BYTES_PER_SECTOR];}
-    uint8_t const *getSector(uint16_t idx) const {  return &diskBytes[idx * BYTES_PER_SECTOR];}
-    TrackSector getFirstFreeTrackSector() const;
-    TrackSector getNextFreeTrackSector(TrackSector previous) const;
+    friend FileSink;
+    friend BasicConcurrentWriter<Geometry>;
 
-    uint8_t writeDataToSector(uint16_t sectorIdx, uint8_t *pData, size_t length, uint16_t prevSectorIdx);
-    TrackSector writeData(uint8_t *pData, size_t length);
+    uint8_t *getSector(uint16_t idx) { return storage.getSector(idx); }
+    uint8_t const *getSector(uint16_t idx) const { return storage.getSector(idx); }
+    // fills the sector and links the previous one to it, the BAM is left to the caller
+    uint8_t writeDataToSector(uint16_t sectorIdx, uint8_t const *pData, size_t length, uint16_t prevSectorIdx);
+    TrackSector writeData(uint8_t const *pData, size_t length);
+    void streamImage(std::ostream &os) const;
 
-    bool isTrackSectorAvailable(TrackSector ts) const;
     void setSectorOccupied(uint16_t sectorIdx);
+    void setSectorFree(uint16_t sectorIdx);
+    // number of sectors deleting the file starting at firstSector frees, calls freeSector(idx) on each
+    template <typename FreeSector>
+    uint16_t walkFileChain(TrackSector firstSector, FreeSector freeSector) const;
+
+    // directory entry of a slot, appends and links a new directory sector to the chain if required
+    uint8_t *claimDirEntry(uint16_t slot);
+    void writeDirEntry(uint16_t slot, DirectoryIndex::Name const &name, TrackSector firstSector, uint16_t numberOfBlocks);
+
+    Storage storage;
+    Allocator allocator; // kept in sync with the BAM sectors
+    Directory directory; // kept in sync with the directory sectors
+    uint8_t numDirSectors; // length of the directory sector chain
+    AllocationPolicy policy;
+};
 
-    uint16_t getNumberOfFreeSectors() const;
-    size_t getNumberOfAvailableBytes() const { return getNumberOfFreeSectors() * DATA_BYTES_PER_SECTOR; }
-    uint32_t getSectorBitsOfTrack(uint8_t trackIdx) const;
+// Receives the content of one file in chunks of any size, see Writer::openFile(). Sectors are
+// allocated and filled as the data arrives, so memory use does not depend on the file size.
+// close() writes the directory entry. If the file cannot be completed, i.e. a write() ran out of
+// space, close() fails or the sink is destroyed without close(), all its sectors are released.
+// The Writer must outlive the sink.
+template <typename Geometry>
+class BasicFileSink
+{
+public:
+    BasicFileSink(BasicFileSink &&other);
+    BasicFileSink(BasicFileSink const &) = delete;
+    BasicFileSink &operator = (BasicFileSink const &) = delete;
+    BasicFileSink &operator = (BasicFileSink &&) = delete;
+    ~BasicFileSink();
 
-    std::string makeD64FileName(std::string const &origFileName);
-    void writeString(uint8_t *pDest, std::string const &in);
-    void writeStringWithPadding(uint8_t *pDest, std::string const &in, size_t len, uint8_t padding);
+    // false if the image is full, or if the name was taken or the directory was full on open
+    bool write(uint8_t const *pData, size_t length);
+    // false if a write failed or no data was written
+    bool close();
 
-    std::array<uint8_t, BYTES_PER_SECTOR * NUM_SECTORS> diskBytes;
+    bool isOpen() const { return pWriter != nullptr; }
+
+private:
+    using Writer = BasicWriter<Geometry>;
+    friend Writer;
+    BasicFileSink(Writer *pWriter, DirectoryIndex::Name const &name, uint16_t slot);
+
+    void release();
+
+    Writer *pWriter; // nullptr once closed or released
+    DirectoryIndex::Name name;
+    uint16_t slot;
+    TrackSector firstSector;
+    uint16_t sectorIdx; // sector receiving the data, INVALID before the first write
+    uint8_t usedBytesInSector;
+    uint16_t numberOfBlocks;
 };
 
-std::ostream & operator << (std::ostream &os, d64::Writer const &writer);
+using Writer = BasicWriter<D64Geometry>;
+using FileSink = BasicFileSink<D64Geometry>;
+
+using D64ExtendedWriter = BasicWriter<D64ExtendedGeometry>;
+using D71Writer = BasicWriter<D71Geometry>;
+using D81Writer = BasicWriter<D81Geometry>;
 
 }
 
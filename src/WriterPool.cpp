@@ -0,0 +1,69 @@
+#include "WriterPool.h"
+
+using namespace d64;
+using namespace std;
+
+template <typename Geometry>
+void BasicWriterPool<Geometry>::Recycler::operator () (Writer *pWriter) const
+{
+    if (pPool != nullptr)
+    {
+        pPool->recycle(pWriter);
+    }
+    else
+    {
+        delete pWriter;
+    }
+}
+
+template <typename Geometry>
+typename BasicWriterPool<Geometry>::Handle BasicWriterPool<Geometry>::acquire(std::string const &diskName, std::string const &diskId)
+{
+    std::unique_ptr<Writer> pWriter;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idleWriters.empty())
+        {
+            pWriter = std::move(idleWriters.back());
+            idleWriters.pop_back();
+        }
+    }
+
+    if (pWriter)
+    {
+        // outside the lock, the reset touches the sectors written by the previous user
+        pWriter->reset(diskName, diskId);
+    }
+    else
+    {
+        pWriter.reset(new Writer(diskName, storageMode, diskId));
+    }
+
+    return Handle(pWriter.release(), Recycler{this});
+}
+
+template <typename Geometry>
+size_t BasicWriterPool<Geometry>::getNumberOfIdleWriters() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return idleWriters.size();
+}
+
+template <typename Geometry>
+void BasicWriterPool<Geometry>::recycle(Writer *pWriter)
+{
+    std::unique_ptr<Writer> pIdle(pWriter);
+    std::lock_guard<std::mutex> lock(mutex);
+    // keeps its capacity when Writers are taken out, so this does not allocate in steady state
+    idleWriters.push_back(std::move(pIdle));
+}
+
+namespace d64
+{
+
+template class BasicWriterPool<D64Geometry>;
+template class BasicWriterPool<D64ExtendedGeometry>;
+template class BasicWriterPool<D71Geometry>;
+template class BasicWriterPool<D81Geometry>;
+
+}
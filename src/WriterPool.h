@@ -0,0 +1,55 @@
+#ifndef WRITER_POOL_H
+#define WRITER_POOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Writer.h"
+
+namespace d64
+{
+
+// Thread-safe pool of Writers. A Writer handed back to the pool is reset and handed out again
+// instead of building a new one, so once the pool has as many Writers as are used at the same
+// time, an image costs no heap allocation for its Writer.
+template <typename Geometry>
+class BasicWriterPool
+{
+public:
+    using Writer = BasicWriter<Geometry>;
+
+    // gives the Writer back to its pool, or deletes it if there is no pool
+    struct Recycler
+    {
+        BasicWriterPool *pPool;
+        void operator () (Writer *pWriter) const;
+    };
+
+    using Handle = std::unique_ptr<Writer, Recycler>;
+
+    explicit BasicWriterPool(StorageMode storageMode = StorageMode::DENSE) : storageMode(storageMode) {}
+
+    BasicWriterPool(BasicWriterPool const &) = delete;
+    BasicWriterPool &operator = (BasicWriterPool const &) = delete;
+
+    // a blank image with the given name and ID, goes back to the pool when the handle is destroyed.
+    // The pool must outlive the handles.
+    Handle acquire(std::string const &diskName = "Demo", std::string const &diskId = "42");
+
+    size_t getNumberOfIdleWriters() const;
+
+private:
+    void recycle(Writer *pWriter);
+
+    StorageMode storageMode;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Writer>> idleWriters;
+};
+
+using WriterPool = BasicWriterPool<D64Geometry>;
+
+}
+
+#endif
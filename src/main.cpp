@@ -1,131 +1,408 @@
-
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
-#include <array>
-
-// POSIX API to read folders and files within
-#include <sys/types.h>
-#include <dirent.h>
+#include <vector>
+#include <cstdlib>
+#include <memory>
+#include <chrono>
 
-#include "Writer.h"
+#include "ImageBuilder.h"
+#include "BatchBuilder.h"
+#include "FolderWatcher.h"
+#include "BuildServer.h"
+#include "Verifier.h"
+#include "Stats.h"
 
 using namespace std;
 using namespace d64;
 
-static constexpr size_t MAX_PROG_FILE_LEN = 65535;
-
 void usage(char const *argv0)
 {
-    cerr << "Usage: " << argv0 << " <srcpath> <imagepath>" << endl;
+    cerr << "Usage: " << argv0 << " [--format <format>] [<cache options> | <placement options>] <srcpath> <imagepath>" << endl;
+    cerr << "       " << argv0 << " --batch [-j <jobs>] [--format <format>] [<cache options>] <imagedir> <srcpath>..." << endl;
+    cerr << "       " << argv0 << " --manifest [-j <jobs>] [--format <format>] [<cache options>] <manifestpath>" << endl;
+    cerr << "       " << argv0 << " --update [--format <format>] <srcpath> <imagepath>" << endl;
+    cerr << "       " << argv0 << " --watch [--format <format>] <srcpath> <imagepath>" << endl;
+    cerr << "       " << argv0 << " --span [-j <jobs>] [--format <format>] [--packing fast|best] <srcpath> <imagepath>" << endl;
+    cerr << "       " << argv0 << " --serve [-j <jobs>] <socketpath>" << endl;
+    cerr << "       " << argv0 << " --verify [-j <jobs>] [--format <format>] <imagepath>..." << endl;
     cerr << "Reads all '.prg' files found in a folder path to generate a .D64 image file." << endl;
+    cerr << "--batch builds one image <imagedir>/<foldername>.d64 per source folder," << endl;
+    cerr << "--manifest builds the images listed as '<srcpath> <imagepath>' lines in a file." << endl;
+    cerr << "Batch builds run on <jobs> threads, by default on one per hardware thread." << endl;
+    cerr << "--update adds, replaces and deletes files of an existing image to match the folder," << endl;
+    cerr << "only the changed sectors are written." << endl;
+    cerr << "--watch builds the image and keeps it up to date while the files in the folder change." << endl;
+    cerr << "--span distributes the files onto as few images <imagepath>_1, _2, ... as possible." << endl;
+    cerr << "--serve builds the images requested on a Unix domain socket on <jobs> threads until terminated." << endl;
+    cerr << "--verify checks the directory, the file chains and the BAM of images on <jobs> threads and prints" << endl;
+    cerr << "the problems found, not for g64." << endl;
+    cerr << "<format> is d64 (default), d64-40 (40 tracks), d71, d81 or g64 (the tracks of a d64 as GCR bitstream," << endl;
+    cerr << "not for --update and --watch)." << endl;
+    cerr << "<cache options> are --cache <cachedir> to reuse the images of unchanged folders," << endl;
+    cerr << "--cache-size <megabytes> to limit the cache (default 256) and --cache-links to hard-link the images" << endl;
+    cerr << "instead of copying them, for images which are never written in place." << endl;
+    cerr << "<placement options> are --placement linear (default), dos, closest or fastest to put the files" << endl;
+    cerr << "from the first track on, outward from the directory like the DOS, resp. as close to the directory" << endl;
+    cerr << "as possible, or the one of these which loads fastest, and --interleave <sectors> between the blocks." << endl;
+    cerr << "--stats prints the time spent, the bytes read and written, the sectors allocated, the files skipped" << endl;
+    cerr << "and the hit rate of the cache as one JSON object when done." << endl;
 }
 
-// returns a value > 0 if a .PRG file was read into the buffer
-size_t readProgFile(std::string const &filePath, array<uint8_t, MAX_PROG_FILE_LEN> &fileBuf)
+// more threads than this are a typo rather than a plan
+constexpr unsigned long MAX_JOBS = 1024;
+// megabytes, so the size in bytes fits into 64 bits
+constexpr unsigned long long MAX_CACHE_MEGABYTES = ~0ull >> 20;
+
+// false unless text is a plain number from 1 to maxValue
+static bool parseNumber(char const *text, unsigned long long maxValue, unsigned long long &value)
 {
-    // check .prg or .PRG extension
-    // first two bytes offset in Memory
-    // offset + byte length < 64k
-    size_t ret = 0;
+    char *pEnd = nullptr;
+    unsigned long long parsed = ((text[0] >= '0') && (text[0] <= '9')) ? std::strtoull(text, &pEnd, 10) : 0;
+    if ((pEnd == nullptr) || (*pEnd != '\0') || (parsed == 0) || (parsed > maxValue))
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
 
-    std::string fileSuffix = filePath.length() > 4 ? filePath.substr(filePath.length() - 4, 4) : "";
+// the value of -j, false unless it is a plain number from 1 to MAX_JOBS
+static bool parseJobs(char const *text, unsigned &numWorkers)
+{
+    unsigned long long value = 0;
+    if (!parseNumber(text, MAX_JOBS, value))
+    {
+        return false;
+    }
+    numWorkers = static_cast<unsigned>(value);
+    return true;
+}
+
+// prints the statistics of the run as JSON when main() returns. The phases and counters
+// are all zero in builds without instrumentation (Release), "instrumented" tells so.
+class StatsReport
+{
+public:
+    // pCache may be null
+    StatsReport(bool isEnabled, BuildCache const *pCache) :
+        isEnabled(isEnabled), pCache(pCache), start(std::chrono::steady_clock::now()) {}
+    ~StatsReport();
 
-    if (fileSuffix == ".PRG" || fileSuffix == ".prg")
+private:
+    bool isEnabled;
+    BuildCache const *pCache;
+    std::chrono::steady_clock::time_point start;
+};
+
+StatsReport::~StatsReport()
+{
+    if (!isEnabled)
     {
-        std::ifstream is(filePath, ios_base::in | ios_base::binary);
-        is.seekg(0, ios::end);
-        streampos fileSize = is.tellg();
+        return;
+    }
 
-        if (fileSize <= MAX_PROG_FILE_LEN)
-        {
-            is.seekg(0, ios::beg);
-            static_assert(sizeof(char) == sizeof(uint8_t), "the types char and uint8_t do not have the same size");
-            is.read(reinterpret_cast<char *>(&fileBuf[0]), fileSize);
-            uint16_t offset = fileBuf[0] + (fileBuf[1] << 8);
+    auto wallMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    cout << "{\"wallMicros\": " << wallMicros << ", \"instrumented\": " << (stats::isEnabled() ? "true" : "false") << ", ";
+    stats::writeJsonMembers(cout, stats::getSnapshot());
+    if (pCache != nullptr)
+    {
+        BuildCache::Stats cacheStats = pCache->getStats();
+        cout << ", \"cache\": {\"lookups\": " << cacheStats.lookups << ", \"hits\": " << cacheStats.hits
+             << ", \"hitRate\": " << cacheStats.getHitRate() << ", \"stores\": " << cacheStats.stores
+             << ", \"evictions\": " << cacheStats.evictions << ", \"images\": " << pCache->getNumberOfEntries()
+             << ", \"bytes\": " << pCache->getSize() << "}";
+    }
+    cout << "}" << endl;
+}
 
-            // very unsufficient check. we cannot guarantee that parts of the file won't
-            // show up in memory since the area is taken by the basic interpreter or OS
-            if (offset + fileSize - 1 <= MAX_PROG_FILE_LEN)
-            {
-                ret = fileSize;
-            }
+// verifies the images in parallel, prints their problems, returns the exit code
+static int runVerify(std::vector<std::string> const &imagePaths, unsigned numWorkers, ImageFormat format)
+{
+    std::vector<VerifyResult> results = verifyFiles(imagePaths, format, numWorkers);
+    size_t numBroken = 0;
+
+    for (size_t pathIdx = 0; pathIdx < imagePaths.size(); pathIdx++)
+    {
+        numBroken += results[pathIdx].isOk() ? 0 : 1;
+        for (auto const &problem : results[pathIdx].problems)
+        {
+            cout << imagePaths[pathIdx] << ": " << problem << endl;
         }
     }
 
-    return ret;
+    if (numBroken > 0)
+    {
+        cerr << numBroken << " of " << imagePaths.size() << " images have problems." << endl;
+        return 1;
+    }
+
+    return 0;
 }
 
-// returns the name of the bottommost directory of the path
-// getDirName("./foo/bar/baz") returns "baz"
-std::string getDirName(std::string path)
+// builds the jobs in parallel, reports failed ones, returns the exit code
+static int runBatch(std::vector<BatchJob> const &jobs, unsigned numWorkers, ImageFormat format, BuildCache *pCache)
 {
-    // if present, remove trailing '/'
-    if (path.at(path.length() - 1) == '/')
+    BatchBuilder builder(numWorkers, format, pCache);
+    std::vector<BatchResult> results = builder.build(jobs);
+    size_t numFailed = 0;
+
+    for (size_t jobIdx = 0; jobIdx < jobs.size(); jobIdx++)
+    {
+        if (!results[jobIdx].success)
+        {
+            ++numFailed;
+            cerr << jobs[jobIdx].srcPath << ": " << results[jobIdx].error;
+        }
+    }
+
+    if (numFailed > 0)
     {
-        path = path.substr(0, path.length() -1);
+        cerr << numFailed << " of " << jobs.size() << " images could not be built." << endl;
+        return 1;
     }
 
-    auto pos = path.find_last_of('/');
-    return (pos >= 0) ? path.substr(pos + 1) : path;
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    std::string mode = (argc > 1) ? argv[1] : "";
+    bool isBatch = (mode == "--batch") || (mode == "--manifest");
+    bool isUpdate = (mode == "--update") || (mode == "--watch");
+    bool isSpan = (mode == "--span");
+    bool isServe = (mode == "--serve");
+    bool isVerify = (mode == "--verify");
+    bool isBuild = !isBatch && !isUpdate && !isSpan && !isServe && !isVerify;
+    int argIdx = isBuild ? 1 : 2;
+    unsigned numWorkers = 0;
+    ImageFormat format = ImageFormat::D64;
+    std::string cacheDir;
+    uint64_t cacheSize = BuildCache::DEFAULT_MAX_BYTES;
+    bool printStats = false;
+    bool isCacheLinking = false;
+    PackingMode packingMode = PackingMode::FAST;
+    AllocationPolicy policy;
+    char const *pInterleave = nullptr;
+    bool isFastestPlacement = false;
+
+    // options, each with one value but --stats and --cache-links
+    while (argc > argIdx + 1)
     {
-        usage (argv[0]);
-        return 1;
+        std::string option = argv[argIdx];
+
+        if (option == "--stats")
+        {
+            printStats = true;
+            argIdx += 1;
+            continue;
+        }
+
+        if ((isBuild || isBatch) && (option == "--cache-links"))
+        {
+            isCacheLinking = true;
+            argIdx += 1;
+            continue;
+        }
+
+        if ((isBatch || isSpan || isServe || isVerify) && (option == "-j"))
+        {
+            if (!parseJobs(argv[argIdx + 1], numWorkers))
+            {
+                cerr << "Invalid number of jobs " << argv[argIdx + 1] << ", it must be between 1 and " << MAX_JOBS << "." << endl;
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!isServe && (option == "--format"))
+        {
+            if (!parseImageFormat(argv[argIdx + 1], format))
+            {
+                cerr << "Unknown image format " << argv[argIdx + 1] << "." << endl;
+                return 1;
+            }
+        }
+        else if (isSpan && (option == "--packing"))
+        {
+            std::string packing = argv[argIdx + 1];
+            if ((packing != "fast") && (packing != "best"))
+            {
+                cerr << "Unknown packing " << packing << "." << endl;
+                return 1;
+            }
+            packingMode = (packing == "best") ? PackingMode::BEST : PackingMode::FAST;
+        }
+        else if (isBuild && (option == "--placement"))
+        {
+            isFastestPlacement = (std::string(argv[argIdx + 1]) == "fastest");
+            if (!isFastestPlacement && !parsePlacement(argv[argIdx + 1], policy.placement))
+            {
+                cerr << "Unknown placement " << argv[argIdx + 1] << "." << endl;
+                return 1;
+            }
+        }
+        else if (isBuild && (option == "--interleave"))
+        {
+            // parsed once the format is known
+            pInterleave = argv[argIdx + 1];
+        }
+        else if ((isBuild || isBatch) && (option == "--cache"))
+        {
+            cacheDir = argv[argIdx + 1];
+        }
+        else if ((isBuild || isBatch) && (option == "--cache-size"))
+        {
+            unsigned long long megabytes = 0;
+            if (!parseNumber(argv[argIdx + 1], MAX_CACHE_MEGABYTES, megabytes))
+            {
+                cerr << "Invalid cache size " << argv[argIdx + 1] << ", it must be between 1 and " << MAX_CACHE_MEGABYTES << " megabytes." << endl;
+                usage(argv[0]);
+                return 1;
+            }
+            cacheSize = megabytes << 20;
+        }
+        else
+        {
+            break;
+        }
+        argIdx += 2;
     }
 
-    // FIXME: Do we have to close any handles after opendir()/readdir()?
-    DIR *pDIR = opendir(argv[1]);
-    if (pDIR != nullptr)
+    if (pInterleave != nullptr)
     {
-        struct dirent *dp = nullptr;
-        array<uint8_t, MAX_PROG_FILE_LEN> fileBuf;
-        Writer d64Writer(getDirName(argv[1]));
-
-        bool writeOK = true;
+        unsigned long long interleave = 0;
+        uint8_t maxInterleave = (format == ImageFormat::D81) ? D81Geometry::MAX_SECTORS_ON_TRACK : D64Geometry::MAX_SECTORS_ON_TRACK;
+        if (!parseNumber(pInterleave, maxInterleave, interleave))
+        {
+            cerr << "Invalid interleave " << pInterleave << ", it must be between 1 and " << static_cast<unsigned>(maxInterleave) << " sectors." << endl;
+            usage(argv[0]);
+            return 1;
+        }
+        policy.interleave = static_cast<uint8_t>(interleave);
+    }
 
-        while (((dp = readdir(pDIR)) != nullptr) && writeOK)
+    std::unique_ptr<BuildCache> pCache;
+    if (!cacheDir.empty())
+    {
+        pCache.reset(new BuildCache(cacheDir, cacheSize, BuildCache::DEFAULT_MAX_ENTRIES, isCacheLinking));
+        if (!pCache->isValid())
         {
-            std::stringstream filePath;
-            filePath << argv[1] << "/" << dp->d_name;
+            cerr << "Could not open cache folder " << cacheDir << "." << endl;
+            return 1;
+        }
+    }
 
-            // put the file content into the array, if name and content of file pass our checks
-            size_t readBytes = readProgFile(filePath.str(), fileBuf);
+    // destroyed before the cache, which it reports on
+    StatsReport statsReport(printStats, pCache.get());
+
+    if (isBatch)
+    {
+        std::vector<BatchJob> jobs;
 
-            if (readBytes > 0)
+        if ((mode == "--batch") && (argc > argIdx + 1))
+        {
+            std::string imageDir = argv[argIdx];
+            for (int srcIdx = argIdx + 1; srcIdx < argc; srcIdx++)
             {
-                writeOK = d64Writer.writeFile(dp->d_name, &fileBuf[0], readBytes);
+                jobs.push_back(BatchJob{argv[srcIdx], imageDir + "/" + getDirName(argv[srcIdx]) + getImageSuffix(format)});
             }
+        }
+        else if ((mode == "--manifest") && (argc == argIdx + 1))
+        {
+            std::ifstream manifest(argv[argIdx]);
+            std::string error;
 
-            if (!writeOK)
+            if (!manifest)
+            {
+                cerr << "Could not open manifest " << argv[argIdx] << "." << endl;
+                return 1;
+            }
+            if (!BatchBuilder::readManifest(manifest, jobs, error))
             {
-                cerr << "Could not write file " << dp->d_name << " to image." << std::endl;
+                cerr << error << endl;
+                return 1;
             }
         }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        return runBatch(jobs, numWorkers, format, pCache.get());
+    }
 
-        // all files have been added, now generate the image
-        if (writeOK)
+    if (isServe)
+    {
+        if (argc != argIdx + 1)
         {
-            std::ofstream d64Image(argv[2], std::ios::binary | std::ios::out | std::ios::trunc);
-            d64Image << d64Writer;
-            d64Image.close();
+            usage(argv[0]);
+            return 1;
         }
-        else
+        return serveBuilds(argv[argIdx], numWorkers, cerr) ? 0 : 1;
+    }
+
+    if (isVerify)
+    {
+        if (argc <= argIdx)
         {
+            usage(argv[0]);
             return 1;
         }
+        return runVerify(std::vector<std::string>(argv + argIdx, argv + argc), numWorkers, format);
     }
-    else
+
+    if (argc != argIdx + 2)
     {
-        // error handling: did not find folder
-        cerr << "Could not find folder " << argv[1] << "." << std::endl;
+        usage (argv[0]);
         return 1;
     }
 
-    return 0;
-}
\ No newline at end of file
+    if (isSpan)
+    {
+        std::vector<std::string> imagePaths;
+        bool success = buildSpannedImages(argv[argIdx], argv[argIdx + 1], cerr, imagePaths, format, packingMode, numWorkers);
+        if (success)
+        {
+            for (auto const &imagePath : imagePaths)
+            {
+                cout << imagePath << endl;
+            }
+        }
+        return success ? 0 : 1;
+    }
+    if (mode == "--watch")
+    {
+        return watchFolder(argv[argIdx], argv[argIdx + 1], cout, cerr, format) ? 0 : 1;
+    }
+    if (isUpdate)
+    {
+        return updateImage(argv[argIdx], argv[argIdx + 1], cerr, format) ? 0 : 1;
+    }
+
+    if (pCache && (isFastestPlacement || !policy.isDefault()))
+    {
+        // the cache does not tell images of different placements apart
+        cerr << "Placement options cannot be combined with a cache." << endl;
+        return 1;
+    }
+    if (isFastestPlacement)
+    {
+        AllocationPolicy chosenPolicy;
+        LoadCost cost;
+        if (!buildFastestImage(argv[argIdx], argv[argIdx + 1], cerr, format, policy.interleave, LoadCostModel(), chosenPolicy, cost))
+        {
+            return 1;
+        }
+        cout << "Placement " << getPlacementName(chosenPolicy.placement) << ", estimated load time of all files "
+             << ((cost.micros + 500) / 1000) << " ms." << endl;
+        return 0;
+    }
+
+    if (pCache)
+    {
+        return buildImage(argv[argIdx], argv[argIdx + 1], cerr, format, *pCache) ? 0 : 1;
+    }
+
+    return buildImage(argv[argIdx], argv[argIdx + 1], cerr, format, policy) ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include <cstdlib>
+#include <new>
+
+#include "AllocationCounter.h"
+
+using namespace d64;
+using namespace std;
+
+// in a translation unit of its own, so the compiler does not mix up the replacements with the
+// operators it knows
+static thread_local unsigned numCounters = 0;
+static thread_local size_t numAllocations = 0;
+
+void *operator new(std::size_t size)
+{
+    if (numCounters > 0)
+    {
+        ++numAllocations;
+    }
+
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+AllocationCounter::AllocationCounter() : numAllocationsBefore(numAllocations)
+{
+    ++numCounters;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    --numCounters;
+}
+
+size_t AllocationCounter::getNumberOfAllocations() const
+{
+    return numAllocations - numAllocationsBefore;
+}
@@ -0,0 +1,26 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+namespace d64
+{
+    // Counts the heap allocations of the calling thread while it lives. Works only in executables
+    // which link AllocationCounter.cpp, which replaces the global operator new.
+    class AllocationCounter
+    {
+    public:
+        AllocationCounter();
+        ~AllocationCounter();
+
+        AllocationCounter(AllocationCounter const &) = delete;
+        AllocationCounter &operator=(AllocationCounter const &) = delete;
+
+        size_t getNumberOfAllocations() const;
+
+    private:
+        size_t numAllocationsBefore;
+    };
+}
+
+#endif
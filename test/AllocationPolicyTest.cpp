@@ -0,0 +1,181 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "Writer.h"
+#include "Reader.h"
+#include "LoadCost.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    template <typename Geometry>
+    static std::vector<TrackSector> getChain(BasicWriter<Geometry> const &writer, std::string const &name)
+    {
+        std::vector<uint8_t> image = getImage(writer);
+        BasicReader<Geometry> reader(image.data(), image.size());
+        auto view = reader.getFile(*reader.findFile(name));
+        std::vector<TrackSector> ret;
+        for (auto it = view.begin(); it != view.end(); ++it)
+        {
+            ret.push_back(Geometry::getTrackAndSector(it.getSectorIdx()));
+        }
+        return ret;
+    }
+
+    // files of all sizes until the disk is full, each of them must read back
+    template <typename Geometry>
+    static void checkFullDisk(AllocationPolicy const &policy)
+    {
+        using Writer = BasicWriter<Geometry>;
+        std::unique_ptr<Writer> pWriter(new Writer("POLICY"));
+        pWriter->setAllocationPolicy(policy);
+
+        std::vector<std::vector<uint8_t>> progs;
+        for (size_t fileIdx = 0; pWriter->getNumberOfFreeSectors() > 0; fileIdx++)
+        {
+            size_t length = std::min<size_t>(1 + (fileIdx * 1777) % (60 * 254), pWriter->getNumberOfAvailableBytes());
+            progs.push_back(std::vector<uint8_t>(length, static_cast<uint8_t>(fileIdx)));
+            REQUIRE(pWriter->writeFile("F" + std::to_string(fileIdx), progs.back().data(), length));
+        }
+
+        std::vector<uint8_t> image = getImage(*pWriter);
+        BasicReader<Geometry> reader(image.data(), image.size());
+        REQUIRE(reader.getFiles().size() == progs.size());
+        for (size_t fileIdx = 0; fileIdx < progs.size(); fileIdx++)
+        {
+            std::vector<uint8_t> content;
+            reader.getFile(*reader.findFile("F" + std::to_string(fileIdx))).copyTo(content);
+            REQUIRE(content == progs[fileIdx]);
+        }
+    }
+
+    template <typename Geometry>
+    static void checkAllPolicies()
+    {
+        for (Placement placement : {Placement::LINEAR, Placement::DOS, Placement::CLOSEST_TO_DIRECTORY})
+        {
+            for (uint8_t interleave : {0, 1, 4})
+            {
+                checkFullDisk<Geometry>(AllocationPolicy{placement, interleave});
+            }
+        }
+    }
+
+    TEST_CASE("Allocation policies", "AllocationPolicy")
+    {
+        std::vector<uint8_t> prog(50 * 254, 0x11);
+
+        // outward from the directory on track 18, the next file on the other side
+        Writer writer;
+        writer.setAllocationPolicy(AllocationPolicy{Placement::DOS, 0});
+        REQUIRE(writer.writeFile("FIRST", prog.data(), prog.size()));
+        REQUIRE(writer.writeFile("SECOND", prog.data(), 254));
+        auto chain = getChain(writer, "FIRST");
+        REQUIRE(chain.size() == 50);
+        REQUIRE(chain[0] == TrackSector{16, 0});
+        REQUIRE(chain[20].track == 16);
+        REQUIRE(chain[21].track == 15);
+        REQUIRE(chain[42].track == 14);
+        REQUIRE(getChain(writer, "SECOND")[0] == TrackSector{18, 0});
+
+        // reset() brings back the default
+        writer.reset("LINEAR");
+        REQUIRE(writer.getAllocationPolicy().isDefault());
+        REQUIRE(writer.writeFile("FIRST", prog.data(), prog.size()));
+        REQUIRE(getChain(writer, "FIRST")[0] == TrackSector{0, 0});
+
+        // track after track nearest to the directory
+        writer.reset("CLOSEST");
+        writer.setAllocationPolicy(AllocationPolicy{Placement::CLOSEST_TO_DIRECTORY, 0});
+        REQUIRE(writer.writeFile("FIRST", prog.data(), prog.size()));
+        chain = getChain(writer, "FIRST");
+        REQUIRE(chain[20].track == 16);
+        REQUIRE(chain[21].track == 18);
+        REQUIRE(chain[40].track == 15);
+
+        // custom interleave, then wrapping around a partly used track
+        writer.reset("INTERLEAVE");
+        writer.setAllocationPolicy(AllocationPolicy{Placement::LINEAR, 4});
+        REQUIRE(writer.writeFile("FIRST", prog.data(), 5 * 254));
+        REQUIRE(getChain(writer, "FIRST") == (std::vector<TrackSector>{{0, 0}, {0, 4}, {0, 8}, {0, 12}, {0, 16}}));
+        REQUIRE(writer.writeFile("SECOND", prog.data(), 3 * 254));
+        REQUIRE(getChain(writer, "SECOND") == (std::vector<TrackSector>{{0, 1}, {0, 5}, {0, 9}}));
+
+        checkAllPolicies<D64Geometry>();
+        checkAllPolicies<D64ExtendedGeometry>();
+        checkAllPolicies<D71Geometry>();
+        checkAllPolicies<D81Geometry>();
+    }
+
+    TEST_CASE("Load cost", "AllocationPolicy")
+    {
+        std::vector<uint8_t> prog(3 * 254, 0x22);
+        Writer writer;
+        writer.setAllocationPolicy(AllocationPolicy{Placement::DOS, 10});
+        REQUIRE(writer.writeFile("NEAR", prog.data(), prog.size()));
+
+        // one step, half a revolution, then each block 9 busy sectors later
+        std::vector<uint8_t> image = getImage(writer);
+        Reader reader(image.data(), image.size());
+        LoadCost cost = estimateLoadCost(reader.getFile(*reader.findFile("NEAR")));
+        REQUIRE(cost.numSteps == 1);
+        REQUIRE(cost.numSectorTimes == 11 + 10 + 10);
+        REQUIRE(cost.micros == 3000 + 11 * 200000 / 21 + 2 * (10 * 200000 / 21));
+
+        // an interleave shorter than the loader is busy costs a revolution per block
+        LoadCostModel fastloader;
+        fastloader.busySectors = 3;
+        LoadCost costs[2];
+        for (uint8_t interleave : {1, 4})
+        {
+            writer.reset("COST");
+            writer.setAllocationPolicy(AllocationPolicy{Placement::DOS, interleave});
+            std::vector<uint8_t> large(40 * 254, 0x33);
+            REQUIRE(writer.writeFile("LARGE", large.data(), large.size()));
+            image = getImage(writer);
+            Reader largeReader(image.data(), image.size());
+            costs[interleave / 4] = estimateLoadCost(largeReader, fastloader);
+        }
+        REQUIRE(costs[1].numSteps == costs[0].numSteps);
+        REQUIRE(costs[1].micros * 3 < costs[0].micros);
+    }
+
+    TEST_CASE("Fastest placement", "AllocationPolicy")
+    {
+        std::string root = makeTempFolder();
+        std::string folder = root + "/demo";
+        REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+        for (uint8_t fileIdx = 0; fileIdx < 6; fileIdx++)
+        {
+            writeHostFile(folder + "/part" + std::to_string(fileIdx) + ".prg", std::vector<uint8_t>(2 * 254 + fileIdx, fileIdx));
+        }
+
+        std::ostringstream err;
+        AllocationPolicy chosenPolicy;
+        LoadCost cost;
+        REQUIRE(buildFastestImage(folder, root + "/fastest.d64", err, ImageFormat::D64, 0, LoadCostModel(), chosenPolicy, cost));
+
+        // no placement loads faster. Short files load faster close to the directory, for long ones the
+        // faster zone of the first tracks can make up for the steps.
+        for (Placement placement : {Placement::LINEAR, Placement::DOS, Placement::CLOSEST_TO_DIRECTORY})
+        {
+            REQUIRE(buildImage(folder, root + "/placed.d64", err, ImageFormat::D64, AllocationPolicy{placement, 0}));
+            Reader reader(root + "/placed.d64");
+            LoadCost placementCost = estimateLoadCost(reader);
+            REQUIRE(cost.micros <= placementCost.micros);
+            if (placement == chosenPolicy.placement)
+            {
+                REQUIRE(readHostFile(root + "/placed.d64") == readHostFile(root + "/fastest.d64"));
+            }
+        }
+        REQUIRE(chosenPolicy.placement != Placement::LINEAR);
+        removeFolder(root);
+    }
+}
@@ -0,0 +1,75 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+
+#include <sys/stat.h> // mkdir
+
+#include "BatchBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("Manifest parsing", "BatchBuilder")
+    {
+        std::istringstream manifest(
+            "# comment\n"
+            "\n"
+            "games/folder one\tout/one.d64\n"
+            "games/two   out/two.d64\r\n");
+
+        std::vector<BatchJob> jobs;
+        std::string error;
+        REQUIRE(BatchBuilder::readManifest(manifest, jobs, error));
+        REQUIRE(jobs.size() == 2);
+        REQUIRE(jobs[0].srcPath == "games/folder one");
+        REQUIRE(jobs[0].imagePath == "out/one.d64");
+        REQUIRE(jobs[1].srcPath == "games/two");
+        REQUIRE(jobs[1].imagePath == "out/two.d64");
+
+        std::istringstream broken("only_one_path\n");
+        REQUIRE_FALSE(BatchBuilder::readManifest(broken, jobs, error));
+        REQUIRE(error.find("line 1") != std::string::npos);
+    }
+
+    TEST_CASE("Batch build", "BatchBuilder")
+    {
+        std::string root = makeTempFolder();
+        std::vector<BatchJob> jobs;
+        std::vector<std::vector<uint8_t>> progs;
+
+        for (uint8_t folderIdx = 0; folderIdx < 6; folderIdx++)
+        {
+            std::string folder = root + "/disk" + std::to_string(folderIdx);
+            std::vector<uint8_t> prog = { 0x01, 0x08 };
+            prog.resize(300 + folderIdx * 100, folderIdx);
+            REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+            writeHostFile(folder + "/prog.prg", prog);
+
+            progs.push_back(prog);
+            jobs.push_back(BatchJob{folder, folder + ".d64"});
+        }
+        jobs.push_back(BatchJob{root + "/missing", root + "/missing.d64"});
+
+        std::vector<BatchResult> results = BatchBuilder(3).build(jobs);
+        REQUIRE(results.size() == jobs.size());
+
+        for (size_t jobIdx = 0; jobIdx < progs.size(); jobIdx++)
+        {
+            REQUIRE(results[jobIdx].success);
+
+            std::ifstream is(jobs[jobIdx].imagePath, std::ios::binary);
+            std::vector<uint8_t> image((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            REQUIRE(image.size() == Writer::BYTES_PER_SECTOR * Writer::NUM_SECTORS);
+            assertProgOnImage(progs[jobIdx], "PROG.PRG", &image[0]);
+        }
+
+        REQUIRE_FALSE(results.back().success);
+        REQUIRE(results.back().error.find("missing") != std::string::npos);
+
+        removeFolder(root);
+    }
+}
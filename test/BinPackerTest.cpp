@@ -0,0 +1,182 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+#include "BinPacker.h"
+#include "ImageBuilder.h"
+#include "Reader.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    // every file on exactly one disk, no disk over its capacity
+    static void checkPacking(std::vector<uint16_t> const &fileBlocks, DiskCapacity capacity, std::vector<std::vector<size_t>> const &disks)
+    {
+        std::vector<int> numPlaced(fileBlocks.size(), 0);
+        for (auto const &disk : disks)
+        {
+            REQUIRE(!disk.empty());
+            REQUIRE(disk.size() <= capacity.entries);
+            REQUIRE(std::is_sorted(disk.begin(), disk.end()));
+
+            uint32_t usedBlocks = 0;
+            for (size_t fileIdx : disk)
+            {
+                usedBlocks += fileBlocks[fileIdx];
+                ++numPlaced[fileIdx];
+            }
+            REQUIRE(usedBlocks <= capacity.blocks);
+        }
+        REQUIRE(std::all_of(numPlaced.begin(), numPlaced.end(), [](int num) { return num == 1; }));
+    }
+
+    TEST_CASE("Bin packing", "BinPacker")
+    {
+        std::vector<std::vector<size_t>> disks;
+        DiskCapacity small = { 10, 144 };
+
+        // first fit decreasing needs a third disk here, filling the disks does not
+        std::vector<uint16_t> fileBlocks = { 5, 4, 3, 3, 3, 2 };
+        REQUIRE(packFiles(fileBlocks, small, PackingMode::FAST, disks));
+        checkPacking(fileBlocks, small, disks);
+        REQUIRE(disks.size() == 3);
+        REQUIRE(packFiles(fileBlocks, small, PackingMode::BEST, disks));
+        checkPacking(fileBlocks, small, disks);
+        REQUIRE(disks.size() == 2);
+
+        // the directory limits a disk too
+        DiskCapacity d64 = { 664, 144 };
+        std::vector<uint16_t> tiny(300, 1);
+        REQUIRE(packFiles(tiny, d64, PackingMode::FAST, disks));
+        checkPacking(tiny, d64, disks);
+        REQUIRE(disks.size() == 3);
+        REQUIRE(packFiles(tiny, d64, PackingMode::BEST, disks));
+        checkPacking(tiny, d64, disks);
+        REQUIRE(disks.size() == 3);
+
+        // thousands of files of typical sizes
+        std::mt19937 random(42);
+        std::vector<uint16_t> many;
+        for (int fileIdx = 0; fileIdx < 3000; fileIdx++)
+        {
+            many.push_back(static_cast<uint16_t>(1 + random() % 258));
+        }
+        REQUIRE(packFiles(many, d64, PackingMode::FAST, disks));
+        checkPacking(many, d64, disks);
+        size_t numFast = disks.size();
+        REQUIRE(packFiles(many, d64, PackingMode::BEST, disks));
+        checkPacking(many, d64, disks);
+        REQUIRE(disks.size() <= numFast);
+        REQUIRE(disks.size() >= getMinimumNumberOfDisks(many, d64));
+
+        REQUIRE(packFiles(std::vector<uint16_t>(), d64, PackingMode::BEST, disks));
+        REQUIRE(disks.empty());
+        REQUIRE(!packFiles(std::vector<uint16_t>{ 1, 665 }, d64, PackingMode::FAST, disks));
+    }
+
+    TEST_CASE("Bin packing with names", "BinPacker")
+    {
+        // four small files of two names would all fit onto one disk
+        std::vector<uint16_t> fileBlocks{ 10, 20, 30, 40, 50 };
+        std::vector<size_t> nameIds{ 7, 7, 3, 7, 3 };
+        DiskCapacity d64 = { 664, 144 };
+        for (PackingMode mode : { PackingMode::FAST, PackingMode::BEST })
+        {
+            std::vector<std::vector<size_t>> disks;
+            REQUIRE(packFiles(fileBlocks, d64, mode, disks, nameIds));
+            checkPacking(fileBlocks, d64, disks);
+            REQUIRE(disks.size() == 3);
+            for (auto const &disk : disks)
+            {
+                std::vector<size_t> diskNameIds;
+                for (size_t fileIdx : disk)
+                {
+                    diskNameIds.push_back(nameIds[fileIdx]);
+                }
+                std::sort(diskNameIds.begin(), diskNameIds.end());
+                REQUIRE(std::adjacent_find(diskNameIds.begin(), diskNameIds.end()) == diskNameIds.end());
+            }
+        }
+
+        // names which all differ change nothing
+        std::vector<uint16_t> tight{ 400, 300, 300, 264, 200, 200 };
+        std::vector<size_t> distinct{ 0, 1, 2, 3, 4, 5 };
+        std::vector<std::vector<size_t>> disks;
+        REQUIRE(packFiles(tight, d64, PackingMode::BEST, disks, distinct));
+        checkPacking(tight, d64, disks);
+        REQUIRE(disks.size() == getMinimumNumberOfDisks(tight, d64));
+
+        REQUIRE(!packFiles(fileBlocks, d64, PackingMode::FAST, disks, std::vector<size_t>{ 1, 2 }));
+    }
+
+    TEST_CASE("Spanned images", "BinPacker")
+    {
+        REQUIRE(getSpannedImagePath("out/games.d64", 2) == "out/games_2.d64");
+        REQUIRE(getSpannedImagePath("out.dir/games", 1) == "out.dir/games_1");
+
+        // 10 programs of 200 blocks do not fit onto one disk
+        std::string root = makeTempFolder();
+        std::string folder = root + "/compilation";
+        REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+        std::vector<std::vector<uint8_t>> progs;
+        for (uint8_t fileIdx = 0; fileIdx < 10; fileIdx++)
+        {
+            progs.push_back(std::vector<uint8_t>(200 * 254 - fileIdx, fileIdx));
+            writeHostFile(folder + "/game" + std::to_string(fileIdx) + ".prg", progs.back());
+        }
+
+        std::ostringstream err;
+        std::vector<std::string> imagePaths;
+        REQUIRE(buildSpannedImages(folder, root + "/compilation.d64", err, imagePaths, ImageFormat::D64, PackingMode::FAST, 2));
+        REQUIRE(imagePaths.size() == 4);
+        REQUIRE(imagePaths[0] == root + "/compilation_1.d64");
+
+        std::vector<int> numFound(progs.size(), 0);
+        for (auto const &imagePath : imagePaths)
+        {
+            std::vector<uint8_t> image = readHostFile(imagePath);
+            Reader reader(&image[0], image.size());
+            REQUIRE(reader.getStatus() == Reader::Status::OK);
+            for (size_t fileIdx = 0; fileIdx < progs.size(); fileIdx++)
+            {
+                auto pEntry = reader.findFile("game" + std::to_string(fileIdx) + ".prg");
+                if (pEntry != nullptr)
+                {
+                    std::vector<uint8_t> content;
+                    reader.getFile(*pEntry).copyTo(content);
+                    REQUIRE(content == progs[fileIdx]);
+                    ++numFound[fileIdx];
+                }
+            }
+        }
+        REQUIRE(std::all_of(numFound.begin(), numFound.end(), [](int num) { return num == 1; }));
+
+        // all of them fit onto a D81
+        REQUIRE(buildSpannedImages(folder, root + "/compilation.d81", err, imagePaths, ImageFormat::D81));
+        REQUIRE(imagePaths.size() == 1);
+
+        // the same name on the image, cut to 16 characters, takes a second disk
+        std::string sameNames = root + "/samenames";
+        REQUIRE(mkdir(sameNames.c_str(), 0755) == 0);
+        writeHostFile(sameNames + "/a_very_long_name_1.prg", progs[0]);
+        writeHostFile(sameNames + "/a_very_long_name_2.prg", progs[1]);
+        err.str("");
+        REQUIRE(buildSpannedImages(sameNames, root + "/samenames.d64", err, imagePaths, ImageFormat::D64));
+        REQUIRE(err.str().empty());
+        REQUIRE(imagePaths.size() == 2);
+
+        // nothing to span
+        std::string empty = root + "/empty";
+        REQUIRE(mkdir(empty.c_str(), 0755) == 0);
+        REQUIRE(!buildSpannedImages(empty, root + "/empty.d64", err, imagePaths, ImageFormat::D64));
+        REQUIRE(err.str().find("holds no '.prg' files") != std::string::npos);
+        removeFolder(root);
+    }
+}
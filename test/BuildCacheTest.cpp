@@ -0,0 +1,224 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BuildCache.h"
+#include "BatchBuilder.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    static std::string makeGameFolder(std::string const &root, std::string const &name, uint8_t value)
+    {
+        std::string folder = root + "/" + name;
+        mkdir(folder.c_str(), 0755);
+        std::vector<uint8_t> prog(2000, value);
+        prog[0] = 0x01;
+        prog[1] = 0x08;
+        writeHostFile(folder + "/game.prg", prog);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, value });
+        return folder;
+    }
+
+    static nlink_t getNumberOfLinks(std::string const &path)
+    {
+        struct stat st;
+        REQUIRE(stat(path.c_str(), &st) == 0);
+        return st.st_nlink;
+    }
+
+    TEST_CASE("Content hash", "BuildCache")
+    {
+        std::vector<uint8_t> bytes(1000);
+        for (size_t idx = 0; idx < bytes.size(); idx++)
+        {
+            bytes[idx] = static_cast<uint8_t>(idx * 13);
+        }
+
+        // the same bytes in pieces of any size give the same hash
+        ContentHasher whole, pieces;
+        whole.add(&bytes[0], bytes.size());
+        for (size_t offset = 0, length = 1; offset < bytes.size(); offset += length, length = (length * 3) % 17 + 1)
+        {
+            pieces.add(&bytes[offset], std::min(length, bytes.size() - offset));
+        }
+        REQUIRE(whole.finish() == pieces.finish());
+        REQUIRE(whole.finish().toString().length() == 32);
+
+        // a single bit, the length and the string boundaries change the hash
+        ContentHasher flipped, shorter, ab, a;
+        bytes[500] ^= 0x01;
+        flipped.add(&bytes[0], bytes.size());
+        shorter.add(&bytes[0], bytes.size() - 1);
+        ab.add(std::string("AB"));
+        ab.add(std::string(""));
+        a.add(std::string("A"));
+        a.add(std::string("B"));
+        REQUIRE(flipped.finish() != whole.finish());
+        REQUIRE(shorter.finish() != whole.finish());
+        REQUIRE(ab.finish() != a.finish());
+    }
+
+    TEST_CASE("Folder hash", "BuildCache")
+    {
+        std::string root = makeTempFolder();
+        std::string folder = makeGameFolder(root, "game", 0x11);
+        std::ostringstream err;
+
+        BuildCache::Key key, same, otherFormat, changed;
+        REQUIRE(hashFolder(folder, ImageFormat::D64, key, err));
+        REQUIRE(hashFolder(folder + "/", ImageFormat::D64, same, err));
+        REQUIRE(hashFolder(folder, ImageFormat::D81, otherFormat, err));
+        REQUIRE(key == same);
+        REQUIRE(key != otherFormat);
+
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x12 });
+        REQUIRE(hashFolder(folder, ImageFormat::D64, changed, err));
+        REQUIRE(key != changed);
+
+        writeHostFile(folder + "/bad.prg", std::vector<uint8_t>{ 0x01 });
+        REQUIRE(!hashFolder(folder, ImageFormat::D64, changed, err));
+        removeFolder(root);
+    }
+
+    TEST_CASE("Cached builds", "BuildCache")
+    {
+        std::string root = makeTempFolder();
+        std::string folder = makeGameFolder(root, "game", 0x22);
+        std::string imagePath = root + "/game.d64";
+        std::ostringstream err;
+        BuildCache cache(root + "/cache");
+        REQUIRE(cache.isValid());
+
+        // built once, then taken from the cache
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, cache));
+        std::vector<uint8_t> built = readHostFile(imagePath);
+        REQUIRE(cache.getNumberOfEntries() == 1);
+        REQUIRE(unlink(imagePath.c_str()) == 0);
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, cache));
+        REQUIRE(readHostFile(imagePath) == built);
+        REQUIRE(getNumberOfLinks(imagePath) == 1);
+
+        BuildCache::Stats stats = cache.getStats();
+        REQUIRE(stats.lookups == 2);
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.stores == 1);
+        REQUIRE(stats.getHitRate() == 0.5);
+
+        // the image is a copy, writing it in place does not change the cached one
+        int fd = ::open(imagePath.c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(::pwrite(fd, "X", 1, 0) == 1);
+        ::close(fd);
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, cache));
+        REQUIRE(readHostFile(imagePath) == built);
+
+        // with hard links, writing the image does not change the cached one either
+        BuildCache linking(root + "/linking", BuildCache::DEFAULT_MAX_BYTES, BuildCache::DEFAULT_MAX_ENTRIES, true);
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, linking));
+        REQUIRE(getNumberOfLinks(imagePath) == 2);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x23 });
+        REQUIRE(buildImage(folder, imagePath, err));
+        REQUIRE(getNumberOfLinks(imagePath) == 1);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x22 });
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, linking));
+        REQUIRE(readHostFile(imagePath) == built);
+        REQUIRE(getNumberOfLinks(imagePath) == 2);
+
+        // neither does rebuilding the copy
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x23 });
+        REQUIRE(buildImage(folder, imagePath, err));
+        REQUIRE(getNumberOfLinks(imagePath) == 1);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x22 });
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, cache));
+        REQUIRE(readHostFile(imagePath) == built);
+
+        // nor updating a linked image
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, linking));
+        REQUIRE(getNumberOfLinks(imagePath) == 2);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x24 });
+        REQUIRE(updateImage(folder, imagePath, err));
+        REQUIRE(getNumberOfLinks(imagePath) == 1);
+        writeHostFile(folder + "/intro.prg", std::vector<uint8_t>{ 0x01, 0x08, 0x22 });
+        REQUIRE(buildImage(folder, imagePath, err, ImageFormat::D64, cache));
+        REQUIRE(readHostFile(imagePath) == built);
+
+        // a new cache on the same folder knows the entries
+        BuildCache reopened(root + "/cache");
+        REQUIRE(reopened.getNumberOfEntries() == 1);
+        BuildCache::Key key;
+        REQUIRE(hashFolder(folder, ImageFormat::D64, key, err));
+        REQUIRE(unlink(imagePath.c_str()) == 0);
+        REQUIRE(reopened.fetch(key, imagePath));
+        REQUIRE(readHostFile(imagePath) == built);
+        removeFolder(root);
+    }
+
+    TEST_CASE("Cache eviction", "BuildCache")
+    {
+        std::string root = makeTempFolder();
+        std::ostringstream err;
+        BuildCache cache(root + "/cache", BuildCache::DEFAULT_MAX_BYTES, 2);
+
+        std::vector<std::string> folders;
+        for (uint8_t folderIdx = 0; folderIdx < 3; folderIdx++)
+        {
+            folders.push_back(makeGameFolder(root, "game" + std::to_string(folderIdx), folderIdx));
+        }
+
+        // game0 is used again after game1, so game1 is the least recently used one
+        REQUIRE(buildImage(folders[0], root + "/0.d64", err, ImageFormat::D64, cache));
+        REQUIRE(buildImage(folders[1], root + "/1.d64", err, ImageFormat::D64, cache));
+        REQUIRE(buildImage(folders[0], root + "/0.d64", err, ImageFormat::D64, cache));
+        REQUIRE(buildImage(folders[2], root + "/2.d64", err, ImageFormat::D64, cache));
+        REQUIRE(cache.getNumberOfEntries() == 2);
+        REQUIRE(cache.getStats().evictions == 1);
+
+        REQUIRE(buildImage(folders[0], root + "/0.d64", err, ImageFormat::D64, cache));
+        REQUIRE(buildImage(folders[1], root + "/1.d64", err, ImageFormat::D64, cache));
+        REQUIRE(cache.getStats().hits == 2);
+
+        // the size limit holds the same way
+        BuildCache small(root + "/small", 174848 + 1000);
+        REQUIRE(buildImage(folders[0], root + "/0.d64", err, ImageFormat::D64, small));
+        REQUIRE(buildImage(folders[1], root + "/1.d64", err, ImageFormat::D64, small));
+        REQUIRE(small.getNumberOfEntries() == 1);
+        REQUIRE(small.getSize() == 174848);
+        removeFolder(root);
+    }
+
+    TEST_CASE("Cached batch builds", "BuildCache")
+    {
+        std::string root = makeTempFolder();
+        BuildCache cache(root + "/cache");
+        std::vector<BatchJob> jobs;
+        for (uint8_t folderIdx = 0; folderIdx < 8; folderIdx++)
+        {
+            std::string folder = makeGameFolder(root, "game" + std::to_string(folderIdx), folderIdx);
+            jobs.push_back(BatchJob{folder, folder + ".d64"});
+        }
+
+        BatchBuilder builder(4, ImageFormat::D64, &cache);
+        for (auto const &result : builder.build(jobs))
+        {
+            REQUIRE(result.success);
+        }
+        for (auto const &result : builder.build(jobs))
+        {
+            REQUIRE(result.success);
+        }
+        REQUIRE(cache.getStats().lookups == 16);
+        REQUIRE(cache.getStats().hits == 8);
+        REQUIRE(readHostFile(jobs[3].imagePath).size() == 174848);
+        removeFolder(root);
+    }
+}
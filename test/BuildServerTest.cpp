@@ -0,0 +1,241 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <memory>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "BuildServer.h"
+#include "Writer.h"
+#include "G64.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    // the client side of a connection. Used from several threads, so failures only show in the answers.
+    class TestClient
+    {
+    public:
+        explicit TestClient(int fd) : fd(fd) {}
+        ~TestClient() { ::close(fd); }
+
+        void send(std::string const &text) { send(text.data(), text.size()); }
+        void send(void const *pData, size_t length)
+        {
+            ::send(fd, pData, length, MSG_NOSIGNAL);
+        }
+
+        // the status line, empty if the server has closed the connection
+        std::string readLine()
+        {
+            std::string line;
+            char ch = 0;
+            while ((::read(fd, &ch, 1) == 1) && (ch != '\n'))
+            {
+                line += ch;
+            }
+            return line;
+        }
+
+        std::vector<uint8_t> readBytes(size_t length)
+        {
+            std::vector<uint8_t> bytes(length);
+            size_t numRead = 0;
+            while (numRead < length)
+            {
+                ssize_t chunk = ::read(fd, bytes.data() + numRead, length - numRead);
+                if (chunk <= 0)
+                {
+                    return std::vector<uint8_t>();
+                }
+                numRead += static_cast<size_t>(chunk);
+            }
+            return bytes;
+        }
+
+        // the image of an "OK <length>" answer, empty for other answers
+        std::vector<uint8_t> readImage()
+        {
+            std::string line = readLine();
+            return (line.compare(0, 3, "OK ") == 0) ? readBytes(std::stoul(line.substr(3))) : std::vector<uint8_t>();
+        }
+
+        void shutdownWrite() { ::shutdown(fd, SHUT_WR); }
+
+    private:
+        int fd;
+    };
+
+    TEST_CASE("Build requests", "BuildServer")
+    {
+        std::string folder = makeTempFolder();
+        std::vector<uint8_t> prg(1200, 0x01);
+        writeHostFile(folder + "/game.prg", prg);
+        std::vector<uint8_t> inlineData(5000, 0x02);
+
+        BuildServer server(2);
+        int fds[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        std::thread serving([&server, &fds]() { server.serveConnection(fds[1]); });
+
+        {
+            TestClient client(fds[0]);
+
+            // inline data and a file, the image comes back
+            client.send("BUILD\nNAME served disk\nID 7x\nDATA 5000 intro\n");
+            client.send(inlineData.data(), inlineData.size());
+            client.send("FILE " + folder + "/game.prg\nEND\n");
+            std::vector<uint8_t> image = client.readImage();
+
+            Writer writer("served disk", StorageMode::DENSE, "7x");
+            REQUIRE(writer.writeFile("intro", inlineData.data(), inlineData.size()));
+            REQUIRE(writer.writeFile("game.prg", prg.data(), prg.size()));
+            REQUIRE(image == std::vector<uint8_t>(writer.getImageData(), writer.getImageData() + writer.getImageSize()));
+
+            // the Writer of the pool is blank again for the next request
+            client.send("BUILD d64\nFILE renamed\t" + folder + "/game.prg\nEND\n");
+            Writer other;
+            REQUIRE(other.writeFile("renamed", prg.data(), prg.size()));
+            REQUIRE(client.readImage() == std::vector<uint8_t>(other.getImageData(), other.getImageData() + other.getImageSize()));
+
+            // written to a path instead, as G64
+            client.send("BUILD g64\nFILE " + folder + "/game.prg\nOUTPUT " + folder + "/out.g64\nEND\n");
+            REQUIRE(client.readLine() == "OK 0");
+            std::vector<uint8_t> g64;
+            Writer d64;
+            REQUIRE(d64.writeFile("game.prg", prg.data(), prg.size()));
+            encodeG64<D64Geometry>([&d64](uint16_t idx) { return d64.getSectorData(idx); }, g64);
+            REQUIRE(readHostFile(folder + "/out.g64") == g64);
+
+            // a failed build leaves the connection open
+            client.send("BUILD d81\nFILE " + folder + "/missing.prg\nEND\n");
+            REQUIRE(client.readLine().compare(0, 6, "ERROR ") == 0);
+            client.send("BUILD d71\nDATA 3 a\nabcDATA 3 a\nabcEND\n");
+            REQUIRE(client.readLine() == "ERROR Could not write file a to image.");
+
+            client.send("STATS\n");
+            std::string stats = client.readLine();
+            REQUIRE(stats.compare(0, 3, "OK ") == 0);
+            std::string json = client.readLine();
+            REQUIRE(json.size() + 1 == std::stoul(stats.substr(3)));
+            REQUIRE(json.find("\"requests\": 5, \"failed\": 2, \"p50Micros\": ") == 1);
+
+            // a malformed request ends the connection
+            client.send("BUILD\nBOGUS\n");
+            REQUIRE(client.readLine().compare(0, 6, "ERROR ") == 0);
+            serving.join();
+            ::close(fds[1]);
+            REQUIRE(client.readLine().empty());
+        }
+
+        // the malformed request counts as failed as well
+        LatencyRecorder::Summary latency = server.getLatency();
+        REQUIRE(latency.numRequests == 6);
+        REQUIRE(latency.numFailed == 3);
+        REQUIRE(latency.p50Micros <= latency.p99Micros);
+        REQUIRE(latency.p99Micros <= latency.maxMicros);
+
+        removeFolder(folder);
+    }
+
+    TEST_CASE("Latency percentiles", "BuildServer")
+    {
+        LatencyRecorder recorder(100);
+        for (uint64_t micros = 1; micros <= 200; micros++)
+        {
+            recorder.record(micros, micros % 10 != 0);
+        }
+
+        // the last 100 requests count for the percentiles
+        LatencyRecorder::Summary summary = recorder.getSummary();
+        REQUIRE(summary.numRequests == 200);
+        REQUIRE(summary.numFailed == 20);
+        REQUIRE(summary.p50Micros == 150);
+        REQUIRE(summary.p90Micros == 190);
+        REQUIRE(summary.p99Micros == 199);
+        REQUIRE(summary.maxMicros == 200);
+    }
+
+    TEST_CASE("Socket server", "BuildServer")
+    {
+        std::string folder = makeTempFolder();
+        std::string socketPath = folder + "/d64.sock";
+        std::vector<uint8_t> data(3000, 0x03);
+        Writer writer;
+        REQUIRE(writer.writeFile("file", data.data(), data.size()));
+        std::vector<uint8_t> expected(writer.getImageData(), writer.getImageData() + writer.getImageSize());
+
+        BuildServer server(2, 1000);
+        std::ostringstream err;
+        REQUIRE(server.listen(socketPath, err));
+        struct stat st;
+        REQUIRE(::stat(socketPath.c_str(), &st) == 0);
+        REQUIRE((st.st_mode & 0777) == 0600);
+        std::thread running([&server]() { server.run(); });
+
+        auto connect = [&socketPath]()
+        {
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            socketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+            REQUIRE(::connect(fd, reinterpret_cast<sockaddr const *>(&addr), sizeof(addr)) == 0);
+            return fd;
+        };
+
+        // more idle clients than workers do not hold up the others
+        std::vector<std::unique_ptr<TestClient>> idleClients;
+        for (int clientIdx = 0; clientIdx < 3; clientIdx++)
+        {
+            idleClients.emplace_back(new TestClient(connect()));
+        }
+        idleClients[0]->send("BUILD\n");
+
+        // concurrent clients with several requests each
+        std::vector<std::thread> clients;
+        std::vector<int> numMatching(4, 0);
+        for (int clientIdx = 0; clientIdx < 4; clientIdx++)
+        {
+            int fd = connect();
+            clients.emplace_back([fd, clientIdx, &data, &expected, &numMatching]()
+            {
+                TestClient client(fd);
+                for (int requestIdx = 0; requestIdx < 10; requestIdx++)
+                {
+                    client.send("BUILD\nDATA 3000 file\n");
+                    client.send(data.data(), data.size());
+                    client.send("END\n");
+                    numMatching[clientIdx] += (client.readImage() == expected) ? 1 : 0;
+                }
+                client.shutdownWrite();
+            });
+        }
+        for (auto &client : clients)
+        {
+            client.join();
+        }
+        REQUIRE(numMatching == std::vector<int>(4, 10));
+
+        // and are dropped after the timeout, within a request as well as between requests
+        for (auto &pClient : idleClients)
+        {
+            REQUIRE(pClient->readLine().empty());
+        }
+        REQUIRE(server.getLatency().numRequests == 41);
+        REQUIRE(server.getLatency().numFailed == 1);
+
+        // stopping does not wait for idle clients
+        TestClient idle(connect());
+        server.stop();
+        running.join();
+
+        removeFolder(folder);
+    }
+}
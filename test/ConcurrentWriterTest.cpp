@@ -0,0 +1,194 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+#include "ConcurrentWriter.h"
+#include "Reader.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    // every file reads back, no sector belongs to two chains and the BAM has exactly the sectors
+    // of the chains and of the directory as occupied
+    template <typename Geometry>
+    static void checkImage(BasicWriter<Geometry> const &writer, std::vector<std::vector<uint8_t>> const &progs,
+                           std::vector<bool> const &isWritten)
+    {
+        using Writer = BasicWriter<Geometry>;
+        std::vector<uint8_t> image = getImage(writer);
+        BasicReader<Geometry> reader(image.data(), image.size());
+
+        std::vector<bool> isInChain(Geometry::NUM_SECTORS, false);
+        uint16_t numUsedSectors = 0;
+        size_t numFiles = 0;
+        for (size_t fileIdx = 0; fileIdx < progs.size(); fileIdx++)
+        {
+            auto const *pEntry = reader.findFile("F" + std::to_string(fileIdx));
+            REQUIRE((pEntry != nullptr) == isWritten[fileIdx]);
+            if (pEntry == nullptr)
+            {
+                continue;
+            }
+
+            std::vector<uint8_t> content;
+            auto view = reader.getFile(*pEntry);
+            view.copyTo(content);
+            REQUIRE(content == progs[fileIdx]);
+            REQUIRE(view.getNumberOfSectors() == pEntry->numberOfBlocks);
+            for (auto it = view.begin(); it != view.end(); ++it)
+            {
+                REQUIRE(!isInChain[it.getSectorIdx()]);
+                isInChain[it.getSectorIdx()] = true;
+            }
+            numUsedSectors += pEntry->numberOfBlocks;
+            ++numFiles;
+        }
+        REQUIRE(reader.getFiles().size() == numFiles);
+
+        for (uint8_t trackIdx = 0; trackIdx < Geometry::NUM_TRACKS; trackIdx++)
+        {
+            if (Geometry::isReservedTrack(trackIdx))
+            {
+                continue;
+            }
+
+            auto const &bamEntry = Geometry::getBamEntry(trackIdx);
+            uint8_t const *pBits = &writer.getSectorData(bamEntry.bitsSectorIdx)[bamEntry.bitsOffset];
+            uint8_t numFree = 0;
+            for (uint8_t sector = 0; sector < Geometry::getSectorsOnTrack(trackIdx); sector++)
+            {
+                bool isFree = (pBits[sector / 8] >> (sector % 8)) & 1;
+                REQUIRE(isFree == !isInChain[Geometry::getSectorIdx(TrackSector{trackIdx, sector})]);
+                numFree += isFree;
+            }
+            REQUIRE(writer.getSectorData(bamEntry.countSectorIdx)[bamEntry.countOffset] == numFree);
+        }
+        REQUIRE(writer.getNumberOfFreeSectors() == Writer::getNumberOfFreeSectorsOnBlankImage() - numUsedSectors);
+    }
+
+    // one thread writes the same image as the Writer does
+    template <typename Geometry>
+    static void checkSingleThread()
+    {
+        using Writer = BasicWriter<Geometry>;
+        std::unique_ptr<Writer> pExpected(new Writer("CONCURRENT"));
+        std::unique_ptr<Writer> pWriter(new Writer("CONCURRENT"));
+        BasicConcurrentWriter<Geometry> concurrentWriter(*pWriter);
+
+        for (size_t fileIdx = 0; fileIdx < 20; fileIdx++)
+        {
+            std::vector<uint8_t> prog(1 + (fileIdx * 1777) % (30 * 254), static_cast<uint8_t>(fileIdx));
+            std::string name = "F" + std::to_string(fileIdx);
+            REQUIRE(pExpected->writeFile(name, prog.data(), prog.size()));
+            REQUIRE(concurrentWriter.writeFile(name, prog.data(), prog.size()));
+        }
+
+        REQUIRE(getImage(*pWriter) == getImage(*pExpected));
+    }
+
+    TEST_CASE("Single thread", "ConcurrentWriter")
+    {
+        checkSingleThread<D64Geometry>();
+        checkSingleThread<D64ExtendedGeometry>();
+        checkSingleThread<D71Geometry>();
+        checkSingleThread<D81Geometry>();
+    }
+
+    // threads write files of all sizes at the same time, until more is asked for than fits
+    template <typename Geometry>
+    static void stressConcurrentWriter(StorageMode storageMode, size_t numThreads, size_t numFiles)
+    {
+        using Writer = BasicWriter<Geometry>;
+        std::vector<std::vector<uint8_t>> progs;
+        for (size_t fileIdx = 0; fileIdx < numFiles; fileIdx++)
+        {
+            std::vector<uint8_t> prog(1 + (fileIdx * 2311) % (12 * 254));
+            for (size_t byteIdx = 0; byteIdx < prog.size(); byteIdx++)
+            {
+                prog[byteIdx] = static_cast<uint8_t>(fileIdx * 31 + byteIdx);
+            }
+            progs.push_back(prog);
+        }
+
+        std::unique_ptr<Writer> pWriter(new Writer("STRESS", storageMode));
+        std::vector<bool> isWritten(numFiles);
+        {
+            BasicConcurrentWriter<Geometry> concurrentWriter(*pWriter);
+            std::vector<char> results(numFiles, 0);
+            std::atomic<size_t> nextFile(0);
+            std::vector<std::thread> threads;
+            for (size_t threadIdx = 0; threadIdx < numThreads; threadIdx++)
+            {
+                threads.emplace_back([&]()
+                {
+                    for (size_t fileIdx; (fileIdx = nextFile++) < numFiles; )
+                    {
+                        results[fileIdx] = concurrentWriter.writeFile("F" + std::to_string(fileIdx), progs[fileIdx].data(), progs[fileIdx].size());
+                    }
+                });
+            }
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+
+            std::copy(results.begin(), results.end(), isWritten.begin());
+            REQUIRE(concurrentWriter.getNumberOfFreeSectors() == pWriter->getNumberOfFreeSectors());
+        }
+
+        checkImage(*pWriter, progs, isWritten);
+
+        // the Writer goes on from there
+        std::vector<uint8_t> last(254, 0xaa);
+        bool hasRoom = (pWriter->getNumberOfFreeSectors() > 0) && (pWriter->getNumberOfFiles() < Writer::MAX_DIR_ENTRIES);
+        REQUIRE(pWriter->writeFile("LAST", last.data(), last.size()) == hasRoom);
+    }
+
+    TEST_CASE("Stress", "ConcurrentWriter")
+    {
+        for (int round = 0; round < 20; round++)
+        {
+            // more files than fit onto the disk resp. into the directory
+            stressConcurrentWriter<D64Geometry>(StorageMode::DENSE, 8, 130);
+            stressConcurrentWriter<D64Geometry>(StorageMode::SPARSE, 8, 130);
+        }
+        stressConcurrentWriter<D64ExtendedGeometry>(StorageMode::DENSE, 4, 150);
+        stressConcurrentWriter<D71Geometry>(StorageMode::DENSE, 4, 150);
+        stressConcurrentWriter<D81Geometry>(StorageMode::DENSE, 4, 400);
+    }
+
+    TEST_CASE("Same name", "ConcurrentWriter")
+    {
+        std::unique_ptr<Writer> pWriter(new Writer("SAME"));
+        ConcurrentWriter concurrentWriter(*pWriter);
+        std::vector<uint8_t> prog(1000, 0x11);
+        std::atomic<int> numWritten(0);
+
+        std::vector<std::thread> threads;
+        for (int threadIdx = 0; threadIdx < 8; threadIdx++)
+        {
+            threads.emplace_back([&]()
+            {
+                for (int fileIdx = 0; fileIdx < 10; fileIdx++)
+                {
+                    numWritten += concurrentWriter.writeFile("F" + std::to_string(fileIdx), prog.data(), prog.size());
+                }
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        // each name once, and an empty file never
+        REQUIRE(numWritten == 10);
+        REQUIRE(pWriter->getNumberOfFiles() == 10);
+        REQUIRE(!concurrentWriter.writeFile("EMPTY", prog.data(), 0));
+        checkImage(*pWriter, std::vector<std::vector<uint8_t>>(10, prog), std::vector<bool>(10, true));
+    }
+}
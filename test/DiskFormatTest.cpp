@@ -0,0 +1,177 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+
+#include "Writer.h"
+#include "BitOps.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    template <typename Geometry>
+    static uint64_t getBamBits(BasicWriter<Geometry> const &writer, uint8_t track)
+    {
+        auto const &bamEntry = Geometry::getBamEntry(track);
+        uint64_t ret = 0;
+        for (uint8_t byteIdx = 0; byteIdx < Geometry::BAM_BITMAP_BYTES; byteIdx++)
+        {
+            ret |= static_cast<uint64_t>(writer.getSectorData(bamEntry.bitsSectorIdx)[bamEntry.bitsOffset + byteIdx]) << (byteIdx * 8);
+        }
+        return ret;
+    }
+
+    // free count and bitmap of each track agree, returns the free blocks outside the reserved tracks
+    template <typename Geometry>
+    static uint16_t checkBam(BasicWriter<Geometry> const &writer)
+    {
+        uint16_t freeBlocks = 0;
+        for (uint8_t track = 0; track < Geometry::NUM_TRACKS; track++)
+        {
+            auto const &bamEntry = Geometry::getBamEntry(track);
+            uint8_t count = writer.getSectorData(bamEntry.countSectorIdx)[bamEntry.countOffset];
+            uint64_t bits = getBamBits(writer, track);
+
+            REQUIRE(count == countSetBits(bits));
+            REQUIRE((bits >> Geometry::getSectorsOnTrack(track)) == 0);
+            if (!Geometry::isReservedTrack(track))
+            {
+                freeBlocks += count;
+            }
+        }
+        return freeBlocks;
+    }
+
+    template <typename Geometry>
+    static void checkFormat(uint16_t expectedFreeBlocks)
+    {
+        using Writer = BasicWriter<Geometry>;
+
+        // blank disk
+        Writer writer("FORMAT", StorageMode::DENSE, "ID");
+        REQUIRE(writer.getImageSize() == Geometry::NUM_SECTORS * 256u);
+        REQUIRE(checkBam(writer) == expectedFreeBlocks);
+        REQUIRE(writer.getSectorData(Writer::FIRST_DIR_SECTOR_IDX)[0] == 0x00);
+        REQUIRE(writer.getSectorData(Writer::FIRST_DIR_SECTOR_IDX)[1] == 0xff);
+        uint8_t const *pHeader = writer.getSectorData(Writer::HEADER_SECTOR_IDX);
+        REQUIRE(std::string(&pHeader[Geometry::DISK_NAME_OFFSET], &pHeader[Geometry::DISK_NAME_OFFSET + 6]) == "FORMAT");
+
+        // files of all sizes, spread over the whole disk
+        std::vector<std::vector<uint8_t>> files;
+        uint16_t usedBlocks = 0;
+        for (uint16_t fileIdx = 0; usedBlocks + (fileIdx + 1) * 10 < expectedFreeBlocks; fileIdx++)
+        {
+            std::vector<uint8_t> file((fileIdx + 1) * 10 * Writer::DATA_BYTES_PER_SECTOR - fileIdx, static_cast<uint8_t>(fileIdx));
+            usedBlocks += (file.size() + Writer::DATA_BYTES_PER_SECTOR - 1) / Writer::DATA_BYTES_PER_SECTOR;
+            REQUIRE(writer.writeFile("FILE" + std::to_string(fileIdx), &file[0], file.size()));
+            files.push_back(file);
+        }
+        REQUIRE(checkBam(writer) == expectedFreeBlocks - usedBlocks);
+
+        // the rest of the disk in one file, then it is full
+        std::vector<uint8_t> rest((expectedFreeBlocks - usedBlocks) * Writer::DATA_BYTES_PER_SECTOR, 0x42);
+        REQUIRE(writer.writeFile("REST", &rest[0], rest.size()));
+        REQUIRE(checkBam(writer) == 0);
+        REQUIRE(!writer.writeFile("FULL", &rest[0], 1));
+
+        std::vector<uint8_t> image = getImage(writer);
+        for (size_t fileIdx = 0; fileIdx < files.size(); fileIdx++)
+        {
+            assertProgOnImage<Geometry>(files[fileIdx], "FILE" + std::to_string(fileIdx), &image[0]);
+        }
+        assertProgOnImage<Geometry>(rest, "REST", &image[0]);
+
+        // the directory takes as many entries as the format has
+        writer.reset("DIRECTORY");
+        std::vector<uint8_t> small(10, 0x01);
+        for (uint16_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            REQUIRE(writer.writeFile("F" + std::to_string(fileIdx), &small[0], small.size()));
+        }
+        REQUIRE(!writer.writeFile("ONE_TOO_MANY", &small[0], small.size()));
+        REQUIRE(checkBam(writer) == expectedFreeBlocks - Writer::MAX_DIR_ENTRIES);
+
+        image = getImage(writer);
+        assertProgOnImage<Geometry>(small, "F0", &image[0]);
+        assertProgOnImage<Geometry>(small, "F" + std::to_string(Writer::MAX_DIR_ENTRIES - 1), &image[0]);
+
+        // sparse storage builds the same image
+        BasicWriter<Geometry> dense("SAME"), sparse("SAME", StorageMode::SPARSE);
+        std::vector<uint8_t> same(5000, 0x42);
+        for (auto pWriter : {&dense, &sparse})
+        {
+            REQUIRE(pWriter->writeFile("SAME", &same[0], same.size()));
+        }
+        REQUIRE(getImage(dense) == getImage(sparse));
+    }
+
+    TEST_CASE("D64 with 35 tracks", "DiskFormat")
+    {
+        checkFormat<D64Geometry>(664);
+    }
+
+    TEST_CASE("D64 with 40 tracks", "DiskFormat")
+    {
+        checkFormat<D64ExtendedGeometry>(749);
+
+        // the first 35 tracks are the same as on a 35 track image
+        D64ExtendedWriter extended;
+        Writer writer;
+        for (uint16_t idx = 0; idx < Writer::NUM_SECTORS; idx++)
+        {
+            if (idx != Writer::BAM_SECTOR_IDX)
+            {
+                REQUIRE(std::equal(writer.getSectorData(idx), writer.getSectorData(idx) + 256, extended.getSectorData(idx)));
+            }
+        }
+        // SpeedDOS BAM entries of tracks 36..40
+        uint8_t const *pBAM = extended.getSectorData(Writer::BAM_SECTOR_IDX);
+        REQUIRE(pBAM[0xc0] == 17);
+        REQUIRE(pBAM[0xc1] == 0xff);
+        REQUIRE(pBAM[0xc2] == 0xff);
+        REQUIRE(pBAM[0xc3] == 0x01);
+        REQUIRE(std::equal(pBAM, pBAM + 0xc0, writer.getSectorData(Writer::BAM_SECTOR_IDX)));
+    }
+
+    TEST_CASE("D71", "DiskFormat")
+    {
+        checkFormat<D71Geometry>(1328);
+
+        D71Writer writer;
+        uint8_t const *pBAM = writer.getSectorData(D71Writer::BAM_SECTOR_IDX);
+        REQUIRE(pBAM[3] == 0x80); // double sided
+        REQUIRE(pBAM[0xdd] == 21); // track 36
+        // track 53 is taken as a whole, its first sector holds the bitmaps of the second side
+        REQUIRE(pBAM[0xdd + 17] == 0);
+        uint8_t const *pSide2BAM = writer.getSectorData(D71Geometry::getSectorIdx(D71Format::SIDE_2_BAM_SECTOR));
+        REQUIRE(pSide2BAM[0] == 0xff);
+        REQUIRE(pSide2BAM[2] == 0x1f);
+        REQUIRE(pSide2BAM[17 * 3] == 0x00);
+    }
+
+    TEST_CASE("D81", "DiskFormat")
+    {
+        checkFormat<D81Geometry>(3160);
+
+        D81Writer writer("D81", StorageMode::DENSE, "AB");
+        uint8_t const *pHeader = writer.getSectorData(D81Writer::HEADER_SECTOR_IDX);
+        REQUIRE(pHeader[0] == 40);
+        REQUIRE(pHeader[1] == 3);
+        REQUIRE(pHeader[0x16] == 'A');
+        REQUIRE(pHeader[0x17] == 'B');
+        REQUIRE(pHeader[0x19] == '3');
+        REQUIRE(pHeader[0x1a] == 'D');
+
+        for (uint16_t bamIdx : {D81Writer::BAM_SECTOR_IDX, static_cast<uint16_t>(D81Writer::BAM_SECTOR_IDX + 1)})
+        {
+            uint8_t const *pBAM = writer.getSectorData(bamIdx);
+            REQUIRE(pBAM[2] == 'D');
+            REQUIRE(pBAM[3] == 0xbb);
+            REQUIRE(pBAM[4] == 'A');
+            REQUIRE(pBAM[5] == 'B');
+        }
+        // track 40: header, two BAM sectors and the first directory sector are taken
+        REQUIRE(writer.getSectorData(D81Writer::BAM_SECTOR_IDX)[0x10 + 39 * 6] == 36);
+    }
+}
@@ -0,0 +1,129 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+
+#include "FolderScanner.h"
+#include "BoundedQueue.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("Bounded queue", "FolderScanner")
+    {
+        BoundedQueue<int> queue(3);
+        std::vector<int> popped;
+
+        // the consumer keeps up with a producer which is held back by the capacity
+        std::thread consumer([&queue, &popped]()
+        {
+            int item = 0;
+            while (queue.pop(item))
+            {
+                popped.push_back(item);
+            }
+        });
+        for (int item = 0; item < 1000; item++)
+        {
+            REQUIRE(queue.push(item));
+        }
+        queue.close();
+        consumer.join();
+
+        REQUIRE(popped.size() == 1000);
+        for (int item = 0; item < 1000; item++)
+        {
+            REQUIRE(popped[item] == item);
+        }
+        REQUIRE_FALSE(queue.push(1000));
+
+        // closing wakes up a blocked producer
+        BoundedQueue<int> full(1);
+        REQUIRE(full.push(1));
+        std::thread producer([&full]() { REQUIRE_FALSE(full.push(2)); });
+        full.close();
+        producer.join();
+        int item = 0;
+        REQUIRE(full.pop(item));
+        REQUIRE(item == 1);
+        REQUIRE_FALSE(full.pop(item));
+    }
+
+    TEST_CASE("Folder scan", "FolderScanner")
+    {
+        std::string folder = makeTempFolder();
+
+        // more files than the scanner reads ahead
+        for (int fileIdx = 0; fileIdx < 100; fileIdx++)
+        {
+            writeHostFile(folder + "/file" + std::to_string(fileIdx) + ".prg", std::vector<uint8_t>(2 + fileIdx * 100, static_cast<uint8_t>(fileIdx)));
+        }
+        writeHostFile(folder + "/readme.txt", std::vector<uint8_t>(10, 0x20));
+
+        std::vector<std::string> expectedNames;
+        DIR *pDIR = opendir(folder.c_str());
+        for (struct dirent *dp = readdir(pDIR); dp != nullptr; dp = readdir(pDIR))
+        {
+            if (ProgFile::hasProgSuffix(dp->d_name))
+            {
+                expectedNames.push_back(dp->d_name);
+            }
+        }
+        closedir(pDIR);
+
+        for (unsigned numReaders : {1u, 4u, 16u})
+        {
+            FolderScanner scanner(folder, numReaders, 4);
+            REQUIRE(scanner.isOpen());
+
+            // in directory order, with the content of each file
+            std::string fileName;
+            ProgFile progFile;
+            std::vector<std::string> names;
+            while (scanner.next(fileName, progFile))
+            {
+                REQUIRE(progFile.getStatus() == ProgFile::Status::OK);
+                int fileIdx = std::stoi(fileName.substr(4));
+                REQUIRE(progFile.getLength() == 2 + static_cast<size_t>(fileIdx) * 100);
+                REQUIRE(progFile.getData()[progFile.getLength() - 1] == fileIdx);
+                names.push_back(fileName);
+            }
+            REQUIRE(names == expectedNames);
+        }
+
+        // files which cannot be read come in their place with their status
+        writeHostFile(folder + "/short.prg", std::vector<uint8_t>{ 0x01 });
+        {
+            FolderScanner scanner(folder);
+            std::string fileName;
+            ProgFile progFile;
+            bool hasShortFile = false;
+            while (scanner.next(fileName, progFile))
+            {
+                hasShortFile = hasShortFile || ((fileName == "short.prg") && (progFile.getStatus() == ProgFile::Status::TOO_SHORT));
+            }
+            REQUIRE(hasShortFile);
+        }
+
+        // a scanner which is left before the end stops its stages
+        for (int run = 0; run < 20; run++)
+        {
+            FolderScanner scanner(folder, 4, 2);
+            std::string fileName;
+            ProgFile progFile;
+            REQUIRE(scanner.next(fileName, progFile));
+        }
+
+        FolderScanner missing(folder + "/missing");
+        std::string fileName;
+        ProgFile progFile;
+        REQUIRE_FALSE(missing.isOpen());
+        REQUIRE_FALSE(missing.next(fileName, progFile));
+
+        removeFolder(folder);
+    }
+}
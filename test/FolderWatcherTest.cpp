@@ -0,0 +1,111 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdio> // std::rename
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FolderWatcher.h"
+#include "Reader.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    static std::vector<uint8_t> readFileOfImage(std::string const &imagePath, std::string const &name)
+    {
+        std::vector<uint8_t> image = readHostFile(imagePath);
+        Reader reader(&image[0], image.size());
+        std::vector<uint8_t> ret;
+        auto pEntry = reader.findFile(name);
+        if (pEntry != nullptr)
+        {
+            reader.getFile(*pEntry).copyTo(ret);
+        }
+        return ret;
+    }
+
+    TEST_CASE("Watch a folder", "FolderWatcher")
+    {
+        std::string root = makeTempFolder();
+        std::string folder = root + "/game";
+        std::string imagePath = root + "/game.d64";
+        REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+
+        std::vector<uint8_t> main = { 0x01, 0x08, 0x01 }, intro = { 0x01, 0x08, 0x02 };
+        writeHostFile(folder + "/main.prg", main);
+        writeHostFile(folder + "/intro.prg", intro);
+
+        std::ostringstream err;
+        FolderWatcher watcher(folder, imagePath, err);
+        REQUIRE(watcher.start());
+        REQUIRE(readFileOfImage(imagePath, "MAIN.PRG") == main);
+        REQUIRE(watcher.update(20) == FolderWatcher::Result::IDLE);
+
+        // a saved file
+        main.resize(3000, 0x42);
+        writeHostFile(folder + "/main.prg", main);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(watcher.getNumberOfChangedFiles() == 1);
+        REQUIRE(readFileOfImage(imagePath, "MAIN.PRG") == main);
+        REQUIRE(readFileOfImage(imagePath, "INTRO.PRG") == intro);
+
+        // several changes in a row are applied together
+        std::vector<uint8_t> outro = { 0x01, 0x08, 0x03 };
+        writeHostFile(folder + "/outro.tmp", outro);
+        REQUIRE(std::rename((folder + "/outro.tmp").c_str(), (folder + "/outro.prg").c_str()) == 0);
+        REQUIRE(unlink((folder + "/intro.prg").c_str()) == 0);
+        writeHostFile(folder + "/notes.txt", outro);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(watcher.getNumberOfChangedFiles() == 2);
+        REQUIRE(readFileOfImage(imagePath, "OUTRO.PRG") == outro);
+        REQUIRE(readFileOfImage(imagePath, "INTRO.PRG").empty());
+
+        // a broken file keeps its previous content
+        writeHostFile(folder + "/main.prg", std::vector<uint8_t>{ 0x01 });
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(readFileOfImage(imagePath, "MAIN.PRG") == main);
+        REQUIRE(!err.str().empty());
+
+        // only changed files arrive at the watcher
+        REQUIRE(watcher.update(20) == FolderWatcher::Result::IDLE);
+
+        // an image which cannot be replaced stays as it was, the watcher goes on
+        std::vector<uint8_t> image = readHostFile(imagePath);
+        REQUIRE(unlink(imagePath.c_str()) == 0);
+        REQUIRE(mkdir(imagePath.c_str(), 0755) == 0);
+        writeHostFile(folder + "/outro.prg", main);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::NOT_UPDATED);
+        REQUIRE(rmdir(imagePath.c_str()) == 0);
+        writeHostFile(imagePath, image);
+        writeHostFile(folder + "/outro.prg", outro);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(readFileOfImage(imagePath, "OUTRO.PRG") == outro);
+
+        // a second watcher of the same image, no temporary files are left behind
+        writeHostFile(folder + "/main.prg", main);
+        FolderWatcher other(folder, imagePath, err);
+        REQUIRE(other.start());
+        writeHostFile(folder + "/intro.prg", intro);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(other.update(1000) == FolderWatcher::Result::UPDATED);
+        REQUIRE(readFileOfImage(imagePath, "INTRO.PRG") == intro);
+        DIR *pDir = opendir(root.c_str());
+        REQUIRE(pDir != nullptr);
+        std::vector<std::string> names;
+        while (dirent *pEntry = readdir(pDir))
+        {
+            names.push_back(pEntry->d_name);
+        }
+        closedir(pDir);
+        REQUIRE(names.size() == 4); // ".", "..", the folder and the image
+
+        removeFolder(folder);
+        REQUIRE(watcher.update(1000) == FolderWatcher::Result::FAILED);
+        removeFolder(root);
+    }
+}
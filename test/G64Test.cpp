@@ -0,0 +1,160 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "G64.h"
+#include "Writer.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    static uint32_t getUint32(std::vector<uint8_t> const &image, size_t offset)
+    {
+        return image[offset] | (image[offset + 1] << 8) | (image[offset + 2] << 16) | (static_cast<uint32_t>(image[offset + 3]) << 24);
+    }
+
+    // decodes the blocks following the sync marks of each track like the drive does, every sector
+    // must be there once with correct checksums and the content of the Writer
+    template <typename Geometry>
+    static void checkG64(BasicWriter<Geometry> const &writer, std::vector<uint8_t> const &image)
+    {
+        using L = G64Layout;
+        REQUIRE(image.size() == L::FIRST_TRACK_OFFSET + Geometry::NUM_TRACKS * L::BYTES_PER_TRACK_ENTRY);
+        REQUIRE(std::string(image.begin(), image.begin() + 8) == "GCR-1541");
+        REQUIRE(image[9] == L::NUM_HALF_TRACKS);
+
+        uint8_t const *pId = &writer.getSectorData(Geometry::HEADER_SECTOR_IDX)[Geometry::DISK_ID_FIELDS[0].offset];
+        for (uint8_t halfTrack = 0; halfTrack < L::NUM_HALF_TRACKS; halfTrack++)
+        {
+            uint32_t trackOffset = getUint32(image, L::TRACK_OFFSETS_OFFSET + halfTrack * 4);
+            uint8_t trackIdx = halfTrack / 2;
+            if ((halfTrack % 2 != 0) || (trackIdx >= Geometry::NUM_TRACKS))
+            {
+                REQUIRE(trackOffset == 0);
+                continue;
+            }
+
+            uint8_t numSectors = Geometry::getSectorsOnTrack(trackIdx);
+            uint32_t speedZone = getUint32(image, L::SPEED_ZONES_OFFSET + halfTrack * 4);
+            REQUIRE(speedZone == L::getSpeedZone(numSectors));
+            uint16_t trackBytes = image[trackOffset] | (image[trackOffset + 1] << 8);
+            REQUIRE(trackBytes == L::getTrackBytes(speedZone));
+
+            uint8_t const *pTrack = &image[trackOffset + 2];
+            std::vector<int> numFound(numSectors, 0);
+            int lastSector = -1;
+            for (size_t pos = 0; pos < trackBytes; )
+            {
+                if (pTrack[pos] != 0xff)
+                {
+                    ++pos;
+                    continue;
+                }
+                while ((pos < trackBytes) && (pTrack[pos] == 0xff))
+                {
+                    ++pos;
+                }
+
+                uint8_t firstBytes[4];
+                REQUIRE(decodeGcr(&pTrack[pos], 4, firstBytes));
+                if (firstBytes[0] == L::HEADER_BLOCK_ID)
+                {
+                    uint8_t header[8];
+                    REQUIRE(decodeGcr(&pTrack[pos], 8, header));
+                    REQUIRE(header[3] == trackIdx + 1);
+                    REQUIRE(header[4] == pId[1]);
+                    REQUIRE(header[5] == pId[0]);
+                    REQUIRE(header[1] == (header[2] ^ header[3] ^ header[4] ^ header[5]));
+                    lastSector = header[2];
+                    pos += L::HEADER_GCR_BYTES;
+                }
+                else
+                {
+                    uint8_t data[260];
+                    REQUIRE(firstBytes[0] == L::DATA_BLOCK_ID);
+                    REQUIRE(lastSector >= 0);
+                    REQUIRE(decodeGcr(&pTrack[pos], sizeof(data), data));
+                    uint8_t checksum = 0;
+                    for (int byteIdx = 1; byteIdx <= 256; byteIdx++)
+                    {
+                        checksum ^= data[byteIdx];
+                    }
+                    REQUIRE(data[257] == checksum);
+                    uint8_t const *pSector = writer.getSectorData(Geometry::getSectorIdx(TrackSector{trackIdx, static_cast<uint8_t>(lastSector)}));
+                    REQUIRE(std::equal(pSector, pSector + 256, &data[1]));
+                    ++numFound[lastSector];
+                    lastSector = -1;
+                    pos += L::DATA_GCR_BYTES;
+                }
+            }
+            REQUIRE(std::all_of(numFound.begin(), numFound.end(), [](int num) { return num == 1; }));
+        }
+    }
+
+    TEST_CASE("GCR", "G64")
+    {
+        uint8_t zeros[4] = { 0, 0, 0, 0 };
+        uint8_t gcr[5];
+        encodeGcr(zeros, sizeof(zeros), gcr);
+        REQUIRE(std::vector<uint8_t>(gcr, gcr + 5) == (std::vector<uint8_t>{ 0x52, 0x94, 0xa5, 0x29, 0x4a }));
+
+        std::vector<uint8_t> bytes(256);
+        for (size_t byteIdx = 0; byteIdx < bytes.size(); byteIdx++)
+        {
+            bytes[byteIdx] = static_cast<uint8_t>(byteIdx);
+        }
+        std::vector<uint8_t> encoded(bytes.size() / 4 * 5);
+        encodeGcr(bytes.data(), bytes.size(), encoded.data());
+        std::vector<uint8_t> decoded(bytes.size());
+        REQUIRE(decodeGcr(encoded.data(), decoded.size(), decoded.data()));
+        REQUIRE(decoded == bytes);
+
+        // GCR never has more than two '0' bits in a row
+        uint8_t noCode[5] = { 0, 0, 0, 0, 0 };
+        REQUIRE(!decodeGcr(noCode, 4, decoded.data()));
+    }
+
+    TEST_CASE("G64 image", "G64")
+    {
+        std::vector<uint8_t> prog(300 * 254);
+        for (size_t byteIdx = 0; byteIdx < prog.size(); byteIdx++)
+        {
+            prog[byteIdx] = static_cast<uint8_t>(byteIdx * 7 + byteIdx / 254);
+        }
+
+        std::string root = makeTempFolder();
+        Writer writer("G64 DISK", StorageMode::SPARSE, "XY");
+        REQUIRE(writer.writeFile("LARGE", prog.data(), prog.size()));
+        REQUIRE(writer.writeFile("SMALL", prog.data(), 1000));
+        REQUIRE(writer.writeG64File(root + "/disk.g64"));
+        checkG64(writer, readHostFile(root + "/disk.g64"));
+
+        D64ExtendedWriter extendedWriter("G64 DISK");
+        REQUIRE(extendedWriter.writeFile("LARGE", prog.data(), prog.size()));
+        REQUIRE(extendedWriter.writeFile("SECOND", prog.data(), prog.size()));
+        REQUIRE(extendedWriter.writeG64File(root + "/disk40.g64"));
+        checkG64(extendedWriter, readHostFile(root + "/disk40.g64"));
+
+        // the 1571 and 1581 do not fit into a G64
+        REQUIRE(!D81Writer().writeG64File(root + "/disk.g64"));
+
+        // a folder straight to G64
+        std::string folder = root + "/demo";
+        REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+        writeHostFile(folder + "/prog.prg", std::vector<uint8_t>(prog.begin(), prog.begin() + 5000));
+        std::ostringstream err;
+        REQUIRE(buildImage(folder, root + "/demo.g64", err, ImageFormat::G64));
+        Writer demoWriter("demo");
+        REQUIRE(demoWriter.writeFile("prog.prg", prog.data(), 5000));
+        checkG64(demoWriter, readHostFile(root + "/demo.g64"));
+        REQUIRE(!updateImage(folder, root + "/demo.g64", err, ImageFormat::G64));
+
+        removeFolder(root);
+    }
+}
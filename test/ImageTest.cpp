@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Image.h"
+#include "D64Api.h"
+#include "Writer.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("In-process image", "Image")
+    {
+        std::string folder = makeTempFolder();
+        std::vector<uint8_t> data(3000, 0x11);
+        std::vector<uint8_t> fromFd(700, 0x22);
+        writeHostFile(folder + "/file.prg", fromFd);
+
+        Image image(ImageFormat::D64, "disk", "17");
+        REQUIRE(image.addFile("one", data.data(), data.size()) == Image::Status::OK);
+        int fd = ::open((folder + "/file.prg").c_str(), O_RDONLY);
+        REQUIRE(image.addFile("two", fd) == Image::Status::OK);
+        ::close(fd);
+        REQUIRE(image.getNumberOfFiles() == 2);
+
+        // the same bytes as a Writer with the same files
+        Writer writer("disk", StorageMode::DENSE, "17");
+        REQUIRE(writer.writeFile("one", data.data(), data.size()));
+        REQUIRE(writer.writeFile("two", fromFd.data(), fromFd.size()));
+        std::vector<uint8_t> bytes;
+        REQUIRE(image.getBytes(bytes) == Image::Status::OK);
+        REQUIRE(bytes == std::vector<uint8_t>(writer.getImageData(), writer.getImageData() + writer.getImageSize()));
+
+        REQUIRE(image.saveImage(folder + "/out.d64") == Image::Status::OK);
+        REQUIRE(readHostFile(folder + "/out.d64") == bytes);
+        REQUIRE(image.saveImage(folder + "/missing/out.d64") == Image::Status::WRITE_FAILED);
+
+        // the reasons a file is not added, the image stays as it was
+        uint16_t freeSectors = image.getNumberOfFreeSectors();
+        REQUIRE(image.addFile("one", data.data(), 10) == Image::Status::NAME_EXISTS);
+        REQUIRE(image.addFile("", data.data(), 10) == Image::Status::INVALID_ARGUMENT);
+        REQUIRE(image.addFile("empty", data.data(), 0) == Image::Status::INVALID_ARGUMENT);
+        std::vector<uint8_t> large(Writer::getNumberOfFreeSectorsOnBlankImage() * Writer::DATA_BYTES_PER_SECTOR, 0x33);
+        REQUIRE(image.addFile("large", large.data(), large.size()) == Image::Status::DISK_FULL);
+        REQUIRE(image.addFile("bad fd", -1) == Image::Status::INVALID_ARGUMENT);
+        REQUIRE(image.getNumberOfFiles() == 2);
+        REQUIRE(image.getNumberOfFreeSectors() == freeSectors);
+
+        // a full directory
+        Image full(ImageFormat::D64);
+        for (uint16_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            REQUIRE(full.addFile("file" + std::to_string(fileIdx), data.data(), 2) == Image::Status::OK);
+        }
+        REQUIRE(full.addFile("another", data.data(), 2) == Image::Status::DIRECTORY_FULL);
+        REQUIRE(std::string(Image::getStatusText(Image::Status::DIRECTORY_FULL)) == "directory full");
+
+        // G64 bytes as written to a file
+        Image g64(ImageFormat::G64);
+        REQUIRE(g64.addFile("one", data.data(), data.size()) == Image::Status::OK);
+        REQUIRE(g64.saveImage(folder + "/out.g64") == Image::Status::OK);
+        REQUIRE(g64.getBytes(bytes) == Image::Status::OK);
+        REQUIRE(readHostFile(folder + "/out.g64") == bytes);
+        REQUIRE(g64.getSize() == bytes.size());
+
+        // a moved-from image fails instead of crashing, until another one is assigned
+        Image moved(std::move(g64));
+        REQUIRE(moved.getNumberOfFiles() == 1);
+        REQUIRE(g64.getNumberOfFiles() == 0);
+        REQUIRE(g64.getSize() == 0);
+        REQUIRE(g64.addFile("two", data.data(), data.size()) == Image::Status::INVALID_ARGUMENT);
+        REQUIRE(g64.getBytes(bytes) == Image::Status::INVALID_ARGUMENT);
+        REQUIRE(g64.saveImage(folder + "/moved.g64") == Image::Status::INVALID_ARGUMENT);
+        g64 = std::move(moved);
+        REQUIRE(g64.getNumberOfFiles() == 1);
+
+        removeFolder(folder);
+    }
+
+    TEST_CASE("C API", "Image")
+    {
+        d64_image *pImage = nullptr;
+        REQUIRE(d64_image_create(static_cast<d64_format>(17), nullptr, nullptr, &pImage) == D64_INVALID_ARGUMENT);
+        REQUIRE(d64_image_create(D64_FORMAT_D81, "c api", nullptr, &pImage) == D64_OK);
+        REQUIRE(pImage != nullptr);
+
+        std::vector<uint8_t> data(1000, 0x44);
+        REQUIRE(d64_image_add_file(pImage, "one", data.data(), data.size()) == D64_OK);
+        REQUIRE(d64_image_add_file(pImage, "one", data.data(), data.size()) == D64_NAME_EXISTS);
+        REQUIRE(d64_image_add_file(pImage, nullptr, data.data(), data.size()) == D64_INVALID_ARGUMENT);
+        REQUIRE(d64_image_add_file(pImage, "null", nullptr, 10) == D64_INVALID_ARGUMENT);
+        uint16_t numberOfFiles = 0;
+        REQUIRE(d64_image_get_number_of_files(pImage, &numberOfFiles) == D64_OK);
+        REQUIRE(numberOfFiles == 1);
+
+        // the size first, then the bytes
+        size_t length = 0;
+        REQUIRE(d64_image_get_bytes(pImage, nullptr, 0, &length) == D64_BUFFER_TOO_SMALL);
+        REQUIRE(length == D81Writer().getImageSize());
+        std::vector<uint8_t> bytes(length);
+        REQUIRE(d64_image_get_bytes(pImage, bytes.data(), bytes.size(), &length) == D64_OK);
+
+        D81Writer writer("c api");
+        REQUIRE(writer.writeFile("one", data.data(), data.size()));
+        REQUIRE(bytes == std::vector<uint8_t>(writer.getImageData(), writer.getImageData() + writer.getImageSize()));
+
+        REQUIRE(std::string(d64_status_text(D64_DISK_FULL)) == "disk full");
+        REQUIRE(std::string(d64_status_text(D64_BUFFER_TOO_SMALL)) == "buffer too small");
+        REQUIRE(std::string(d64_status_text(static_cast<d64_status>(99))) == "unknown status");
+
+        d64_image_destroy(pImage);
+        d64_image_destroy(nullptr);
+    }
+}
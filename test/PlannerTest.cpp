@@ -0,0 +1,90 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <random>
+
+#include "Planner.h"
+#include "Writer.h"
+
+using namespace std;
+
+namespace d64
+{
+    // plans and writes the files one by one, both must agree on every file and on the result
+    template <typename Geometry>
+    static void checkPlan(std::vector<size_t> const &lengths)
+    {
+        using Writer = BasicWriter<Geometry>;
+        BasicPlanner<Geometry> planner;
+        Writer writer("PLAN", StorageMode::SPARSE);
+        std::vector<uint8_t> data;
+
+        bool allWritten = true;
+        for (size_t fileIdx = 0; fileIdx < lengths.size(); fileIdx++)
+        {
+            data.assign(lengths[fileIdx], static_cast<uint8_t>(fileIdx));
+            bool isWritten = writer.writeFile("FILE" + std::to_string(fileIdx), data.data(), data.size());
+            REQUIRE(planner.addFile(lengths[fileIdx]) == isWritten);
+            allWritten = allWritten && isWritten;
+        }
+
+        REQUIRE(planner.isEverythingFitting() == allWritten);
+        REQUIRE(planner.getNumberOfFreeSectors() == writer.getNumberOfFreeSectors());
+        REQUIRE(planner.getNumberOfUsedBlocks() == Writer::getNumberOfFreeSectorsOnBlankImage() - writer.getNumberOfFreeSectors());
+        REQUIRE(planner.getNumberOfFiles() == writer.getNumberOfFiles());
+
+        auto freeCounts = planner.getFreeCountsOfBam();
+        for (uint8_t track = 0; track < Geometry::NUM_TRACKS; track++)
+        {
+            auto const &bamEntry = Geometry::getBamEntry(track);
+            REQUIRE(freeCounts[track] == writer.getSectorData(bamEntry.countSectorIdx)[bamEntry.countOffset]);
+        }
+
+        uint8_t numDirSectors = 1;
+        for (uint8_t const *pSector = writer.getSectorData(Writer::FIRST_DIR_SECTOR_IDX); pSector[0] != 0x00; numDirSectors++)
+        {
+            pSector = writer.getSectorData(Geometry::getSectorIdx(TrackSector{Writer::DIRECTORY_TRACK, pSector[1]}));
+        }
+        REQUIRE(planner.getNumberOfDirSectors() == numDirSectors);
+    }
+
+    template <typename Geometry>
+    static void checkPlans()
+    {
+        uint16_t numBlocks = BasicWriter<Geometry>::getNumberOfFreeSectorsOnBlankImage();
+
+        checkPlan<Geometry>({});
+        checkPlan<Geometry>({ 1, 254, 255, 0, 508, 509 });
+        // exactly full, then one byte too much
+        checkPlan<Geometry>({ numBlocks * size_t(254) });
+        checkPlan<Geometry>({ 1000, numBlocks * size_t(254) - 1000 + 1, 100 });
+        // the directory runs full before the blocks do
+        checkPlan<Geometry>(std::vector<size_t>(Geometry::MAX_DIR_ENTRIES + 3, 1));
+
+        // files of random sizes until the disk is full, some of them do not fit anymore
+        std::mt19937 random(17);
+        std::vector<size_t> lengths;
+        for (int fileIdx = 0; fileIdx < 120; fileIdx++)
+        {
+            lengths.push_back(1 + random() % (64 * 254));
+        }
+        checkPlan<Geometry>(lengths);
+    }
+
+    TEST_CASE("Planner", "Planner")
+    {
+        checkPlans<D64Geometry>();
+        checkPlans<D64ExtendedGeometry>();
+        checkPlans<D71Geometry>();
+        checkPlans<D81Geometry>();
+
+        Planner planner;
+        REQUIRE(planner.addFiles({ 254 * 10, 254 * 600 }));
+        REQUIRE(!planner.addFiles({ 254 * 55 }));
+        REQUIRE(planner.getNumberOfRejectedFiles() == 1);
+        REQUIRE(planner.getNumberOfFreeSectors() == 54);
+        planner.reset();
+        REQUIRE(planner.isEverythingFitting());
+        REQUIRE(planner.getNumberOfFreeSectors() == 664);
+    }
+}
@@ -0,0 +1,61 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "ProgFile.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("Program files", "ProgFile")
+    {
+        std::string folder = makeTempFolder();
+
+        // loads at $C000, ends at $FFFF
+        std::vector<uint8_t> prog = { 0x00, 0xc0 };
+        prog.resize(2 + 0x4000, 0xea);
+        writeHostFile(folder + "/fits.prg", prog);
+
+        ProgFile fits(folder + "/fits.prg");
+        REQUIRE(fits.getStatus() == ProgFile::Status::OK);
+        REQUIRE(fits.getLength() == prog.size());
+        REQUIRE(std::vector<uint8_t>(fits.getData(), fits.getData() + fits.getLength()) == prog);
+
+        // one byte beyond $FFFF
+        prog.push_back(0xea);
+        writeHostFile(folder + "/beyond.prg", prog);
+        REQUIRE(ProgFile(folder + "/beyond.prg").getStatus() == ProgFile::Status::EXCEEDS_ADDRESS_SPACE);
+
+        writeHostFile(folder + "/short.prg", std::vector<uint8_t>{ 0x01 });
+        REQUIRE(ProgFile(folder + "/short.prg").getStatus() == ProgFile::Status::TOO_SHORT);
+
+        writeHostFile(folder + "/large.prg", std::vector<uint8_t>(ProgFile::MAX_PROG_FILE_LEN + 1, 0x00));
+        REQUIRE(ProgFile(folder + "/large.prg").getStatus() == ProgFile::Status::TOO_LARGE);
+
+        REQUIRE(ProgFile(folder + "/missing.prg").getStatus() == ProgFile::Status::OPEN_FAILED);
+        REQUIRE(ProgFile(folder).getStatus() == ProgFile::Status::NOT_A_REGULAR_FILE);
+
+        REQUIRE(ProgFile::hasProgSuffix("game.PRG"));
+        REQUIRE_FALSE(ProgFile::hasProgSuffix(".prg"));
+        REQUIRE_FALSE(ProgFile::hasProgSuffix("game.txt"));
+
+        // a folder named like a '.prg' file is skipped by a build, but invalid files fail it
+        std::string buildFolder = folder + "/build";
+        REQUIRE(::mkdir(buildFolder.c_str(), 0700) == 0);
+        REQUIRE(::mkdir((buildFolder + "/folder.prg").c_str(), 0700) == 0);
+        writeHostFile(buildFolder + "/fits.prg", std::vector<uint8_t>(prog.begin(), prog.end() - 1));
+        std::ostringstream err;
+        REQUIRE(buildImage(buildFolder, folder + "/out.d64", err));
+        REQUIRE(err.str().empty());
+        writeHostFile(buildFolder + "/short.prg", std::vector<uint8_t>{ 0x01 });
+        REQUIRE_FALSE(buildImage(buildFolder, folder + "/out.d64", err));
+
+        removeFolder(folder);
+    }
+}
@@ -0,0 +1,196 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <memory>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "Reader.h"
+#include "Writer.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    template <typename Geometry>
+    static std::vector<uint8_t> readFile(BasicReader<Geometry> const &reader, std::string const &name)
+    {
+        auto pEntry = reader.findFile(name);
+        REQUIRE(pEntry != nullptr);
+
+        std::vector<uint8_t> ret;
+        auto view = reader.getFile(*pEntry);
+        REQUIRE(view.isComplete());
+        view.copyTo(ret);
+        REQUIRE(view.getLength() == ret.size());
+        REQUIRE(view.getNumberOfSectors() == pEntry->numberOfBlocks);
+        return ret;
+    }
+
+    TEST_CASE("Reader round trip", "Reader")
+    {
+        std::vector<uint8_t> small = { 0x01, 0x08, 0x60 };
+        std::vector<uint8_t> exact(2 * Writer::DATA_BYTES_PER_SECTOR, 0x11);
+        std::vector<uint8_t> large(100 * Writer::DATA_BYTES_PER_SECTOR + 17);
+        for (size_t idx = 0; idx < large.size(); idx++)
+        {
+            large[idx] = static_cast<uint8_t>(idx * 7);
+        }
+
+        Writer writer("READER");
+        REQUIRE(writer.writeFile("small", &small[0], small.size()));
+        REQUIRE(writer.writeFile("EXACT", &exact[0], exact.size()));
+        REQUIRE(writer.writeFile("large.prg", &large[0], large.size()));
+        std::vector<uint8_t> image = getImage(writer);
+
+        // from memory
+        Reader reader(&image[0], image.size());
+        REQUIRE(reader.getStatus() == Reader::Status::OK);
+        REQUIRE(reader.getFiles().size() == 3);
+        REQUIRE(reader.getFiles()[1].name == makeD64FileName("EXACT"));
+        REQUIRE(reader.getFiles()[2].slot == 2);
+        REQUIRE(reader.getFiles()[2].type == 0x82);
+        REQUIRE(readFile(reader, "small") == small);
+        REQUIRE(readFile(reader, "exact") == exact);
+        REQUIRE(readFile(reader, "LARGE.PRG") == large);
+        REQUIRE(reader.findFile("MISSING") == nullptr);
+
+        // the views point into the image
+        auto view = reader.getFile(*reader.findFile("SMALL"));
+        REQUIRE((*view.begin()).pData >= &image[0]);
+        REQUIRE((*view.begin()).pData < &image[0] + image.size());
+
+        // mapped from a file, with and without error bytes
+        std::string folder = makeTempFolder();
+        writeHostFile(folder + "/plain.d64", image);
+        Reader mapped(folder + "/plain.d64");
+        REQUIRE(mapped.getStatus() == Reader::Status::OK);
+        REQUIRE(readFile(mapped, "large.prg") == large);
+
+        std::vector<uint8_t> withErrors(image);
+        withErrors.resize(image.size() + Reader::NUM_SECTORS, 0x01);
+        writeHostFile(folder + "/errors.d64", withErrors);
+        REQUIRE(Reader(folder + "/errors.d64").getStatus() == Reader::Status::OK);
+
+        writeHostFile(folder + "/short.d64", std::vector<uint8_t>(image.begin(), image.end() - 1));
+        REQUIRE(Reader(folder + "/short.d64").getStatus() == Reader::Status::WRONG_SIZE);
+        REQUIRE(Reader(folder + "/missing.d64").getStatus() == Reader::Status::OPEN_FAILED);
+        REQUIRE(Reader(folder).getStatus() == Reader::Status::NOT_A_REGULAR_FILE);
+        REQUIRE(Reader(&image[0], 1000).getFiles().empty());
+        removeFolder(folder);
+    }
+
+    TEST_CASE("Reader on a full directory", "Reader")
+    {
+        Writer writer("FULL");
+        std::vector<uint8_t> content(3, 0x00);
+        for (uint16_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            content[2] = static_cast<uint8_t>(fileIdx);
+            REQUIRE(writer.writeFile("FILE_" + std::to_string(fileIdx), &content[0], content.size()));
+        }
+        std::vector<uint8_t> image = getImage(writer);
+
+        Reader reader(&image[0], image.size());
+        REQUIRE(reader.getFiles().size() == Writer::MAX_DIR_ENTRIES);
+        for (uint16_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            content[2] = static_cast<uint8_t>(fileIdx);
+            REQUIRE(readFile(reader, "FILE_" + std::to_string(fileIdx)) == content);
+            REQUIRE(reader.findFile("FILE_" + std::to_string(fileIdx))->slot == fileIdx);
+        }
+    }
+
+    TEST_CASE("Reader on broken chains", "Reader")
+    {
+        std::vector<uint8_t> content(10 * Writer::DATA_BYTES_PER_SECTOR, 0x33);
+        Writer writer("BROKEN");
+        REQUIRE(writer.writeFile("CYCLE", &content[0], content.size()));
+        REQUIRE(writer.writeFile("OUTSIDE", &content[0], content.size()));
+        std::vector<uint8_t> image = getImage(writer);
+
+        Reader reader(&image[0], image.size());
+        auto cycle = reader.getFile(*reader.findFile("CYCLE"));
+        auto outside = reader.getFile(*reader.findFile("OUTSIDE"));
+
+        // the last sector of CYCLE links back to its first one
+        uint16_t firstIdx = cycle.begin().getSectorIdx();
+        uint16_t lastIdx = firstIdx;
+        for (auto it = cycle.begin(); it != cycle.end(); ++it)
+        {
+            lastIdx = it.getSectorIdx();
+        }
+        TrackSector first = D64Geometry::getTrackAndSector(firstIdx);
+        image[lastIdx * 256] = first.track + 1;
+        image[lastIdx * 256 + 1] = first.sector;
+        REQUIRE(!cycle.isComplete());
+        REQUIRE(cycle.getNumberOfSectors() == Reader::NUM_SECTORS);
+
+        // the first sector of OUTSIDE links to track 36
+        uint16_t outsideIdx = outside.begin().getSectorIdx();
+        image[outsideIdx * 256] = 36;
+        REQUIRE(!outside.isComplete());
+        REQUIRE(outside.getNumberOfSectors() == 1);
+    }
+
+    TEST_CASE("Reader on an image written by the DOS", "Reader")
+    {
+        std::vector<uint8_t> small = { 0x01, 0x08, 0x60 };
+        std::vector<uint8_t> exact(2 * Writer::DATA_BYTES_PER_SECTOR, 0x11);
+        std::vector<uint8_t> large(100 * Writer::DATA_BYTES_PER_SECTOR + 17, 0x22);
+        Writer writer("DOS");
+        REQUIRE(writer.writeFile("SMALL.PRG", &small[0], small.size()));
+        REQUIRE(writer.writeFile("EXACT.PRG", &exact[0], exact.size()));
+        REQUIRE(writer.writeFile("LARGE.PRG", &large[0], large.size()));
+        std::vector<uint8_t> image = getImage(writer);
+
+        // the DOS marks the last sectors with the offset of their last byte, one more than the Writer
+        {
+            Reader reader(&image[0], image.size());
+            REQUIRE(reader.getLastSectorFormat() == LastSectorFormat::BYTE_COUNT);
+            for (auto const &entry : reader.getFiles())
+            {
+                uint16_t lastIdx = TrackSector::INVALID;
+                auto view = reader.getFile(entry);
+                for (auto it = view.begin(); it != view.end(); ++it)
+                {
+                    lastIdx = it.getSectorIdx();
+                }
+                ++image[lastIdx * 256 + 1];
+            }
+        }
+
+        Reader reader(&image[0], image.size());
+        REQUIRE(reader.getLastSectorFormat() == LastSectorFormat::LAST_BYTE_OFFSET);
+        REQUIRE(readFile(reader, "SMALL.PRG") == small);
+        REQUIRE(readFile(reader, "EXACT.PRG") == exact);
+        REQUIRE(readFile(reader, "LARGE.PRG") == large);
+
+        // the update finds the files unchanged and leaves the image as it is
+        std::string folder = makeTempFolder();
+        REQUIRE(mkdir((folder + "/dos").c_str(), 0755) == 0);
+        writeHostFile(folder + "/dos/small.prg", small);
+        writeHostFile(folder + "/dos/exact.prg", exact);
+        writeHostFile(folder + "/dos/large.prg", large);
+        writeHostFile(folder + "/dos.d64", image);
+        std::ostringstream err;
+        REQUIRE(updateImage(folder + "/dos", folder + "/dos.d64", err));
+        REQUIRE(readHostFile(folder + "/dos.d64") == image);
+        removeFolder(folder);
+    }
+
+    TEST_CASE("Reader on a D81", "Reader")
+    {
+        std::vector<uint8_t> large(2000 * D81Writer::DATA_BYTES_PER_SECTOR + 1, 0x81);
+        auto pWriter = std::make_unique<D81Writer>("D81");
+        REQUIRE(pWriter->writeFile("LARGE", &large[0], large.size()));
+        std::vector<uint8_t> image = getImage(*pWriter);
+
+        BasicReader<D81Geometry> reader(&image[0], image.size());
+        REQUIRE(reader.getStatus() == BasicReader<D81Geometry>::Status::OK);
+        REQUIRE(readFile(reader, "LARGE") == large);
+    }
+}
@@ -0,0 +1,87 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include "Stats.h"
+#include "Writer.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("Writer counters", "Stats")
+    {
+        stats::reset();
+
+        Writer writer;
+        std::vector<uint8_t> data(5000, 0x42);
+        REQUIRE(writer.writeFile("one", data.data(), data.size()));
+        REQUIRE(writer.writeFile("two", data.data(), 100));
+        REQUIRE_FALSE(writer.writeFile("one", data.data(), 100));
+
+        stats::Snapshot snapshot = stats::getSnapshot();
+        if (!stats::isEnabled())
+        {
+            // compiled out: nothing is counted
+            REQUIRE(snapshot.get(stats::Counter::SECTORS_ALLOCATED) == 0);
+            REQUIRE(snapshot.get(stats::Phase::LAYOUT).calls == 0);
+            return;
+        }
+
+        uint16_t allocated = Writer::getNumberOfFreeSectorsOnBlankImage() - writer.getNumberOfFreeSectors();
+        REQUIRE(snapshot.get(stats::Counter::SECTORS_ALLOCATED) == allocated);
+        REQUIRE(snapshot.get(stats::Counter::ALLOCATION_PROBES) >= allocated);
+        REQUIRE(snapshot.get(stats::Counter::DIRECTORY_SEARCHES) == 3);
+        REQUIRE(snapshot.get(stats::Phase::DIRECTORY).calls == 3);
+        REQUIRE(snapshot.get(stats::Phase::LAYOUT).calls == 2);
+        REQUIRE(snapshot.get(stats::Counter::BYTES_WRITTEN) == 0);
+
+        stats::reset();
+        REQUIRE(stats::getSnapshot().get(stats::Counter::SECTORS_ALLOCATED) == 0);
+    }
+
+    TEST_CASE("Build counters", "Stats")
+    {
+        std::string folder = makeTempFolder();
+        writeHostFile(folder + "/a.prg", std::vector<uint8_t>(1000, 0x01));
+        writeHostFile(folder + "/b.prg", std::vector<uint8_t>(300, 0x02));
+        writeHostFile(folder + "/notes.txt", std::vector<uint8_t>(10, 0x20));
+
+        stats::reset();
+        std::ostringstream err;
+        REQUIRE(buildImage(folder, folder + "/out.d64", err, ImageFormat::D64));
+        stats::Snapshot snapshot = stats::getSnapshot();
+
+        if (stats::isEnabled())
+        {
+            REQUIRE(snapshot.get(stats::Counter::FILES_READ) == 2);
+            REQUIRE(snapshot.get(stats::Counter::BYTES_READ) == 1300);
+            REQUIRE(snapshot.get(stats::Counter::SKIPPED_NOT_PRG) == 1);
+            REQUIRE(snapshot.get(stats::Counter::IMAGES_WRITTEN) == 1);
+            REQUIRE(snapshot.get(stats::Counter::BYTES_WRITTEN) == Writer().getImageSize());
+            REQUIRE(snapshot.get(stats::Phase::READ).calls == 2);
+            REQUIRE(snapshot.get(stats::Phase::SCAN).calls >= 4);
+            REQUIRE(snapshot.get(stats::Phase::SERIALIZE).calls == 1);
+        }
+
+        // the reason a file is rejected
+        writeHostFile(folder + "/c.prg", std::vector<uint8_t>{ 0x01 });
+        stats::reset();
+        REQUIRE_FALSE(buildImage(folder, folder + "/out.d64", err, ImageFormat::D64));
+        snapshot = stats::getSnapshot();
+        REQUIRE(snapshot.get(stats::Counter::REJECTED_TOO_SHORT) == (stats::isEnabled() ? 1 : 0));
+
+        // JSON members with the names of the counters and phases
+        std::ostringstream json;
+        stats::writeJsonMembers(json, snapshot);
+        REQUIRE(json.str().find("\"phases\": {\"scan\": {\"calls\": ") == 0);
+        REQUIRE(json.str().find(std::string("\"") + stats::getName(stats::Counter::REJECTED_TOO_SHORT) + "\": " +
+                                std::to_string(snapshot.get(stats::Counter::REJECTED_TOO_SHORT))) != std::string::npos);
+        REQUIRE(json.str().back() == '}');
+
+        removeFolder(folder);
+    }
+}
@@ -0,0 +1,236 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Writer.h"
+#include "Reader.h"
+#include "ImageBuilder.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    static std::vector<uint8_t> makeProg(size_t length, uint8_t value)
+    {
+        std::vector<uint8_t> prog(length, value);
+        prog[0] = 0x01;
+        prog[1] = 0x08;
+        return prog;
+    }
+
+    static std::vector<uint8_t> readFile(Reader const &reader, std::string const &name)
+    {
+        std::vector<uint8_t> ret;
+        auto pEntry = reader.findFile(name);
+        REQUIRE(pEntry != nullptr);
+        reader.getFile(*pEntry).copyTo(ret);
+        return ret;
+    }
+
+    TEST_CASE("Load an image", "Update")
+    {
+        std::vector<uint8_t> prog = makeProg(30 * Writer::DATA_BYTES_PER_SECTOR, 0x55);
+        Writer original("LOAD");
+        for (uint16_t fileIdx = 0; fileIdx < 20; fileIdx++)
+        {
+            REQUIRE(original.writeFile("FILE" + std::to_string(fileIdx), &prog[0], 100 + fileIdx));
+        }
+        std::vector<uint8_t> image = getImage(original);
+
+        for (StorageMode mode : {StorageMode::DENSE, StorageMode::SPARSE})
+        {
+            Writer loaded("OTHER", mode);
+            REQUIRE(loaded.loadImage(&image[0], image.size()));
+            REQUIRE(loaded.getNumberOfChangedSectors() == 0);
+            REQUIRE(getImage(loaded) == image);
+
+            // the directory and the BAM are taken over
+            REQUIRE(!loaded.writeFile("FILE3", &prog[0], prog.size()));
+            REQUIRE(loaded.writeFile("FILE20", &prog[0], prog.size()));
+            REQUIRE(original.writeFile("FILE20", &prog[0], prog.size()));
+            REQUIRE(getImage(loaded) == getImage(original));
+            original.deleteFile("FILE20");
+        }
+
+        // the directory chain must have the layout the Writer gives it
+        std::vector<uint8_t> moved(image);
+        moved[Writer::FIRST_DIR_SECTOR_IDX * Writer::BYTES_PER_SECTOR] = Writer::DIRECTORY_TRACK + 1;
+        moved[Writer::FIRST_DIR_SECTOR_IDX * Writer::BYTES_PER_SECTOR + 1] = Writer::getDirSectorOnTrack(1) + 1;
+        Writer writer;
+        REQUIRE(!writer.loadImage(&moved[0], moved.size()));
+        REQUIRE(!writer.loadImage(&image[0], image.size() - 1));
+    }
+
+    TEST_CASE("Delete and replace files", "Update")
+    {
+        std::vector<uint8_t> progA = makeProg(10 * Writer::DATA_BYTES_PER_SECTOR, 0xaa);
+        std::vector<uint8_t> progB = makeProg(5 * Writer::DATA_BYTES_PER_SECTOR, 0xbb);
+        Writer onlyA("UPDATE"), writer("UPDATE");
+        REQUIRE(onlyA.writeFile("A", &progA[0], progA.size()));
+        REQUIRE(writer.writeFile("A", &progA[0], progA.size()));
+        REQUIRE(writer.writeFile("B", &progB[0], progB.size()));
+
+        std::string folder = makeTempFolder();
+        std::string imagePath = folder + "/update.d64";
+        REQUIRE(writer.writeImageFile(imagePath));
+        std::vector<uint8_t> image = getImage(writer);
+        REQUIRE(writer.loadImage(&image[0], image.size()));
+
+        // deleting touches the BAM and the directory sector only
+        REQUIRE(writer.deleteFile("B"));
+        REQUIRE(!writer.deleteFile("B"));
+        REQUIRE(writer.getNumberOfChangedSectors() == 2);
+        uint8_t const *pBam = writer.getSectorData(Writer::BAM_SECTOR_IDX);
+        REQUIRE(std::equal(pBam, pBam + Writer::BYTES_PER_SECTOR, onlyA.getSectorData(Writer::BAM_SECTOR_IDX)));
+
+        int fd = open(imagePath.c_str(), O_WRONLY);
+        REQUIRE(writer.writeChangedSectors(fd));
+        close(fd);
+        REQUIRE(writer.getNumberOfChangedSectors() == 0);
+        REQUIRE(readHostFile(imagePath) == getImage(writer));
+
+        // a replaced file keeps its directory slot, a new file takes the slot of the deleted one
+        std::vector<uint8_t> newA = makeProg(12 * Writer::DATA_BYTES_PER_SECTOR - 7, 0xcc);
+        REQUIRE(writer.replaceFile("a", &newA[0], newA.size()));
+        REQUIRE(writer.replaceFile("C", &progB[0], progB.size()));
+        std::vector<uint8_t> tooLarge(665 * Writer::DATA_BYTES_PER_SECTOR, 0x00);
+        REQUIRE(!writer.replaceFile("A", &tooLarge[0], tooLarge.size()));
+
+        fd = open(imagePath.c_str(), O_WRONLY);
+        REQUIRE(writer.writeChangedSectors(fd));
+        close(fd);
+
+        image = readHostFile(imagePath);
+        REQUIRE(image == getImage(writer));
+        Reader reader(&image[0], image.size());
+        REQUIRE(reader.getFiles().size() == 2);
+        REQUIRE(reader.findFile("A")->slot == 0);
+        REQUIRE(reader.findFile("C")->slot == 1);
+        REQUIRE(readFile(reader, "A") == newA);
+        REQUIRE(readFile(reader, "C") == progB);
+
+        // sectors of the chain which are free in the BAM make the old file seem to free more than
+        // it does, a replacement which then does not fit leaves the old file as it was
+        Writer small;
+        std::vector<uint8_t> progS = makeProg(10 * Writer::DATA_BYTES_PER_SECTOR, 0x5a);
+        REQUIRE(small.writeFile("S", &progS[0], progS.size()));
+        image = getImage(small);
+        Reader smallReader(&image[0], image.size());
+        uint16_t sectorIdx = D64Geometry::getSectorIdx(smallReader.findFile("S")->firstSector);
+        size_t bamOffset = Writer::BAM_SECTOR_IDX * Writer::BYTES_PER_SECTOR;
+        for (uint8_t const *pSector = &image[sectorIdx * Writer::BYTES_PER_SECTOR]; ; pSector = &image[sectorIdx * Writer::BYTES_PER_SECTOR])
+        {
+            TrackSector ts = D64Geometry::getTrackAndSector(sectorIdx);
+            ++image[bamOffset + 4 + 4 * ts.track];
+            image[bamOffset + 5 + 4 * ts.track + ts.sector / 8] |= static_cast<uint8_t>(1 << (ts.sector % 8));
+            if (pSector[0] == 0)
+            {
+                break;
+            }
+            sectorIdx = D64Geometry::getSectorIdx(TrackSector{static_cast<uint8_t>(pSector[0] - 1), pSector[1]});
+        }
+        Writer loaded;
+        REQUIRE(loaded.loadImage(&image[0], image.size()));
+        std::vector<uint8_t> notFitting = makeProg((loaded.getNumberOfFreeSectors() + 5) * Writer::DATA_BYTES_PER_SECTOR, 0xa5);
+        REQUIRE(!loaded.replaceFile("S", &notFitting[0], notFitting.size()));
+        REQUIRE(loaded.getNumberOfFiles() == 1);
+        image = getImage(loaded);
+        Reader loadedReader(&image[0], image.size());
+        REQUIRE(readFile(loadedReader, "S") == progS);
+
+        removeFolder(folder);
+    }
+
+    // a name whose bucket in the name index of a D64 is bucketIdx, with the hash of DirectoryIndex
+    static std::string makeNameInBucket(uint16_t bucketIdx)
+    {
+        for (uint32_t nameIdx = 0; ; nameIdx++)
+        {
+            std::string name = "N" + std::to_string(nameIdx);
+            uint32_t hash = 2166136261u;
+            for (uint8_t ch : makeD64FileName(name))
+            {
+                hash = (hash ^ ch) * 16777619u;
+            }
+            if (((hash ^ (hash >> 16)) & 255) == bucketIdx)
+            {
+                return name;
+            }
+        }
+    }
+
+    TEST_CASE("Delete and write many files", "Update")
+    {
+        // deleted entries fill buckets 0 to 191 of the 256, new entries the rest, then the index
+        // must still find out that a name is not there
+        std::vector<uint8_t> prog = makeProg(100, 0x42);
+        Writer writer;
+        for (auto range : { std::make_pair(0, 144), std::make_pair(144, 192), std::make_pair(192, 256) })
+        {
+            for (int bucketIdx = range.first; bucketIdx < range.second; bucketIdx++)
+            {
+                REQUIRE(writer.writeFile(makeNameInBucket(static_cast<uint16_t>(bucketIdx)), &prog[0], prog.size()));
+            }
+            if (range.second < 256)
+            {
+                for (int bucketIdx = range.first; bucketIdx < range.second; bucketIdx++)
+                {
+                    REQUIRE(writer.deleteFile(makeNameInBucket(static_cast<uint16_t>(bucketIdx))));
+                }
+            }
+        }
+
+        REQUIRE(writer.getNumberOfFiles() == 64);
+        REQUIRE(!writer.hasFile("ANOTHER"));
+        REQUIRE(writer.writeFile("ANOTHER", &prog[0], prog.size()));
+        REQUIRE(writer.hasFile(makeNameInBucket(200)));
+    }
+
+    TEST_CASE("Update an image from a folder", "Update")
+    {
+        std::string root = makeTempFolder();
+        std::string folder = root + "/disk";
+        std::string imagePath = root + "/disk.d64";
+        REQUIRE(mkdir(folder.c_str(), 0755) == 0);
+
+        std::vector<uint8_t> progA = makeProg(300, 0x0a), progB = makeProg(3000, 0x0b), progC = makeProg(30000, 0x0c);
+        writeHostFile(folder + "/a.prg", progA);
+        writeHostFile(folder + "/b.prg", progB);
+        writeHostFile(folder + "/c.prg", progC);
+
+        std::ostringstream err;
+        REQUIRE(buildImage(folder, imagePath, err));
+        std::vector<uint8_t> built = readHostFile(imagePath);
+
+        // nothing changed, nothing to write
+        REQUIRE(updateImage(folder, imagePath, err));
+        REQUIRE(readHostFile(imagePath) == built);
+
+        std::vector<uint8_t> newB = makeProg(5000, 0xbb), progD = makeProg(700, 0x0d);
+        writeHostFile(folder + "/b.prg", newB);
+        writeHostFile(folder + "/d.prg", progD);
+        REQUIRE(unlink((folder + "/c.prg").c_str()) == 0);
+        REQUIRE(updateImage(folder, imagePath, err));
+
+        std::vector<uint8_t> image = readHostFile(imagePath);
+        Reader reader(&image[0], image.size());
+        REQUIRE(reader.getFiles().size() == 3);
+        REQUIRE(readFile(reader, "A.PRG") == progA);
+        REQUIRE(readFile(reader, "B.PRG") == newB);
+        REQUIRE(readFile(reader, "D.PRG") == progD);
+        REQUIRE(reader.findFile("C.PRG") == nullptr);
+
+        // disk name and ID are kept
+        size_t nameOffset = Writer::HEADER_SECTOR_IDX * Writer::BYTES_PER_SECTOR + D64Geometry::DISK_NAME_OFFSET;
+        REQUIRE(std::equal(&built[nameOffset], &built[nameOffset + 0x14], &image[nameOffset]));
+
+        REQUIRE(!updateImage(folder, root + "/missing.d64", err));
+        removeFolder(root);
+    }
+}
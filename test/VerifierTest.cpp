@@ -0,0 +1,160 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+
+#include "Verifier.h"
+#include "Writer.h"
+#include "Reader.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    template <typename Geometry>
+    static VerifyResult verifyWrittenImage()
+    {
+        BasicWriter<Geometry> writer("verified");
+        std::vector<uint8_t> data(6000, 0x55);
+        for (uint16_t fileIdx = 0; fileIdx < 20; fileIdx++)
+        {
+            REQUIRE(writer.writeFile("file" + std::to_string(fileIdx), data.data(), 100 + fileIdx * 300));
+        }
+        REQUIRE(writer.deleteFile("file3"));
+        std::vector<uint8_t> image = getImage(writer);
+        return verify<Geometry>(image.data(), image.size());
+    }
+
+    TEST_CASE("Verify written images", "Verifier")
+    {
+        VerifyResult result = verifyWrittenImage<D64Geometry>();
+        REQUIRE(result.problems == std::vector<std::string>());
+        REQUIRE(result.numFiles == 19);
+        REQUIRE(verifyWrittenImage<D64ExtendedGeometry>().isOk());
+        REQUIRE(verifyWrittenImage<D71Geometry>().isOk());
+        REQUIRE(verifyWrittenImage<D81Geometry>().isOk());
+
+        // a blank image uses the BAM and the first directory sector only
+        Writer blank;
+        result = verify(blank.getImageData(), blank.getImageSize(), ImageFormat::D64);
+        REQUIRE(result.isOk());
+        REQUIRE(result.numFiles == 0);
+        REQUIRE(result.numUsedSectors == 2);
+
+        REQUIRE(!verify(blank.getImageData(), blank.getImageSize() - 1, ImageFormat::D64).isOk());
+        REQUIRE(verify(blank.getImageData(), blank.getImageSize(), ImageFormat::G64).problems ==
+                std::vector<std::string>{"G64 images cannot be verified"});
+    }
+
+    TEST_CASE("Verify broken images", "Verifier")
+    {
+        Writer writer("broken");
+        std::vector<uint8_t> data(3000, 0x66);
+        REQUIRE(writer.writeFile("one", data.data(), 3000));
+        REQUIRE(writer.writeFile("two", data.data(), 600));
+        std::vector<uint8_t> good = getImage(writer);
+
+        Reader reader(good.data(), good.size());
+        uint16_t oneIdx = D64Geometry::getSectorIdx(reader.findFile("one")->firstSector);
+        uint16_t twoIdx = D64Geometry::getSectorIdx(reader.findFile("two")->firstSector);
+        TrackSector two = reader.findFile("two")->firstSector;
+        REQUIRE(verify<D64Geometry>(good.data(), good.size()).isOk());
+
+        auto verifyChanged = [&good](uint16_t sectorIdx, uint8_t offset, uint8_t value)
+        {
+            std::vector<uint8_t> image = good;
+            image[sectorIdx * 256 + offset] = value;
+            return verify<D64Geometry>(image.data(), image.size()).problems;
+        };
+
+        // the first sector of "one" links to "two", which ends both early. The names are PETSCII.
+        std::vector<uint8_t> crossLinked = good;
+        crossLinked[oneIdx * 256] = static_cast<uint8_t>(two.track + 1);
+        crossLinked[oneIdx * 256 + 1] = two.sector;
+        std::vector<std::string> problems = verify<D64Geometry>(crossLinked.data(), crossLinked.size()).problems;
+        REQUIRE(problems.size() == 4);
+        REQUIRE(problems[0] == "file \"ONE\": the directory gives 12 blocks, the file has 4");
+        REQUIRE(problems[1] == "file \"TWO\": track " + std::to_string(two.track + 1) + " sector " + std::to_string(two.sector) +
+                " is used by file \"ONE\" as well");
+        REQUIRE(problems[2] == "file \"TWO\": the directory gives 3 blocks, the file has 0");
+        REQUIRE(problems[3].find("are allocated but not in use") != std::string::npos);
+
+        // control codes in names are escaped
+        std::vector<uint8_t> escaped = crossLinked;
+        uint16_t dirIdx = D64Geometry::FIRST_DIR_SECTOR_IDX;
+        escaped[dirIdx * 256 + 5] = 0x1b;
+        escaped[dirIdx * 256 + 6] = '"';
+        problems = verify<D64Geometry>(escaped.data(), escaped.size()).problems;
+        REQUIRE(problems[0] == "file \"\\x1b\\x22E\": the directory gives 12 blocks, the file has 4");
+
+        // a cycle
+        std::vector<uint8_t> cycle = good;
+        cycle[twoIdx * 256] = static_cast<uint8_t>(two.track + 1);
+        cycle[twoIdx * 256 + 1] = two.sector;
+        problems = verify<D64Geometry>(cycle.data(), cycle.size()).problems;
+        REQUIRE(problems.size() == 3);
+        REQUIRE(problems[0].find("file \"TWO\": links from") == 0);
+        REQUIRE(problems[0].find("which it uses already") != std::string::npos);
+
+        // a link outside the image
+        problems = verifyChanged(twoIdx, 0, 36);
+        REQUIRE(problems[0].find("to track 36 sector") != std::string::npos);
+
+        // the BAM count of track 1 and a free sector in use
+        uint16_t bamIdx = D64Geometry::BAM_SECTOR_IDX;
+        problems = verifyChanged(bamIdx, 4, static_cast<uint8_t>(good[bamIdx * 256 + 4] + 1));
+        REQUIRE(problems == std::vector<std::string>{"BAM of track 1: " + std::to_string(good[bamIdx * 256 + 4] + 1) +
+                                                     " free sectors are counted, " + std::to_string(good[bamIdx * 256 + 4]) + " are marked free"});
+        std::vector<uint8_t> freed = good;
+        freed[bamIdx * 256 + 5] |= 0x01;
+        freed[bamIdx * 256 + 4]++;
+        problems = verify<D64Geometry>(freed.data(), freed.size()).problems;
+        REQUIRE(problems == std::vector<std::string>{"BAM of track 1: sectors 0 are in use but free"});
+        freed = good;
+        freed[bamIdx * 256 + 4 + 4 * 34 + 3] = 0x00;
+        freed[bamIdx * 256 + 4 + 4 * 34]--;
+        problems = verify<D64Geometry>(freed.data(), freed.size()).problems;
+        REQUIRE(problems == std::vector<std::string>{"BAM of track 35: sectors 16 are allocated but not in use"});
+
+        // the directory
+        problems = verifyChanged(D64Geometry::FIRST_DIR_SECTOR_IDX, 0, 1);
+        REQUIRE(problems[0].find("the directory: links from track 18 sector 1 to track 1 sector") == 0);
+        problems = verifyChanged(D64Geometry::BAM_SECTOR_IDX, 0, 0);
+        REQUIRE(problems[0] == "the directory: starts at track 0 sector 1, which is outside the image");
+    }
+
+    TEST_CASE("Verify image files", "Verifier")
+    {
+        std::string folder = makeTempFolder();
+        std::vector<std::string> paths;
+        std::vector<uint8_t> data(2000, 0x77);
+
+        for (int imageIdx = 0; imageIdx < 16; imageIdx++)
+        {
+            D71Writer writer;
+            REQUIRE(writer.writeFile("file", data.data(), data.size()));
+            std::vector<uint8_t> image = getImage(writer);
+            if (imageIdx % 5 == 4)
+            {
+                image[D71Geometry::BAM_SECTOR_IDX * 256 + 4] = 0;
+            }
+            paths.push_back(folder + "/" + std::to_string(imageIdx) + ".d71");
+            writeHostFile(paths.back(), image);
+        }
+        paths.push_back(folder + "/missing.d71");
+
+        std::vector<VerifyResult> results = verifyFiles(paths, ImageFormat::D71, 3);
+        REQUIRE(results.size() == paths.size());
+        for (size_t pathIdx = 0; pathIdx + 1 < paths.size(); pathIdx++)
+        {
+            REQUIRE(results[pathIdx].isOk() == (pathIdx % 5 != 4));
+            REQUIRE(results[pathIdx].numFiles == 1);
+        }
+        REQUIRE(results.back().problems == std::vector<std::string>{"the image could not be opened"});
+
+        // the size tells the wrong format
+        REQUIRE(verifyFile(paths[0], ImageFormat::D64).problems == std::vector<std::string>{"the image does not have the size of an image"});
+
+        removeFolder(folder);
+    }
+}
@@ -0,0 +1,537 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <array>
+#include <vector>
+#include <sstream>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <thread>
+#include <atomic>
+#include <string>
+
+#include "Writer.h"
+#include "SectorAllocator.h"
+#include "BatchBuilder.h"
+#include "ImageBuilder.h"
+#include "WriterPool.h"
+#include "ConcurrentWriter.h"
+#include "Reader.h"
+#include "WriterTestHelper.h"
+
+using namespace std;
+
+namespace d64
+{
+    // The BAM rescan allocation Writer used before the SectorAllocator index,
+    // kept as a reference to compare against
+    class BAMScanAllocator
+    {
+    public:
+        BAMScanAllocator()
+        {
+            for (uint8_t trackIdx = 0; trackIdx < Writer::NUM_TRACKS; trackIdx++)
+            {
+                uint32_t freeBits = (1 << TrackSector::getSectorsOnTrack(trackIdx)) - 1;
+                bam[4 + trackIdx * 4] = TrackSector::getSectorsOnTrack(trackIdx);
+                bam[5 + trackIdx * 4] = static_cast<uint8_t>(freeBits & 0xff);
+                bam[6 + trackIdx * 4] = static_cast<uint8_t>((freeBits >> 8) & 0xff);
+                bam[7 + trackIdx * 4] = static_cast<uint8_t>((freeBits >> 16) & 0xff);
+            }
+        }
+
+        uint32_t getSectorBitsOfTrack(uint8_t trackIdx) const
+        {
+            uint8_t const *pTrackEntry = &bam[4 + trackIdx * 4];
+            return pTrackEntry[1] + (pTrackEntry[2] << 8) + (pTrackEntry[3] << 16);
+        }
+
+        bool isTrackSectorAvailable(TrackSector ts) const
+        {
+            return (getSectorBitsOfTrack(ts.track) & (1 << ts.sector));
+        }
+
+        void setOccupied(TrackSector ts)
+        {
+            uint8_t *pTrackEntry = &bam[4 + ts.track * 4];
+            --pTrackEntry[0];
+            pTrackEntry[1 + ts.sector / 8] &= (1 << (ts.sector % 8)) ^ 0xff;
+        }
+
+        uint16_t getNumberOfFreeSectors() const
+        {
+            uint16_t ret = 0;
+            for (uint8_t trackIdx = 0; trackIdx < Writer::NUM_TRACKS; trackIdx++)
+            {
+                if (trackIdx != Writer::DIRECTORY_TRACK)
+                {
+                    ret = ret + bam[(trackIdx + 1) * 4];
+                }
+            }
+            return ret;
+        }
+
+        TrackSector getNextFree(TrackSector previous) const
+        {
+            uint8_t sectorStartIDx = previous.sector;
+
+            for (uint8_t trackIdx = previous.track; trackIdx < Writer::NUM_TRACKS; trackIdx++)
+            {
+                if (trackIdx != Writer::DIRECTORY_TRACK)
+                {
+                    uint8_t interleave = TrackSector::getInterleaveOnTrack(trackIdx);
+                    uint8_t numSectors = TrackSector::getSectorsOnTrack(trackIdx);
+
+                    for (uint8_t i = 0; i < numSectors; i++)
+                    {
+                        uint8_t sectorOnTrack = static_cast<uint8_t>((sectorStartIDx + (i * interleave)) % numSectors);
+                        TrackSector nextTS = {trackIdx, sectorOnTrack};
+                        if (isTrackSectorAvailable(nextTS))
+                        {
+                            return nextTS;
+                        }
+                    }
+                }
+                sectorStartIDx = 0;
+            }
+
+            return Writer::TRACK_SECTOR_INVALID;
+        }
+
+        TrackSector getFirstFree() const
+        {
+            TrackSector ret = {0, 0};
+            return isTrackSectorAvailable(ret) ? ret : getNextFree(ret);
+        }
+
+    private:
+        std::array<uint8_t, Writer::BYTES_PER_SECTOR> bam = {};
+    };
+
+    // The branch chain conversions TrackSector used before the constexpr lookup tables,
+    // kept as a reference to compare against
+    struct BranchyTrackSector
+    {
+        static uint16_t getSectorIdx(TrackSector ts)
+        {
+            if (ts.track < 17) return (ts.track * 21) + ts.sector;
+            if (ts.track < 24) return (17 * 21) + ((ts.track - 17) * 19) + ts.sector;
+            if (ts.track < 30) return (17 * 21) + (7 * 19) + ((ts.track - 24) * 18) + ts.sector;
+            return (17 * 21) + (7 * 19) + (6 * 18) + ((ts.track - 30) * 17) + ts.sector;
+        }
+
+        static TrackSector getTrackAndSector(uint16_t sectorIdx)
+        {
+            if (sectorIdx < 357) return TrackSector{static_cast<uint8_t>(sectorIdx / 21), static_cast<uint8_t>(sectorIdx % 21)};
+            if (sectorIdx < 490) return TrackSector{static_cast<uint8_t>(((sectorIdx - 357) / 19) + 17), static_cast<uint8_t>((sectorIdx - 357) % 19)};
+            if (sectorIdx < 598) return TrackSector{static_cast<uint8_t>(((sectorIdx - 490) / 18) + 24), static_cast<uint8_t>((sectorIdx - 490) % 18)};
+            return TrackSector{static_cast<uint8_t>(((sectorIdx - 598) / 17) + 30), static_cast<uint8_t>((sectorIdx - 598) % 17)};
+        }
+
+        static uint8_t getSectorsOnTrack(uint8_t track)
+        {
+            if (track < 17) return 21;
+            if (track < 24) return 19;
+            if (track < 30) return 18;
+            return 17;
+        }
+
+        static uint8_t getInterleaveOnTrack(uint8_t track)
+        {
+            switch (getSectorsOnTrack(track))
+            {
+                case 18: return 7;
+                case 17: return 9;
+                default: return 10;
+            }
+        }
+    };
+
+    // round trips for a sequence of sector indices, including the per-track lookups of the allocator
+    template <typename Conversions>
+    static uint32_t convertSectors(std::vector<uint16_t> const &sectorIndices)
+    {
+        uint32_t checksum = 0;
+
+        for (uint16_t sectorIdx : sectorIndices)
+        {
+            TrackSector ts = Conversions::getTrackAndSector(sectorIdx);
+            checksum += Conversions::getSectorIdx(ts);
+            checksum += Conversions::getSectorsOnTrack(ts.track) * Conversions::getInterleaveOnTrack(ts.track);
+        }
+
+        return checksum;
+    }
+
+    TEST_CASE("TrackSector conversions", "[benchmark]")
+    {
+        // scattered accesses like the allocator produces, a linear congruential generator keeps it reproducible
+        std::vector<uint16_t> sectorIndices;
+        uint32_t state = 1;
+        for (uint32_t i = 0; i < 16 * Writer::NUM_SECTORS; i++)
+        {
+            state = state * 1103515245 + 12345;
+            sectorIndices.push_back(static_cast<uint16_t>((state >> 8) % Writer::NUM_SECTORS));
+        }
+
+        REQUIRE(convertSectors<BranchyTrackSector>(sectorIndices) == convertSectors<TrackSector>(sectorIndices));
+
+        BENCHMARK("branch chains, 10928 round trips")
+        {
+            return convertSectors<BranchyTrackSector>(sectorIndices);
+        };
+
+        BENCHMARK("lookup tables, 10928 round trips")
+        {
+            return convertSectors<TrackSector>(sectorIndices);
+        };
+    }
+
+    // allocates the whole disk as files of blocksPerFile sectors, the way Writer::writeData walks the chain
+    template <typename Allocator>
+    static uint16_t fillDisk(Allocator &allocator, uint16_t blocksPerFile)
+    {
+        uint16_t allocated = 0;
+
+        while (allocator.getNumberOfFreeSectors() >= blocksPerFile)
+        {
+            TrackSector ts = allocator.getFirstFree();
+            for (uint16_t block = 0; block < blocksPerFile; block++)
+            {
+                if (block > 0)
+                {
+                    ts = allocator.getNextFree(ts);
+                }
+                allocator.setOccupied(ts);
+                ++allocated;
+            }
+        }
+
+        return allocated;
+    }
+
+    TEST_CASE("Sector allocation", "[benchmark]")
+    {
+        BENCHMARK("BAM rescan, 664 files of 1 block")
+        {
+            BAMScanAllocator allocator;
+            return fillDisk(allocator, 1);
+        };
+
+        BENCHMARK("SectorAllocator, 664 files of 1 block")
+        {
+            SectorAllocator allocator;
+            return fillDisk(allocator, 1);
+        };
+
+        BENCHMARK("BAM rescan, 166 files of 4 blocks")
+        {
+            BAMScanAllocator allocator;
+            return fillDisk(allocator, 4);
+        };
+
+        BENCHMARK("SectorAllocator, 166 files of 4 blocks")
+        {
+            SectorAllocator allocator;
+            return fillDisk(allocator, 4);
+        };
+    }
+
+    TEST_CASE("Free sector count", "[benchmark]")
+    {
+        // differently filled disks, so the counts cannot be hoisted out of the loop
+        std::vector<BAMScanAllocator> scanAllocators(8);
+        std::vector<SectorAllocator> allocators(8);
+        for (uint16_t idx = 0; idx < 8; idx++)
+        {
+            fillDisk(scanAllocators[idx], 1 + idx * 80);
+            fillDisk(allocators[idx], 1 + idx * 80);
+            REQUIRE(scanAllocators[idx].getNumberOfFreeSectors() == allocators[idx].getNumberOfFreeSectors());
+        }
+
+        BENCHMARK("BAM track entries, 1024 queries")
+        {
+            uint32_t sum = 0;
+            for (uint16_t query = 0; query < 1024; query++)
+            {
+                sum += scanAllocators[query % 8].getNumberOfFreeSectors();
+            }
+            return sum;
+        };
+
+        BENCHMARK("SectorAllocator, 1024 queries")
+        {
+            uint32_t sum = 0;
+            for (uint16_t query = 0; query < 1024; query++)
+            {
+                sum += allocators[query % 8].getNumberOfFreeSectors();
+            }
+            return sum;
+        };
+    }
+
+    TEST_CASE("Fill image", "[benchmark]")
+    {
+        uint16_t availableDataSectors = Writer::NUM_SECTORS - 19;
+        std::vector<uint8_t> file(availableDataSectors * Writer::DATA_BYTES_PER_SECTOR, 0x42);
+
+        BENCHMARK("Writer with one small file, dense storage")
+        {
+            Writer w;
+            return w.writeFile("SMALL", &file[0], 1000);
+        };
+
+        BENCHMARK("Writer with one small file, sparse storage")
+        {
+            Writer w("Demo", SectorStorage::Mode::SPARSE);
+            return w.writeFile("SMALL", &file[0], 1000);
+        };
+
+        WriterPool densePool;
+        BENCHMARK("Writer with one small file, dense storage, pooled")
+        {
+            WriterPool::Handle pWriter = densePool.acquire();
+            return pWriter->writeFile("SMALL", &file[0], 1000);
+        };
+
+        WriterPool sparsePool(SectorStorage::Mode::SPARSE);
+        BENCHMARK("Writer with one small file, sparse storage, pooled")
+        {
+            WriterPool::Handle pWriter = sparsePool.acquire();
+            return pWriter->writeFile("SMALL", &file[0], 1000);
+        };
+
+        BENCHMARK("writeFile, one tiny file of 1 block")
+        {
+            Writer w;
+            return w.writeFile("TINY", &file[0], 100);
+        };
+
+        BENCHMARK("writeFile, one medium file of 64 blocks")
+        {
+            Writer w;
+            return w.writeFile("MEDIUM", &file[0], 64 * Writer::DATA_BYTES_PER_SECTOR);
+        };
+
+        BENCHMARK("writeFile, one 664 block file")
+        {
+            Writer w;
+            return w.writeFile("BIG", &file[0], file.size());
+        };
+
+        std::vector<uint8_t> d81File(3160 * Writer::DATA_BYTES_PER_SECTOR, 0x42);
+        BENCHMARK("writeFile, one 3160 block file on a D81")
+        {
+            D81Writer w;
+            return w.writeFile("BIG", &d81File[0], d81File.size());
+        };
+
+        // 40 files of 79 blocks fill a D81, one writeFile() after the other resp. from 4 threads
+        std::vector<std::string> d81FileNames;
+        for (uint8_t fileIdx = 0; fileIdx < 40; fileIdx++)
+        {
+            d81FileNames.push_back("FILE_" + std::to_string(fileIdx));
+        }
+        size_t d81FileLength = 79 * Writer::DATA_BYTES_PER_SECTOR;
+
+        BENCHMARK("writeFile, 40 files of 79 blocks on a D81")
+        {
+            D81Writer w;
+            bool success = true;
+            for (auto const &fileName : d81FileNames)
+            {
+                success = success && w.writeFile(fileName, &d81File[0], d81FileLength);
+            }
+            return success;
+        };
+
+        BENCHMARK("ConcurrentWriter, 40 files of 79 blocks on a D81, 4 threads")
+        {
+            D81Writer w;
+            BasicConcurrentWriter<D81Geometry> concurrentWriter(w);
+            std::atomic<size_t> nextFile(0);
+            std::vector<std::thread> threads;
+            for (int threadIdx = 0; threadIdx < 4; threadIdx++)
+            {
+                threads.emplace_back([&]()
+                {
+                    for (size_t fileIdx; (fileIdx = nextFile++) < d81FileNames.size(); )
+                    {
+                        concurrentWriter.writeFile(d81FileNames[fileIdx], &d81File[0], d81FileLength);
+                    }
+                });
+            }
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+            return w.getNumberOfFiles();
+        };
+
+        // the directory holds 144 files, 4 blocks each leaves 88 blocks free
+        size_t fileLength = 4 * Writer::DATA_BYTES_PER_SECTOR;
+        std::vector<std::string> fileNames;
+        for (uint8_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            fileNames.push_back("FILE_" + std::to_string(fileIdx));
+        }
+
+        BENCHMARK("writeFile, 144 files of 4 blocks")
+        {
+            Writer w;
+            bool success = true;
+            for (auto const &fileName : fileNames)
+            {
+                success = success && w.writeFile(fileName, &file[0], fileLength);
+            }
+            return success;
+        };
+    }
+
+    TEST_CASE("Image serialization", "[benchmark]")
+    {
+        std::vector<uint8_t> file(100 * Writer::DATA_BYTES_PER_SECTOR, 0x42);
+        Writer w;
+        w.writeFile("FILE", &file[0], file.size());
+
+        std::ofstream devNull("/dev/null", std::ios::binary);
+        BENCHMARK("byte-wise operator <<, as before")
+        {
+            for (uint8_t const *p = w.getImageData(); p != w.getImageData() + w.getImageSize(); ++p)
+            {
+                devNull << *p;
+            }
+        };
+
+        BENCHMARK("operator <<")
+        {
+            devNull << w;
+        };
+
+        int fd = open("/dev/null", O_WRONLY);
+        BENCHMARK("writeImage")
+        {
+            return w.writeImage(fd);
+        };
+
+        BENCHMARK("writeG64, GCR encoding of 35 tracks")
+        {
+            return w.writeG64(fd);
+        };
+        close(fd);
+    }
+
+    TEST_CASE("Directory lookup", "[benchmark]")
+    {
+        std::vector<uint8_t> file(3, 0x42);
+        Writer w;
+        std::vector<DirectoryName> names;
+        for (uint8_t fileIdx = 0; fileIdx < Writer::MAX_DIR_ENTRIES; fileIdx++)
+        {
+            w.writeFile("FILE_" + std::to_string(fileIdx), &file[0], file.size());
+            names.push_back(makeD64FileName("FILE_" + std::to_string(fileIdx)));
+        }
+        std::vector<uint8_t> image(w.getImageData(), w.getImageData() + w.getImageSize());
+
+        // walks the directory chain like the test helper does
+        BENCHMARK("directory scan, 144 lookups")
+        {
+            uint32_t found = 0;
+            for (auto const &name : names)
+            {
+                for (uint16_t sectorIdx = Writer::FIRST_DIR_SECTOR_IDX; sectorIdx != TrackSector::INVALID; )
+                {
+                    uint8_t const *pSector = &image[sectorIdx * Writer::BYTES_PER_SECTOR];
+                    for (uint16_t entryIdx = 0; entryIdx < 8; entryIdx++)
+                    {
+                        found += std::equal(name.begin(), name.end(), &pSector[entryIdx * 32 + 5]);
+                    }
+                    sectorIdx = (pSector[0] == 0) ? TrackSector::INVALID :
+                        TrackSector::getSectorIdx(TrackSector{static_cast<uint8_t>(pSector[0] - 1), pSector[1]});
+                }
+            }
+            return found;
+        };
+
+        Reader reader(&image[0], image.size());
+        reader.getFiles();
+        BENCHMARK("Reader::findFile, 144 lookups")
+        {
+            uint32_t found = 0;
+            for (auto const &name : names)
+            {
+                found += (reader.findFile(name) != nullptr);
+            }
+            return found;
+        };
+    }
+
+    TEST_CASE("Folder to image", "[benchmark]")
+    {
+        // one source folder with tiny, medium and large programs, as a typical game disk
+        std::string root = makeTempFolder();
+        std::string folder = root + "/game";
+        mkdir(folder.c_str(), 0755);
+
+        uint16_t fileIdx = 0;
+        for (uint16_t numBlocks : {1, 1, 2, 4, 8, 16, 32, 64, 100, 150})
+        {
+            std::vector<uint8_t> prog(numBlocks * Writer::DATA_BYTES_PER_SECTOR - 10, static_cast<uint8_t>(fileIdx));
+            prog[0] = 0x01;
+            prog[1] = 0x08;
+            writeHostFile(folder + "/part" + std::to_string(fileIdx++) + ".prg", prog);
+        }
+
+        std::string imagePath = root + "/game.d64";
+        std::ostringstream err;
+        REQUIRE(buildImage(folder, imagePath, err));
+
+        BENCHMARK("buildImage, 10 files of 378 blocks in total")
+        {
+            return buildImage(folder, imagePath, err);
+        };
+
+        removeFolder(root);
+    }
+
+    TEST_CASE("Batch build", "[benchmark]")
+    {
+        // 32 source folders with 8 files of 80 blocks each
+        std::string root = makeTempFolder();
+        std::vector<BatchJob> jobs;
+        std::vector<uint8_t> prog(80 * Writer::DATA_BYTES_PER_SECTOR, 0x42);
+        prog[0] = 0x01;
+        prog[1] = 0x08;
+
+        for (uint16_t folderIdx = 0; folderIdx < 32; folderIdx++)
+        {
+            std::string folder = root + "/disk" + std::to_string(folderIdx);
+            mkdir(folder.c_str(), 0755);
+            for (uint8_t fileIdx = 0; fileIdx < 8; fileIdx++)
+            {
+                writeHostFile(folder + "/file" + std::to_string(fileIdx) + ".prg", prog);
+            }
+            jobs.push_back(BatchJob{folder, folder + ".d64"});
+        }
+
+        std::vector<unsigned> workerCounts = {1, 2, 4};
+        unsigned hardwareThreads = std::thread::hardware_concurrency();
+        if (hardwareThreads > 4)
+        {
+            workerCounts.push_back(hardwareThreads);
+        }
+
+        for (unsigned numWorkers : workerCounts)
+        {
+            BENCHMARK("32 images, " + std::to_string(numWorkers) + " workers")
+            {
+                return BatchBuilder(numWorkers).build(jobs).size();
+            };
+        }
+
+        removeFolder(root);
+    }
+}
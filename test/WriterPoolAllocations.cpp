@@ -0,0 +1,53 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include <string>
+
+#include "WriterPool.h"
+#include "AllocationCounter.h"
+
+using namespace std;
+
+namespace d64
+{
+    TEST_CASE("Writer pool allocations", "WriterPool")
+    {
+        std::vector<uint8_t> file(10000, 0xaa);
+        std::vector<std::string> names = { "A", "B", "C", "D" };
+
+        for (auto mode : { SectorStorage::Mode::DENSE, SectorStorage::Mode::SPARSE })
+        {
+            WriterPool pool(mode);
+            {
+                WriterPool::Handle pFirst = pool.acquire("FIRST");
+                WriterPool::Handle pSecond = pool.acquire("SECOND");
+                for (auto const &name : names)
+                {
+                    REQUIRE(pFirst->writeFile(name, &file[0], file.size()));
+                    REQUIRE(pSecond->writeFile(name, &file[0], file.size()));
+                }
+            }
+
+            // once the pool is warm, an image allocates nothing on the heap
+            std::string diskName = "RECYCLED";
+            for (int round = 0; round < 3; round++)
+            {
+                bool written = true;
+                size_t numAllocations = 0;
+                {
+                    AllocationCounter counter;
+                    WriterPool::Handle pWriter = pool.acquire(diskName);
+                    for (auto const &name : names)
+                    {
+                        written = written && pWriter->writeFile(name, &file[0], file.size());
+                    }
+                    pWriter.reset();
+                    numAllocations = counter.getNumberOfAllocations();
+                }
+
+                REQUIRE(written);
+                REQUIRE(numAllocations == 0);
+                REQUIRE(pool.getNumberOfIdleWriters() == 2);
+            }
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#include <catch2/catch_test_macros.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "WriterPool.h"
+
+using namespace std;
+
+namespace d64
+{
+    static void fillWriter(Writer &writer, std::vector<uint8_t> const &file, std::vector<std::string> const &names)
+    {
+        for (auto const &name : names)
+        {
+            REQUIRE(writer.writeFile(name, &file[0], file.size()));
+        }
+    }
+
+    TEST_CASE("Writer reset", "WriterPool")
+    {
+        std::vector<uint8_t> file(3000, 0x55);
+        std::vector<std::string> names = { "ONE", "TWO", "THREE", "FOUR", "FIVE", "SIX", "SEVEN", "EIGHT", "NINE" };
+
+        for (auto mode : { SectorStorage::Mode::DENSE, SectorStorage::Mode::SPARSE })
+        {
+            Writer writer("FIRST", mode);
+            fillWriter(writer, file, names);
+
+            // a reset image is the same as a new one, bit for bit
+            writer.reset("second", "7z");
+            Writer fresh("SECOND", SectorStorage::Mode::DENSE, "7Z");
+            for (uint16_t idx = 0; idx < Writer::NUM_SECTORS; idx++)
+            {
+                REQUIRE(std::equal(writer.getSectorData(idx), writer.getSectorData(idx) + Writer::BYTES_PER_SECTOR, fresh.getSectorData(idx)));
+            }
+
+            uint8_t const *pBAM = writer.getSectorData(Writer::BAM_SECTOR_IDX);
+            REQUIRE(pBAM[0xa2] == '7');
+            REQUIRE(pBAM[0xa3] == 'Z');
+
+            if (mode == SectorStorage::Mode::SPARSE)
+            {
+                REQUIRE(writer.getNumberOfMaterializedSectors() == 2);
+            }
+
+            // and fills up the same way
+            fillWriter(writer, file, names);
+            fillWriter(fresh, file, names);
+            for (uint16_t idx = 0; idx < Writer::NUM_SECTORS; idx++)
+            {
+                REQUIRE(std::equal(writer.getSectorData(idx), writer.getSectorData(idx) + Writer::BYTES_PER_SECTOR, fresh.getSectorData(idx)));
+            }
+        }
+    }
+
+    TEST_CASE("Writer pool", "WriterPool")
+    {
+        std::vector<uint8_t> file(10000, 0xaa);
+        std::vector<std::string> names = { "A", "B", "C", "D" };
+
+        for (auto mode : { SectorStorage::Mode::DENSE, SectorStorage::Mode::SPARSE })
+        {
+            WriterPool pool(mode);
+            REQUIRE(pool.getNumberOfIdleWriters() == 0);
+
+            {
+                WriterPool::Handle pFirst = pool.acquire("FIRST");
+                WriterPool::Handle pSecond = pool.acquire("SECOND");
+                fillWriter(*pFirst, file, names);
+                fillWriter(*pSecond, file, names);
+            }
+            REQUIRE(pool.getNumberOfIdleWriters() == 2);
+
+            // recycled writers come back blank, WriterPoolAllocations.cpp counts their heap allocations
+            for (int round = 0; round < 3; round++)
+            {
+                WriterPool::Handle pWriter = pool.acquire("RECYCLED");
+                fillWriter(*pWriter, file, names);
+                pWriter.reset();
+                REQUIRE(pool.getNumberOfIdleWriters() == 2);
+            }
+
+            WriterPool::Handle pWriter = pool.acquire("BLANK");
+            Writer fresh("BLANK", mode);
+            for (uint16_t idx = 0; idx < Writer::NUM_SECTORS; idx++)
+            {
+                REQUIRE(std::equal(pWriter->getSectorData(idx), pWriter->getSectorData(idx) + Writer::BYTES_PER_SECTOR, fresh.getSectorData(idx)));
+            }
+        }
+    }
+
+    TEST_CASE("Writer pool shared by threads", "WriterPool")
+    {
+        WriterPool pool;
+        std::vector<uint8_t> file(5000, 0x11);
+        std::atomic<unsigned> numFailed(0);
+
+        auto user = [&pool, &file, &numFailed]()
+        {
+            for (int round = 0; round < 50; round++)
+            {
+                WriterPool::Handle pWriter = pool.acquire("THREADS");
+                if (!pWriter->writeFile("FILE", &file[0], file.size()) ||
+                    (pWriter->getSectorData(Writer::FIRST_DIR_SECTOR_IDX)[2] != 0x82) ||
+                    pWriter->writeFile("FILE", &file[0], file.size()))
+                {
+                    ++numFailed;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int threadIdx = 0; threadIdx < 4; threadIdx++)
+        {
+            threads.emplace_back(user);
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        REQUIRE(numFailed == 0);
+        REQUIRE(pool.getNumberOfIdleWriters() >= 1);
+        REQUIRE(pool.getNumberOfIdleWriters() <= 4);
+    }
+}
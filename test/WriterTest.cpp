@@ -12,6 +12,10 @@
 #include <streambuf>
 #include <algorithm>
 #include <sstream>
+#include <iterator>
+
+#include <cstdlib> // mkstemp
+#include <unistd.h> // unlink
 
 #include "Writer.h"
 #include "WriterTestHelper.h"
@@ -93,13 +97,14 @@ namespace d64
     {
         uint16_t availableDataSectors = Writer::NUM_SECTORS - 19;
         size_t availableBytesOnImage = availableDataSectors * Writer::DATA_BYTES_PER_SECTOR;
-        uint8_t maxSupportedFiles = 8;
-        size_t fileLength = availableBytesOnImage / maxSupportedFiles;
+        uint8_t maxSupportedFiles = Writer::MAX_DIR_ENTRIES;
+        // whole blocks only, 144 files of 4 blocks
+        size_t fileLength = (availableDataSectors / maxSupportedFiles) * Writer::DATA_BYTES_PER_SECTOR;
 
         std::vector<uint8_t> file;
         Writer w;
 
-        // write 8 files that fill up the whole image
+        // write 144 files that fill up the whole directory track
         for (uint8_t fileIdx = 0; fileIdx < maxSupportedFiles; fileIdx++)
         {
             std::string fileName = makeFileName(fileIdx);
@@ -112,15 +117,238 @@ namespace d64
             }
         }
 
-        D64ImgBuf imageBuf;
-        writeImageToBuf(imageBuf, w);        
+        // the directory is full although there is space left for data
+        REQUIRE(fileLength * maxSupportedFiles < availableBytesOnImage);
+        REQUIRE_FALSE(w.writeFile("ONE_TOO_MANY", &file[0], file.size()));
 
         for (uint8_t fileIdx = 0; fileIdx < maxSupportedFiles; fileIdx++)
         {
             std::string fileName = makeFileName(fileIdx);
-            makeFileContent(fileIdx, availableBytesOnImage / maxSupportedFiles, file);
+            makeFileContent(fileIdx, fileLength, file);
+
+            assertProgOnImage(file, fileName, w.getImageData());
+        }
+
+        // all 18 directory sectors are chained, 18/1 first, 18/18 last
+        uint8_t const *pLastDirSector = &w.getImageData()[(Writer::BAM_SECTOR_IDX + 18) * Writer::BYTES_PER_SECTOR];
+        REQUIRE(pLastDirSector[0] == 0x00);
+        REQUIRE(pLastDirSector[1] == 0xff);
+        uint8_t const *pBAM = &w.getImageData()[Writer::BAM_SECTOR_IDX * Writer::BYTES_PER_SECTOR];
+        REQUIRE(pBAM[4 + Writer::DIRECTORY_TRACK * 4] == 0);
+    }
+
+    TEST_CASE("Duplicate file names", "Writer")
+    {
+        std::vector<uint8_t> file;
+        makeFileContent(0, 100, file);
+        Writer w;
+
+        REQUIRE(w.writeFile("game.prg", &file[0], file.size()));
+        // same name on the disk after conversion to upper case
+        REQUIRE_FALSE(w.writeFile("GAME.PRG", &file[0], file.size()));
+        REQUIRE(w.writeFile("GAME2.PRG", &file[0], file.size()));
+    }
+
+    TEST_CASE("Interleaved sector chain", "Writer")
+    {
+        // three blocks on track 1: sectors 0, 10 and 20 with interleave 10
+        std::vector<uint8_t> file;
+        makeFileContent(0, 3 * Writer::DATA_BYTES_PER_SECTOR, file);
+
+        Writer w;
+        if (!w.writeFile("CHAIN", &file[0], file.size()))
+        {
+            FAIL("File could not be written");
+        }
+
+        D64ImgBuf imageBuf;
+        writeImageToBuf(imageBuf, w);
+        assertProgOnImage(file, "CHAIN", imageBuf);
+
+        uint8_t const *pSector0 = &imageBuf[0];
+        uint8_t const *pSector10 = &imageBuf[10 * Writer::BYTES_PER_SECTOR];
+        REQUIRE(pSector0[0] == 1);
+        REQUIRE(pSector0[1] == 10);
+        REQUIRE(pSector10[0] == 1);
+        REQUIRE(pSector10[1] == 20);
+
+        // the BAM has the three sectors occupied
+        uint8_t const *pBAM = &imageBuf[Writer::BAM_SECTOR_IDX * Writer::BYTES_PER_SECTOR];
+        REQUIRE(pBAM[4] == 21 - 3);
+    }
+
+    TEST_CASE("Image serialization", "Writer")
+    {
+        std::vector<uint8_t> file;
+        makeFileContent(0, 1000, file);
+        Writer w;
+        REQUIRE(w.writeFile("SERIAL", &file[0], file.size()));
+
+        std::vector<uint8_t> expected(w.getImageData(), w.getImageData() + w.getImageSize());
+        REQUIRE(expected.size() == Writer::BYTES_PER_SECTOR * Writer::NUM_SECTORS);
+
+        D64ImgBuf imageBuf;
+        writeImageToBuf(imageBuf, w);
+        REQUIRE(std::equal(expected.begin(), expected.end(), imageBuf.begin()));
+
+        for (bool useMmap : {false, true})
+        {
+            char path[] = "/tmp/D64WriterTestXXXXXX";
+            int fd = mkstemp(path);
+            REQUIRE(fd >= 0);
+            close(fd);
+
+            REQUIRE(w.writeImageFile(path, useMmap));
+            std::ifstream is(path, std::ios::binary);
+            std::vector<uint8_t> written((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            unlink(path);
 
-            assertProgOnImage(file, fileName, imageBuf);  
+            REQUIRE(written == expected);
         }
     }
+
+    TEST_CASE("Streamed files", "Writer")
+    {
+        std::vector<uint8_t> small;
+        std::vector<uint8_t> large;
+        makeFileContent(0, 1000, small);
+        makeFileContent(0, 100 * Writer::DATA_BYTES_PER_SECTOR + 17, large);
+
+        Writer expected;
+        REQUIRE(expected.writeFile("SMALL", &small[0], small.size()));
+        REQUIRE(expected.writeFile("LARGE", &large[0], large.size()));
+
+        // same files in chunks of odd sizes, the sink of LARGE is opened before SMALL is written
+        Writer w;
+        FileSink smallSink = w.openFile("SMALL");
+        FileSink largeSink = w.openFile("LARGE");
+        for (size_t pos = 0; pos < small.size(); pos += 77)
+        {
+            REQUIRE(smallSink.write(&small[pos], std::min(static_cast<size_t>(77), small.size() - pos)));
+        }
+        REQUIRE(smallSink.close());
+
+        size_t pos = 0;
+        REQUIRE(w.writeFile("READER", [&small, &pos](uint8_t *pBuf, size_t maxLength)
+        {
+            size_t length = std::min(std::min(maxLength, static_cast<size_t>(100)), small.size() - pos);
+            std::copy(&small[pos], &small[pos + length], pBuf);
+            pos += length;
+            return length;
+        }));
+
+        for (size_t pos = 0; pos < large.size(); pos += 1000)
+        {
+            REQUIRE(largeSink.write(&large[pos], std::min(static_cast<size_t>(1000), large.size() - pos)));
+        }
+        REQUIRE(largeSink.close());
+
+        assertProgOnImage(small, "SMALL", w.getImageData());
+        assertProgOnImage(large, "LARGE", w.getImageData());
+        assertProgOnImage(small, "READER", w.getImageData());
+
+        // files without content and duplicate names are refused
+        FileSink emptySink = w.openFile("EMPTY");
+        REQUIRE_FALSE(emptySink.close());
+        FileSink duplicateSink = w.openFile("SMALL");
+        REQUIRE_FALSE(duplicateSink.write(&small[0], small.size()));
+        REQUIRE_FALSE(duplicateSink.close());
+
+        // streaming SMALL and LARGE in one go gives the same image as the contiguous writes
+        Writer streamed;
+        FileSink sink = streamed.openFile("SMALL");
+        REQUIRE(sink.write(&small[0], small.size()));
+        REQUIRE(sink.close());
+        FileSink sink2 = streamed.openFile("LARGE");
+        REQUIRE(sink2.write(&large[0], large.size()));
+        REQUIRE(sink2.close());
+        REQUIRE(std::equal(streamed.getImageData(), streamed.getImageData() + streamed.getImageSize(), expected.getImageData()));
+    }
+
+    TEST_CASE("Streamed file exceeding the image", "Writer")
+    {
+        std::vector<uint8_t> file;
+        makeFileContent(0, 1000, file);
+
+        Writer w;
+        REQUIRE(w.writeFile("FIRST", &file[0], file.size()));
+        std::vector<uint8_t> before(w.getImageData(), w.getImageData() + w.getImageSize());
+
+        // a generator which never ends, the sink runs out of sectors
+        FileSink sink = w.openFile("ENDLESS");
+        bool success = true;
+        for (uint16_t chunk = 0; success && chunk < Writer::NUM_SECTORS; chunk++)
+        {
+            success = sink.write(&file[0], Writer::DATA_BYTES_PER_SECTOR);
+        }
+        REQUIRE_FALSE(success);
+        REQUIRE_FALSE(sink.close());
+
+        // all sectors and the directory slot are released again
+        REQUIRE(std::equal(before.begin(), before.end(), w.getImageData()));
+        REQUIRE(w.writeFile("SECOND", &file[0], file.size()));
+        assertProgOnImage(file, "SECOND", w.getImageData());
+    }
+
+    TEST_CASE("Sparse sector storage", "Writer")
+    {
+        std::vector<uint8_t> file;
+        Writer dense("SPARSE");
+        Writer sparse("SPARSE", SectorStorage::Mode::SPARSE);
+
+        // BAM and first directory sector only
+        REQUIRE(sparse.getNumberOfMaterializedSectors() == 2);
+        REQUIRE(sparse.getImageData() == nullptr);
+
+        uint16_t numberOfBlocks = 0;
+        for (uint16_t fileIdx = 0; fileIdx < 20; fileIdx++)
+        {
+            makeFileContent(0, 100 + fileIdx * 300, file);
+            numberOfBlocks += (file.size() + Writer::DATA_BYTES_PER_SECTOR - 1) / Writer::DATA_BYTES_PER_SECTOR;
+            REQUIRE(dense.writeFile(makeFileName(fileIdx), &file[0], file.size()));
+            REQUIRE(sparse.writeFile(makeFileName(fileIdx), &file[0], file.size()));
+        }
+
+        // a sink destroyed without close() gives its sectors back to the pool
+        uint16_t materialized = sparse.getNumberOfMaterializedSectors();
+        {
+            FileSink sink = sparse.openFile("RELEASED");
+            REQUIRE(sink.write(&file[0], file.size()));
+            REQUIRE(sparse.getNumberOfMaterializedSectors() > materialized);
+        }
+        REQUIRE(sparse.getNumberOfMaterializedSectors() == materialized);
+
+        // the blocks of the 20 files, 3 directory sectors, the BAM
+        REQUIRE(sparse.getNumberOfMaterializedSectors() == numberOfBlocks + 3 + 1);
+
+        for (uint16_t idx = 0; idx < Writer::NUM_SECTORS; idx++)
+        {
+            REQUIRE(std::equal(sparse.getSectorData(idx), sparse.getSectorData(idx) + Writer::BYTES_PER_SECTOR, dense.getSectorData(idx)));
+        }
+
+        // serialized bit for bit like the dense image, by all paths
+        D64ImgBuf imageBuf;
+        writeImageToBuf(imageBuf, sparse);
+        REQUIRE(std::equal(imageBuf.begin(), imageBuf.end(), dense.getImageData()));
+
+        for (bool useMmap : {false, true})
+        {
+            char path[] = "/tmp/D64WriterTestXXXXXX";
+            int fd = mkstemp(path);
+            REQUIRE(fd >= 0);
+            close(fd);
+
+            REQUIRE(sparse.writeImageFile(path, useMmap));
+            std::ifstream is(path, std::ios::binary);
+            std::vector<uint8_t> written((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            unlink(path);
+
+            REQUIRE(std::equal(written.begin(), written.end(), dense.getImageData()));
+        }
+
+        // copies are deep
+        Writer copy(sparse);
+        REQUIRE(copy.writeFile("COPY", &file[0], file.size()));
+        REQUIRE(copy.getNumberOfMaterializedSectors() > sparse.getNumberOfMaterializedSectors());
+    }
 }
@@ -2,6 +2,12 @@
 #include <catch2/catch_test_macros.hpp>
 #include <sstream>
 #include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstdlib> // mkdtemp
+
+#include <ftw.h>
+#include <unistd.h>
 
 #include "WriterTestHelper.h"
 
@@ -11,17 +17,24 @@ namespace d64
 {
     static uint8_t const *getSector(uint16_t idx, uint8_t const *pImage) {  return &pImage[idx * Writer::BYTES_PER_SECTOR];}
 
-    static uint32_t getSectorBitsOfTrack(uint8_t trackIdx, uint8_t const *pImage)
+    template <typename Geometry>
+    static uint64_t getSectorBitsOfTrack(uint8_t trackIdx, uint8_t const *pImage)
     {
-        uint8_t const *pBAM = getSector(Writer::BAM_SECTOR_IDX, pImage);
-        uint8_t const *pTrackEntry = &pBAM[4 + trackIdx * 4];
-        return pTrackEntry[1] + (pTrackEntry[2] << 8) + (pTrackEntry[3] << 16);
+        auto const &bamEntry = Geometry::getBamEntry(trackIdx);
+        uint8_t const *pBits = &getSector(bamEntry.bitsSectorIdx, pImage)[bamEntry.bitsOffset];
+        uint64_t ret = 0;
+        for (uint8_t byteIdx = 0; byteIdx < Geometry::BAM_BITMAP_BYTES; byteIdx++)
+        {
+            ret |= static_cast<uint64_t>(pBits[byteIdx]) << (byteIdx * 8);
+        }
+        return ret;
     }
 
+    template <typename Geometry>
     static bool isTrackSectorAvailable(TrackSector ts, uint8_t const *pImage)
     {
-        uint32_t sectorBits = getSectorBitsOfTrack(ts.track, pImage);
-        return (sectorBits & (1 << ts.sector));
+        uint64_t sectorBits = getSectorBitsOfTrack<Geometry>(ts.track, pImage);
+        return (sectorBits & (1ull << ts.sector));
     }
 
     static std::string getFileName(uint8_t const *pFileEntry)
@@ -41,49 +54,70 @@ namespace d64
         return strm.str();
     }
 
+    template <typename Geometry>
     static uint8_t const *getFileEntry(std::string const &d64ProgName, uint8_t const *pImage)
     {
+        using Writer = BasicWriter<Geometry>;
+
+        // follow the chain of directory sectors, starting on the first directory sector of the directory track
         uint8_t const *pDIRSector = getSector(Writer::FIRST_DIR_SECTOR_IDX, pImage);
-        uint8_t entryIdx = 0;
+        uint16_t numDIRSectors = 0;
 
-        while (entryIdx < 8)
+        while (pDIRSector != nullptr)
         {
-            uint8_t const *pFileEntry = &pDIRSector[ 32 * entryIdx];
-            std::string entryFileName = getFileName(pFileEntry);
-            if (entryFileName == d64ProgName)
+            if (++numDIRSectors > Writer::NUM_DIR_SECTORS)
             {
-                break;
+                FAIL("Directory sector chain is too long.");
             }
 
-            ++entryIdx;     
-        }
+            for (uint8_t entryIdx = 0; entryIdx < 8; entryIdx++)
+            {
+                uint8_t const *pFileEntry = &pDIRSector[ 32 * entryIdx];
+                if ((pFileEntry[2] != 0) && (getFileName(pFileEntry) == d64ProgName))
+                {
+                    return pFileEntry;
+                }
+            }
 
-        if (entryIdx >= 8)
-        {
-            FAIL ("Did not find a file entry with the given name.");
+            if (pDIRSector[0] == 0)
+            {
+                pDIRSector = nullptr;
+            }
+            else if (pDIRSector[0] == Writer::DIRECTORY_TRACK + 1)
+            {
+                pDIRSector = getSector(Geometry::getSectorIdx(TrackSector{Writer::DIRECTORY_TRACK, pDIRSector[1]}), pImage);
+            }
+            else
+            {
+                FAIL("Directory sector is linked to a sector outside the directory track.");
+            }
         }
 
-        return &pDIRSector[ 32 * entryIdx];
+        FAIL ("Did not find a file entry with the given name.");
+        return nullptr;
     }
 
+    template <typename Geometry>
     static void assertValidTrackAndSector(uint8_t track, uint8_t sector)
     {
-        if (track > 34)
+        if (track >= Geometry::NUM_TRACKS)
         {
             FAIL("Illegal track number in TrackSector detected.");
         }
 
-        if (sector >= TrackSector::getSectorsOnTrack(track))
+        if (sector >= Geometry::getSectorsOnTrack(track))
         {
             FAIL("Illegal sector number in TrackSector detected.");
         }
     }
 
+    template <typename Geometry>
     static TrackSector getStartingTrackSector(uint8_t const *pFileEntry)
     {
         uint8_t track = pFileEntry[3];
         uint8_t sector = pFileEntry[4];
-        assertValidTrackAndSector(track, sector);
+        // tracks in the directory entry start with 1
+        assertValidTrackAndSector<Geometry>(static_cast<uint8_t>(track - 1), sector);
         return TrackSector{static_cast<uint8_t>(track - 1), sector};
     }
 
@@ -92,9 +126,10 @@ namespace d64
         return static_cast<uint16_t>(pFileEntry[30] + (pFileEntry[31] << 8));
     }
 
+    template <typename Geometry>
     static void getFilePayload(TrackSector ts, uint16_t sectors, uint8_t const *pImage, std::vector<uint8_t> &out)
     {
-        uint8_t const *pSector = getSector(TrackSector::getSectorIdx(ts), pImage);
+        uint8_t const *pSector = getSector(Geometry::getSectorIdx(ts), pImage);
 
         while ((sectors > 0) && (pSector))
         {
@@ -105,10 +140,10 @@ namespace d64
             {
                 // Complete sector to stream, next Track and Sector must be valid
                 ts = TrackSector{static_cast<uint8_t>(track - 1), sector};
-                assertValidTrackAndSector(ts.track, ts.sector);
+                assertValidTrackAndSector<Geometry>(ts.track, ts.sector);
 
                 std::for_each(&pSector[2], &pSector[256], [&out](uint8_t b) {out.push_back(b);} );
-                pSector = getSector(TrackSector::getSectorIdx(ts), pImage);
+                pSector = getSector(Geometry::getSectorIdx(ts), pImage);
             }
             else
             {
@@ -124,7 +159,7 @@ namespace d64
             }
 
             // The sector has to be marked as occupied ('0')
-            if (isTrackSectorAvailable(ts, pImage))
+            if (isTrackSectorAvailable<Geometry>(ts, pImage))
             {
                 FAIL("Track and Sector detected as available although containing file data");
             }
@@ -146,12 +181,16 @@ namespace d64
 
     void assertProgOnImage(std::vector<uint8_t> const &prog, std::string const &d64ProgName, D64ImgBuf &imageBuf)
     {
-        uint8_t const *pImage = &imageBuf[0];
-        uint8_t const *pDIRSector = getSector(Writer::FIRST_DIR_SECTOR_IDX, pImage);
-        uint8_t const *pFileEntry = getFileEntry(d64ProgName, pImage);
+        assertProgOnImage(prog, d64ProgName, &imageBuf[0]);
+    }
+
+    template <typename Geometry>
+    void assertProgOnImage(std::vector<uint8_t> const &prog, std::string const &d64ProgName, uint8_t const *pImage)
+    {
+        uint8_t const *pFileEntry = getFileEntry<Geometry>(d64ProgName, pImage);
 
         std::vector<uint8_t> progInImage; // this shall contain our program after getFilePayload() is called
-        getFilePayload(getStartingTrackSector(pFileEntry), getNumberOfSectors(pFileEntry), pImage, progInImage);
+        getFilePayload<Geometry>(getStartingTrackSector<Geometry>(pFileEntry), getNumberOfSectors(pFileEntry), pImage, progInImage);
 
         if (prog != progInImage)
         {
@@ -160,6 +199,11 @@ namespace d64
 
     }
 
+    template void assertProgOnImage<D64Geometry>(std::vector<uint8_t> const &, std::string const &, uint8_t const *);
+    template void assertProgOnImage<D64ExtendedGeometry>(std::vector<uint8_t> const &, std::string const &, uint8_t const *);
+    template void assertProgOnImage<D71Geometry>(std::vector<uint8_t> const &, std::string const &, uint8_t const *);
+    template void assertProgOnImage<D81Geometry>(std::vector<uint8_t> const &, std::string const &, uint8_t const *);
+
     void writeImageToBuf(D64ImgBuf &dest, Writer &src)
     {
         D64ImageStreamBuf sb(dest);
@@ -167,4 +211,40 @@ namespace d64
         testStream << src;
     }
 
-}
\ No newline at end of file
+
+    std::string makeTempFolder()
+    {
+        char path[] = "/tmp/D64WriterTestXXXXXX";
+        if (mkdtemp(path) == nullptr)
+        {
+            FAIL("Could not create temporary folder");
+        }
+        return path;
+    }
+
+    void writeHostFile(std::string const &path, std::vector<uint8_t> const &content)
+    {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        os.write(reinterpret_cast<char const *>(content.data()), content.size());
+        if (!os)
+        {
+            FAIL("Could not write file " << path);
+        }
+    }
+
+    std::vector<uint8_t> readHostFile(std::string const &path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        if (!is)
+        {
+            FAIL("Could not read file " << path);
+        }
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    void removeFolder(std::string const &path)
+    {
+        auto removeEntry = [](char const *pPath, struct stat const *, int, struct FTW *) { return ::remove(pPath); };
+        nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+}
@@ -3,6 +3,8 @@
 
 #include "Writer.h"
 #include <array>
+#include <string>
+#include <vector>
 
 namespace d64
 {
@@ -20,8 +22,29 @@ namespace d64
         }
     };
 
+    // the image has the format of Geometry, by default a 35 track D64
+    template <typename Geometry = D64Geometry>
+    void assertProgOnImage(std::vector<uint8_t> const &prog, std::string const &d64ProgName, uint8_t const *pImage);
     void assertProgOnImage(std::vector<uint8_t> const &prog, std::string const &d64ProgName, D64ImgBuf &imageBuf);
     void writeImageToBuf(D64ImgBuf &dest, Writer &src);
+
+    // the bytes of an image in any storage mode
+    template <typename Geometry>
+    std::vector<uint8_t> getImage(BasicWriter<Geometry> const &writer)
+    {
+        std::vector<uint8_t> image;
+        for (uint16_t idx = 0; idx < Geometry::NUM_SECTORS; idx++)
+        {
+            image.insert(image.end(), writer.getSectorData(idx), writer.getSectorData(idx) + BasicWriter<Geometry>::BYTES_PER_SECTOR);
+        }
+        return image;
+    }
+
+    // fixture folders on the host file system
+    std::string makeTempFolder();
+    void writeHostFile(std::string const &path, std::vector<uint8_t> const &content);
+    std::vector<uint8_t> readHostFile(std::string const &path);
+    void removeFolder(std::string const &path);
 }
 
 #endif